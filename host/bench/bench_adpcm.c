@@ -0,0 +1,293 @@
+/*
+ * bench_adpcm.c
+ *
+ * IMA ADPCM decoding in the TinyWav reader. A mono and a stereo test signal
+ * are encoded with the reference encoder in bench_common.c, then read back
+ * through tinywav_read_f in a range of chunk sizes, plain and aligned, and
+ * after seeks; every read must match, bit for bit, a decode of the same file
+ * by the straightforward per sample decoder below. The round trip's signal to
+ * noise ratio against the original is given for reference.
+ *
+ * Throughput is decoded samples per second on the host, reading 4096 byte
+ * chunks aligned as sections do, and the card sectors read per second of
+ * audio against the same track stored as 16 bit PCM.
+ *
+ * Usage: bench_adpcm [--seconds TRACK_SECONDS] [--mb DECODED_MB]
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench_common.h"
+#include "sim.h"
+
+#define SAMPLE_RATE 44100
+#define READ_BUFFER_SIZE (4 * TINYWAV_SECTOR_SIZE)
+#define TIMED_CHUNK 4096
+#define SEEKS 200
+
+// Chords with a slow sweep and a little noise, loud enough to use the upper
+// step sizes
+static int16_t *make_signal(int channels, uint32_t frames) {
+  int16_t *pcm = malloc((size_t)frames * channels * sizeof(int16_t));
+  uint32_t noise = 1;
+  for (uint32_t i = 0; i < frames; ++i) {
+    double t = (double)i / SAMPLE_RATE;
+    for (int c = 0; c < channels; ++c) {
+      noise = noise * 1664525u + 1013904223u;
+      double v = 0.35 * sin(2 * M_PI * (220.0 + 30.0 * c) * t) +
+                 0.25 * sin(2 * M_PI * 1318.5 * t + c) +
+                 0.15 * sin(2 * M_PI * (500.0 + 4000.0 * t / 10.0) * t) +
+                 0.02 * ((int32_t)noise / 2147483648.0);
+      pcm[i * channels + c] = (int16_t)lrint(v * 32767.0);
+    }
+  }
+  return pcm;
+}
+
+static uint32_t le16(const uint8_t *p) { return p[0] | p[1] << 8; }
+static uint32_t le32(const uint8_t *p) { return le16(p) | le16(p + 2) << 16; }
+
+// Per sample decode of a whole file written by bench_write_ima_adpcm, walking
+// each block's nibbles in file order. Returns the frame count.
+static uint32_t reference_decode(const char *path, int16_t **out) {
+  static const int16_t steps[89] = {
+      7,     8,     9,     10,    11,    12,    13,    14,    16,    17,
+      19,    21,    23,    25,    28,    31,    34,    37,    41,    45,
+      50,    55,    60,    66,    73,    80,    88,    97,    107,   118,
+      130,   143,   157,   173,   190,   209,   230,   253,   279,   307,
+      337,   371,   408,   449,   494,   544,   598,   658,   724,   796,
+      876,   963,   1060,  1166,  1282,  1411,  1552,  1707,  1878,  2066,
+      2272,  2499,  2749,  3024,  3327,  3660,  4026,  4428,  4871,  5358,
+      5894,  6484,  7132,  7845,  8630,  9493,  10442, 11487, 12635, 13899,
+      15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794, 32767};
+  static const int adjust[16] = {-1, -1, -1, -1, 2, 4, 6, 8,
+                                 -1, -1, -1, -1, 2, 4, 6, 8};
+
+  FILE *f = fopen(path, "rb");
+  fseek(f, 0, SEEK_END);
+  long size = ftell(f);
+  fseek(f, 0, SEEK_SET);
+  uint8_t *file = malloc(size);
+  size_t got = fread(file, 1, size, f);
+  fclose(f);
+  if (got != (size_t)size) {
+    free(file);
+    return 0;
+  }
+
+  int channels = le16(file + 22);
+  uint32_t block_align = le16(file + 32);
+  uint32_t block_frames = le16(file + 38);
+  uint32_t frames = le32(file + 48);
+  uint32_t data_size = le32(file + 56);
+  const uint8_t *data = file + 60;
+
+  int16_t *pcm = malloc((size_t)data_size / block_align * block_frames * channels * sizeof(int16_t));
+  uint32_t frame = 0;
+  for (uint32_t b = 0; b < data_size / block_align; ++b) {
+    const uint8_t *block = data + b * block_align;
+    for (int c = 0; c < channels; ++c) {
+      int predictor = (int16_t)le16(block + 4 * c);
+      int index = block[4 * c + 2];
+      pcm[(size_t)frame * channels + c] = (int16_t)predictor;
+      for (uint32_t j = 0; j + 1 < block_frames; ++j) {
+        uint8_t byte = block[4 * channels + (j / 8) * 4 * channels + 4 * c + (j % 8) / 2];
+        int nibble = (j % 2) ? byte >> 4 : byte & 15;
+        int step = steps[index];
+        int diff = step >> 3;
+        if (nibble & 4) diff += step;
+        if (nibble & 2) diff += step >> 1;
+        if (nibble & 1) diff += step >> 2;
+        predictor += (nibble & 8) ? -diff : diff;
+        predictor = predictor > 32767 ? 32767 : predictor < -32768 ? -32768 : predictor;
+        index += adjust[nibble];
+        index = index > 88 ? 88 : index < 0 ? 0 : index;
+        pcm[((size_t)frame + 1 + j) * channels + c] = (int16_t)predictor;
+      }
+    }
+    frame += block_frames;
+  }
+
+  free(file);
+  *out = pcm;
+  return frames;
+}
+
+static bool open_track(TinyWav *tw, const char *path, uint8_t *read_buffer) {
+  if (tinywav_open_read(tw, path, TW_INTERLEAVED) != 0) {
+    fprintf(stderr, "Could not open %s\n", path);
+    return false;
+  }
+  if (read_buffer != NULL) {
+    tinywav_set_read_buffer(tw, read_buffer, READ_BUFFER_SIZE);
+  }
+  return true;
+}
+
+// Whole file read in `chunk` byte reads against the reference decode
+static bool check_reads(const char *path, const int16_t *want, uint32_t frames,
+                        int chunk, bool aligned) {
+  uint8_t *read_buffer = malloc(READ_BUFFER_SIZE);
+  TinyWav tw;
+  if (!open_track(&tw, path, aligned ? read_buffer : NULL)) {
+    free(read_buffer);
+    return false;
+  }
+  int frame_bytes = tw.numChannels * sizeof(int16_t);
+  int16_t *buffer = malloc(chunk);
+  uint32_t done = 0;
+  bool ok = tw.numFramesInHeader == (int32_t)frames;
+  int got;
+  while (ok && (got = tinywav_read_f(&tw, buffer, chunk)) > 0) {
+    ok = done + got <= frames &&
+         memcmp(buffer, want + (size_t)done * tw.numChannels, (size_t)got * frame_bytes) == 0;
+    done += got;
+  }
+  ok = ok && done == frames;
+  if (!ok) {
+    fprintf(stderr, "%s: %s reads of %d bytes differ from the reference from frame %u\n",
+            path, aligned ? "aligned" : "plain", chunk, (unsigned)done);
+  }
+  free(buffer);
+  tinywav_close_read(&tw);
+  free(read_buffer);
+  return ok;
+}
+
+// Reads of random length from random frames, as seeks within and across
+// blocks leave the decoder
+static bool check_seeks(const char *path, const int16_t *want, uint32_t frames, bool aligned) {
+  uint8_t *read_buffer = malloc(READ_BUFFER_SIZE);
+  TinyWav tw;
+  if (!open_track(&tw, path, aligned ? read_buffer : NULL)) {
+    free(read_buffer);
+    return false;
+  }
+  int frame_bytes = tw.numChannels * sizeof(int16_t);
+  int16_t *buffer = malloc(4096 * frame_bytes);
+  uint32_t seed = 12345;
+  bool ok = true;
+  for (int i = 0; ok && i < SEEKS; ++i) {
+    seed = seed * 1664525u + 1013904223u;
+    uint32_t frame = (seed >> 8) % frames;
+    int count = 1 + (int)(seed % 4096);
+    tinywav_seek_data(&tw, frame * frame_bytes);
+    int got = tinywav_read_f(&tw, buffer, count * frame_bytes);
+    int expect = (int)(frames - frame < (uint32_t)count ? frames - frame : (uint32_t)count);
+    ok = got == expect &&
+         memcmp(buffer, want + (size_t)frame * tw.numChannels, (size_t)got * frame_bytes) == 0;
+    if (!ok) {
+      fprintf(stderr, "%s: %s read of %d frames after seeking to frame %u differs\n",
+              path, aligned ? "aligned" : "plain", count, (unsigned)frame);
+    }
+  }
+  free(buffer);
+  tinywav_close_read(&tw);
+  free(read_buffer);
+  return ok;
+}
+
+static double snr(const int16_t *original, const int16_t *decoded, size_t samples) {
+  double signal = 0.0, noise = 0.0;
+  for (size_t i = 0; i < samples; ++i) {
+    double error = (double)decoded[i] - original[i];
+    signal += (double)original[i] * original[i];
+    noise += error * error;
+  }
+  return 10.0 * log10(signal / fmax(noise, 1e-9));
+}
+
+// Bytes of decoded audio read in TIMED_CHUNK aligned reads, looping the
+// track, and the host time it took
+static double decode_ns(const char *path, uint64_t target, uint64_t *bytes) {
+  uint8_t *read_buffer = malloc(READ_BUFFER_SIZE);
+  uint8_t *buffer = malloc(TIMED_CHUNK);
+  TinyWav tw;
+  if (!open_track(&tw, path, read_buffer)) {
+    return NAN;
+  }
+  int frame_bytes = tw.numChannels * sizeof(int16_t);
+  *bytes = 0;
+  uint64_t start = bench_now_ns();
+  while (*bytes < target) {
+    int got = tinywav_read_f(&tw, buffer, TIMED_CHUNK);
+    if (got <= 0) {
+      tinywav_seek_data(&tw, 0);
+      continue;
+    }
+    *bytes += (uint64_t)got * frame_bytes;
+  }
+  double ns = (double)(bench_now_ns() - start);
+  tinywav_close_read(&tw);
+  free(buffer);
+  free(read_buffer);
+  return ns;
+}
+
+int main(int argc, char **argv) {
+  double seconds = bench_arg_double(argc, argv, "--seconds", 10.0);
+  double total_mb = bench_arg_double(argc, argv, "--mb", 256.0);
+  const int chunks[] = {4, 512, 1000, 1536, 4096, 16384};
+
+  if (!bench_prepare_card(NULL, 0, NULL)) {
+    return 1;
+  }
+  uint32_t frames = (uint32_t)(seconds * SAMPLE_RATE);
+
+  printf("%-8s %8s %10s %10s %12s %14s %14s\n", "track", "SNR dB",
+         "Msample/s", "ns/sample", "x realtime", "sect/aud-s", "s16 sect/aud-s");
+
+  for (int channels = 1; channels <= 2; ++channels) {
+    char path[32], pcm_path[32];
+    snprintf(path, sizeof(path), "sdc/IMA%d.WAV", channels);
+    snprintf(pcm_path, sizeof(pcm_path), "sdc/PCM%d.WAV", channels);
+    bench_track_t pcm_track = {pcm_path + 4, SAMPLE_RATE, channels, TW_INT16, seconds, 440.0};
+
+    int16_t *original = make_signal(channels, frames);
+    int16_t *want = NULL;
+    if (!bench_write_ima_adpcm(path, channels, SAMPLE_RATE, original, frames) ||
+        !bench_write_track(pcm_path, &pcm_track) ||
+        reference_decode(path, &want) != frames) {
+      fprintf(stderr, "Could not write %s\n", path);
+      return 1;
+    }
+
+    for (size_t c = 0; c < sizeof(chunks) / sizeof(chunks[0]); ++c) {
+      for (int aligned = 0; aligned <= 1; ++aligned) {
+        if (!check_reads(path, want, frames, chunks[c], aligned)) {
+          return 1;
+        }
+      }
+    }
+    if (!check_seeks(path, want, frames, false) || !check_seeks(path, want, frames, true)) {
+      return 1;
+    }
+
+    uint64_t bytes;
+    double ns = decode_ns(path, (uint64_t)(total_mb * 1024 * 1024), &bytes);
+    double samples = (double)bytes / sizeof(int16_t);
+
+    // Card accounting over exactly the track's audio, once through
+    uint64_t track_bytes = (uint64_t)frames * channels * sizeof(int16_t);
+    sim_init(NULL);
+    decode_ns(path, track_bytes, &bytes);
+    double sectors = sim_get_stats()->card_sectors / seconds;
+    sim_init(NULL);
+    decode_ns(pcm_path, track_bytes, &bytes);
+    double pcm_sectors = sim_get_stats()->card_sectors / seconds;
+
+    printf("%-8s %8.1f %10.1f %10.2f %12.0f %14.0f %14.0f\n",
+           channels == 1 ? "mono" : "stereo",
+           snr(original, want, (size_t)frames * channels), samples / ns * 1e3,
+           ns / samples, samples / (ns / 1e9) / (SAMPLE_RATE * channels),
+           sectors, pcm_sectors);
+
+    free(want);
+    free(original);
+  }
+  printf("All reads matched the reference decoder\n");
+  return 0;
+}
@@ -0,0 +1,176 @@
+/*
+ * bench_boot.c
+ *
+ * Boot-to-first-sample time against the number of files on the card, with
+ * and without the on-card track index. Each boot runs in a child process on
+ * the same card: the first scans the card and writes the index, the second
+ * boots from the index and must not read a single directory entry, and the
+ * third boots after another file was copied
+ * to the card, which must rebuild the index. The fourth boots after the first
+ * page was re-exported at the same size, which leaves the free cluster count
+ * as it was: opening the page must find it changed and drop the index.
+ *
+ * Card accesses are charged --sector-us of simulated time per 512 byte
+ * sector at the 5 MHz mount clock (about 1 ms on the SPI bus), less once the
+ * firmware has raised the clock. --card-max-khz limits the clock the card
+ * reads cleanly at, so probing has to fall back.
+ *
+ * Usage: bench_boot [--sector-us US] [--card-max-khz KHZ] [--log LEVEL]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <utime.h>
+
+#include "bench_common.h"
+#include "sim.h"
+
+#include "driver/i2s_std.h"
+#include "main.h"
+
+#define BOOT_TIMEOUT_S 20.0
+
+static const bench_track_t tracks[] = {
+    {"PAGE1.WAV", 44100, 2, TW_INT16, 1.0, 440.0},
+    {"PAGE2.WAV", 44100, 2, TW_INT16, 1.0, 554.4},
+    {"PAGE3.WAV", 22050, 2, TW_INT16, 1.0, 659.3},
+};
+
+typedef struct boot_result {
+  uint64_t first_audio_us;
+  uint64_t card_sectors;
+  uint64_t dir_entries_read;
+  uint32_t card_khz;
+} boot_result_t;
+
+static bool add_files(int first, int count) {
+  for (int i = first; i < first + count; ++i) {
+    char path[64];
+    snprintf(path, sizeof(path), "sdc/NOTE%04d.TXT", i);
+    FILE *file = fopen(path, "w");
+    if (file == NULL) {
+      perror(path);
+      return false;
+    }
+    fputs("page notes\n", file);
+    fclose(file);
+  }
+  return true;
+}
+
+// Same size, a later modification time
+static bool reexport_first_page(void) {
+  struct stat st;
+  if (stat("sdc/PAGE1.WAV", &st) != 0) {
+    perror("sdc/PAGE1.WAV");
+    return false;
+  }
+  struct utimbuf times = {st.st_atime, st.st_mtime + 60};
+  return utime("sdc/PAGE1.WAV", &times) == 0;
+}
+
+static boot_result_t boot(const sim_config_t *config) {
+  boot_result_t result = {0, 0, 0, 0};
+  int fds[2];
+  if (pipe(fds) != 0) {
+    perror("pipe");
+    return result;
+  }
+
+  pid_t child = fork();
+  if (child == 0) {
+    close(fds[0]);
+    sim_init(config);
+    sim_start(app_main);
+    for (double waited = 0; waited < BOOT_TIMEOUT_S; waited += 0.01) {
+      if (sim_get_stats()->first_audio_us != 0) {
+        break;
+      }
+      sim_run_for(0.01);
+    }
+    result.first_audio_us = sim_get_stats()->first_audio_us;
+    result.card_sectors = sim_get_stats()->card_sectors;
+    result.dir_entries_read = sim_get_stats()->dir_entries_read;
+    result.card_khz = sim_card_bus_khz();
+    sim_stop();
+    ssize_t written = write(fds[1], &result, sizeof(result));
+    _exit(written == sizeof(result) ? 0 : 1);
+  }
+
+  close(fds[1]);
+  if (read(fds[0], &result, sizeof(result)) != sizeof(result)) {
+    result.first_audio_us = 0;
+  }
+  close(fds[0]);
+  waitpid(child, NULL, 0);
+  return result;
+}
+
+int main(int argc, char **argv) {
+  const int file_counts[] = {10, 100, 1000};
+  sim_config_t config = {
+      .time_scale = 1.0,
+      .log_level = (esp_log_level_t)bench_arg_double(argc, argv, "--log",
+                                                     ESP_LOG_ERROR),
+      .card_sector_us = (uint32_t)bench_arg_double(argc, argv, "--sector-us", 1000),
+      .card_max_khz =
+          (uint32_t)bench_arg_double(argc, argv, "--card-max-khz", 0),
+  };
+
+  printf("card sector %lu us at %d kHz, card limit %lu kHz, "
+         "times are boot to first sample in ms (sectors)\n",
+         (unsigned long)config.card_sector_us, SIM_CARD_REFERENCE_KHZ,
+         (unsigned long)config.card_max_khz);
+  printf("%-8s %20s %20s %20s %20s\n", "files", "scan + write index",
+         "from index", "after card change", "after re-export");
+
+  uint32_t probed_khz = 0;
+  for (size_t c = 0; c < sizeof(file_counts) / sizeof(file_counts[0]); ++c) {
+    int extra = file_counts[c] - (int)(sizeof(tracks) / sizeof(tracks[0]));
+    if (!bench_prepare_card(tracks, sizeof(tracks) / sizeof(tracks[0]), NULL) ||
+        !add_files(0, extra)) {
+      return 1;
+    }
+
+    boot_result_t scan = boot(&config);
+    boot_result_t indexed = boot(&config);
+    if (!add_files(extra, 1)) {
+      return 1;
+    }
+    boot_result_t changed = boot(&config);
+    if (!reexport_first_page()) {
+      return 1;
+    }
+    boot_result_t reexported = boot(&config);
+
+    probed_khz = scan.card_khz;
+    printf("%-8d %11.1f (%6llu) %11.1f (%6llu) %11.1f (%6llu) %11.1f (%6llu)\n",
+           file_counts[c], scan.first_audio_us / 1000.0,
+           (unsigned long long)scan.card_sectors,
+           indexed.first_audio_us / 1000.0,
+           (unsigned long long)indexed.card_sectors,
+           changed.first_audio_us / 1000.0,
+           (unsigned long long)changed.card_sectors,
+           reexported.first_audio_us / 1000.0,
+           (unsigned long long)reexported.card_sectors);
+    if (scan.first_audio_us == 0 || indexed.first_audio_us == 0 ||
+        changed.first_audio_us == 0 || reexported.first_audio_us == 0) {
+      fprintf(stderr, "a boot did not reach first audio\n");
+      return 1;
+    }
+    if (indexed.dir_entries_read != 0) {
+      fprintf(stderr, "booting from the index read %llu directory entries\n",
+              (unsigned long long)indexed.dir_entries_read);
+      return 1;
+    }
+    if (access("sdc/INDEX.MBI", F_OK) == 0) {
+      fprintf(stderr, "the track index outlived a re-exported page\n");
+      return 1;
+    }
+  }
+  printf("card clock after probing %lu kHz\n", (unsigned long)probed_khz);
+  return 0;
+}
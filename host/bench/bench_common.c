@@ -0,0 +1,329 @@
+/*
+ * bench_common.c
+ */
+
+#include "bench_common.h"
+
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/param.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define WRITE_BLOCK_FRAMES 1024
+
+uint64_t bench_now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+// IMA ADPCM reference encoder: the nibble is the difference from the
+// predictor in steps, and the predictor and step index follow it exactly as
+// the decoder will
+static const int16_t ima_steps[89] = {
+    7,     8,     9,     10,    11,    12,    13,    14,    16,    17,
+    19,    21,    23,    25,    28,    31,    34,    37,    41,    45,
+    50,    55,    60,    66,    73,    80,    88,    97,    107,   118,
+    130,   143,   157,   173,   190,   209,   230,   253,   279,   307,
+    337,   371,   408,   449,   494,   544,   598,   658,   724,   796,
+    876,   963,   1060,  1166,  1282,  1411,  1552,  1707,  1878,  2066,
+    2272,  2499,  2749,  3024,  3327,  3660,  4026,  4428,  4871,  5358,
+    5894,  6484,  7132,  7845,  8630,  9493,  10442, 11487, 12635, 13899,
+    15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794, 32767};
+static const int ima_index_adjust[8] = {-1, -1, -1, -1, 2, 4, 6, 8};
+
+typedef struct ima_state {
+  int predictor;
+  int index;
+} ima_state_t;
+
+static uint8_t ima_encode(ima_state_t *s, int sample) {
+  int step = ima_steps[s->index];
+  int diff = sample - s->predictor;
+  uint8_t nibble = 0;
+  if (diff < 0) {
+    nibble = 8;
+    diff = -diff;
+  }
+  int delta = step >> 3;
+  for (int mask = 4; mask > 0; mask >>= 1, step >>= 1) {
+    if (diff >= step) {
+      nibble |= mask;
+      diff -= step;
+      delta += step;
+    }
+  }
+  s->predictor += (nibble & 8) ? -delta : delta;
+  s->predictor = MAX(MIN(s->predictor, INT16_MAX), INT16_MIN);
+  s->index = MAX(MIN(s->index + ima_index_adjust[nibble & 7], 88), 0);
+  return nibble;
+}
+
+static void put16(uint8_t *p, uint16_t v) {
+  p[0] = (uint8_t)v;
+  p[1] = (uint8_t)(v >> 8);
+}
+
+static void put32(uint8_t *p, uint32_t v) {
+  put16(p, (uint16_t)v);
+  put16(p + 2, (uint16_t)(v >> 16));
+}
+
+bool bench_write_ima_adpcm(const char *path, int channels,
+                           uint32_t sample_rate, const int16_t *pcm,
+                           uint32_t frames) {
+  uint16_t block_align = 256 * channels * MAX(1, sample_rate / 11025);
+  uint32_t block_frames = (block_align - 4 * channels) * 2 / channels + 1;
+  uint32_t blocks = (frames + block_frames - 1) / block_frames;
+  uint32_t data_size = blocks * block_align;
+
+  FILE *f = fopen(path, "wb");
+  if (f == NULL) {
+    return false;
+  }
+
+  uint8_t header[60];
+  memcpy(header, "RIFF", 4);
+  put32(header + 4, sizeof(header) - 8 + data_size);
+  memcpy(header + 8, "WAVEfmt ", 8);
+  put32(header + 16, 20);
+  put16(header + 20, TINYWAV_FORMAT_IMA_ADPCM);
+  put16(header + 22, channels);
+  put32(header + 24, sample_rate);
+  put32(header + 28, (uint32_t)((uint64_t)sample_rate * block_align / block_frames));
+  put16(header + 32, block_align);
+  put16(header + 34, 4);
+  put16(header + 36, 2); // extra format bytes
+  put16(header + 38, block_frames);
+  memcpy(header + 40, "fact", 4);
+  put32(header + 44, 4);
+  put32(header + 48, frames);
+  memcpy(header + 52, "data", 4);
+  put32(header + 56, data_size);
+  bool ok = fwrite(header, sizeof(header), 1, f) == 1;
+
+  ima_state_t state[2] = {{0, 0}, {0, 0}};
+  uint8_t *block = malloc(block_align);
+  for (uint32_t b = 0; ok && b < blocks; ++b) {
+    uint32_t first = b * block_frames;
+    memset(block, 0, block_align);
+    // Frames past the end of the track encode silence
+    #define SAMPLE(frame, c) ((frame) < frames ? pcm[(frame) * channels + (c)] : 0)
+    for (int c = 0; c < channels; ++c) {
+      state[c].predictor = SAMPLE(first, c);
+      put16(block + 4 * c, (uint16_t)(int16_t)state[c].predictor);
+      block[4 * c + 2] = (uint8_t)state[c].index;
+    }
+    for (uint32_t j = 0; j + 1 < block_frames; ++j) {
+      for (int c = 0; c < channels; ++c) {
+        uint8_t nibble = ima_encode(&state[c], SAMPLE(first + 1 + j, c));
+        uint8_t *byte = block + 4 * channels + (j / 8) * 4 * channels + 4 * c + (j % 8) / 2;
+        *byte |= (j % 2) ? nibble << 4 : nibble;
+      }
+    }
+    #undef SAMPLE
+    ok = fwrite(block, block_align, 1, f) == 1;
+  }
+
+  free(block);
+  return fclose(f) == 0 && ok;
+}
+
+bool bench_add_loop(const char *path, uint32_t start, uint32_t end) {
+  FILE *f = fopen(path, "r+b");
+  if (f == NULL) {
+    return false;
+  }
+
+  // Chunks start on an even offset
+  bool ok = fseek(f, 0, SEEK_END) == 0;
+  long size = ftell(f);
+  if (ok && size % 2 != 0) {
+    ok = fputc(0, f) == 0;
+    size++;
+  }
+
+  uint8_t chunk[8 + 36 + 24] = {0};
+  memcpy(chunk, "smpl", 4);
+  put32(chunk + 4, sizeof(chunk) - 8);
+  put32(chunk + 8 + 28, 1); // loops
+  put32(chunk + 8 + 36 + 4, 0); // forward
+  put32(chunk + 8 + 36 + 8, start);
+  put32(chunk + 8 + 36 + 12, end - 1); // the loop's last frame
+  ok = ok && fwrite(chunk, sizeof(chunk), 1, f) == 1;
+
+  uint8_t riff_size[4];
+  put32(riff_size, (uint32_t)(size + sizeof(chunk) - 8));
+  ok = ok && fseek(f, 4, SEEK_SET) == 0 && fwrite(riff_size, 4, 1, f) == 1;
+  return fclose(f) == 0 && ok;
+}
+
+bool bench_add_loudness(const char *path, int16_t loudness) {
+  FILE *f = fopen(path, "r+b");
+  if (f == NULL) {
+    return false;
+  }
+
+  bool ok = fseek(f, 0, SEEK_END) == 0;
+  long size = ftell(f);
+  if (ok && size % 2 != 0) {
+    ok = fputc(0, f) == 0;
+    size++;
+  }
+
+  // bext version 2 with its fixed fields only, the unmeasured levels unknown
+  uint8_t chunk[8 + 602] = {0};
+  memcpy(chunk, "bext", 4);
+  put32(chunk + 4, sizeof(chunk) - 8);
+  put16(chunk + 8 + 346, 2); // version
+  put16(chunk + 8 + 412, (uint16_t)loudness);
+  for (int field = 414; field < 422; field += 2) {
+    put16(chunk + 8 + field, TINYWAV_LOUDNESS_UNKNOWN); // range, peaks
+  }
+  ok = ok && fwrite(chunk, sizeof(chunk), 1, f) == 1;
+
+  uint8_t riff_size[4];
+  put32(riff_size, (uint32_t)(size + sizeof(chunk) - 8));
+  ok = ok && fseek(f, 4, SEEK_SET) == 0 && fwrite(riff_size, 4, 1, f) == 1;
+  return fclose(f) == 0 && ok;
+}
+
+bool bench_write_track(const char *path, const bench_track_t *track) {
+  if (track->format == BENCH_FORMAT_IMA_ADPCM) {
+    uint32_t total = (uint32_t)(track->seconds * track->sample_rate);
+    int16_t *pcm = malloc((size_t)total * track->channels * sizeof(int16_t));
+    double phase_step = 2.0 * M_PI * track->frequency / track->sample_rate;
+    for (uint32_t i = 0; i < total; ++i) {
+      int16_t sample = (int16_t)(0.5 * INT16_MAX * sin(phase_step * i));
+      for (int c = 0; c < track->channels; ++c) {
+        pcm[i * track->channels + c] = sample;
+      }
+    }
+    bool ok = bench_write_ima_adpcm(path, track->channels, track->sample_rate, pcm, total);
+    free(pcm);
+    return ok;
+  }
+
+  TinyWav tw;
+  if (tinywav_open_write(&tw, track->channels, track->sample_rate,
+                         track->format, TW_INTERLEAVED, path) != 0) {
+    return false;
+  }
+
+  float block[WRITE_BLOCK_FRAMES * 2];
+  uint32_t total = (uint32_t)(track->seconds * track->sample_rate);
+  double phase_step = 2.0 * M_PI * track->frequency / track->sample_rate;
+
+  for (uint32_t frame = 0; frame < total;) {
+    int frames = (int)MIN(WRITE_BLOCK_FRAMES, total - frame);
+    for (int i = 0; i < frames; ++i) {
+      float sample = 0.5f * (float)sin(phase_step * (frame + i));
+      for (int c = 0; c < track->channels; ++c) {
+        block[i * track->channels + c] = sample;
+      }
+    }
+    if (tinywav_write_f(&tw, block, frames) != frames) {
+      tinywav_close_write(&tw);
+      return false;
+    }
+    frame += frames;
+  }
+
+  tinywav_close_write(&tw);
+  return true;
+}
+
+bool bench_prepare_card(const bench_track_t *tracks, int num_tracks,
+                        const char *card_dir) {
+  char scratch[] = "/tmp/musicbook-sim-XXXXXX";
+  if (mkdtemp(scratch) == NULL) {
+    perror("mkdtemp");
+    return false;
+  }
+  if (chdir(scratch) != 0) {
+    perror("chdir");
+    return false;
+  }
+
+  if (card_dir != NULL) {
+    char resolved[PATH_MAX];
+    if (realpath(card_dir, resolved) == NULL || symlink(resolved, "sdc") != 0) {
+      perror("card directory");
+      return false;
+    }
+    return true;
+  }
+
+  if (mkdir("sdc", 0755) != 0) {
+    perror("mkdir sdc");
+    return false;
+  }
+
+  for (int i = 0; i < num_tracks; ++i) {
+    char path[64];
+    snprintf(path, sizeof(path), "sdc/%s", tracks[i].name);
+    if (!bench_write_track(path, &tracks[i])) {
+      fprintf(stderr, "Could not write %s\n", path);
+      return false;
+    }
+  }
+  return true;
+}
+
+static const struct {
+  const char *name;
+  TinyWavSampleFormat format;
+} format_names[] = {
+    {"u8", TW_UINT8},   {"s16", TW_INT16},   {"s24", TW_INT24},
+    {"s32", TW_INT32},  {"f32", TW_FLOAT32},
+    {"ima", (TinyWavSampleFormat)BENCH_FORMAT_IMA_ADPCM},
+};
+
+int bench_format(const char *name) {
+  for (size_t i = 0; i < sizeof(format_names) / sizeof(format_names[0]); ++i) {
+    if (strcmp(name, format_names[i].name) == 0) {
+      return format_names[i].format;
+    }
+  }
+  return -1;
+}
+
+const char *bench_format_name(TinyWavSampleFormat format) {
+  for (size_t i = 0; i < sizeof(format_names) / sizeof(format_names[0]); ++i) {
+    if (format_names[i].format == format) {
+      return format_names[i].name;
+    }
+  }
+  return "?";
+}
+
+bool bench_write_trace(const char *path, void (*dump)(FILE *out)) {
+  FILE *out = fopen(path, "w");
+  if (out == NULL) {
+    fprintf(stderr, "Could not write %s\n", path);
+    return false;
+  }
+  dump(out);
+  fclose(out);
+  return true;
+}
+
+double bench_arg_double(int argc, char **argv, const char *name, double def) {
+  const char *value = bench_arg_string(argc, argv, name, NULL);
+  return value != NULL ? atof(value) : def;
+}
+
+const char *bench_arg_string(int argc, char **argv, const char *name,
+                             const char *def) {
+  for (int i = 1; i + 1 < argc; ++i) {
+    if (strcmp(argv[i], name) == 0) {
+      return argv[i + 1];
+    }
+  }
+  return def;
+}
@@ -0,0 +1,81 @@
+/*
+ * bench_common.h
+ *
+ * Helpers shared by the host benchmarks: synthetic WAV cards and timing.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdint.h>
+
+#include "tinywav.h"
+
+/** bench_track_t format for tracks stored as IMA ADPCM, read back as s16. */
+#define BENCH_FORMAT_IMA_ADPCM TINYWAV_FORMAT_IMA_ADPCM
+
+typedef struct bench_track {
+  const char *name;    ///< 8.3 name as stored on the card, e.g. "PAGE1.WAV"
+  uint32_t sample_rate;
+  int16_t channels;
+  TinyWavSampleFormat format; ///< or BENCH_FORMAT_IMA_ADPCM
+  double seconds;
+  double frequency; ///< sine frequency, varied per track to tell them apart
+} bench_track_t;
+
+/**
+ * Create a scratch directory holding an "sdc" card directory with the given
+ * tracks and change into it, so the firmware's MOUNT_POINT resolves there.
+ *
+ * @param card_dir  Existing directory of WAV files to use instead of
+ * generating tracks, or NULL.
+ *
+ * @return  true on success.
+ */
+bool bench_prepare_card(const bench_track_t *tracks, int num_tracks,
+                        const char *card_dir);
+
+/** Write one synthetic sine track with the TinyWav writer. */
+bool bench_write_track(const char *path, const bench_track_t *track);
+
+/**
+ * Write interleaved 16 bit PCM as an IMA ADPCM WAV file, with the reference
+ * encoder of the IMA recommended practice and Microsoft's block size for the
+ * sample rate (256 bytes per channel per 11025 Hz). The last block is padded
+ * with silence and a fact chunk holds the frame count.
+ */
+bool bench_write_ima_adpcm(const char *path, int channels,
+                           uint32_t sample_rate, const int16_t *pcm,
+                           uint32_t frames);
+
+/**
+ * Append a smpl chunk to a WAV file with one forward loop from frame start up
+ * to, not including, frame end.
+ */
+bool bench_add_loop(const char *path, uint32_t start, uint32_t end);
+
+/**
+ * Append a version 2 bext chunk to a WAV file giving its integrated loudness
+ * in hundredths of a LUFS.
+ */
+bool bench_add_loudness(const char *path, int16_t loudness);
+
+/** Sample format named u8, s16, s24, s32, f32 or ima, or -1 for another
+ * name. */
+int bench_format(const char *name);
+
+/** Name of a sample format, as bench_format() takes it. */
+const char *bench_format_name(TinyWavSampleFormat format);
+
+/** Write a trace to path with dump, trace_dump() of a firmware built with
+ * TRACE_ENABLE. */
+bool bench_write_trace(const char *path, void (*dump)(FILE *out));
+
+/** Monotonic wall clock in nanoseconds. */
+uint64_t bench_now_ns(void);
+
+/** Parse "--name value" style options; returns the default when absent. */
+double bench_arg_double(int argc, char **argv, const char *name, double def);
+const char *bench_arg_string(int argc, char **argv, const char *name,
+                             const char *def);
@@ -0,0 +1,131 @@
+/*
+ * bench_convert.c
+ *
+ * Throughput of every sample format conversion kernel (src/convert.c) in
+ * samples per second on the host, converting a block at a time as
+ * read_section does, and each kernel's deviation from an exact conversion in
+ * output LSBs. Cycles per sample on target are logged by the firmware with
+ * its buffer stats.
+ *
+ * Usage: bench_convert [--samples N]
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench_common.h"
+#include "convert.h"
+
+// Samples per call: a 3072 byte conversion buffer of 32 bit samples, less a
+// few so the kernels' tails run too
+#define BLOCK_SAMPLES (768 - 3)
+
+static const TinyWavSampleFormat formats[] = {TW_UINT8, TW_INT16, TW_INT24,
+                                              TW_INT32, TW_FLOAT32};
+
+// Full scale sine, with a few out of range values for the float kernels
+static double test_value(int i) {
+  if (i % 97 == 0) {
+    return i % 2 == 0 ? 1.5 : -1.5;
+  }
+  return sin(i * 0.01) * (i % 3 == 0 ? 1.0 : 0.99);
+}
+
+// Store v in `format`, returning the value the file then holds, as a fraction
+// of full scale
+static double encode(uint8_t *out, TinyWavSampleFormat format, double v) {
+  double clipped = fmax(fmin(v, 1.0), -1.0);
+  switch (format) {
+  case TW_UINT8: {
+    int x = (int)fmin(floor(clipped * 128.0) + 128, 255);
+    out[0] = (uint8_t)x;
+    return (x - 128) / 128.0;
+  }
+  case TW_INT16: {
+    int16_t x = (int16_t)fmin(floor(clipped * 32768.0), 32767);
+    memcpy(out, &x, sizeof(x));
+    return x / 32768.0;
+  }
+  case TW_INT24: {
+    int32_t x = (int32_t)fmin(floor(clipped * 8388608.0), 8388607);
+    out[0] = (uint8_t)x;
+    out[1] = (uint8_t)(x >> 8);
+    out[2] = (uint8_t)(x >> 16);
+    return x / 8388608.0;
+  }
+  case TW_INT32: {
+    int32_t x = (int32_t)fmin(floor(clipped * 2147483648.0), 2147483647.0);
+    memcpy(out, &x, sizeof(x));
+    return x / 2147483648.0;
+  }
+  case TW_FLOAT32: {
+    float x = (float)v;
+    memcpy(out, &x, sizeof(x));
+    return x;
+  }
+  }
+  return 0.0;
+}
+
+// Largest difference between the kernel's output and the exact value, in
+// output LSBs
+static double max_error(const void *out, const double *values, int out_bits,
+                        int samples) {
+  double scale = out_bits == 16 ? 32768.0 : 2147483648.0;
+  double error = 0.0;
+  for (int i = 0; i < samples; ++i) {
+    double got = out_bits == 16 ? ((const int16_t *)out)[i]
+                                : ((const int32_t *)out)[i];
+    double want = fmax(fmin(values[i] * scale, scale - 1), -scale);
+    error = fmax(error, fabs(got - want));
+  }
+  return error;
+}
+
+int main(int argc, char **argv) {
+  double total = bench_arg_double(argc, argv, "--samples", 20e6);
+
+  uint32_t *src = malloc(BLOCK_SAMPLES * 4 + 4);
+  int32_t *dst = malloc(BLOCK_SAMPLES * 4);
+  double *values = malloc(BLOCK_SAMPLES * sizeof(double));
+
+  printf("%-6s %-6s %14s %10s %12s\n", "from", "to", "Msamples/s",
+         "ns/sample", "max error");
+
+  for (size_t f = 0; f < sizeof(formats) / sizeof(formats[0]); ++f) {
+    TinyWavSampleFormat format = formats[f];
+    int size = tinywav_sample_size(format);
+    for (int i = 0; i < BLOCK_SAMPLES; ++i) {
+      values[i] = encode((uint8_t *)src + i * size, format, test_value(i));
+    }
+
+    for (int out_bits = 16; out_bits <= 32; out_bits += 16) {
+      convert_fn_t convert = convert_select(format, out_bits);
+      if (convert == NULL) {
+        continue;
+      }
+
+      memset(dst, 0, BLOCK_SAMPLES * 4);
+      convert(dst, src, BLOCK_SAMPLES);
+      double error = max_error(dst, values, out_bits, BLOCK_SAMPLES);
+
+      uint64_t blocks = (uint64_t)(total / BLOCK_SAMPLES) + 1;
+      uint64_t start = bench_now_ns();
+      for (uint64_t b = 0; b < blocks; ++b) {
+        convert(dst, src, BLOCK_SAMPLES);
+        __asm__ volatile("" : : "r"(dst) : "memory");
+      }
+      double ns = (double)(bench_now_ns() - start) / (blocks * BLOCK_SAMPLES);
+
+      printf("%-6s s%-5d %14.1f %10.2f %12.2f\n", bench_format_name(format),
+             out_bits, 1e3 / ns, ns, error);
+    }
+  }
+
+  free(values);
+  free(dst);
+  free(src);
+  return 0;
+}
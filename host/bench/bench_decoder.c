@@ -0,0 +1,186 @@
+/*
+ * bench_decoder.c
+ *
+ * Real-time factor of every decoder backend (src/decoder.c) on the tracks it
+ * plays: each track is read from the simulated card start to end, several
+ * times over, in read blocks of the firmware's size with aligned reads, from
+ * a task standing in for the reader. Reported per backend are the audio
+ * seconds read per wall second, the reader's CPU time per audio second (the
+ * share of core 1 it takes) and the decode task's (of core 0), and how often
+ * the reader waited for the decode task.
+ *
+ * Every backend reading an IMA ADPCM track must return the same frames as
+ * TinyWav decoding it inline, read straight through and after seeks.
+ *
+ * Usage: bench_decoder [--seconds TRACK_SECONDS] [--passes N]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "bench_common.h"
+#include "sim.h"
+
+#include "decoder.h"
+#include "esp_cpu.h"
+#include "freertos/task.h"
+
+#define READ_BUFFER_SIZE (4 * TINYWAV_SECTOR_SIZE)
+#define READ_BYTES 1536
+#define SEEKS 100
+
+typedef struct run {
+  const char *path;
+  const decoder_backend_t *backend;
+  int passes;
+  bool seeks; // read after seeks instead of straight through
+  // Results
+  bool ok;
+  uint32_t hash;
+  uint64_t frames;
+  uint64_t wall_ns;
+  uint64_t reader_ns;
+  uint32_t rate;
+  volatile bool done;
+} run_t;
+
+static uint32_t fnv(uint32_t hash, const uint8_t *data, size_t len) {
+  for (size_t i = 0; i < len; ++i) {
+    hash = (hash ^ data[i]) * 16777619u;
+  }
+  return hash;
+}
+
+// The reader's side, run as a task so the decode task can wake it
+static void read_track(void *arg) {
+  run_t *run = (run_t *)arg;
+  TinyWav tw;
+  decoder_t decoder;
+  uint8_t *read_buffer = malloc(READ_BUFFER_SIZE);
+  uint8_t *buffer = malloc(READ_BYTES);
+  run->hash = 2166136261u;
+
+  if (tinywav_open_read(&tw, run->path, TW_INTERLEAVED) != 0 ||
+      tinywav_set_read_buffer(&tw, read_buffer, READ_BUFFER_SIZE) != 0 ||
+      !decoder_open_with(&decoder, &tw, run->backend)) {
+    run->done = true;
+    vTaskDelete(NULL);
+  }
+  run->rate = tw.h.SampleRate;
+  int read_frames = READ_BYTES / decoder.frame_size;
+  uint32_t seed = 12345;
+  run->ok = true;
+
+  uint64_t wall = bench_now_ns();
+  esp_cpu_cycle_count_t cpu = esp_cpu_get_cycle_count();
+  for (int pass = 0; pass < run->passes && run->ok; ++pass) {
+    decoder_seek(&decoder, 0);
+    for (int i = 0; run->seeks ? i < SEEKS : !decoder_at_end(&decoder); ++i) {
+      int frames = read_frames;
+      if (run->seeks) {
+        seed = seed * 1664525u + 1013904223u;
+        decoder_seek(&decoder, (seed >> 8) % tw.numFramesInHeader);
+        frames = 1 + (int)(seed % read_frames);
+      }
+      int got = decoder_read_frames(&decoder, buffer, frames);
+      if (got < 0 || (got == 0 && !decoder_at_end(&decoder))) {
+        run->ok = false;
+        break;
+      }
+      run->hash = fnv(run->hash, buffer, (size_t)got * decoder.frame_size);
+      run->frames += got;
+    }
+  }
+  run->reader_ns = esp_cpu_get_cycle_count() - cpu;
+  run->wall_ns = bench_now_ns() - wall;
+
+  decoder_close(&decoder);
+  tinywav_close_read(&tw);
+  free(buffer);
+  free(read_buffer);
+  run->done = true;
+  vTaskDelete(NULL);
+}
+
+static bool run_reader(run_t *run) {
+  run->done = false;
+  run->frames = 0;
+  if (xTaskCreatePinnedToCore(read_track, "read_file", 8192, run, 10, NULL, 1) != pdPASS) {
+    return false;
+  }
+  while (!run->done) {
+    usleep(1000);
+  }
+  return run->ok;
+}
+
+int main(int argc, char **argv) {
+  double seconds = bench_arg_double(argc, argv, "--seconds", 10.0);
+  int passes = (int)bench_arg_double(argc, argv, "--passes", 10);
+
+  const bench_track_t tracks[] = {
+      {"S16.WAV", 44100, 2, TW_INT16, seconds, 440.0},
+      {"IMA2.WAV", 44100, 2, BENCH_FORMAT_IMA_ADPCM, seconds, 440.0},
+      {"IMA1.WAV", 22050, 1, BENCH_FORMAT_IMA_ADPCM, seconds, 440.0},
+  };
+  const int num_tracks = sizeof(tracks) / sizeof(tracks[0]);
+  if (!bench_prepare_card(tracks, num_tracks, NULL)) {
+    return 1;
+  }
+  sim_init(NULL);
+
+  printf("%-9s %-16s %12s %14s %14s %8s\n", "track", "backend", "x realtime",
+         "reader ms/s", "decode ms/s", "waits");
+
+  for (int t = 0; t < num_tracks; ++t) {
+    char path[32];
+    snprintf(path, sizeof(path), "sdc/%s", tracks[t].name);
+    uint32_t reference[2] = {0, 0};
+    const char *reference_name = NULL;
+
+    for (int b = 0; b < decoder_backend_count; ++b) {
+      const decoder_backend_t *backend = decoder_backends[b];
+      TinyWav probe;
+      if (tinywav_open_read(&probe, path, TW_INTERLEAVED) != 0) {
+        return 1;
+      }
+      bool takes = backend->probe(&probe);
+      tinywav_close_read(&probe);
+      if (!takes) {
+        continue;
+      }
+
+      // Straight through, timed, then after seeks
+      decode_stats_t before = *decoder_task_stats();
+      run_t timed = {.path = path, .backend = backend, .passes = passes};
+      bool ok = run_reader(&timed);
+      decode_stats_t after = *decoder_task_stats();
+      run_t seeking = {.path = path, .backend = backend, .passes = 1, .seeks = true};
+      if (!ok || !run_reader(&seeking)) {
+        fprintf(stderr, "%s: %s read failed\n", path, backend->name);
+        return 1;
+      }
+
+      if (reference_name == NULL) {
+        reference_name = backend->name;
+        reference[0] = timed.hash;
+        reference[1] = seeking.hash;
+      } else if (timed.hash != reference[0] || seeking.hash != reference[1]) {
+        fprintf(stderr, "%s: %s returned different frames than %s\n", path,
+                backend->name, reference_name);
+        return 1;
+      }
+
+      double audio_seconds = (double)timed.frames / timed.rate;
+      printf("%-9s %-16s %12.0f %14.2f %14.2f %8lu\n", tracks[t].name,
+             backend->name, audio_seconds / (timed.wall_ns / 1e9),
+             timed.reader_ns / 1e6 / audio_seconds,
+             (after.cycles - before.cycles) / 1e6 / audio_seconds,
+             (unsigned long)(after.waits - before.waits));
+    }
+  }
+  printf("Every backend returned the same frames\n");
+  return 0;
+}
@@ -0,0 +1,324 @@
+/*
+ * bench_fifo.c
+ *
+ * Checks the lock-free audio FIFO (spsc_fifo_t in src/spsc.h) and compares
+ * it with the byte ring buffer stand-in it replaced.
+ *
+ * The checks cover the edges of a full and an empty FIFO, peeks that wrap
+ * around the end of the buffer, and drains. Then a producer thread writes
+ * blocks of the reader's sizes, now and then draining the FIFO as a page
+ * change does, while a consumer thread takes DMA buffer sized reads as the
+ * ISR does. Every byte written must be read or drained exactly once, in
+ * order.
+ *
+ * The benchmark fills DMA buffers from both queues with the reader and ISR
+ * interleaved as in playback, reporting the ISR's host nanoseconds per buffer
+ * and how many buffers came up short although enough audio was queued. Once
+ * playback has started with less than a buffer queued, the read position no
+ * longer divides the ring buffer, which then returns a short span wherever
+ * its contents wrap.
+ *
+ * Usage: bench_fifo [--buffers N]
+ */
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench_common.h"
+#include "sim.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/ringbuf.h"
+#include "spsc.h"
+
+#define CAPACITY 8192
+#define RING_SIZE 24576 // BUFF_MAX_SIZE with the default BUFF_SIZE
+#define DMA_BYTES 512   // 128 stereo 16 bit frames
+#define START_BYTES 300 // queued when the first buffer is taken
+#define STRESS_WORDS (8u * 1024 * 1024)
+
+static int failures;
+
+static void expect(bool ok, const char *what) {
+  if (!ok) {
+    fprintf(stderr, "FAILED: %s\n", what);
+    failures++;
+  }
+}
+
+static void check_edges(void) {
+  static uint8_t storage[CAPACITY];
+  uint8_t in[CAPACITY], out[CAPACITY];
+  for (int i = 0; i < CAPACITY; ++i) {
+    in[i] = (uint8_t)(i * 7 + 1);
+  }
+
+  spsc_fifo_t f;
+  expect(!spsc_fifo_init(&f, storage, 3000), "capacity must be a power of two");
+  expect(spsc_fifo_capacity(3000) == 4096 && spsc_fifo_capacity(4096) == 4096,
+         "capacity rounds up to a power of two");
+  expect(spsc_fifo_init(&f, storage, CAPACITY), "init");
+
+  spsc_fifo_spans_t spans;
+  expect(spsc_fifo_peek(&f, &spans, DMA_BYTES) == 0, "empty peek");
+  expect(spsc_fifo_write(&f, in, CAPACITY), "write to capacity");
+  expect(!spsc_fifo_write(&f, in, 1), "write to a full FIFO");
+  expect(spsc_fifo_used(&f) == CAPACITY, "full");
+
+  // Move the read position near the end so the next reads wrap
+  uint32_t n = spsc_fifo_peek(&f, &spans, CAPACITY - 100);
+  expect(n == CAPACITY - 100 && spans.span[1].len == 0, "one span up to the end");
+  expect(spsc_fifo_consume(&f, &spans, n), "consume");
+  expect(spsc_fifo_write(&f, in, 300), "write across the end");
+
+  n = spsc_fifo_peek(&f, &spans, CAPACITY);
+  expect(n == 400 && spans.span[0].len == 100 && spans.span[1].len == 300,
+         "two spans across the end");
+  memcpy(out, spans.span[0].data, spans.span[0].len);
+  memcpy(out + spans.span[0].len, spans.span[1].data, spans.span[1].len);
+  expect(memcmp(out, in + CAPACITY - 100, 100) == 0 && memcmp(out + 100, in, 300) == 0,
+         "spans hold the bytes in order");
+
+  // A drain between peek and consume makes the consume fail
+  n = spsc_fifo_peek(&f, &spans, 50);
+  expect(spsc_fifo_drain(&f, out, 150) == 150, "drain copies up to max");
+  expect(memcmp(out, in + CAPACITY - 100, 100) == 0 && memcmp(out + 100, in, 50) == 0,
+         "drain copies the oldest bytes");
+  expect(spsc_fifo_used(&f) == 0, "drain empties the FIFO");
+  expect(!spsc_fifo_consume(&f, &spans, n), "consume after a drain fails");
+  expect(spsc_fifo_peek(&f, &spans, DMA_BYTES) == 0, "empty after the drain");
+}
+
+typedef struct stress {
+  spsc_fifo_t fifo;
+  uint8_t *seen; // times each word was read or drained
+  uint32_t consumer_last;
+  volatile bool done;
+  uint64_t drained;
+  uint64_t consumed;
+  uint64_t retries;
+  bool ordered;
+} stress_t;
+
+static void mark(stress_t *s, const uint8_t *bytes, uint32_t len, uint32_t *last) {
+  for (uint32_t i = 0; i < len; i += 4) {
+    uint32_t word;
+    memcpy(&word, bytes + i, 4);
+    if (word >= STRESS_WORDS || (last != NULL && word + 1 <= *last)) {
+      s->ordered = false;
+      return;
+    }
+    s->seen[word]++;
+    if (last != NULL) {
+      *last = word + 1;
+    }
+  }
+}
+
+// The ISR's side
+static void *consume(void *arg) {
+  stress_t *s = (stress_t *)arg;
+  uint8_t buffer[DMA_BYTES];
+  while (!s->done || spsc_fifo_used(&s->fifo) > 0) {
+    spsc_fifo_spans_t spans;
+    uint32_t got;
+    while (spsc_fifo_used(&s->fifo) == 0 && !s->done) {
+      sched_yield();
+    }
+    while (true) {
+      got = spsc_fifo_peek(&s->fifo, &spans, DMA_BYTES);
+      memcpy(buffer, spans.span[0].data, spans.span[0].len);
+      memcpy(buffer + spans.span[0].len, spans.span[1].data, spans.span[1].len);
+      if (spsc_fifo_consume(&s->fifo, &spans, got)) {
+        break;
+      }
+      s->retries++;
+    }
+    mark(s, buffer, got, &s->consumer_last);
+    s->consumed += got;
+  }
+  return NULL;
+}
+
+static void check_stress(void) {
+  static stress_t s;
+  static uint8_t storage[CAPACITY];
+  spsc_fifo_init(&s.fifo, storage, CAPACITY);
+  s.seen = calloc(STRESS_WORDS, 1);
+  s.ordered = true;
+
+  pthread_t consumer;
+  pthread_create(&consumer, NULL, consume, &s);
+
+  // The reader's side: blocks of 96 to 1536 bytes, a drain every so often
+  uint8_t block[1536], tail[CAPACITY];
+  uint32_t next = 0, seed = 1;
+  while (next < STRESS_WORDS) {
+    seed = seed * 1664525u + 1013904223u;
+    uint32_t words = 24 + (seed >> 8) % 361;
+    if (words > STRESS_WORDS - next) {
+      words = STRESS_WORDS - next;
+    }
+    for (uint32_t i = 0; i < words; ++i) {
+      uint32_t word = next + i;
+      memcpy(block + 4 * i, &word, 4);
+    }
+    while (!spsc_fifo_write(&s.fifo, block, words * 4)) {
+      sched_yield();
+    }
+    next += words;
+
+    if ((seed >> 20) % 64 == 0) {
+      uint32_t len = spsc_fifo_drain(&s.fifo, tail, sizeof(tail));
+      uint32_t last = 0;
+      mark(&s, tail, len, &last);
+      s.drained += len;
+    }
+  }
+  s.done = true;
+  pthread_join(consumer, NULL);
+
+  bool once = true;
+  for (uint32_t i = 0; i < STRESS_WORDS; ++i) {
+    once &= s.seen[i] == 1;
+  }
+  expect(s.ordered, "bytes are read in the order written");
+  expect(once, "every byte is read or drained exactly once");
+  expect(s.consumed + s.drained == (uint64_t)STRESS_WORDS * 4, "no byte lost");
+  printf("stress: %u MB through, %.1f%% drained, %llu consumer retries after drains\n",
+         (unsigned)(STRESS_WORDS * 4 / (1024 * 1024)), 100.0 * s.drained / (STRESS_WORDS * 4.0),
+         (unsigned long long)s.retries);
+  free(s.seen);
+}
+
+typedef struct fill_result {
+  double ns_per_buffer;
+  uint64_t short_fills; // buffers not filled although enough was queued
+} fill_result_t;
+
+// Playback as the ISR sees it: the reader fills the queue in blocks, the ISR
+// takes BATCH buffers (timed), and every PAGE_BATCHES the page turns, dropping
+// what is queued and starting the next track with START_BYTES
+#define BATCH 32
+#define PAGE_BATCHES 8
+
+static fill_result_t bench_fifo(int buffers, uint32_t block) {
+  uint32_t size = spsc_fifo_capacity(RING_SIZE);
+  uint8_t *storage = malloc(size);
+  uint8_t *tail = malloc(size);
+  spsc_fifo_t f;
+  spsc_fifo_init(&f, storage, size);
+  uint8_t in[1536], dma[DMA_BYTES];
+  memset(in, 1, sizeof(in));
+  fill_result_t r = {0, 0};
+  uint64_t ns = 0;
+  int done = 0;
+
+  for (int batch = 0; done < buffers; ++batch) {
+    if (batch % PAGE_BATCHES == 0) {
+      spsc_fifo_drain(&f, tail, size);
+      spsc_fifo_write(&f, in, START_BYTES);
+    } else {
+      // Only as deep as the ring buffer holds
+      while (spsc_fifo_used(&f) + block <= RING_SIZE && spsc_fifo_write(&f, in, block)) {
+      }
+    }
+
+    uint32_t queued = spsc_fifo_used(&f);
+    uint64_t start = bench_now_ns();
+    for (int i = 0; i < BATCH; ++i, ++done) {
+      spsc_fifo_spans_t spans;
+      uint32_t got = spsc_fifo_peek(&f, &spans, DMA_BYTES);
+      memcpy(dma, spans.span[0].data, spans.span[0].len);
+      memcpy(dma + spans.span[0].len, spans.span[1].data, spans.span[1].len);
+      spsc_fifo_consume(&f, &spans, got);
+      if (got < DMA_BYTES) {
+        memset(dma + got, 0, DMA_BYTES - got);
+        r.short_fills += queued >= DMA_BYTES;
+      }
+      queued -= got;
+    }
+    ns += bench_now_ns() - start;
+  }
+  free(tail);
+  free(storage);
+  r.ns_per_buffer = (double)ns / done;
+  return r;
+}
+
+static fill_result_t bench_ringbuf(int buffers, uint32_t block) {
+  RingbufHandle_t rb = xRingbufferCreate(RING_SIZE, RINGBUF_TYPE_BYTEBUF);
+  uint8_t in[1536], dma[DMA_BYTES];
+  memset(in, 1, sizeof(in));
+  fill_result_t r = {0, 0};
+  uint64_t ns = 0;
+  size_t queued = 0;
+  int done = 0;
+
+  for (int batch = 0; done < buffers; ++batch) {
+    if (batch % PAGE_BATCHES == 0) {
+      size_t received;
+      void *data;
+      while ((data = xRingbufferReceiveUpTo(rb, &received, 0, RING_SIZE)) != NULL) {
+        vRingbufferReturnItem(rb, data);
+      }
+      xRingbufferSend(rb, in, START_BYTES, 0);
+      queued = START_BYTES;
+    } else {
+      while (xRingbufferSend(rb, in, block, 0) == pdTRUE) {
+        queued += block;
+      }
+    }
+
+    uint64_t start = bench_now_ns();
+    for (int i = 0; i < BATCH; ++i, ++done) {
+      size_t got = 0;
+      BaseType_t woken = pdFALSE;
+      uint8_t *data = xRingbufferReceiveUpToFromISR(rb, &got, DMA_BYTES);
+      if (data != NULL) {
+        memcpy(dma, data, got);
+        vRingbufferReturnItemFromISR(rb, data, &woken);
+      }
+      if (got < DMA_BYTES) {
+        memset(dma + got, 0, DMA_BYTES - got);
+        r.short_fills += queued >= DMA_BYTES;
+      }
+      queued -= got;
+    }
+    ns += bench_now_ns() - start;
+  }
+  vRingbufferDelete(rb);
+  r.ns_per_buffer = (double)ns / done;
+  return r;
+}
+
+int main(int argc, char **argv) {
+  int buffers = (int)bench_arg_double(argc, argv, "--buffers", 2000000);
+  sim_init(NULL);
+
+  check_edges();
+  check_stress();
+  if (failures > 0) {
+    return 1;
+  }
+
+  printf("%-8s %-12s %14s %14s\n", "block", "queue", "isr ns/buffer", "short fills");
+  const uint32_t blocks[] = {96, 384, 1536};
+  for (size_t b = 0; b < sizeof(blocks) / sizeof(blocks[0]); ++b) {
+    fill_result_t ring = bench_ringbuf(buffers, blocks[b]);
+    fill_result_t fifo = bench_fifo(buffers, blocks[b]);
+    printf("%-8u %-12s %14.1f %14llu\n", (unsigned)blocks[b], "ringbuf", ring.ns_per_buffer,
+           (unsigned long long)ring.short_fills);
+    printf("%-8u %-12s %14.1f %14llu\n", (unsigned)blocks[b], "spsc_fifo", fifo.ns_per_buffer,
+           (unsigned long long)fifo.short_fills);
+    if (fifo.short_fills > 0) {
+      fprintf(stderr, "FAILED: the FIFO filled a buffer short\n");
+      return 1;
+    }
+  }
+  printf("All FIFO checks passed\n");
+  return 0;
+}
@@ -0,0 +1,155 @@
+/*
+ * bench_fragmentation.c
+ *
+ * Streams every track of a card whose files are laid out contiguously, in
+ * runs of four clusters and in single clusters, and compares reading the
+ * audio data through FatFs with raw sector reads (read_track_sectors) where
+ * map_track finds the track in one run. Reports the runs per track, the card
+ * time, read() calls, card commands and sectors to stream it, and checks both
+ * paths return the same samples.
+ *
+ * FatFs's own time per read() call, --read-us, is what raw reads save; the
+ * card does the same work either way.
+ *
+ * Usage: bench_fragmentation [--sector-us US] [--command-us US] [--read-us US]
+ *                            [--chunk BYTES] [--log LEVEL]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "bench_common.h"
+#include "sim.h"
+
+#include "file_managment.h"
+
+#define READ_BUFFER_SIZE (4 * TINYWAV_SECTOR_SIZE)
+
+static const bench_track_t tracks[] = {
+    {"PAGE1.WAV", 44100, 2, TW_INT16, 4.0, 440.0},
+    {"PAGE2.WAV", 44100, 2, TW_INT16, 4.0, 554.4},
+    {"PAGE3.WAV", 44100, 2, TW_INT16, 4.0, 659.3},
+};
+
+// Clusters per run for each track, 0 for one contiguous run
+static const uint32_t clusters_per_run[] = {0, 4, 1};
+
+typedef struct stream_result {
+  double ms;      // simulated card time
+  uint64_t reads; // read() calls
+  uint64_t commands;
+  uint64_t sectors;
+  uint32_t hash;  // FNV-1a of the audio data
+} stream_result_t;
+
+// Read the track's audio data in chunk byte aligned reads, raw when extent
+// is given
+static bool stream_track(track_info_t *track, track_extent_t *extent, int chunk,
+                         stream_result_t *result) {
+  TinyWav tw;
+  if (open_track(track, &tw) != 0) {
+    return false;
+  }
+  uint8_t *read_buffer = malloc(READ_BUFFER_SIZE);
+  uint8_t *buffer = malloc(chunk);
+  tinywav_set_read_buffer(&tw, read_buffer, READ_BUFFER_SIZE);
+  if (extent != NULL) {
+    tinywav_set_sector_reader(&tw, read_track_sectors, extent);
+  }
+
+  uint64_t start = sim_time_us();
+  sim_stats_t before = *sim_get_stats();
+  int frame = tw.h.BlockAlign;
+  uint32_t hash = 2166136261u;
+  int frames;
+  while ((frames = tinywav_read_f(&tw, buffer, chunk)) > 0) {
+    for (int i = 0; i < frames * frame; ++i) {
+      hash = (hash ^ buffer[i]) * 16777619u;
+    }
+  }
+  result->ms = (sim_time_us() - start) / 1000.0;
+  result->reads = sim_get_stats()->file_reads - before.file_reads;
+  result->commands = sim_get_stats()->card_commands - before.card_commands;
+  result->sectors = sim_get_stats()->card_sectors - before.card_sectors;
+  result->hash = hash;
+
+  tinywav_close_read(&tw);
+  free(buffer);
+  free(read_buffer);
+  return frames == 0;
+}
+
+int main(int argc, char **argv) {
+  int chunk = (int)bench_arg_double(argc, argv, "--chunk", 8192);
+  sim_config_t config = {
+      .time_scale = 1.0,
+      .log_level = (esp_log_level_t)bench_arg_double(argc, argv, "--log",
+                                                     ESP_LOG_ERROR),
+      .card_sector_us = (uint32_t)bench_arg_double(argc, argv, "--sector-us", 50),
+      .card_command_us = (uint32_t)bench_arg_double(argc, argv, "--command-us", 500),
+      .file_read_us = (uint32_t)bench_arg_double(argc, argv, "--read-us", 60),
+  };
+
+  int num_tracks = sizeof(tracks) / sizeof(tracks[0]);
+  if (!bench_prepare_card(tracks, num_tracks, NULL)) {
+    return 1;
+  }
+  for (int i = 0; i < num_tracks; ++i) {
+    char path[64];
+    snprintf(path, sizeof(path), "sdc/%s", tracks[i].name);
+    if (clusters_per_run[i] > 0 && !sim_card_fragment(path, clusters_per_run[i])) {
+      return 1;
+    }
+  }
+
+  sim_init(&config);
+  sdmmc_card_t card;
+  if (!mount_fs(&card)) {
+    return 1;
+  }
+  sort_filenames();
+
+  // Mounting prints card details, so rows are printed once all are done
+  char rows[sizeof(tracks) / sizeof(tracks[0])][160];
+  int mismatches = 0;
+
+  for (int i = 0; i < track_count(); ++i) {
+    track_info_t *track = track_at(i);
+    track_extent_t extent;
+    if (!map_track(track, &extent)) {
+      return 1;
+    }
+    bool raw = extent.runs == 1 && extent.sectors > 0;
+
+    stream_result_t fatfs, streamed;
+    if (!stream_track(track, NULL, chunk, &fatfs) ||
+        !stream_track(track, raw ? &extent : NULL, chunk, &streamed)) {
+      fprintf(stderr, "could not stream %s\n", track_name(track));
+      return 1;
+    }
+    if (streamed.hash != fatfs.hash) {
+      mismatches++;
+    }
+
+    snprintf(rows[i], sizeof(rows[i]),
+             "%-6u %-10s %5lu %-6s %9.1f %6llu %6llu %6llu %9.1f %6llu %6llu %6llu %s",
+             track->page, track_name(track), (unsigned long)extent.runs,
+             raw ? "raw" : "fatfs", fatfs.ms, (unsigned long long)fatfs.reads,
+             (unsigned long long)fatfs.commands, (unsigned long long)fatfs.sectors,
+             streamed.ms, (unsigned long long)streamed.reads,
+             (unsigned long long)streamed.commands, (unsigned long long)streamed.sectors,
+             streamed.hash == fatfs.hash ? "same" : "DIFFERENT");
+  }
+
+  printf("card sector %lu us, command %lu us, read() %lu us, %d byte reads, "
+         "times in simulated ms\n",
+         (unsigned long)config.card_sector_us, (unsigned long)config.card_command_us,
+         (unsigned long)config.file_read_us, chunk);
+  printf("%-6s %-10s %5s %-6s %9s %6s %6s %6s %9s %6s %6s %6s %s\n", "page",
+         "track", "runs", "path", "fatfs ms", "reads", "cmds", "sects", "stream ms",
+         "reads", "cmds", "sects", "data");
+  for (int i = 0; i < track_count(); ++i) {
+    printf("%s\n", rows[i]);
+  }
+  return mismatches == 0 ? 0 : 1;
+}
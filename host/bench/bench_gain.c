@@ -0,0 +1,208 @@
+/*
+ * bench_gain.c
+ *
+ * Checks the packed gain kernel bit for bit against a double precision
+ * reference, every 16 bit sample at a range of gains, and compares its
+ * throughput with a straightforward float loop, with its cost per DMA buffer
+ * against the buffer's play time. Also reads back the loudness of a track
+ * tagged with a bext chunk.
+ *
+ * Usage: bench_gain [--seconds AUDIO_SECONDS]
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "bench_common.h"
+
+#include "driver/i2s_std.h"
+#include "gain.h"
+#include "main.h"
+
+#define SAMPLE_RATE 44100
+#define CHANNELS 2
+
+// Reference: Q4.12 product rounded half up, then saturated
+static int64_t scale_reference(int64_t sample, uint16_t gain, int64_t min,
+                               int64_t max) {
+  double scaled = floor((double)sample * gain / GAIN_UNITY + 0.5);
+  return scaled < min ? min : (scaled > max ? max : (int64_t)scaled);
+}
+
+// Naive float gain per sample, for the timings
+static void gain_float_s16(int16_t *samples, size_t count, float gain) {
+  for (size_t i = 0; i < count; ++i) {
+    samples[i] = (int16_t)fmaxf(fminf(lrintf(samples[i] * gain), 32767.0f), -32768.0f);
+  }
+}
+
+static int failures = 0;
+
+static void fail(const char *what, uint16_t gain, int64_t sample, int64_t got,
+                 int64_t expected) {
+  if (failures++ < 10) {
+    printf("FAIL %s gain %u sample %lld: %lld, expected %lld\n", what, gain,
+           (long long)sample, (long long)got, (long long)expected);
+  }
+}
+
+static void check_s16(uint16_t gain) {
+  // Every sample value, then every odd count up to 7 for the tail
+  static int16_t samples[65536];
+  for (int i = 0; i < 65536; ++i) {
+    samples[i] = (int16_t)(i - 32768);
+  }
+  gain_apply_s16(samples, 65536, gain);
+  for (int i = 0; i < 65536; ++i) {
+    int64_t expected = scale_reference(i - 32768, gain, INT16_MIN, INT16_MAX);
+    if (samples[i] != expected) {
+      fail("s16", gain, i - 32768, samples[i], expected);
+    }
+  }
+
+  for (size_t count = 1; count <= 7; ++count) {
+    int16_t tail[8] = {INT16_MAX, INT16_MIN, 12345, -12345, 1, -1, 2048, 4321};
+    int16_t original[8];
+    for (int i = 0; i < 8; ++i) {
+      original[i] = tail[i];
+    }
+    gain_apply_s16(tail, count, gain);
+    for (size_t i = 0; i < 8; ++i) {
+      int64_t expected = i < count ? scale_reference(original[i], gain, INT16_MIN, INT16_MAX)
+                                   : original[i];
+      if (tail[i] != expected) {
+        fail("s16 tail", gain, original[i], tail[i], expected);
+      }
+    }
+  }
+}
+
+static void check_s32(uint16_t gain) {
+  enum { COUNT = 1 << 16 };
+  static int32_t samples[COUNT], original[COUNT];
+  const int32_t extremes[] = {INT32_MIN, INT32_MIN + 1, -1, 0, 1, INT32_MAX - 1, INT32_MAX};
+  for (int i = 0; i < COUNT; ++i) {
+    original[i] = i < 7 ? extremes[i] : (int32_t)(((uint32_t)rand() << 16) ^ (uint32_t)rand());
+    samples[i] = original[i];
+  }
+  gain_apply_s32(samples, COUNT, gain);
+  for (int i = 0; i < COUNT; ++i) {
+    int64_t expected = scale_reference(original[i], gain, INT32_MIN, INT32_MAX);
+    if (samples[i] != expected) {
+      fail("s32", gain, original[i], samples[i], expected);
+    }
+  }
+}
+
+static void check_levels(void) {
+  struct {
+    int32_t db;
+    uint16_t gain;
+  } levels[] = {{0, GAIN_UNITY}, {-600, 2053}, {600, 8173}, {-12000, 0}, {2400, 64917}, {2500, GAIN_MAX}};
+  for (size_t i = 0; i < sizeof(levels) / sizeof(levels[0]); ++i) {
+    uint16_t gain = gain_from_db(levels[i].db);
+    if (gain != levels[i].gain) {
+      printf("FAIL gain_from_db(%ld): %u, expected %u\n", (long)levels[i].db, gain, levels[i].gain);
+      failures++;
+    }
+  }
+
+  struct {
+    int16_t loudness;
+    int32_t db;
+  } tracks[] = {{TINYWAV_LOUDNESS_UNKNOWN, 0},
+                {LOUDNESS_TARGET, 0},
+                {LOUDNESS_TARGET + 500, -500},
+                {LOUDNESS_TARGET - 300, 300},
+                {-5000, LOUDNESS_MAX_BOOST}};
+  for (size_t i = 0; i < sizeof(tracks) / sizeof(tracks[0]); ++i) {
+    int32_t db = gain_normalize_db(tracks[i].loudness);
+    if (db != tracks[i].db) {
+      printf("FAIL gain_normalize_db(%d): %ld, expected %ld\n", tracks[i].loudness, (long)db,
+             (long)tracks[i].db);
+      failures++;
+    }
+  }
+}
+
+static void check_bext(void) {
+  const char *path = "bench_gain.wav";
+  bench_track_t track = {"GAIN.WAV", SAMPLE_RATE, CHANNELS, TW_INT16, 0.1, 440.0};
+  const int16_t loudness[] = {TINYWAV_LOUDNESS_UNKNOWN, -2345};
+  for (int i = 0; i < 2; ++i) {
+    TinyWav tw;
+    bool ok = bench_write_track(path, &track) &&
+              (loudness[i] == TINYWAV_LOUDNESS_UNKNOWN || bench_add_loudness(path, loudness[i])) &&
+              tinywav_open_read(&tw, path, TW_INTERLEAVED) == 0;
+    if (!ok) {
+      printf("FAIL could not write and open %s\n", path);
+      failures++;
+      continue;
+    }
+    if (tw.loudness != loudness[i]) {
+      printf("FAIL bext loudness %d, expected %d\n", tw.loudness, loudness[i]);
+      failures++;
+    }
+    tinywav_close_read(&tw);
+  }
+  remove(path);
+}
+
+static void run(uint16_t gain, double seconds) {
+  const size_t count = DMA_FRAME_NUM * CHANNELS;
+  int16_t *samples = malloc(count * sizeof(int16_t));
+  for (size_t i = 0; i < count; ++i) {
+    samples[i] = (int16_t)(16000.0 * sin(2.0 * M_PI * 440.0 * (i / CHANNELS) / SAMPLE_RATE));
+  }
+
+  // A DMA buffer at a time, as read_section scales blocks; the samples
+  // saturate or fade as it goes, which costs either kernel the same
+  uint64_t total = (uint64_t)(seconds * SAMPLE_RATE * CHANNELS);
+  uint64_t scaled = 0;
+  uint64_t start = bench_now_ns();
+  while (scaled < total) {
+    gain_apply_s16(samples, count, gain);
+    scaled += count;
+  }
+  double fixed_ns = (double)(bench_now_ns() - start) / scaled;
+
+  float gain_float = (float)gain / GAIN_UNITY;
+  scaled = 0;
+  start = bench_now_ns();
+  while (scaled < total) {
+    gain_float_s16(samples, count, gain_float);
+    scaled += count;
+  }
+  double float_ns = (double)(bench_now_ns() - start) / scaled;
+
+  double period_ns = 1e9 * DMA_FRAME_NUM / SAMPLE_RATE;
+  printf("%-8u %8.2f %14.1f %14.1f %14.0f %10.3f%%\n", gain, (double)gain / GAIN_UNITY,
+         1e3 / fixed_ns, 1e3 / float_ns, fixed_ns * count, 100.0 * fixed_ns * count / period_ns);
+  free(samples);
+}
+
+int main(int argc, char **argv) {
+  double seconds = bench_arg_double(argc, argv, "--seconds", 2000.0);
+
+  const uint16_t gains[] = {0, 1, 2053, GAIN_UNITY - 1, GAIN_UNITY, 8173, GAIN_MAX};
+  for (size_t i = 0; i < sizeof(gains) / sizeof(gains[0]); ++i) {
+    check_s16(gains[i]);
+    check_s32(gains[i]);
+  }
+  check_levels();
+  check_bext();
+  if (failures > 0) {
+    printf("%d failures\n", failures);
+    return 1;
+  }
+  printf("bit exact: s16 all samples, s32 random and extremes, %zu gains\n",
+         sizeof(gains) / sizeof(gains[0]));
+
+  printf("%d channels at %d Hz, DMA buffer %d frames\n", CHANNELS, SAMPLE_RATE, DMA_FRAME_NUM);
+  printf("%-8s %8s %14s %14s %14s %11s\n", "gain", "x", "Msamples/s", "float Msmp/s",
+         "ns/DMA buffer", "of period");
+  run(2053, seconds);
+  run(8173, seconds);
+  return 0;
+}
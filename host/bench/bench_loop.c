@@ -0,0 +1,222 @@
+/*
+ * bench_loop.c
+ *
+ * Plays tracks through the firmware's sections (src/sections.c) for several
+ * loops and checks that the stream read_section returns is the track up to
+ * its loop end, then the loop over and over, sample for sample, with no frame
+ * dropped or repeated at the wrap. Tracks loop whole or over the loop of a
+ * smpl chunk, in PCM formats played as stored and converted, in IMA ADPCM,
+ * and short enough for the track cache, which converts them straight from the
+ * cache, for several read sizes.
+ *
+ * Reported per track are the frames checked and the card sectors read per
+ * loop once the first has played.
+ *
+ * Usage: bench_loop [--loops N] [--log LEVEL]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "bench_common.h"
+#include "sim.h"
+
+#include "file_managment.h"
+#include "freertos/task.h"
+#include "sections.h"
+
+typedef struct loop_track {
+  bench_track_t track;
+  uint32_t loop_start; // smpl loop, none if loop_end is 0
+  uint32_t loop_end;
+} loop_track_t;
+
+static const loop_track_t tracks[] = {
+    {{"PAGE1.WAV", 44100, 2, TW_INT16, 0.5, 440.0}, 0, 0},
+    {{"PAGE2.WAV", 44100, 2, TW_INT16, 1.0, 554.4}, 10007, 33333},
+    {{"PAGE3.WAV", 44100, 2, BENCH_FORMAT_IMA_ADPCM, 1.0, 659.3}, 5001, 30011},
+    {{"PAGE4.WAV", 22050, 1, TW_INT24, 0.6, 330.0}, 1001, 12345},
+    {{"PAGE5.WAV", 22050, 1, TW_INT16, 0.3, 880.0}, 2000, 6001},
+    {{"PAGE6.WAV", 22050, 1, TW_INT24, 0.3, 990.0}, 1000, 4001},
+};
+#define NUM_TRACKS (int)(sizeof(tracks) / sizeof(tracks[0]))
+
+static const int read_sizes[] = {384, 1000, 4096};
+#define NUM_READ_SIZES (int)(sizeof(read_sizes) / sizeof(read_sizes[0]))
+
+typedef struct check {
+  int loops;
+  // Results
+  bool ok;
+  uint64_t frames[NUM_TRACKS];
+  double sectors_per_loop[NUM_TRACKS];
+  volatile bool done;
+} check_t;
+
+// The track's frames as read_section returns them, read straight through
+static uint8_t *expected_frames(const char *path, size_t out_frame, uint32_t *frames) {
+  TinyWav tw;
+  if (tinywav_open_read(&tw, path, TW_INTERLEAVED) != 0) {
+    return NULL;
+  }
+  size_t file_frame = tinywav_sample_size(tw.sampFmt) * tw.numChannels;
+  uint8_t *file = malloc((size_t)tw.numFramesInHeader * file_frame);
+  uint8_t *out = malloc((size_t)tw.numFramesInHeader * out_frame);
+  int got = tinywav_read_f(&tw, file, tw.numFramesInHeader * file_frame);
+  convert_fn_t convert = convert_select(tw.sampFmt, I2S_SAMPLE_BITS);
+  if (got == tw.numFramesInHeader) {
+    if (convert != NULL) {
+      convert(out, file, (size_t)got * tw.numChannels);
+    } else {
+      memcpy(out, file, (size_t)got * file_frame);
+    }
+  }
+  *frames = got;
+  tinywav_close_read(&tw);
+  free(file);
+  if (got != tw.numFramesInHeader) {
+    free(out);
+    return NULL;
+  }
+  return out;
+}
+
+static bool check_track(check_t *check, int t) {
+  const loop_track_t *lt = &tracks[t];
+  char path[32];
+  snprintf(path, sizeof(path), "sdc/%s", lt->track.name);
+
+  section_source_t *source = get_section((uint16_t)(t + 1), NULL);
+  if (source == NULL) {
+    fprintf(stderr, "%s: no section\n", path);
+    return false;
+  }
+
+  size_t frame = source->bytes_in_frame;
+  uint32_t total;
+  uint8_t *expected = expected_frames(path, frame, &total);
+  if (expected == NULL) {
+    fprintf(stderr, "%s: could not read it straight through\n", path);
+    return false;
+  }
+  uint32_t loop_start = lt->loop_end != 0 ? lt->loop_start : 0;
+  uint32_t loop_end = lt->loop_end != 0 ? lt->loop_end : total;
+  uint32_t loop_frames = loop_end - loop_start;
+  uint64_t frames_wanted = loop_end + (uint64_t)check->loops * loop_frames;
+
+  uint8_t *buffer = malloc(read_sizes[NUM_READ_SIZES - 1]);
+  bool ok = true;
+  for (int r = 0; r < NUM_READ_SIZES && ok; ++r) {
+    rewind_section(source);
+    uint64_t sectors_after_first = 0;
+    uint64_t played = 0;
+
+    while (played < frames_wanted && ok) {
+      int got = read_section(source, buffer, read_sizes[r]);
+      if (got <= 0) {
+        fprintf(stderr, "%s: read of %d bytes returned %d at frame %llu\n", path,
+                read_sizes[r], got, (unsigned long long)played);
+        ok = false;
+        break;
+      }
+      for (int i = 0; i < got; ++i, ++played) {
+        uint64_t n = played < loop_end ? played : loop_start + (played - loop_end) % loop_frames;
+        if (memcmp(buffer + i * frame, expected + n * frame, frame) != 0) {
+          fprintf(stderr, "%s: frame %llu (track frame %llu) differs, reads of %d bytes\n", path,
+                  (unsigned long long)played, (unsigned long long)n, read_sizes[r]);
+          ok = false;
+          break;
+        }
+      }
+      if (played >= loop_end + loop_frames && sectors_after_first == 0) {
+        sectors_after_first = sim_get_stats()->card_sectors;
+      }
+    }
+
+    check->frames[t] += played;
+    if (r == NUM_READ_SIZES - 1 && check->loops > 1) {
+      check->sectors_per_loop[t] =
+          (double)(sim_get_stats()->card_sectors - sectors_after_first) / (check->loops - 1);
+    }
+  }
+
+  free(buffer);
+  free(expected);
+  return ok;
+}
+
+static void check_tracks(void *arg) {
+  check_t *check = (check_t *)arg;
+  check->ok = true;
+  for (int t = 0; t < NUM_TRACKS && check->ok; ++t) {
+    check->ok = check_track(check, t);
+  }
+  check->done = true;
+  vTaskDelete(NULL);
+}
+
+int main(int argc, char **argv) {
+  int loops = (int)bench_arg_double(argc, argv, "--loops", 4);
+  sim_config_t config = {
+      .time_scale = 1.0,
+      .log_level = (esp_log_level_t)bench_arg_double(argc, argv, "--log",
+                                                     ESP_LOG_ERROR),
+  };
+
+  bench_track_t cards[NUM_TRACKS];
+  for (int t = 0; t < NUM_TRACKS; ++t) {
+    cards[t] = tracks[t].track;
+  }
+  if (!bench_prepare_card(cards, NUM_TRACKS, NULL)) {
+    return 1;
+  }
+  for (int t = 0; t < NUM_TRACKS; ++t) {
+    char path[32];
+    snprintf(path, sizeof(path), "sdc/%s", tracks[t].track.name);
+    if (tracks[t].loop_end != 0 &&
+        !bench_add_loop(path, tracks[t].loop_start, tracks[t].loop_end)) {
+      fprintf(stderr, "%s: could not add its loop\n", path);
+      return 1;
+    }
+  }
+
+  sim_init(&config);
+  sdmmc_card_t card;
+  if (!mount_fs(&card)) {
+    return 1;
+  }
+  sort_filenames();
+
+  // A task, so the decode task can wake it
+  check_t check = {.loops = loops};
+  if (xTaskCreatePinnedToCore(check_tracks, "read_file", 8192, &check, 10, NULL, 1) != pdPASS) {
+    return 1;
+  }
+  while (!check.done) {
+    usleep(1000);
+  }
+  if (!check.ok) {
+    return 1;
+  }
+
+  printf("%-10s %-4s %-16s %12s %16s\n", "track", "fmt", "loop", "frames",
+         "sectors/loop");
+  for (int t = 0; t < NUM_TRACKS; ++t) {
+    const loop_track_t *lt = &tracks[t];
+    char loop[32];
+    if (lt->loop_end != 0) {
+      snprintf(loop, sizeof(loop), "%lu-%lu", (unsigned long)lt->loop_start,
+               (unsigned long)lt->loop_end);
+    } else {
+      snprintf(loop, sizeof(loop), "whole track");
+    }
+    printf("%-10s %-4s %-16s %12llu %16.1f\n", lt->track.name,
+           bench_format_name(lt->track.format), loop,
+           (unsigned long long)check.frames[t], check.sectors_per_loop[t]);
+  }
+  printf("Every loop was continuous, read sizes %d, %d and %d bytes\n",
+         read_sizes[0], read_sizes[1], read_sizes[2]);
+  return 0;
+}
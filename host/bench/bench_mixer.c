@@ -0,0 +1,121 @@
+/*
+ * bench_mixer.c
+ *
+ * Throughput of the crossfade kernel against a straightforward float
+ * implementation, its deviation from that reference, and its cost per DMA
+ * buffer compared with the buffer's play time.
+ *
+ * Usage: bench_mixer [--seconds AUDIO_SECONDS]
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "bench_common.h"
+
+#include "driver/i2s_std.h"
+#include "main.h"
+#include "mixer.h"
+
+#define SAMPLE_RATE 44100
+#define FADE_FRAMES (SAMPLE_RATE * 30 / 1000)
+
+// Reference: sine/cosine gains evaluated per frame in float
+static void crossfade_reference(int16_t *to, const int16_t *from, int frames,
+                                int channels, int start, int length) {
+  for (int i = 0; i < frames; ++i) {
+    float angle = (float)(start + i) / length * (float)M_PI_2;
+    float gain_in = sinf(angle), gain_out = cosf(angle);
+    for (int c = 0; c < channels; ++c) {
+      float mixed = from[c] * gain_out + to[c] * gain_in;
+      to[c] = (int16_t)fmaxf(fminf(mixed, 32767.0f), -32768.0f);
+    }
+    to += channels;
+    from += channels;
+  }
+}
+
+static void fill(int16_t *samples, int frames, int channels, double frequency) {
+  for (int i = 0; i < frames; ++i) {
+    for (int c = 0; c < channels; ++c) {
+      samples[i * channels + c] =
+          (int16_t)(16000.0 * sin(2.0 * M_PI * frequency * i / SAMPLE_RATE + c));
+    }
+  }
+}
+
+static void run(int channels, double seconds) {
+  const int frames = FADE_FRAMES;
+  int16_t *from = malloc(frames * channels * sizeof(int16_t));
+  int16_t *to = malloc(frames * channels * sizeof(int16_t));
+  int16_t *fixed = malloc(frames * channels * sizeof(int16_t));
+  int16_t *reference = malloc(frames * channels * sizeof(int16_t));
+  fill(from, frames, channels, 440.0);
+  fill(to, frames, channels, 660.0);
+
+  // Accuracy over one whole fade, mixed a DMA buffer at a time
+  crossfade_t fade;
+  crossfade_start(&fade, frames, channels);
+  for (int i = 0; i < frames * channels; ++i) {
+    fixed[i] = to[i];
+    reference[i] = to[i];
+  }
+  for (int i = 0; i < frames; i += DMA_FRAME_NUM) {
+    int n = frames - i < DMA_FRAME_NUM ? frames - i : DMA_FRAME_NUM;
+    crossfade_mix_s16(&fade, fixed + i * channels, from + i * channels, n);
+  }
+  crossfade_reference(reference, from, frames, channels, 0, frames);
+
+  int max_error = 0;
+  for (int i = 0; i < frames * channels; ++i) {
+    int error = abs(fixed[i] - reference[i]);
+    if (error > max_error) {
+      max_error = error;
+    }
+  }
+
+  // Throughput, repeating the fade until `seconds` of audio have been mixed
+  uint64_t total_frames = (uint64_t)(seconds * SAMPLE_RATE);
+  uint64_t mixed = 0;
+  uint64_t start = bench_now_ns();
+  while (mixed < total_frames) {
+    crossfade_start(&fade, frames, channels);
+    for (int i = 0; i < frames; i += DMA_FRAME_NUM) {
+      int n = frames - i < DMA_FRAME_NUM ? frames - i : DMA_FRAME_NUM;
+      crossfade_mix_s16(&fade, fixed + i * channels, from + i * channels, n);
+    }
+    mixed += frames;
+  }
+  double fixed_ns = (double)(bench_now_ns() - start) / mixed;
+
+  mixed = 0;
+  start = bench_now_ns();
+  while (mixed < total_frames) {
+    crossfade_reference(reference, from, frames, channels, 0, frames);
+    mixed += frames;
+  }
+  double reference_ns = (double)(bench_now_ns() - start) / mixed;
+
+  double period_ns = 1e9 * DMA_FRAME_NUM / SAMPLE_RATE;
+  printf("%-8d %14.1f %14.1f %10d %14.0f %10.3f%%\n", channels,
+         1e3 / fixed_ns * channels, 1e3 / reference_ns * channels, max_error,
+         fixed_ns * DMA_FRAME_NUM, 100.0 * fixed_ns * DMA_FRAME_NUM / period_ns);
+
+  free(from);
+  free(to);
+  free(fixed);
+  free(reference);
+}
+
+int main(int argc, char **argv) {
+  double seconds = bench_arg_double(argc, argv, "--seconds", 2000.0);
+
+  printf("fade %d frames at %d Hz, DMA buffer %d frames\n", FADE_FRAMES,
+         SAMPLE_RATE, DMA_FRAME_NUM);
+  printf("%-8s %14s %14s %10s %14s %11s\n", "channels", "Msamples/s",
+         "float Msmp/s", "max error", "ns/DMA buffer", "of period");
+  run(1, seconds);
+  run(2, seconds);
+  return 0;
+}
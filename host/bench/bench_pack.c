@@ -0,0 +1,175 @@
+/*
+ * bench_pack.c
+ *
+ * Page switch time with the book as loose WAV files against the same book
+ * packed by the book packer (host/tools). The firmware boots in a child
+ * process for each layout and turns to pages two or more apart, so the
+ * section for each new page is seldom prefetched and its track is opened on
+ * the switch: a loose track is opened and, the first time, parsed, and its
+ * clusters mapped, where a packed one is a seek within the pack. The tracks
+ * are in the formats the firmware converts as it plays, which the pack holds
+ * converted already.
+ *
+ * Card accesses are charged --sector-us of simulated time per 512 byte
+ * sector at the 5 MHz mount clock, less once the firmware raised it, and
+ * --command-us per read command.
+ *
+ * Usage: bench_pack [--switches N] [--sector-us US] [--command-us US]
+ *                   [--log LEVEL]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "bench_common.h"
+#include "packer.h"
+#include "sim.h"
+#include "sim_gpio.h"
+
+#include "book_pack.h"
+#include "driver/i2s_std.h"
+#include "main.h"
+#include "page_input.h"
+#include "sections.h"
+
+static const bench_track_t tracks[] = {
+    {"PAGE1.WAV", 44100, 2, TW_INT16, 2.0, 440.0},
+    {"PAGE2.WAV", 44100, 2, TW_INT24, 2.0, 493.9},
+    {"PAGE3.WAV", 44100, 2, BENCH_FORMAT_IMA_ADPCM, 2.0, 554.4},
+    {"PAGE4.WAV", 44100, 2, TW_FLOAT32, 2.0, 587.3},
+    {"PAGE5.WAV", 44100, 2, TW_INT16, 2.0, 659.3},
+    {"PAGE6.WAV", 44100, 2, BENCH_FORMAT_IMA_ADPCM, 2.0, 740.0},
+    {"PAGE7.WAV", 44100, 2, TW_INT32, 2.0, 830.6},
+};
+
+static const int pins[] = PAGE_ID_PINS;
+#define PIN_COUNT (int)(sizeof(pins) / sizeof(pins[0]))
+
+// Pages two or more apart, beyond the neighbours prefetched
+static const int order[] = {4, 1, 6, 3, 7, 2, 5, 1, 3, 6, 4, 7, 5, 2};
+
+typedef struct layout_result {
+  uint64_t boot_us;
+  uint32_t switches;
+  uint32_t gapless;
+  uint64_t latency_us;
+  uint32_t max_latency_us;
+  uint64_t card_sectors; // charged while switching
+  uint64_t underruns;
+} layout_result_t;
+
+static void set_page(unsigned page) {
+  unsigned levels = page ^ (page >> 1);
+  for (int bit = 0; bit < PIN_COUNT; ++bit) {
+    sim_gpio_set_level(pins[bit], (levels >> bit) & 1);
+  }
+}
+
+static void play(const sim_config_t *config, int switches, layout_result_t *result) {
+  sim_init(config);
+  sim_start(app_main);
+  set_page(1);
+  sim_run_for(0.5);
+  result->boot_us = sim_get_stats()->first_audio_us;
+
+  uint64_t sectors_before = sim_get_stats()->card_sectors;
+  uint64_t underruns_before = sim_get_stats()->underruns;
+  for (int i = 0; i < switches; ++i) {
+    page_switch_stats_t before, after;
+    get_page_switch_stats(&before);
+    set_page(order[i % (sizeof(order) / sizeof(order[0]))]);
+    sim_run_for(0.3);
+    get_page_switch_stats(&after);
+    if (after.switches == before.switches) {
+      continue;
+    }
+    result->switches++;
+    result->gapless += after.gapless_switches - before.gapless_switches;
+    result->latency_us += after.last_latency_us;
+    if (after.last_latency_us > result->max_latency_us) {
+      result->max_latency_us = after.last_latency_us;
+    }
+  }
+  result->card_sectors = sim_get_stats()->card_sectors - sectors_before;
+  result->underruns = sim_get_stats()->underruns - underruns_before;
+  sim_stop();
+}
+
+// Runs the firmware on the card as it stands in a child process, which
+// starts from fresh firmware state
+static bool run_layout(const sim_config_t *config, int switches, layout_result_t *result) {
+  *result = (layout_result_t){0};
+  int fds[2];
+  if (pipe(fds) != 0) {
+    perror("pipe");
+    return false;
+  }
+
+  fflush(stdout);
+  pid_t child = fork();
+  if (child == 0) {
+    close(fds[0]);
+    play(config, switches, result);
+    ssize_t written = write(fds[1], result, sizeof(*result));
+    _exit(written == sizeof(*result) ? 0 : 1);
+  }
+
+  close(fds[1]);
+  bool ok = read(fds[0], result, sizeof(*result)) == sizeof(*result);
+  close(fds[0]);
+  waitpid(child, NULL, 0);
+  return ok;
+}
+
+static void print_row(const char *name, const layout_result_t *result) {
+  printf("%-8s %9.1f %9lu %8lu %12.0f %12lu %16.1f %10llu\n", name, result->boot_us / 1000.0,
+         (unsigned long)result->switches, (unsigned long)result->gapless,
+         result->switches > 0 ? (double)result->latency_us / result->switches : 0.0,
+         (unsigned long)result->max_latency_us,
+         result->switches > 0 ? (double)result->card_sectors / result->switches : 0.0,
+         (unsigned long long)result->underruns);
+}
+
+int main(int argc, char **argv) {
+  int switches = (int)bench_arg_double(argc, argv, "--switches", 14);
+  sim_config_t config = {
+      .time_scale = 1.0,
+      .log_level = (esp_log_level_t)bench_arg_double(argc, argv, "--log",
+                                                     ESP_LOG_ERROR),
+      .card_sector_us = (uint32_t)bench_arg_double(argc, argv, "--sector-us", 1000),
+      .card_command_us = (uint32_t)bench_arg_double(argc, argv, "--command-us", 0),
+  };
+
+  if (!bench_prepare_card(tracks, sizeof(tracks) / sizeof(tracks[0]), NULL)) {
+    return 1;
+  }
+
+  layout_result_t loose, packed;
+  if (!run_layout(&config, switches, &loose)) {
+    fprintf(stderr, "loose layout did not run\n");
+    return 1;
+  }
+
+  packer_options_t options = {I2S_SAMPLE_BITS, OUTPUT_SAMPLE_RATE, RESAMPLE_TAPS, false};
+  uint64_t start = bench_now_ns();
+  if (packer_write("sdc", "sdc/" BOOK_PACK_FILE, &options) != (int)(sizeof(tracks) / sizeof(tracks[0]))) {
+    return 1;
+  }
+  double pack_ms = (bench_now_ns() - start) / 1e6;
+  if (!run_layout(&config, switches, &packed)) {
+    fprintf(stderr, "packed layout did not run\n");
+    return 1;
+  }
+
+  printf("%d tracks (s16, s24, ima, f32, s32), packed in %.1f ms, card sector %lu us, "
+         "command %lu us\n",
+         (int)(sizeof(tracks) / sizeof(tracks[0])), pack_ms,
+         (unsigned long)config.card_sector_us, (unsigned long)config.card_command_us);
+  printf("%-8s %9s %9s %8s %12s %12s %16s %10s\n", "layout", "boot ms", "switches", "gapless",
+         "avg us", "max us", "sectors/switch", "underruns");
+  print_row("loose", &loose);
+  print_row("pack", &packed);
+  return 0;
+}
@@ -0,0 +1,154 @@
+/*
+ * bench_page_switch.c
+ *
+ * Sets Gray coded page ids on the simulated page id pins while the firmware
+ * plays and reports the firmware's page-turn-to-new-audio latency for every
+ * switch. With --bounce N every pin that changes chatters N times, 50 us
+ * apart, before it settles; the latency still counts from the first edge. PAGE1 and
+ * PAGE2 share a format, so switching between them should stay gapless;
+ * PAGE3 has a different sample rate and forces the channel to be
+ * reconfigured, unless the configuration resamples every track to
+ * OUTPUT_SAMPLE_RATE. Gapless switches also report the crossfade's mixing cost
+ * per frame, in host nanoseconds. Built with TRACE_ENABLE, --trace writes the
+ * firmware's trace of the run as Chrome trace JSON. Built with
+ * BOOK_STORAGE_FLASH, the tracks play from the book partition's image.
+ *
+ * Usage: bench_page_switch_<config> [--switches N] [--bounce N] [--trace FILE]
+ *                                   [--log LEVEL]
+ */
+
+#include <stdio.h>
+
+#include "bench_common.h"
+#include "packer.h"
+#include "sim.h"
+#include "sim_gpio.h"
+
+#include "driver/i2s_std.h"
+#include "main.h"
+#include "page_input.h"
+#include "sections.h"
+#include "trace.h"
+
+#define LATENCY_TARGET_US 20000
+#define BOUNCE_GAP_US 50
+
+static const bench_track_t tracks[] = {
+    {"PAGE1.WAV", 44100, 2, TW_INT16, 4.0, 440.0},
+    {"PAGE2.WAV", 44100, 2, TW_INT16, 4.0, 554.4},
+    {"PAGE3.WAV", 22050, 2, TW_INT16, 4.0, 659.3},
+};
+
+static const int pins[] = PAGE_ID_PINS;
+#define PIN_COUNT (int)(sizeof(pins) / sizeof(pins[0]))
+static const int order[] = {1, 0, 1, 2, 0, 2, 1};
+
+static void set_pins(unsigned levels) {
+  for (int bit = 0; bit < PIN_COUNT; ++bit) {
+    sim_gpio_set_level(pins[bit], (levels >> bit) & 1);
+  }
+}
+
+// Moves the pins from the last page id to the Gray code of page, bouncing
+// every changed pin first
+static void set_page(unsigned page, int bounces) {
+  static unsigned current = 0;
+  unsigned target = page ^ (page >> 1);
+  for (int i = 0; i < bounces; ++i) {
+    set_pins(i % 2 == 0 ? target : current);
+    sim_sleep_us(BOUNCE_GAP_US);
+    set_pins(i % 2 == 0 ? current : target);
+    sim_sleep_us(BOUNCE_GAP_US);
+  }
+  set_pins(target);
+  current = target;
+}
+
+int main(int argc, char **argv) {
+  int switches = (int)bench_arg_double(argc, argv, "--switches", 14);
+  int bounces = (int)bench_arg_double(argc, argv, "--bounce", 0);
+  sim_config_t config = {
+      .time_scale = 1.0,
+      .log_level = (esp_log_level_t)bench_arg_double(argc, argv, "--log",
+                                                     ESP_LOG_ERROR),
+  };
+
+  if (!bench_prepare_card(tracks, sizeof(tracks) / sizeof(tracks[0]), NULL)) {
+    return 1;
+  }
+
+#if BOOK_STORAGE == BOOK_STORAGE_FLASH
+  // The book partition holds the card's tracks, packed
+  packer_options_t pack_options = {I2S_SAMPLE_BITS, OUTPUT_SAMPLE_RATE, RESAMPLE_TAPS, false};
+  if (packer_write("sdc", "book.img", &pack_options) < 0) {
+    return 1;
+  }
+  config.flash_image = "book.img";
+  config.flash_label = BOOK_PARTITION;
+#endif
+
+  sim_init(&config);
+  sim_start(app_main);
+  set_page(1, 0);
+  sim_run_for(0.5);
+
+  printf("config  dma_desc_num=%d dma_frame_num=%d %s, bounces %d\n",
+         DMA_DESC_NUM, DMA_FRAME_NUM,
+         PLAYBACK_MODE == PLAYBACK_DIRECT ? "direct" : "ringbuffer", bounces);
+  printf("%-8s %-10s %-22s %12s %14s\n", "switch", "to page", "path",
+         "latency us", "mix ns/frame");
+
+  // Buffers the simulated DMA engine played stale, and the ones the
+  // firmware's ISR padded with silence
+  int over_target = 0;
+  buffer_stats_t buffers;
+  get_buffer_stats(&buffers);
+  uint64_t underruns_before = sim_get_stats()->underruns + buffers.underruns;
+
+  for (int i = 0; i < switches; ++i) {
+    int page = order[i % (sizeof(order) / sizeof(order[0]))];
+    page_switch_stats_t before, after;
+    get_page_switch_stats(&before);
+
+    set_page(page + 1, bounces);
+    sim_run_for(0.3);
+
+    get_page_switch_stats(&after);
+    if (after.switches == before.switches) {
+      printf("%-8d %-10d %-22s %12s\n", i, page + 1, "no switch", "-");
+      continue;
+    }
+    bool gapless = after.gapless_switches != before.gapless_switches;
+    if (gapless && after.last_latency_us > LATENCY_TARGET_US) {
+      over_target++;
+    }
+    if (gapless) {
+      printf("%-8d %-10d %-22s %12lu %14lu\n", i, page + 1, "gapless",
+             (unsigned long)after.last_latency_us,
+             (unsigned long)after.crossfade_cycles_per_frame);
+    } else {
+      printf("%-8d %-10d %-22s %12lu %14s\n", i, page + 1,
+             "channel reconfigured", (unsigned long)after.last_latency_us, "-");
+    }
+  }
+
+  get_buffer_stats(&buffers);
+  sim_stop();
+  uint64_t underruns = sim_get_stats()->underruns + buffers.underruns - underruns_before;
+
+#if TRACE_ENABLE
+  const char *trace_path = bench_arg_string(argc, argv, "--trace", NULL);
+  if (trace_path != NULL && !bench_write_trace(trace_path, trace_dump)) {
+    return 1;
+  }
+#endif
+
+  page_switch_stats_t stats;
+  get_page_switch_stats(&stats);
+  printf("switches %lu (gapless %lu), max latency %lu us, "
+         "gapless over %d us: %d, underruns during run %llu\n",
+         (unsigned long)stats.switches, (unsigned long)stats.gapless_switches,
+         (unsigned long)stats.max_latency_us, LATENCY_TARGET_US, over_target,
+         (unsigned long long)underruns);
+  return 0;
+}
@@ -0,0 +1,226 @@
+/*
+ * bench_pipeline.c
+ *
+ * Runs the unmodified firmware (app_main and the reader task) against the
+ * simulated card, ring buffer and I2S DMA engine for a fixed amount of
+ * simulated audio, then reports throughput, ISR cost, underruns and how
+ * often the reader task woke and how long core 1 idled for the buffer
+ * configuration this binary was compiled with. --stall-us and --stall-every
+ * make every Nth card read stall, to see the buffers size themselves to it.
+ * --command-us charges every card read command, which aligned reads send
+ * fewer of, and --read-us every read() call, which raw sector reads skip.
+ * --format stores the tracks as u8, s24, s32 or f32 instead of s16, to
+ * measure converting them to the I2S sample width, and --rate at another
+ * sample rate than 44.1 kHz, to measure resampling them to
+ * OUTPUT_SAMPLE_RATE. --track-seconds shortens the tracks, so that the
+ * first page loops; once it fits the track cache the loops stop reading the
+ * card. --loudness tags the tracks with an integrated loudness in LUFS, so
+ * playback scales them to LOUDNESS_TARGET. Built with TRACE_ENABLE, --trace
+ * writes the firmware's trace of the run as Chrome trace JSON. Built with
+ * BOOK_STORAGE_FLASH, the tracks are packed into the book partition's image
+ * and played from its mapping instead of the card.
+ *
+ * Usage: bench_pipeline_<config> [--seconds S] [--scale X] [--card DIR]
+ *                                [--sector-us US] [--stall-us US]
+ *                                [--stall-every N] [--command-us US]
+ *                                [--read-us US] [--format FORMAT]
+ *                                [--rate HZ] [--track-seconds S]
+ *                                [--loudness LUFS] [--trace FILE]
+ *                                [--log LEVEL]
+ */
+
+#include <stdio.h>
+#include <sys/param.h>
+
+#include "bench_common.h"
+#include "packer.h"
+#include "sim.h"
+
+#include "driver/i2s_std.h"
+#include "esp_rom_sys.h"
+#include "main.h"
+#include "sections.h"
+#include "trace.h"
+
+static bench_track_t tracks[] = {
+    {"PAGE1.WAV", 44100, 2, TW_INT16, 4.0, 440.0},
+    {"PAGE2.WAV", 44100, 2, TW_INT16, 4.0, 554.4},
+    {"PAGE3.WAV", 44100, 2, TW_INT16, 4.0, 659.3},
+};
+
+int main(int argc, char **argv) {
+  double seconds = bench_arg_double(argc, argv, "--seconds", 3.0);
+  sim_config_t config = {
+      .time_scale = bench_arg_double(argc, argv, "--scale", 1.0),
+      .log_level = (esp_log_level_t)bench_arg_double(argc, argv, "--log",
+                                                     ESP_LOG_ERROR),
+      .card_sector_us =
+          (uint32_t)bench_arg_double(argc, argv, "--sector-us", 0),
+      .card_stall_us = (uint32_t)bench_arg_double(argc, argv, "--stall-us", 0),
+      .card_stall_every =
+          (uint32_t)bench_arg_double(argc, argv, "--stall-every", 0),
+      .card_command_us =
+          (uint32_t)bench_arg_double(argc, argv, "--command-us", 0),
+      .file_read_us = (uint32_t)bench_arg_double(argc, argv, "--read-us", 0),
+  };
+
+  int format = bench_format(bench_arg_string(argc, argv, "--format", "s16"));
+  if (format < 0) {
+    fprintf(stderr, "unknown --format\n");
+    return 1;
+  }
+  uint32_t rate = (uint32_t)bench_arg_double(argc, argv, "--rate", 44100);
+  double track_seconds = bench_arg_double(argc, argv, "--track-seconds", 4.0);
+  for (size_t i = 0; i < sizeof(tracks) / sizeof(tracks[0]); ++i) {
+    tracks[i].format = (TinyWavSampleFormat)format;
+    tracks[i].sample_rate = rate;
+    tracks[i].seconds = track_seconds;
+  }
+
+  if (!bench_prepare_card(tracks, sizeof(tracks) / sizeof(tracks[0]),
+                          bench_arg_string(argc, argv, "--card", NULL))) {
+    return 1;
+  }
+  if (bench_arg_string(argc, argv, "--loudness", NULL) != NULL) {
+    int16_t loudness = (int16_t)(bench_arg_double(argc, argv, "--loudness", 0) * 100);
+    for (size_t i = 0; i < sizeof(tracks) / sizeof(tracks[0]); ++i) {
+      char path[32];
+      snprintf(path, sizeof(path), "sdc/%s", tracks[i].name);
+      if (!bench_add_loudness(path, loudness)) {
+        fprintf(stderr, "%s: could not add its loudness\n", path);
+        return 1;
+      }
+    }
+  }
+
+#if BOOK_STORAGE == BOOK_STORAGE_FLASH
+  // The book partition holds the card's tracks, packed
+  packer_options_t pack_options = {I2S_SAMPLE_BITS, OUTPUT_SAMPLE_RATE, RESAMPLE_TAPS, false};
+  if (packer_write("sdc", "book.img", &pack_options) < 0) {
+    return 1;
+  }
+  config.flash_image = "book.img";
+  config.flash_label = BOOK_PARTITION;
+#endif
+
+  sim_init(&config);
+  sim_start(app_main);
+  sim_run_for(seconds);
+
+  reader_stats_t reader;
+  buffer_stats_t buffers;
+  get_reader_stats(&reader);
+  get_buffer_stats(&buffers);
+  sim_stop();
+
+#if TRACE_ENABLE
+  const char *trace_path = bench_arg_string(argc, argv, "--trace", NULL);
+  if (trace_path != NULL && !bench_write_trace(trace_path, trace_dump)) {
+    return 1;
+  }
+#endif
+
+  const sim_stats_t *stats = sim_get_stats();
+  const bench_track_t *track = &tracks[0];
+  uint32_t played_rate = OUTPUT_SAMPLE_RATE ? OUTPUT_SAMPLE_RATE : track->sample_rate;
+  double byte_rate = (double)played_rate * track->channels * I2S_SAMPLE_BITS / 8;
+
+  printf("config              MIN_DATA_SIZE=%d DATA_MULTIPLIER=%d "
+         "dma_desc_num=%d dma_frame_num=%d %s\n",
+         MIN_DATA_SIZE, DATA_MULTIPLIER, DMA_DESC_NUM, DMA_FRAME_NUM,
+         PLAYBACK_MODE == PLAYBACK_DIRECT ? "direct" : "ringbuffer");
+  printf("stream              %u Hz, %d ch, %s played at %d bit, %u Hz (%.0f B/s)\n",
+         track->sample_rate, track->channels, bench_format_name(track->format),
+         I2S_SAMPLE_BITS, played_rate, byte_rate);
+  printf("simulated audio     %.2f s (time scale %.1fx)\n", seconds,
+         config.time_scale);
+  // Buffers the DMA engine played stale, and the ones the ISR padded with
+  // silence
+  printf("dma buffers played  %llu (underruns %llu)\n",
+         (unsigned long long)stats->dma_buffers_played,
+         (unsigned long long)(stats->underruns + buffers.underruns));
+  printf("isr callbacks       %llu, avg %.0f ns, max %llu ns\n",
+         (unsigned long long)stats->isr_calls,
+         stats->isr_calls ? (double)stats->isr_ns_total / stats->isr_calls : 0.0,
+         (unsigned long long)stats->isr_ns_max);
+  printf("ring throughput     %.0f B/s in, %.0f B/s out\n",
+         buffers.bytes_queued / seconds, buffers.bytes_played / seconds);
+
+  double reader_seconds = MAX(reader.elapsed_us, 1) / 1e6;
+  printf("reader task         %.0f wakeups/s, awake %.1f%%, core 1 idle %.1f%%\n",
+         reader.wakeups / reader_seconds,
+         100.0 * reader.busy_us / MAX(reader.elapsed_us, 1),
+         100.0 - 100.0 * reader.busy_us / MAX(reader.elapsed_us, 1));
+
+  printf("card reads          p50 %lu us, p99 %lu us, max %lu us\n",
+         (unsigned long)buffers.read_p50_us, (unsigned long)buffers.read_p99_us,
+         (unsigned long)buffers.read_max_us);
+  printf("buffers             ring depth %lu B (%.1f ms), reads of %lu B, "
+         "low water %lu B, high water %lu B, %lu underruns seen by firmware\n",
+         (unsigned long)buffers.ring_depth, buffers.ring_depth * 1000.0 / byte_rate,
+         (unsigned long)buffers.read_size, (unsigned long)buffers.low_water,
+         (unsigned long)buffers.high_water, (unsigned long)buffers.underruns);
+
+  uint64_t staged = section_staged_bytes();
+  printf("file reads          %.0f read()/s, %.0f card commands/s, "
+         "%.0f B/s through sector buffers (%s)\n",
+         stats->file_reads / seconds, stats->card_commands / seconds,
+         (stats->window_bytes + staged) / seconds,
+         ALIGNED_READS ? "aligned" : "fatfs");
+
+  const convert_stats_t *converted = section_convert_stats();
+  if (converted->samples > 0) {
+    printf("conversion          %.0f samples/s, %.1f ns/sample\n",
+           converted->samples / seconds,
+           (double)converted->cycles / converted->samples);
+  }
+
+  const resample_stats_t *resampled = section_resample_stats();
+  if (resampled->frames > 0) {
+    double ns_per_frame = (double)resampled->cycles / resampled->frames;
+    printf("resampling          %.0f frames/s, %.1f ns/frame, %.2f ms CPU per "
+           "output second (%d taps)\n",
+           resampled->frames / seconds, ns_per_frame,
+           ns_per_frame * played_rate / 1e6, RESAMPLE_TAPS);
+  }
+
+  const gain_stats_t *scaled = section_gain_stats();
+  if (scaled->samples > 0) {
+    printf("gain                %.0f samples/s, %.2f ns/sample\n",
+           scaled->samples / seconds, (double)scaled->cycles / scaled->samples);
+  }
+
+  const track_cache_stats_t *cached = track_cache_stats();
+  printf("track cache         %lu hits, %lu misses, %.0f B/s served, %u of %d B held\n",
+         (unsigned long)cached->hits, (unsigned long)cached->misses,
+         cached->bytes_served / seconds, (unsigned)cached->bytes_used,
+         TRACK_CACHE_SIZE);
+
+#if TRACE_ENABLE
+  const trace_counters_t *traced = trace_counters();
+  printf("trace               %lu records, read max %lu us, isr max %.1f us, "
+         "%lu underruns%s%s\n",
+         (unsigned long)traced->recorded,
+         (unsigned long)(traced->events[TRACE_READ].max_cycles / esp_rom_get_cpu_ticks_per_us()),
+         traced->events[TRACE_ISR_REFILL].max_cycles / (double)esp_rom_get_cpu_ticks_per_us(),
+         (unsigned long)traced->events[TRACE_UNDERRUN].count,
+         trace_path != NULL ? ", written to " : "", trace_path != NULL ? trace_path : "");
+#endif
+
+  // Every hop a sample takes on its way to the DMA buffer is one copy:
+  // read() into the block buffer, through FatFs's or the section's sector
+  // buffer, format conversion, resampling, the ring buffer send, the ISR
+  // memcpy out of the ring, i2s_channel_write and preloading.
+  uint64_t isr_copied = buffers.bytes_played;
+  uint64_t copied = stats->file_bytes_read + stats->window_bytes + staged +
+                    converted->samples * (I2S_SAMPLE_BITS / 8) +
+                    resampled->frames * track->channels * (I2S_SAMPLE_BITS / 8) +
+                    buffers.bytes_queued +
+                    isr_copied + stats->i2s_bytes_written +
+                    stats->i2s_bytes_preloaded;
+  printf("bytes copied        %.0f B per audio second (%.2f per byte played), "
+         "%.0f B/s in ISR\n",
+         copied / seconds, (double)copied / MAX(stats->dma_bytes_played, 1),
+         isr_copied / seconds);
+  return 0;
+}
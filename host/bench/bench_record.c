@@ -0,0 +1,192 @@
+/*
+ * bench_record.c
+ *
+ * Records narration through the firmware's recorder (src/recorder.c) from the
+ * simulated microphone while the book plays: opens page 1, holds the record
+ * button for --seconds, releases it, then does the same on page 2. The
+ * microphone sends a ramp counting up by one every frame, so every recording
+ * must read back as an unbroken ramp of about the time the button was held,
+ * with no DMA buffer dropped, while every --busy-every-th write keeps the card
+ * busy for --busy-us. Playback must start again after each recording, and at
+ * the next boot the recordings must take their pages in the book.
+ *
+ * Reported per recording are its frames, the DMA buffers dropped, the most
+ * blocks waiting on the writer and the slowest block write, against the time
+ * the double buffer covers.
+ *
+ * Usage: bench_record_<rate> [--seconds S] [--busy-us US] [--busy-every N]
+ *                            [--sector-us US] [--log LEVEL]
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "bench_common.h"
+#include "sim.h"
+#include "sim_gpio.h"
+
+#include "driver/i2s_std.h"
+#include "file_managment.h"
+#include "main.h"
+#include "page_input.h"
+#include "recorder.h"
+
+#define RECORDINGS 2
+
+static const bench_track_t tracks[] = {
+    {"PAGE1.WAV", 44100, 2, TW_INT16, 4.0, 440.0},
+    {"PAGE2.WAV", 44100, 2, TW_INT16, 4.0, 554.4},
+    {"PAGE3.WAV", 44100, 2, TW_INT16, 4.0, 659.3},
+};
+
+static const int pins[] = PAGE_ID_PINS;
+#define PIN_COUNT (int)(sizeof(pins) / sizeof(pins[0]))
+
+static void set_page(unsigned page) {
+  unsigned gray = page ^ (page >> 1);
+  for (int bit = 0; bit < PIN_COUNT; ++bit) {
+    sim_gpio_set_level(pins[bit], (gray >> bit) & 1);
+  }
+}
+
+// The recording must be the microphone's ramp, one step per frame
+static bool check_recording(const char *path, uint32_t *frames) {
+  TinyWav tw;
+  if (tinywav_open_read(&tw, path, TW_INTERLEAVED) != 0) {
+    fprintf(stderr, "%s: does not open\n", path);
+    return false;
+  }
+  bool ok = tw.numChannels == 1 && tw.sampFmt == TW_INT16 &&
+            tw.h.SampleRate == RECORD_SAMPLE_RATE;
+  if (!ok) {
+    fprintf(stderr, "%s: not %d Hz 16 bit mono\n", path, RECORD_SAMPLE_RATE);
+  }
+
+  int16_t samples[1024];
+  uint16_t expected = 0;
+  *frames = 0;
+  int got;
+  while (ok && (got = tinywav_read_f(&tw, samples, sizeof(samples))) > 0) {
+    for (int i = 0; i < got; ++i, ++*frames) {
+      if (*frames > 0 && (uint16_t)samples[i] != expected) {
+        fprintf(stderr, "%s: frame %lu is %u, not %u\n", path,
+                (unsigned long)*frames, (uint16_t)samples[i], expected);
+        ok = false;
+        break;
+      }
+      expected = (uint16_t)samples[i] + 1;
+    }
+  }
+  tinywav_close_read(&tw);
+  return ok;
+}
+
+int main(int argc, char **argv) {
+  double seconds = bench_arg_double(argc, argv, "--seconds", 5.0);
+  sim_config_t config = {
+      .time_scale = 1.0,
+      .log_level = (esp_log_level_t)bench_arg_double(argc, argv, "--log",
+                                                     ESP_LOG_ERROR),
+      .card_sector_us =
+          (uint32_t)bench_arg_double(argc, argv, "--sector-us", 200),
+      .card_busy_us =
+          (uint32_t)bench_arg_double(argc, argv, "--busy-us", 250000),
+      .card_busy_every =
+          (uint32_t)bench_arg_double(argc, argv, "--busy-every", 16),
+      .mic_tone_hz = 0,
+  };
+
+  if (!bench_prepare_card(tracks, sizeof(tracks) / sizeof(tracks[0]), NULL)) {
+    return 1;
+  }
+
+  sim_init(&config);
+  sim_start(app_main);
+  set_page(1);
+  sim_run_for(0.5);
+
+  printf("config  %d Hz mono, %d byte blocks x %d covering %lu ms, card busy "
+         "%lu us every %lu writes\n",
+         RECORD_SAMPLE_RATE, RECORD_BLOCK_SIZE, RECORD_BLOCK_SLOTS,
+         (unsigned long)((uint64_t)RECORD_BLOCK_SIZE * 1000 /
+                         (RECORD_SAMPLE_RATE * RECORD_FRAME_BYTES)),
+         (unsigned long)config.card_busy_us,
+         (unsigned long)config.card_busy_every);
+  printf("%-6s %10s %10s %10s %10s %14s %14s\n", "page", "held s", "frames",
+         "captured", "dropped", "max queued", "write max us");
+
+  bool ok = true;
+  for (int r = 0; r < RECORDINGS; ++r) {
+    unsigned page = r + 1;
+    set_page(page);
+    sim_run_for(0.5);
+
+    record_stats_t before, after;
+    page_switch_stats_t switches_before, switches_after;
+    get_record_stats(&before);
+    sim_gpio_set_level(RECORD_BUTTON_PIN, 1);
+    sim_run_for(seconds);
+    sim_gpio_set_level(RECORD_BUTTON_PIN, 0);
+    get_page_switch_stats(&switches_before);
+    sim_run_for(0.5);
+    get_record_stats(&after);
+    get_page_switch_stats(&switches_after);
+
+    char path[64];
+    snprintf(path, sizeof(path), "sdc/%s/PAGE%u.TMP", RECORD_DIR, page);
+    uint32_t frames = 0;
+    bool continuous = check_recording(path, &frames);
+    uint64_t dropped = after.buffers_dropped - before.buffers_dropped;
+    printf("%-6u %10.1f %10lu %10llu %10llu %14lu %14lu\n", page, seconds,
+           (unsigned long)frames,
+           (unsigned long long)(after.buffers_captured - before.buffers_captured),
+           (unsigned long long)dropped, (unsigned long)after.max_blocks_queued,
+           (unsigned long)after.write_max_us);
+
+    // The debounce and the channel's start cost a little of the hold
+    double held_frames = seconds * RECORD_SAMPLE_RATE;
+    if (!continuous || dropped != 0 || frames < held_frames * 0.98 ||
+        frames > held_frames * 1.01) {
+      fprintf(stderr, "page %u: recording is broken\n", page);
+      ok = false;
+    }
+    if (switches_after.switches == switches_before.switches) {
+      fprintf(stderr, "page %u: playback did not start again\n", page);
+      ok = false;
+    }
+  }
+  sim_stop();
+
+  const sim_stats_t *stats = sim_get_stats();
+  record_stats_t record;
+  get_record_stats(&record);
+  if (stats->dma_buffers_received != record.buffers_captured) {
+    fprintf(stderr, "%llu DMA buffers received, %llu captured\n",
+            (unsigned long long)stats->dma_buffers_received,
+            (unsigned long long)record.buffers_captured);
+    ok = false;
+  }
+
+  // What the next boot does before indexing the book
+  int committed = commit_recordings();
+  sort_filenames();
+  for (int r = 0; r < RECORDINGS; ++r) {
+    char expected[32];
+    snprintf(expected, sizeof(expected), "%s/PAGE%d.WAV", RECORD_DIR, r + 1);
+    track_info_t *track = find_track(r + 1);
+    if (track == NULL || strcmp(track_name(track), expected) != 0) {
+      fprintf(stderr, "page %d plays %s, not %s\n", r + 1,
+              track != NULL ? track_name(track) : "nothing", expected);
+      ok = false;
+    }
+  }
+
+  printf("%d recordings taken into the book, %llu card writes, %llu bytes\n",
+         committed, (unsigned long long)stats->file_writes,
+         (unsigned long long)stats->file_bytes_written);
+  if (!ok) {
+    return 1;
+  }
+  printf("Every recording was continuous with no DMA buffer dropped\n");
+  return 0;
+}
@@ -0,0 +1,134 @@
+/*
+ * bench_resample.c
+ *
+ * Cost and accuracy of the polyphase resampler (src/resample.c) converting
+ * 16 bit stereo from each supported source rate to a fixed output rate, for
+ * every filter length. Cost is host CPU time per second of output audio;
+ * cycles per output frame on target are logged by the firmware with its
+ * buffer stats. Accuracy is the signal to noise ratio of a resampled sine
+ * against the exact sine at the output rate, at 1 kHz and at a quarter of the
+ * lower rate, half way to its Nyquist frequency.
+ *
+ * Usage: bench_resample [--out-rate HZ] [--seconds OUTPUT_SECONDS]
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "bench_common.h"
+#include "resample.h"
+
+#define CHANNELS 2
+#define AMPLITUDE 16000.0
+
+// Output frames per call, a read block's worth
+#define BLOCK_FRAMES 512
+
+static const uint32_t rates[] = {8000, 11025, 16000, 22050, 32000, 44100, 48000};
+static const int tap_counts[] = {2, 8, 16, 32};
+
+// Sine at `frequency`, sampled at `rate` so that input frame taps / 2 - 1,
+// the centre of the first output frame's filter, is time zero
+static int16_t *make_input(uint32_t rate, int taps, double frequency, size_t frames) {
+  int16_t *in = malloc(frames * CHANNELS * sizeof(int16_t));
+  for (size_t i = 0; i < frames; ++i) {
+    double t = ((double)i - (taps / 2 - 1)) / rate;
+    for (int c = 0; c < CHANNELS; ++c) {
+      in[i * CHANNELS + c] = (int16_t)lrint(AMPLITUDE * sin(2.0 * M_PI * frequency * t + c));
+    }
+  }
+  return in;
+}
+
+// Signal to noise ratio in dB of one output second against the exact sine
+static double snr(uint32_t in_rate, uint32_t out_rate, int taps, double frequency) {
+  size_t out_frames = out_rate;
+  size_t in_frames = (size_t)((double)out_frames * in_rate / out_rate) + taps + 1;
+  int16_t *in = make_input(in_rate, taps, frequency, in_frames);
+  int16_t *out = malloc(out_frames * CHANNELS * sizeof(int16_t));
+
+  resampler_t r;
+  if (!resampler_init(&r, in_rate, out_rate, CHANNELS, taps)) {
+    return NAN;
+  }
+  int made = resample_s16(&r, out, (int)out_frames, in, in_frames);
+  resampler_free(&r);
+
+  double signal = 0.0, noise = 0.0;
+  for (int i = 0; i < made; ++i) {
+    for (int c = 0; c < CHANNELS; ++c) {
+      double want = AMPLITUDE * sin(2.0 * M_PI * frequency * i / out_rate + c);
+      double error = out[i * CHANNELS + c] - want;
+      signal += want * want;
+      noise += error * error;
+    }
+  }
+  free(out);
+  free(in);
+  return 10.0 * log10(signal / fmax(noise, 1e-9));
+}
+
+// Host nanoseconds per output frame, resampling a block at a time and
+// discarding used input the way the sections do
+static double time_resample(uint32_t in_rate, uint32_t out_rate, int taps, double seconds) {
+  size_t in_frames = in_rate + taps;
+  int16_t *in = make_input(in_rate, taps, 1000.0, in_frames);
+  int16_t out[BLOCK_FRAMES * CHANNELS];
+
+  resampler_t r;
+  if (!resampler_init(&r, in_rate, out_rate, CHANNELS, taps)) {
+    return NAN;
+  }
+  uint64_t total = (uint64_t)(seconds * out_rate);
+  uint64_t done = 0;
+  size_t offset = 0;
+
+  uint64_t start = bench_now_ns();
+  while (done < total) {
+    int made = resample_s16(&r, out, BLOCK_FRAMES, in + offset * CHANNELS, in_frames - offset);
+    __asm__ volatile("" : : "r"(out) : "memory");
+    if (made == 0) {
+      offset = 0;
+      resampler_reset(&r);
+      continue;
+    }
+    done += made;
+    offset += resampler_consume(&r);
+  }
+  double ns = (double)(bench_now_ns() - start) / done;
+
+  resampler_free(&r);
+  free(in);
+  return ns;
+}
+
+int main(int argc, char **argv) {
+  uint32_t out_rate = (uint32_t)bench_arg_double(argc, argv, "--out-rate", 48000);
+  double seconds = bench_arg_double(argc, argv, "--seconds", 20);
+
+  printf("16 bit stereo to %lu Hz, %d phases, host CPU per output second\n",
+         (unsigned long)out_rate, RESAMPLE_PHASES);
+  printf("%-8s %5s %12s %8s %10s %10s %10s %12s\n", "from Hz", "taps", "ms CPU/s",
+         "% core", "ns/frame", "SNR 1k", "SNR fs/4", "table bytes");
+
+  for (size_t i = 0; i < sizeof(rates) / sizeof(rates[0]); ++i) {
+    uint32_t in_rate = rates[i];
+    if (in_rate == out_rate) {
+      continue;
+    }
+    // Half way to the Nyquist frequency of the lower rate
+    double high = 0.25 * (in_rate < out_rate ? in_rate : out_rate);
+
+    for (size_t t = 0; t < sizeof(tap_counts) / sizeof(tap_counts[0]); ++t) {
+      int taps = tap_counts[t];
+      double ns = time_resample(in_rate, out_rate, taps, seconds);
+      double ms_per_second = ns * out_rate / 1e6;
+      printf("%-8lu %5d %12.2f %8.2f %10.2f %10.1f %10.1f %12u\n",
+             (unsigned long)in_rate, taps, ms_per_second, ms_per_second / 10.0, ns,
+             snr(in_rate, out_rate, taps, 1000.0), snr(in_rate, out_rate, taps, high),
+             (unsigned)((RESAMPLE_PHASES + 1) * taps * sizeof(int16_t)));
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,153 @@
+/*
+ * bench_tinywav.c
+ *
+ * Raw throughput of tinywav_read_f for a range of read chunk sizes, against
+ * a file in the host page cache. This isolates the per-call cost of the read
+ * path from SD bus speed.
+ *
+ * Every chunk size is read both ways: plain reads at whatever offset the
+ * data chunk leaves them, which FatFs splits into partial sectors through its
+ * sector buffer, and aligned reads (tinywav_set_read_buffer) of whole
+ * sectors, starting from the data's first sector boundary as sections do
+ * once their in-memory head is played. For each, the read() calls, card commands and sectors the card
+ * model saw and the bytes copied through an intermediate buffer (FatFs's or
+ * tinywav's) are given per second of audio.
+ *
+ * Usage: bench_tinywav [--mb TOTAL_MB]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "bench_common.h"
+#include "sim.h"
+
+#include "driver/i2s_std.h"
+#include "main.h"
+
+static const bench_track_t track = {"READ.WAV", 44100, 2, TW_INT16, 10.0, 440.0};
+
+#define READ_BUFFER_SIZE (4 * TINYWAV_SECTOR_SIZE)
+
+typedef struct run_result {
+  double mb_per_s;
+  double ns_per_call;
+  uint64_t bytes;
+  uint64_t staged;
+} run_result_t;
+
+static bool run(int chunk, bool aligned, uint64_t target, run_result_t *result) {
+  TinyWav tw;
+  if (tinywav_open_read(&tw, "sdc/READ.WAV", TW_INTERLEAVED) != 0) {
+    return false;
+  }
+
+  uint8_t *read_buffer = malloc(READ_BUFFER_SIZE);
+  uint8_t *buffer = malloc(chunk);
+  uint32_t first = 0;
+  if (aligned) {
+    tinywav_set_read_buffer(&tw, read_buffer, READ_BUFFER_SIZE);
+    first = (TINYWAV_SECTOR_SIZE - tw.dataStart % TINYWAV_SECTOR_SIZE) %
+            TINYWAV_SECTOR_SIZE;
+  }
+  tinywav_seek_data(&tw, first);
+
+  uint64_t bytes = 0;
+  uint64_t calls = 0;
+  uint64_t start = bench_now_ns();
+
+  while (bytes < target) {
+    int frames = tinywav_read_f(&tw, buffer, chunk);
+    ++calls;
+    if (frames <= 0) {
+      tinywav_seek_data(&tw, first);
+      continue;
+    }
+    bytes += (uint64_t)frames * tw.h.BlockAlign;
+  }
+
+  double elapsed = (bench_now_ns() - start) / 1e9;
+  result->mb_per_s = bytes / elapsed / (1024 * 1024);
+  result->ns_per_call = elapsed * 1e9 / calls;
+  result->bytes = bytes;
+  result->staged = tw.bytesStaged;
+
+  free(buffer);
+  free(read_buffer);
+  tinywav_close_read(&tw);
+  return true;
+}
+
+// FNV-1a of the file's audio read in chunks from its first sample, to check
+// aligned reads return the same data as plain ones
+static uint32_t hash_file(int chunk, bool aligned) {
+  TinyWav tw;
+  if (tinywav_open_read(&tw, "sdc/READ.WAV", TW_INTERLEAVED) != 0) {
+    return 0;
+  }
+  uint8_t *read_buffer = malloc(READ_BUFFER_SIZE);
+  uint8_t *buffer = malloc(chunk);
+  if (aligned) {
+    tinywav_set_read_buffer(&tw, read_buffer, READ_BUFFER_SIZE);
+  }
+  tinywav_seek_data(&tw, 0);
+
+  uint32_t hash = 2166136261u;
+  int frames;
+  while ((frames = tinywav_read_f(&tw, buffer, chunk)) > 0) {
+    for (int i = 0; i < frames * tw.h.BlockAlign; ++i) {
+      hash = (hash ^ buffer[i]) * 16777619u;
+    }
+  }
+
+  free(buffer);
+  free(read_buffer);
+  tinywav_close_read(&tw);
+  return hash;
+}
+
+int main(int argc, char **argv) {
+  double total_mb = bench_arg_double(argc, argv, "--mb", 256.0);
+  const int chunks[] = {BUFF_READ_SIZE, 512, 1024, 1536, 4096, 16384};
+
+  if (!bench_prepare_card(&track, 1, NULL)) {
+    return 1;
+  }
+
+  double byte_rate = (double)track.sample_rate * track.channels * track.format;
+  printf("%-8s %-8s %9s %9s %13s %12s %12s %14s\n", "chunk", "reads", "MB/s",
+         "ns/call", "read()/aud-s", "cmds/aud-s", "sect/aud-s", "copied B/aud-s");
+
+  for (size_t c = 0; c < sizeof(chunks) / sizeof(chunks[0]); ++c) {
+    for (int aligned = 0; aligned <= 1; ++aligned) {
+      if (aligned && hash_file(chunks[c], true) != hash_file(chunks[c], false)) {
+        fprintf(stderr, "aligned reads of %d bytes returned different data\n",
+                chunks[c]);
+        return 1;
+      }
+
+      run_result_t timed, counted;
+      if (!run(chunks[c], aligned, (uint64_t)(total_mb * 1024 * 1024), &timed)) {
+        return 1;
+      }
+
+      // Card accounting over exactly the file's audio, once through
+      sim_init(NULL);
+      if (!run(chunks[c], aligned, (uint64_t)(byte_rate * track.seconds), &counted)) {
+        return 1;
+      }
+      const sim_stats_t *stats = sim_get_stats();
+      double audio_seconds = counted.bytes / byte_rate;
+
+      printf("%-8d %-8s %9.1f %9.0f %13.0f %12.0f %12.0f %14.0f\n", chunks[c],
+             aligned ? "aligned" : "fatfs", timed.mb_per_s, timed.ns_per_call,
+             stats->file_reads / audio_seconds,
+             stats->card_commands / audio_seconds,
+             stats->card_sectors / audio_seconds,
+             (stats->window_bytes + counted.staged) / audio_seconds);
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,145 @@
+/*
+ * bench_tracks.c
+ *
+ * Track table cost for books of 10, 100 and 1000 pages, laid out as long
+ * file names in chapter subdirectories: building the table by scanning the
+ * card and from the track index, its size, page lookup time, and the card
+ * time to open a track the first time (header parsed) and again (header from
+ * the table).
+ *
+ * Card accesses are charged --sector-us of simulated time per 512 byte
+ * sector; lookups are timed on the host CPU.
+ *
+ * Usage: bench_tracks [--sector-us US] [--log LEVEL]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "bench_common.h"
+#include "sim.h"
+
+#include "file_managment.h"
+
+#define PAGES_PER_CHAPTER 25
+#define OPENS 32
+#define LOOKUPS 1000000
+
+static bool write_book(int pages) {
+  bench_track_t track = {NULL, 22050, 1, TW_INT16, 0.02, 440.0};
+
+  for (int page = 1; page <= pages; ++page) {
+    char dir[64], path[128];
+    snprintf(dir, sizeof(dir), "sdc/Chapter %d", (page - 1) / PAGES_PER_CHAPTER + 1);
+    if ((page - 1) % PAGES_PER_CHAPTER == 0 && mkdir(dir, 0755) != 0) {
+      perror(dir);
+      return false;
+    }
+    snprintf(path, sizeof(path), "%s/Page %04d narration.wav", dir, page);
+    track.name = path;
+    if (!bench_write_track(path, &track)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Simulated milliseconds and card sectors spent in sort_filenames()
+static void timed_sort(double *ms, uint64_t *sectors) {
+  uint64_t start = sim_time_us();
+  uint64_t sectors_before = sim_get_stats()->card_sectors;
+  sort_filenames();
+  *ms = (sim_time_us() - start) / 1000.0;
+  *sectors = sim_get_stats()->card_sectors - sectors_before;
+}
+
+// Average simulated milliseconds to open and close a track
+static double timed_opens(const uint16_t *pages) {
+  uint64_t start = sim_time_us();
+  for (int i = 0; i < OPENS; ++i) {
+    TinyWav tw;
+    if (open_track(find_track(pages[i]), &tw) == 0) {
+      tinywav_close_read(&tw);
+    }
+  }
+  return (sim_time_us() - start) / 1000.0 / OPENS;
+}
+
+int main(int argc, char **argv) {
+  const int page_counts[] = {10, 100, 1000};
+  sim_config_t config = {
+      .time_scale = 1.0,
+      .log_level = (esp_log_level_t)bench_arg_double(argc, argv, "--log",
+                                                     ESP_LOG_ERROR),
+      .card_sector_us = (uint32_t)bench_arg_double(argc, argv, "--sector-us", 1000),
+  };
+
+  // Mounting prints card details, so rows are printed once all are done
+  char rows[sizeof(page_counts) / sizeof(page_counts[0])][128];
+
+  srand(1);
+  for (size_t c = 0; c < sizeof(page_counts) / sizeof(page_counts[0]); ++c) {
+    int pages = page_counts[c];
+    if (!bench_prepare_card(NULL, 0, NULL) || !write_book(pages)) {
+      return 1;
+    }
+
+    sim_init(&config);
+    sdmmc_card_t card;
+    if (!mount_fs(&card)) {
+      return 1;
+    }
+
+    double scan_ms, index_ms;
+    uint64_t scan_sectors, index_sectors;
+    timed_sort(&scan_ms, &scan_sectors);
+    timed_sort(&index_ms, &index_sectors);
+    if (track_count() != pages) {
+      fprintf(stderr, "expected %d tracks, found %d\n", pages, track_count());
+      return 1;
+    }
+
+    size_t bytes = track_count() * sizeof(track_info_t);
+    for (int i = 0; i < track_count(); ++i) {
+      bytes += strlen(track_name(track_at(i))) + 1;
+    }
+
+    uint16_t *lookups = malloc(LOOKUPS * sizeof(uint16_t));
+    for (int i = 0; i < LOOKUPS; ++i) {
+      lookups[i] = (uint16_t)(rand() % pages + 1);
+    }
+    uint64_t start = bench_now_ns();
+    uintptr_t found = 0;
+    for (int i = 0; i < LOOKUPS; ++i) {
+      found += (uintptr_t)find_track(lookups[i]);
+    }
+    double lookup_ns = (double)(bench_now_ns() - start) / LOOKUPS;
+    if (found == 0) {
+      return 1;
+    }
+
+    uint16_t open_pages[OPENS];
+    for (int i = 0; i < OPENS; ++i) {
+      open_pages[i] = (uint16_t)(rand() % pages + 1);
+      find_track(open_pages[i])->sample_format = 0; // force a header parse
+    }
+    double first_ms = timed_opens(open_pages);
+    double again_ms = timed_opens(open_pages);
+    free(lookups);
+
+    snprintf(rows[c], sizeof(rows[c]),
+             "%-6d %10.1f %10.1f %9zu %10.1f %11.2f %11.2f", pages, scan_ms,
+             index_ms, bytes, lookup_ns, first_ms, again_ms);
+  }
+
+  printf("card sector %lu us, card times in simulated ms\n",
+         (unsigned long)config.card_sector_us);
+  printf("%-6s %10s %10s %9s %10s %11s %11s\n", "pages", "scan", "index",
+         "bytes", "lookup ns", "first open", "open again");
+  for (size_t c = 0; c < sizeof(page_counts) / sizeof(page_counts[0]); ++c) {
+    printf("%s\n", rows[c]);
+  }
+  return 0;
+}
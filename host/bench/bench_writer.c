@@ -0,0 +1,336 @@
+/*
+ * bench_writer.c
+ *
+ * Records a synthetic stereo sine with the TinyWav writer, as a recording to
+ * the card would be written, three ways:
+ *   stdio   tinywav_write_f() through the file's stdio buffer, 128 bytes as
+ *           newlib gives files on FatFs
+ *   block   tinywav_write_f() converting into a --buffer byte write buffer
+ *   pcm     tinywav_write_interleaved() of frames already in the file's
+ *           format, as I2S receives them, through the same buffer
+ * and reports host MB/s, write() calls, card commands and sectors per second
+ * of audio, sectors written only in part, the MB/s the card allows at
+ * --sector-us per sector and --command-us per command, and the stack the
+ * write calls used, run on a thread whose stack is painted first.
+ *
+ * Every file must read back as written, in s16 and in s24, whose frames
+ * straddle sector and buffer boundaries. A copy taken just before closing,
+ * as a power loss leaves the file, must open with the audio up to the last
+ * header update (the "kept s" column).
+ *
+ * Usage: bench_writer [--seconds S] [--frames N] [--buffer BYTES]
+ *                     [--sync BYTES] [--sector-us US] [--command-us US]
+ */
+
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "bench_common.h"
+#include "sim.h"
+
+#define CHANNELS 2
+#define SAMPLE_RATE 44100
+#define NEWLIB_BUFSIZ 128
+#define STACK_SIZE (1024 * 1024)
+#define PAINT 0xA5
+
+typedef enum { MODE_STDIO, MODE_BLOCK, MODE_PCM } mode_t_;
+
+static const char *mode_names[] = {"stdio", "block", "pcm"};
+
+typedef struct job {
+  // In
+  mode_t_ mode;
+  TinyWavSampleFormat format;
+  const char *path;
+  const char *cut_path; ///< copy taken before closing
+  uint32_t total_frames;
+  const float *source;   ///< frames float frames, written over and over
+  const uint8_t *pcm;    ///< the same in the file's format
+  int frames;
+  uint8_t *buffer;
+  uint32_t buffer_len;
+  uint32_t sync;
+  TinyWav *tw;
+  // Out
+  bool ok;
+  uint64_t ns; ///< writing and closing
+  uint32_t synced_frames; ///< frames the header declared before closing
+} job_t;
+
+static int failures;
+
+static void expect(bool ok, const char *what) {
+  if (!ok) {
+    fprintf(stderr, "FAILED: %s\n", what);
+    failures++;
+  }
+}
+
+// MARK: newlib's stdio on FatFs
+
+static ssize_t cookie_write(void *cookie, const char *buf, size_t size) {
+  return write((int)(intptr_t)cookie, buf, size);
+}
+
+static int cookie_seek(void *cookie, off64_t *position, int whence) {
+  off_t result = lseek((int)(intptr_t)cookie, *position, whence);
+  if (result < 0) {
+    return -1;
+  }
+  *position = result;
+  return 0;
+}
+
+static int cookie_close(void *cookie) { return close((int)(intptr_t)cookie); }
+
+// glibc's own FILE writes bypass the wrapped write(), so the rest of the
+// file goes through one whose buffer and writes match newlib's
+static bool use_newlib_stdio(TinyWav *tw) {
+  if (fflush(tw->f) != 0) {
+    return false;
+  }
+  int fd = dup(fileno(tw->f));
+  fclose(tw->f);
+  cookie_io_functions_t io = {
+      .write = cookie_write, .seek = cookie_seek, .close = cookie_close};
+  tw->f = fopencookie((void *)(intptr_t)fd, "w", io);
+  return tw->f != NULL && setvbuf(tw->f, NULL, _IOFBF, NEWLIB_BUFSIZ) == 0;
+}
+
+// MARK: Writing
+
+static bool copy_file(const char *from, const char *to) {
+  FILE *in = fopen(from, "rb");
+  FILE *out = fopen(to, "wb");
+  bool ok = in != NULL && out != NULL;
+  static char chunk[65536];
+  size_t n;
+  while (ok && (n = fread(chunk, 1, sizeof(chunk), in)) > 0) {
+    ok = fwrite(chunk, 1, n, out) == n;
+  }
+  if (in != NULL) {
+    fclose(in);
+  }
+  if (out != NULL && fclose(out) != 0) {
+    ok = false;
+  }
+  return ok;
+}
+
+static void *write_samples(void *arg) {
+  job_t *job = arg;
+  job->ok = true;
+  for (uint32_t done = 0; job->ok && done < job->total_frames;) {
+    int n = job->total_frames - done < (uint32_t)job->frames
+                ? (int)(job->total_frames - done)
+                : job->frames;
+    int written = job->mode == MODE_PCM
+                      ? tinywav_write_interleaved(job->tw, job->pcm, n)
+                      : tinywav_write_f(job->tw, (void *)job->source, n);
+    job->ok = written == n;
+    done += n;
+  }
+  return NULL;
+}
+
+// Run fn on a thread whose stack is painted first. @returns the bytes of it
+// used, or 0 on failure.
+static size_t run_painted(void *(*fn)(void *), void *arg) {
+  uint8_t *stack;
+  if (posix_memalign((void **)&stack, 4096, STACK_SIZE) != 0) {
+    return 0;
+  }
+  memset(stack, PAINT, STACK_SIZE);
+
+  pthread_attr_t attr;
+  pthread_t thread;
+  pthread_attr_init(&attr);
+  pthread_attr_setstack(&attr, stack, STACK_SIZE);
+  bool ok = pthread_create(&thread, &attr, fn, arg) == 0 &&
+            pthread_join(thread, NULL) == 0;
+  pthread_attr_destroy(&attr);
+
+  size_t untouched = 0;
+  while (untouched < STACK_SIZE && stack[untouched] == PAINT) {
+    untouched++;
+  }
+  free(stack);
+  return ok ? STACK_SIZE - untouched : 0;
+}
+
+static void *idle(void *arg) { return arg; }
+
+// Record the job's file, its writes on a painted stack. @returns the bytes
+// of stack they used, or 0 on failure.
+static size_t write_file(job_t *job) {
+  TinyWav tw;
+  if (tinywav_open_write(&tw, CHANNELS, SAMPLE_RATE, job->format,
+                         TW_INTERLEAVED, job->path) != 0) {
+    return 0;
+  }
+  bool ok = job->mode == MODE_STDIO
+                ? use_newlib_stdio(&tw)
+                : tinywav_set_write_buffer(&tw, job->buffer, job->buffer_len,
+                                           job->sync) == 0;
+
+  job->tw = &tw;
+  uint64_t start = bench_now_ns();
+  size_t stack_bytes = ok ? run_painted(write_samples, job) : 0;
+  uint64_t ns = bench_now_ns() - start;
+
+  const int frame_size = CHANNELS * tinywav_sample_size(job->format);
+  job->synced_frames = job->mode == MODE_STDIO ? 0 : tw.dataSynced / frame_size;
+  ok = ok && job->ok && copy_file(job->path, job->cut_path);
+
+  start = bench_now_ns();
+  tinywav_close_write(&tw);
+  job->ns = ns + bench_now_ns() - start;
+  return ok ? stack_bytes : 0;
+}
+
+// MARK: Checking
+
+// A sample as tinywav_write_f() stores it
+static void encode(float x, TinyWavSampleFormat format, uint8_t *out) {
+  if (format == TW_INT16) {
+    int16_t v = (int16_t)(x * (float)INT16_MAX);
+    memcpy(out, &v, sizeof(v));
+  } else {
+    int32_t v = (int32_t)(x * 8388607.0f);
+    out[0] = (uint8_t)v;
+    out[1] = (uint8_t)(v >> 8);
+    out[2] = (uint8_t)(v >> 16);
+  }
+}
+
+// The file at path must declare frames frames, holding the source's over and
+// over
+static bool check_file(const char *path, const uint8_t *pcm, int source_frames,
+                       TinyWavSampleFormat format, uint32_t frames) {
+  TinyWav tw;
+  if (tinywav_open_read(&tw, path, TW_INTERLEAVED) != 0) {
+    return false;
+  }
+  bool ok = tw.numFramesInHeader == (int32_t)frames && tw.sampFmt == format &&
+            tw.numChannels == CHANNELS && tw.h.SampleRate == SAMPLE_RATE;
+  tinywav_close_read(&tw);
+
+  const uint32_t frame_size = CHANNELS * tinywav_sample_size(format);
+  FILE *f = fopen(path, "rb");
+  ok = ok && f != NULL && fseek(f, 44, SEEK_SET) == 0;
+  uint8_t frame[CHANNELS * 4];
+  for (uint32_t i = 0; ok && i < frames; ++i) {
+    ok = fread(frame, frame_size, 1, f) == 1 &&
+         memcmp(frame, pcm + (i % source_frames) * frame_size, frame_size) == 0;
+  }
+  if (f != NULL) {
+    fclose(f);
+  }
+  return ok;
+}
+
+// MARK: main
+
+int main(int argc, char **argv) {
+  double seconds = bench_arg_double(argc, argv, "--seconds", 60);
+  int frames = (int)bench_arg_double(argc, argv, "--frames", 4096);
+  uint32_t buffer_len = (uint32_t)bench_arg_double(argc, argv, "--buffer", 16384);
+  uint32_t sync = (uint32_t)bench_arg_double(argc, argv, "--sync", 65536);
+  double sector_us = bench_arg_double(argc, argv, "--sector-us", 50);
+  double command_us = bench_arg_double(argc, argv, "--command-us", 500);
+
+  // On tmpfs the header updates' fsync() costs nothing, leaving host MB/s the
+  // writer's own time
+  char scratch[] = "/dev/shm/musicbook-writer-XXXXXX";
+  if (frames < 1 || mkdtemp(scratch) == NULL || chdir(scratch) != 0) {
+    perror("scratch directory");
+    return 1;
+  }
+
+  float *source = malloc(sizeof(float) * CHANNELS * frames);
+  uint8_t *pcm = malloc(4 * CHANNELS * frames);
+  uint8_t *buffer = aligned_alloc(4, buffer_len);
+  if (source == NULL || pcm == NULL || buffer == NULL) {
+    return 1;
+  }
+  for (int i = 0; i < frames; ++i) {
+    for (int c = 0; c < CHANNELS; ++c) {
+      source[i * CHANNELS + c] = 0.5f * (float)sin(2.0 * M_PI * (440 + 110 * c) * i / SAMPLE_RATE);
+    }
+  }
+
+  // glibc keeps a thread's descriptor and TLS at the top of a stack it is
+  // given; that much is in use before the thread runs
+  size_t idle_bytes = run_painted(idle, NULL);
+  printf("%u frame writes, %u byte buffer, header update every %u bytes\n",
+         frames, buffer_len, sync);
+  printf("%-4s %-6s %9s %9s %13s %12s %12s %12s %9s %8s\n", "fmt", "mode",
+         "MB/s", "card MB/s", "write()/aud-s", "cmds/aud-s", "sect/aud-s",
+         "part/aud-s", "stack B", "kept s");
+
+  TinyWavSampleFormat formats[] = {TW_INT16, TW_INT24};
+  for (size_t f = 0; f < sizeof(formats) / sizeof(formats[0]); ++f) {
+    const int sample_size = tinywav_sample_size(formats[f]);
+    for (int i = 0; i < frames * CHANNELS; ++i) {
+      encode(source[i], formats[f], pcm + i * sample_size);
+    }
+
+    for (int mode = MODE_STDIO; mode <= MODE_PCM; ++mode) {
+      job_t job = {
+          .mode = (mode_t_)mode,
+          .format = formats[f],
+          .path = "rec.wav",
+          .cut_path = "cut.wav",
+          .total_frames = (uint32_t)(seconds * SAMPLE_RATE),
+          .source = source,
+          .pcm = pcm,
+          .frames = frames,
+          .buffer = buffer,
+          .buffer_len = buffer_len,
+          .sync = sync,
+      };
+      sim_init(NULL);
+      size_t stack_bytes = write_file(&job);
+      const sim_stats_t *stats = sim_get_stats();
+      expect(stack_bytes != 0, "write the file");
+      expect(check_file(job.path, pcm, frames, formats[f], job.total_frames),
+             "read back what was written");
+      expect(check_file(job.cut_path, pcm, frames, formats[f], job.synced_frames),
+             "a file cut off before closing opens with the audio synced");
+      if (mode != MODE_STDIO && sync != 0) {
+        const uint32_t frame_size = CHANNELS * sample_size;
+        expect(job.total_frames - job.synced_frames <=
+                   (sync + buffer_len) / frame_size + 1,
+               "at most a sync interval and a buffer lost when cut off");
+      }
+
+      double mb = (double)job.total_frames * CHANNELS * sample_size / (1024 * 1024);
+      double card_s = (stats->card_commands * command_us +
+                       stats->card_sectors * sector_us) / 1e6;
+      printf("%-4s %-6s %9.1f %9.2f %13.1f %12.1f %12.1f %12.1f %9zu %8.2f\n",
+             bench_format_name(formats[f]), mode_names[mode],
+             mb / (job.ns / 1e9), card_s > 0 ? mb / card_s : 0.0,
+             stats->file_writes / seconds, stats->card_commands / seconds,
+             stats->card_sectors / seconds,
+             stats->partial_sector_writes / seconds,
+             stack_bytes - idle_bytes, (double)job.synced_frames / SAMPLE_RATE);
+    }
+  }
+
+  unlink("rec.wav");
+  unlink("cut.wav");
+  rmdir(scratch);
+  free(source);
+  free(pcm);
+  free(buffer);
+  if (failures != 0) {
+    fprintf(stderr, "%d checks failed\n", failures);
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,170 @@
+/*
+ * i2s_std.h
+ *
+ * Host stand-in for the ESP-IDF standard-mode I2S driver. A TX channel is
+ * backed by a simulated DMA engine: a ring of dma_desc_num buffers of
+ * dma_frame_num frames, drained at the configured sample rate on the
+ * simulation clock. on_sent fires after every buffer, exactly as the target
+ * interrupt does. Buffers that finish playing are also queued for
+ * i2s_channel_write(), which copies into them from task context. An RX
+ * channel's buffers are filled at the sample rate from a simulated
+ * microphone, and on_recv fires for every one of them.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+
+typedef struct sim_i2s_channel *i2s_chan_handle_t;
+
+typedef enum { I2S_NUM_0 = 0, I2S_NUM_1 = 1, I2S_NUM_AUTO } i2s_port_t;
+typedef enum { I2S_ROLE_MASTER, I2S_ROLE_SLAVE } i2s_role_t;
+
+typedef enum {
+  I2S_DATA_BIT_WIDTH_8BIT = 8,
+  I2S_DATA_BIT_WIDTH_16BIT = 16,
+  I2S_DATA_BIT_WIDTH_24BIT = 24,
+  I2S_DATA_BIT_WIDTH_32BIT = 32,
+} i2s_data_bit_width_t;
+
+typedef enum {
+  I2S_SLOT_BIT_WIDTH_AUTO = 0,
+  I2S_SLOT_BIT_WIDTH_8BIT = 8,
+  I2S_SLOT_BIT_WIDTH_16BIT = 16,
+  I2S_SLOT_BIT_WIDTH_24BIT = 24,
+  I2S_SLOT_BIT_WIDTH_32BIT = 32,
+} i2s_slot_bit_width_t;
+
+typedef enum {
+  I2S_SLOT_MODE_MONO = 1,
+  I2S_SLOT_MODE_STEREO = 2,
+} i2s_slot_mode_t;
+
+typedef enum {
+  I2S_STD_SLOT_LEFT = 1,
+  I2S_STD_SLOT_RIGHT = 2,
+  I2S_STD_SLOT_BOTH = 3,
+} i2s_std_slot_mask_t;
+
+typedef enum {
+  I2S_MCLK_MULTIPLE_128 = 128,
+  I2S_MCLK_MULTIPLE_256 = 256,
+  I2S_MCLK_MULTIPLE_384 = 384,
+} i2s_mclk_multiple_t;
+
+typedef enum {
+  SOC_MOD_CLK_PLL_F160M = 1,
+  SOC_MOD_CLK_APLL = 2,
+} soc_module_clk_t;
+typedef soc_module_clk_t i2s_clock_src_t;
+
+#define I2S_GPIO_UNUSED (-1)
+
+typedef struct {
+  i2s_port_t id;
+  i2s_role_t role;
+  uint32_t dma_desc_num;
+  uint32_t dma_frame_num;
+  bool auto_clear_after_cb;
+  bool auto_clear_before_cb;
+  int intr_priority;
+} i2s_chan_config_t;
+
+typedef struct {
+  uint32_t sample_rate_hz;
+  i2s_clock_src_t clk_src;
+  i2s_mclk_multiple_t mclk_multiple;
+} i2s_std_clk_config_t;
+
+typedef struct {
+  i2s_data_bit_width_t data_bit_width;
+  i2s_slot_bit_width_t slot_bit_width;
+  i2s_slot_mode_t slot_mode;
+  i2s_std_slot_mask_t slot_mask;
+  uint32_t ws_width;
+  bool ws_pol;
+  bool bit_shift;
+  bool msb_right;
+} i2s_std_slot_config_t;
+
+#define I2S_STD_MSB_SLOT_DEFAULT_CONFIG(bits_per_sample, mono_or_stereo)       \
+  {                                                                            \
+    .data_bit_width = (i2s_data_bit_width_t)(bits_per_sample),                 \
+    .slot_bit_width = I2S_SLOT_BIT_WIDTH_AUTO,                                 \
+    .slot_mode = (i2s_slot_mode_t)(mono_or_stereo),                            \
+    .slot_mask = I2S_STD_SLOT_BOTH, .ws_width = (bits_per_sample),             \
+    .ws_pol = false, .bit_shift = false, .msb_right = false,                   \
+  }
+
+#define I2S_STD_PHILIPS_SLOT_DEFAULT_CONFIG(bits_per_sample, mono_or_stereo)   \
+  {                                                                            \
+    .data_bit_width = (i2s_data_bit_width_t)(bits_per_sample),                 \
+    .slot_bit_width = I2S_SLOT_BIT_WIDTH_AUTO,                                 \
+    .slot_mode = (i2s_slot_mode_t)(mono_or_stereo),                            \
+    .slot_mask = (mono_or_stereo) == I2S_SLOT_MODE_MONO ? I2S_STD_SLOT_LEFT    \
+                                                        : I2S_STD_SLOT_BOTH,   \
+    .ws_width = (bits_per_sample), .ws_pol = false, .bit_shift = true,         \
+    .msb_right = (bits_per_sample) <= I2S_DATA_BIT_WIDTH_16BIT,                \
+  }
+
+typedef struct {
+  int mclk;
+  int bclk;
+  int ws;
+  int dout;
+  int din;
+  struct {
+    uint32_t mclk_inv : 1;
+    uint32_t bclk_inv : 1;
+    uint32_t ws_inv : 1;
+  } invert_flags;
+} i2s_std_gpio_config_t;
+
+typedef struct {
+  i2s_std_clk_config_t clk_cfg;
+  i2s_std_slot_config_t slot_cfg;
+  i2s_std_gpio_config_t gpio_cfg;
+} i2s_std_config_t;
+
+typedef struct {
+  void *data;
+  void *dma_buf;
+  size_t size;
+} i2s_event_data_t;
+
+typedef bool (*i2s_isr_callback_t)(i2s_chan_handle_t handle,
+                                   i2s_event_data_t *event, void *user_ctx);
+
+typedef struct {
+  i2s_isr_callback_t on_recv;
+  i2s_isr_callback_t on_recv_q_ovf;
+  i2s_isr_callback_t on_sent;
+  i2s_isr_callback_t on_send_q_ovf;
+} i2s_event_callbacks_t;
+
+esp_err_t i2s_new_channel(const i2s_chan_config_t *chan_cfg,
+                          i2s_chan_handle_t *ret_tx_handle,
+                          i2s_chan_handle_t *ret_rx_handle);
+esp_err_t i2s_del_channel(i2s_chan_handle_t handle);
+esp_err_t i2s_channel_init_std_mode(i2s_chan_handle_t handle,
+                                    const i2s_std_config_t *std_cfg);
+esp_err_t i2s_channel_reconfig_std_clock(i2s_chan_handle_t handle,
+                                         const i2s_std_clk_config_t *clk_cfg);
+esp_err_t i2s_channel_reconfig_std_slot(i2s_chan_handle_t handle,
+                                        const i2s_std_slot_config_t *slot_cfg);
+esp_err_t i2s_channel_register_event_callback(
+    i2s_chan_handle_t handle, const i2s_event_callbacks_t *callbacks,
+    void *user_data);
+esp_err_t i2s_channel_preload_data(i2s_chan_handle_t tx_handle,
+                                   const void *src, size_t size,
+                                   size_t *bytes_loaded);
+esp_err_t i2s_channel_write(i2s_chan_handle_t handle, const void *src,
+                            size_t size, size_t *bytes_written,
+                            uint32_t timeout_ms);
+esp_err_t i2s_channel_enable(i2s_chan_handle_t handle);
+esp_err_t i2s_channel_disable(i2s_chan_handle_t handle);
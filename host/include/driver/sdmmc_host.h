@@ -0,0 +1,44 @@
+/*
+ * sdmmc_host.h
+ *
+ * Host stand-in for the native SDMMC host driver. Its slot shares the
+ * simulated card with the SDSPI host.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include "driver/sdspi_host.h"
+#include "esp_err.h"
+
+#define SDMMC_HOST_SLOT_0 0
+#define SDMMC_HOST_SLOT_1 1
+
+#define SDMMC_SLOT_FLAG_INTERNAL_PULLUP (1 << 0)
+#define SDMMC_SLOT_WIDTH_DEFAULT 0
+
+esp_err_t sdmmc_host_set_card_clk(int slot, uint32_t freq_khz);
+esp_err_t sdmmc_host_get_real_freq(int slot, int *real_freq_khz);
+
+#define SDMMC_HOST_DEFAULT()                                                   \
+  {                                                                            \
+    .flags = SDMMC_HOST_FLAG_1BIT | SDMMC_HOST_FLAG_4BIT |                     \
+             SDMMC_HOST_FLAG_8BIT,                                             \
+    .slot = SDMMC_HOST_SLOT_1, .max_freq_khz = SDMMC_FREQ_DEFAULT,             \
+    .set_card_clk = sdmmc_host_set_card_clk,                                   \
+    .get_real_freq = sdmmc_host_get_real_freq,                                 \
+  }
+
+typedef struct {
+  int gpio_cd;
+  int gpio_wp;
+  uint8_t width;
+  uint32_t flags;
+} sdmmc_slot_config_t;
+
+#define SDMMC_SLOT_CONFIG_DEFAULT()                                            \
+  {                                                                            \
+    .gpio_cd = -1, .gpio_wp = -1, .width = SDMMC_SLOT_WIDTH_DEFAULT,           \
+    .flags = 0,                                                                \
+  }
@@ -0,0 +1,84 @@
+/*
+ * sdspi_host.h
+ *
+ * Host stand-in for the SDSPI host driver and the sdmmc types it exposes.
+ * The card clock can be changed after mounting through the host's
+ * set_card_clk, as on target.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include "esp_err.h"
+
+typedef int spi_host_device_t;
+
+#define SDSPI_DEFAULT_HOST 2
+#define SDSPI_DEFAULT_DMA 3
+#define SDMMC_FREQ_DEFAULT 20000
+#define SDMMC_FREQ_HIGHSPEED 40000
+#define SDMMC_FREQ_PROBING 400
+
+#define SDMMC_HOST_FLAG_1BIT (1 << 0)
+#define SDMMC_HOST_FLAG_4BIT (1 << 1)
+#define SDMMC_HOST_FLAG_8BIT (1 << 2)
+#define SDMMC_HOST_FLAG_SPI (1 << 3)
+
+typedef struct {
+  uint32_t flags;
+  int slot;
+  int max_freq_khz;
+  esp_err_t (*set_card_clk)(int slot, uint32_t freq_khz);
+  esp_err_t (*get_real_freq)(int slot, int *real_freq_khz);
+} sdmmc_host_t;
+
+esp_err_t sdspi_host_set_card_clk(int handle, uint32_t freq_khz);
+esp_err_t sdspi_host_get_real_freq(int handle, int *real_freq_khz);
+
+#define SDSPI_HOST_DEFAULT()                                                   \
+  {                                                                            \
+    .flags = SDMMC_HOST_FLAG_SPI, .slot = SDSPI_DEFAULT_HOST,                  \
+    .max_freq_khz = SDMMC_FREQ_DEFAULT,                                        \
+    .set_card_clk = sdspi_host_set_card_clk,                                   \
+    .get_real_freq = sdspi_host_get_real_freq,                                 \
+  }
+
+typedef struct {
+  int mosi_io_num;
+  int miso_io_num;
+  int sclk_io_num;
+  int quadwp_io_num;
+  int quadhd_io_num;
+  int max_transfer_sz;
+} spi_bus_config_t;
+
+typedef struct {
+  spi_host_device_t host_id;
+  int gpio_cs;
+  int gpio_cd;
+  int gpio_wp;
+  int gpio_int;
+} sdspi_device_config_t;
+
+#define SDSPI_DEVICE_CONFIG_DEFAULT()                                          \
+  {                                                                            \
+    .host_id = SDSPI_DEFAULT_HOST, .gpio_cs = 13, .gpio_cd = -1,               \
+    .gpio_wp = -1, .gpio_int = -1,                                             \
+  }
+
+typedef struct {
+  uint32_t capacity;
+  uint32_t sector_size;
+} sdmmc_csd_t;
+
+typedef struct {
+  sdmmc_host_t host;
+  sdmmc_csd_t csd;
+  int max_freq_khz;
+  int real_freq_khz;
+  uint32_t log_bus_width; ///< log2 of the data lines in use
+} sdmmc_card_t;
+
+esp_err_t spi_bus_initialize(spi_host_device_t host_id,
+                             const spi_bus_config_t *bus_config, int dma_chan);
@@ -0,0 +1,24 @@
+/*
+ * uart.h
+ *
+ * Host stand-in for the ESP-IDF UART driver. There is no console to read:
+ * reads wait out their timeout and return nothing.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+
+typedef int uart_port_t;
+
+#define UART_NUM_0 0
+
+esp_err_t uart_driver_install(uart_port_t uart_num, int rx_buffer_size,
+                              int tx_buffer_size, int queue_size,
+                              void *uart_queue, int intr_alloc_flags);
+int uart_read_bytes(uart_port_t uart_num, void *buf, uint32_t length,
+                    TickType_t ticks_to_wait);
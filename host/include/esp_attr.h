@@ -0,0 +1,14 @@
+/*
+ * esp_attr.h
+ *
+ * Host stand-in: memory placement attributes have no meaning off target.
+ */
+
+#pragma once
+
+#define IRAM_ATTR
+#define IRAM_DATA_ATTR
+#define DRAM_ATTR
+#define EXT_RAM_BSS_ATTR
+#define WORD_ALIGNED_ATTR __attribute__((aligned(4)))
+#define DMA_ATTR WORD_ALIGNED_ATTR
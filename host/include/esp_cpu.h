@@ -0,0 +1,14 @@
+/*
+ * esp_cpu.h
+ *
+ * Host stand-in: the cycle counter counts the calling thread's CPU time in
+ * nanoseconds, matching esp_rom_get_cpu_ticks_per_us().
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+typedef uint32_t esp_cpu_cycle_count_t;
+
+esp_cpu_cycle_count_t esp_cpu_get_cycle_count(void);
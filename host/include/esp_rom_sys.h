@@ -0,0 +1,12 @@
+/*
+ * esp_rom_sys.h
+ *
+ * Host stand-in: one "cycle" per wall clock nanosecond, so cycle budgets
+ * measured on the host come out as host time.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+uint32_t esp_rom_get_cpu_ticks_per_us(void);
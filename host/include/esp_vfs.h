@@ -0,0 +1,10 @@
+/*
+ * esp_vfs.h
+ *
+ * Host stand-in: the host libc already provides POSIX file I/O.
+ */
+
+#pragma once
+
+#include <fcntl.h>
+#include <unistd.h>
@@ -0,0 +1,35 @@
+/*
+ * esp_vfs_fat.h
+ *
+ * Host stand-in for mounting a FAT volume. The "card" is a host directory
+ * which must be reachable under the mount point path.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "driver/sdmmc_host.h"
+#include "driver/sdspi_host.h"
+#include "esp_err.h"
+#include "esp_vfs.h"
+#include "ff.h"
+
+typedef struct {
+  bool format_if_mount_failed;
+  int max_files;
+  size_t allocation_unit_size;
+  bool disk_status_check_enable;
+} esp_vfs_fat_mount_config_t;
+
+esp_err_t esp_vfs_fat_sdspi_mount(const char *base_path,
+                                  const sdmmc_host_t *host_config_input,
+                                  const sdspi_device_config_t *slot_config,
+                                  const esp_vfs_fat_mount_config_t *mount_config,
+                                  sdmmc_card_t **out_card);
+esp_err_t esp_vfs_fat_sdmmc_mount(const char *base_path,
+                                  const sdmmc_host_t *host_config,
+                                  const sdmmc_slot_config_t *slot_config,
+                                  const esp_vfs_fat_mount_config_t *mount_config,
+                                  sdmmc_card_t **out_card);
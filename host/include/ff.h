@@ -0,0 +1,97 @@
+/*
+ * ff.h
+ *
+ * Host stand-in for the FatFs directory API and the file calls needed to map
+ * a file's clusters (fast seek's CREATE_LINKMAP), backed by the host
+ * directory that was "mounted" with esp_vfs_fat_sdspi_mount(). The
+ * simulated card lays the host files out in clusters; see sim_storage.c.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+typedef uint32_t FSIZE_t;
+typedef unsigned int UINT;
+typedef uint8_t BYTE;
+typedef uint16_t WORD;
+typedef uint32_t DWORD;
+typedef DWORD LBA_t;
+
+typedef enum {
+  FR_OK = 0,
+  FR_DISK_ERR,
+  FR_INT_ERR,
+  FR_NOT_READY,
+  FR_NO_FILE,
+  FR_NO_PATH,
+  FR_INVALID_NAME,
+  FR_DENIED,
+  FR_EXIST,
+  FR_INVALID_OBJECT,
+  FR_WRITE_PROTECTED,
+  FR_INVALID_DRIVE,
+  FR_NOT_ENABLED,
+  FR_NO_FILESYSTEM,
+  FR_MKFS_ABORTED,
+  FR_TIMEOUT,
+  FR_LOCKED,
+  FR_NOT_ENOUGH_CORE,
+  FR_TOO_MANY_OPEN_FILES,
+  FR_INVALID_PARAMETER,
+} FRESULT;
+
+#define FA_READ 0x01
+#define FF_USE_FASTSEEK 1
+#define CREATE_LINKMAP ((FSIZE_t)0 - 1)
+
+#define AM_RDO 0x01
+#define AM_HID 0x02
+#define AM_SYS 0x04
+#define AM_DIR 0x10
+#define AM_ARC 0x20
+
+#define FF_MAX_LFN 255
+#define FF_MIN_SS 512
+#define FF_MAX_SS 4096
+
+typedef struct {
+  WORD csize;     ///< sectors per cluster
+  WORD ssize;     ///< bytes per sector
+  LBA_t database; ///< sector of cluster 2
+} FATFS;
+
+typedef struct {
+  FATFS *fs;
+  DWORD sclust; ///< first cluster, 0 for an empty file
+  FSIZE_t objsize;
+} FFOBJID;
+
+typedef struct {
+  FFOBJID obj;
+  BYTE flag;
+  FSIZE_t fptr;
+  DWORD *cltbl; ///< link map table, see f_lseek(fp, CREATE_LINKMAP)
+} FIL;
+
+typedef struct {
+  void *handle;
+  DWORD entries; ///< entries read so far, for the card cost model
+} FF_DIR;
+
+typedef struct {
+  FSIZE_t fsize;
+  WORD fdate;
+  WORD ftime;
+  BYTE fattrib;
+  char fname[FF_MAX_LFN + 1];
+} FILINFO;
+
+FRESULT f_opendir(FF_DIR *dp, const char *path);
+FRESULT f_closedir(FF_DIR *dp);
+FRESULT f_readdir(FF_DIR *dp, FILINFO *fno);
+FRESULT f_stat(const char *path, FILINFO *fno);
+FRESULT f_getfree(const char *path, DWORD *nclst, FATFS **fatfs);
+FRESULT f_open(FIL *fp, const char *path, BYTE mode);
+FRESULT f_close(FIL *fp);
+FRESULT f_lseek(FIL *fp, FSIZE_t ofs);
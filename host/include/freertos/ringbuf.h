@@ -0,0 +1,34 @@
+/*
+ * ringbuf.h
+ *
+ * Host stand-in for the ESP-IDF byte ring buffer. Only RINGBUF_TYPE_BYTEBUF
+ * is implemented; received items point into the ring storage and hold their
+ * space until returned, as on target.
+ */
+
+#pragma once
+
+#include "freertos/FreeRTOS.h"
+
+typedef struct sim_ringbuf *RingbufHandle_t;
+
+typedef enum {
+  RINGBUF_TYPE_NOSPLIT = 0,
+  RINGBUF_TYPE_ALLOWSPLIT,
+  RINGBUF_TYPE_BYTEBUF,
+  RINGBUF_TYPE_MAX,
+} RingbufferType_t;
+
+RingbufHandle_t xRingbufferCreate(size_t buffer_size, RingbufferType_t type);
+void vRingbufferDelete(RingbufHandle_t ringbuf);
+
+BaseType_t xRingbufferSend(RingbufHandle_t ringbuf, const void *item,
+                           size_t item_size, TickType_t ticks_to_wait);
+void *xRingbufferReceiveUpTo(RingbufHandle_t ringbuf, size_t *item_size,
+                             TickType_t ticks_to_wait, size_t max_size);
+void *xRingbufferReceiveUpToFromISR(RingbufHandle_t ringbuf, size_t *item_size,
+                                    size_t max_size);
+void vRingbufferReturnItem(RingbufHandle_t ringbuf, void *item);
+void vRingbufferReturnItemFromISR(RingbufHandle_t ringbuf, void *item,
+                                  BaseType_t *higher_priority_task_woken);
+size_t xRingbufferGetCurFreeSize(RingbufHandle_t ringbuf);
@@ -0,0 +1,8 @@
+/*
+ * sdkconfig.h
+ *
+ * Host stand-in: none of the optional Kconfig features the firmware checks
+ * for (power management, light sleep) exist off target.
+ */
+
+#pragma once
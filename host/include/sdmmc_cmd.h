@@ -0,0 +1,16 @@
+/*
+ * sdmmc_cmd.h
+ *
+ * Host stand-in for the sdmmc protocol layer.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdio.h>
+
+#include "driver/sdspi_host.h"
+
+void sdmmc_card_print_info(FILE *stream, const sdmmc_card_t *card);
+esp_err_t sdmmc_read_sectors(sdmmc_card_t *card, void *dst, size_t start_sector,
+                             size_t sector_count);
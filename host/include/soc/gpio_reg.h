@@ -0,0 +1,12 @@
+/*
+ * gpio_reg.h
+ *
+ * Host stand-in: the GPIO input registers, levels of GPIO 0-31 and 32-39.
+ */
+
+#pragma once
+
+#include "soc/soc.h"
+
+#define GPIO_IN_REG 0x3ff4403c
+#define GPIO_IN1_REG 0x3ff44040
@@ -0,0 +1,8 @@
+/*
+ * lldesc.h
+ *
+ * Host stand-in; the firmware includes it but uses no DMA descriptor types
+ * directly.
+ */
+
+#pragma once
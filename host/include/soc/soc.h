@@ -0,0 +1,14 @@
+/*
+ * soc.h
+ *
+ * Host stand-in for register access. Only the GPIO input register is
+ * simulated, backed by the simulated pin levels.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+uint32_t sim_reg_read(uint32_t reg);
+
+#define REG_READ(reg) sim_reg_read(reg)
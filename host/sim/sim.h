@@ -0,0 +1,152 @@
+/*
+ * sim.h
+ *
+ * Control surface of the host simulation. The firmware sources are compiled
+ * unchanged against the stand-in headers in host/include; this header is
+ * only used by the benchmark drivers to start the firmware, advance the
+ * simulated clock and collect counters.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "esp_log.h"
+
+#define SIM_CARD_REFERENCE_KHZ 5000
+
+typedef struct sim_config {
+  double time_scale;         ///< simulated seconds per wall-clock second
+  esp_log_level_t log_level; ///< firmware ESP_LOGx output threshold
+  /// Simulated time for the card to transfer one 512 byte sector, charged to
+  /// file reads, seeks, opens and directory walks. 0 makes the card free.
+  /// Given for a 1-bit bus at SIM_CARD_REFERENCE_KHZ; faster clocks and
+  /// wider buses scale it down.
+  uint32_t card_sector_us;
+  /// Every card_stall_every-th read() also stalls for card_stall_us, like a
+  /// card busy with wear levelling. 0 disables stalls.
+  uint32_t card_stall_us;
+  uint32_t card_stall_every;
+  /// Every card_busy_every-th write() also holds the card busy for
+  /// card_busy_us, as a card erasing a block or moving data for its wear
+  /// levelling does. 0 disables it.
+  uint32_t card_busy_us;
+  uint32_t card_busy_every;
+  /// Simulated time for every read command sent to the card, on top of its
+  /// sectors: the command, the card's access time and the stop.
+  uint32_t card_command_us;
+  /// Fastest clock the card's wiring carries cleanly. Raw sector reads up to
+  /// 25% above it return corrupted data, faster ones fail with a CRC error.
+  /// 0 means any clock works.
+  uint32_t card_max_khz;
+  /// CPU time VFS and FatFs spend on every read() call, apart from the card:
+  /// descriptor and file locks, the cluster chain walk and the copy out.
+  /// Raw sector reads skip it.
+  uint32_t file_read_us;
+  /// Host file holding the flash partition labelled flash_label, which the
+  /// firmware finds, reads and maps with esp_partition_*. Mapped reads cost
+  /// only the host's memory reads. NULL for no such partition.
+  const char *flash_image;
+  const char *flash_label;
+  /// Microphone behind every I2S RX channel: a full scale sine of
+  /// mic_tone_hz, or with 0 a ramp counting up by one every frame, so a
+  /// recording shows any frame lost or repeated.
+  uint32_t mic_tone_hz;
+} sim_config_t;
+
+typedef struct sim_stats {
+  // I2S DMA engine
+  uint64_t dma_buffers_played;
+  uint64_t dma_bytes_played;
+  uint64_t underruns; ///< DMA buffers played without a complete refill
+  uint64_t first_audio_us; ///< when the first DMA buffer holding audio started
+  uint64_t isr_calls;
+  uint64_t isr_ns_total;
+  uint64_t isr_ns_max;
+  uint64_t i2s_bytes_preloaded;
+  uint64_t i2s_bytes_written; ///< copied into DMA memory by i2s_channel_write
+  uint64_t dma_buffers_received; ///< filled from the microphone by RX channels
+  uint64_t dma_bytes_received;
+
+  // Ring buffer
+  uint64_t ringbuf_bytes_sent;
+  uint64_t ringbuf_bytes_received; ///< task and ISR receives
+  uint64_t ringbuf_bytes_received_isr;
+  uint64_t ringbuf_send_timeouts;
+
+  // File system
+  uint64_t file_bytes_read; ///< bytes returned by read()
+  uint64_t file_reads;      ///< read() calls that returned data
+  uint64_t card_sectors;    ///< sectors charged by the card cost model
+  uint64_t card_commands;   ///< single or multi-sector reads sent to the card
+  uint64_t window_bytes;    ///< copied through FatFs's sector buffer
+  uint64_t file_bytes_written; ///< bytes taken by write()
+  uint64_t file_writes;        ///< write() calls that wrote data
+  uint64_t partial_sector_writes; ///< sectors written only in part
+  uint64_t dir_entries_read;      ///< returned by f_readdir, as a directory walk reads them
+} sim_stats_t;
+
+void sim_init(const sim_config_t *config);
+
+/** Start app_main on a simulated "main" task, as the IDF startup code does. */
+void sim_start(void (*app_main)(void));
+
+/** Block the caller for the given amount of simulated time. */
+void sim_run_for(double sim_seconds);
+
+/** Stop every simulated task and DMA engine and wait for them to exit. */
+void sim_stop(void);
+
+const sim_stats_t *sim_get_stats(void);
+
+/** Simulated microseconds since sim_init(). */
+uint64_t sim_time_us(void);
+
+// MARK: internal helpers shared by the stand-in implementations
+
+sim_stats_t *sim_stats_mut(void);
+bool sim_stopping(void);
+void sim_exit_if_stopping(void);
+void sim_sleep_us(uint64_t sim_us);
+uint64_t sim_wall_ns(void);
+double sim_time_scale(void);
+
+/** Charge the card cost model for transferring `sectors` sectors. */
+void sim_card_access(uint64_t sectors);
+
+/** Charge one read command of `sectors` sectors. */
+void sim_card_command(uint64_t sectors);
+
+/** Charge the card's periodic stall to a read, if one is due. */
+void sim_card_read_stall(void);
+
+/** Hold the card busy after a write, if a busy period is due. */
+void sim_card_write_busy(void);
+
+/** Charge the file system's own time for one read() call. */
+void sim_file_read_overhead(void);
+
+/** Fastest reliable card clock, see sim_config_t::card_max_khz. */
+uint32_t sim_card_max_khz(void);
+
+/** Record the card bus clock and data lines sector costs scale by. */
+void sim_card_set_bus(uint32_t freq_khz, uint32_t lines);
+
+/** Card bus clock last set, 0 before mounting. */
+uint32_t sim_card_bus_khz(void);
+
+/** Lay the host file at `path` out on the simulated card in runs of
+ * `clusters_per_run` 32 KiB clusters, as a fragmented file would be. Files
+ * not laid out this way get one contiguous run when first opened. */
+bool sim_card_fragment(const char *path, uint32_t clusters_per_run);
+
+/** The flash partition of sim_config_t, NULL without one. */
+const char *sim_flash_image(void);
+const char *sim_flash_label(void);
+
+/** See sim_config_t::mic_tone_hz. */
+uint32_t sim_mic_tone_hz(void);
+
+/** Sectors a FatFs lookup of `path` scans, 16 directory entries each. */
+uint64_t sim_card_lookup_sectors(const char *path);
@@ -0,0 +1,18 @@
+/*
+ * sim_compat.h
+ *
+ * Forced include for firmware sources built on the host: declares the newlib
+ * extensions the firmware relies on that glibc does not provide, and points
+ * the trace (src/trace.h) at the simulated clock, since the host's cycle
+ * counter counts per thread.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+char *strnstr(const char *haystack, const char *needle, size_t len);
+
+uint32_t sim_trace_clock(void);
+#define TRACE_CLOCK() sim_trace_clock()
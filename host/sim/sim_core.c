@@ -0,0 +1,435 @@
+/*
+ * sim_core.c
+ *
+ * Simulation clock, logging and FreeRTOS task stand-ins.
+ */
+
+#include "sim.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "esp_cpu.h"
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_rom_sys.h"
+#include "esp_timer.h"
+#include "freertos/task.h"
+
+#define SIM_MAX_TASKS 16
+#define SIM_SLEEP_SLICE_NS 2000000ULL
+
+struct sim_task {
+  pthread_t thread;
+  char name[16];
+  TaskFunction_t function;
+  void *param;
+  bool used;
+
+  pthread_mutex_t notify_lock;
+  pthread_cond_t notified;
+  uint32_t notify_value;
+  bool notify_pending;
+};
+
+static sim_config_t config = {.time_scale = 1.0, .log_level = ESP_LOG_INFO};
+static sim_stats_t stats;
+static uint64_t start_ns;
+static atomic_bool stopping;
+
+// Card bus, 0 until a card is mounted, which leaves sector costs unscaled
+static _Atomic uint32_t card_freq_khz;
+static _Atomic uint32_t card_lines = 1;
+
+static pthread_mutex_t tasks_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct sim_task tasks[SIM_MAX_TASKS];
+static __thread struct sim_task *current_task;
+static char main_thread_name[] = "sim";
+
+uint64_t sim_wall_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+void sim_init(const sim_config_t *cfg) {
+  if (cfg != NULL) {
+    config = *cfg;
+  }
+  if (config.time_scale <= 0) {
+    config.time_scale = 1.0;
+  }
+  memset(&stats, 0, sizeof(stats));
+  atomic_store(&stopping, false);
+  sim_card_set_bus(0, 1);
+  start_ns = sim_wall_ns();
+}
+
+double sim_time_scale(void) { return config.time_scale; }
+
+void sim_card_access(uint64_t sectors) {
+  __atomic_fetch_add(&stats.card_sectors, sectors, __ATOMIC_RELAXED);
+  if (config.card_sector_us == 0 || sectors == 0) {
+    return;
+  }
+  uint64_t cost_us = sectors * config.card_sector_us;
+  uint32_t freq_khz = atomic_load(&card_freq_khz);
+  if (freq_khz != 0) {
+    cost_us = cost_us * SIM_CARD_REFERENCE_KHZ /
+              ((uint64_t)freq_khz * atomic_load(&card_lines));
+  }
+  sim_sleep_us(cost_us);
+}
+
+void sim_card_command(uint64_t sectors) {
+  __atomic_fetch_add(&stats.card_commands, 1, __ATOMIC_RELAXED);
+  if (config.card_command_us != 0) {
+    sim_sleep_us(config.card_command_us);
+  }
+  sim_card_access(sectors);
+}
+
+void sim_file_read_overhead(void) {
+  if (config.file_read_us != 0) {
+    sim_sleep_us(config.file_read_us);
+  }
+}
+
+uint32_t sim_card_max_khz(void) { return config.card_max_khz; }
+
+const char *sim_flash_image(void) { return config.flash_image; }
+
+const char *sim_flash_label(void) { return config.flash_label; }
+
+void sim_card_set_bus(uint32_t freq_khz, uint32_t lines) {
+  atomic_store(&card_freq_khz, freq_khz);
+  atomic_store(&card_lines, lines != 0 ? lines : 1);
+}
+
+uint32_t sim_card_bus_khz(void) { return atomic_load(&card_freq_khz); }
+
+void sim_card_read_stall(void) {
+  static atomic_uint_fast64_t reads;
+  if (config.card_stall_us == 0 || config.card_stall_every == 0) {
+    return;
+  }
+  if (atomic_fetch_add(&reads, 1) % config.card_stall_every ==
+      config.card_stall_every - 1) {
+    sim_sleep_us(config.card_stall_us);
+  }
+}
+
+void sim_card_write_busy(void) {
+  static atomic_uint_fast64_t writes;
+  if (config.card_busy_us == 0 || config.card_busy_every == 0) {
+    return;
+  }
+  if (atomic_fetch_add(&writes, 1) % config.card_busy_every ==
+      config.card_busy_every - 1) {
+    sim_sleep_us(config.card_busy_us);
+  }
+}
+
+uint32_t sim_mic_tone_hz(void) { return config.mic_tone_hz; }
+
+uint64_t sim_time_us(void) {
+  return (uint64_t)((double)(sim_wall_ns() - start_ns) * config.time_scale /
+                    1000.0);
+}
+
+sim_stats_t *sim_stats_mut(void) { return &stats; }
+
+const sim_stats_t *sim_get_stats(void) { return &stats; }
+
+bool sim_stopping(void) { return atomic_load(&stopping); }
+
+void sim_exit_if_stopping(void) {
+  if (sim_stopping() && current_task != NULL) {
+    pthread_exit(NULL);
+  }
+}
+
+void sim_sleep_us(uint64_t sim_us) {
+  uint64_t wall_ns = (uint64_t)((double)sim_us * 1000.0 / config.time_scale);
+  uint64_t deadline = sim_wall_ns() + wall_ns;
+
+  for (;;) {
+    sim_exit_if_stopping();
+    uint64_t now = sim_wall_ns();
+    if (now >= deadline) {
+      return;
+    }
+    uint64_t slice = MIN(deadline - now, SIM_SLEEP_SLICE_NS);
+    struct timespec ts = {.tv_sec = slice / 1000000000ULL,
+                          .tv_nsec = slice % 1000000000ULL};
+    nanosleep(&ts, NULL);
+  }
+}
+
+void sim_log_write(esp_log_level_t level, const char *tag, const char *format,
+                   ...) {
+  static const char letters[] = "NEWIDV";
+
+  if (level > config.log_level) {
+    return;
+  }
+
+  va_list args;
+  va_start(args, format);
+  fprintf(stderr, "%c (%llu) %s: ", letters[level],
+          (unsigned long long)(sim_time_us() / 1000), tag);
+  vfprintf(stderr, format, args);
+  fputc('\n', stderr);
+  va_end(args);
+}
+
+const char *esp_err_to_name(esp_err_t code) {
+  switch (code) {
+  case ESP_OK:
+    return "ESP_OK";
+  case ESP_FAIL:
+    return "ESP_FAIL";
+  case ESP_ERR_NO_MEM:
+    return "ESP_ERR_NO_MEM";
+  case ESP_ERR_INVALID_ARG:
+    return "ESP_ERR_INVALID_ARG";
+  case ESP_ERR_INVALID_STATE:
+    return "ESP_ERR_INVALID_STATE";
+  case ESP_ERR_INVALID_SIZE:
+    return "ESP_ERR_INVALID_SIZE";
+  case ESP_ERR_NOT_FOUND:
+    return "ESP_ERR_NOT_FOUND";
+  case ESP_ERR_TIMEOUT:
+    return "ESP_ERR_TIMEOUT";
+  case ESP_ERR_INVALID_CRC:
+    return "ESP_ERR_INVALID_CRC";
+  default:
+    return "UNKNOWN ERROR";
+  }
+}
+
+// MARK: tasks
+
+static void *task_entry(void *arg) {
+  current_task = (struct sim_task *)arg;
+  current_task->function(current_task->param);
+  return NULL;
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t task, const char *name,
+                                   uint32_t stack_depth, void *param,
+                                   UBaseType_t priority,
+                                   TaskHandle_t *created_task, BaseType_t core) {
+  (void)stack_depth;
+  (void)priority;
+  (void)core;
+
+  pthread_mutex_lock(&tasks_lock);
+  struct sim_task *slot = NULL;
+  for (int i = 0; i < SIM_MAX_TASKS; ++i) {
+    if (!tasks[i].used) {
+      slot = &tasks[i];
+      break;
+    }
+  }
+  if (slot == NULL) {
+    pthread_mutex_unlock(&tasks_lock);
+    return pdFAIL;
+  }
+
+  slot->used = true;
+  slot->function = task;
+  slot->param = param;
+  pthread_mutex_init(&slot->notify_lock, NULL);
+  pthread_cond_init(&slot->notified, NULL);
+  slot->notify_value = 0;
+  slot->notify_pending = false;
+  strncpy(slot->name, name, sizeof(slot->name) - 1);
+  slot->name[sizeof(slot->name) - 1] = '\0';
+
+  if (pthread_create(&slot->thread, NULL, task_entry, slot) != 0) {
+    slot->used = false;
+    pthread_mutex_unlock(&tasks_lock);
+    return pdFAIL;
+  }
+  pthread_mutex_unlock(&tasks_lock);
+
+  if (created_task != NULL) {
+    *created_task = slot;
+  }
+  return pdPASS;
+}
+
+void vTaskDelete(TaskHandle_t task) {
+  if (task == NULL || task == current_task) {
+    pthread_exit(NULL);
+  }
+  pthread_cancel(task->thread);
+}
+
+void vTaskDelay(TickType_t ticks) {
+  if (ticks == 0) {
+    sim_exit_if_stopping();
+    sched_yield();
+    return;
+  }
+  sim_sleep_us((uint64_t)ticks * portTICK_PERIOD_MS * 1000);
+}
+
+char *pcTaskGetName(TaskHandle_t task) {
+  if (task == NULL) {
+    task = current_task;
+  }
+  return task != NULL ? task->name : main_thread_name;
+}
+
+TickType_t xTaskGetTickCount(void) {
+  return (TickType_t)(sim_time_us() / (portTICK_PERIOD_MS * 1000));
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void) { return current_task; }
+
+// MARK: notifications
+
+BaseType_t xTaskNotify(TaskHandle_t task, uint32_t value, eNotifyAction action) {
+  if (task == NULL) {
+    return pdFAIL;
+  }
+  pthread_mutex_lock(&task->notify_lock);
+  switch (action) {
+  case eSetBits:
+    task->notify_value |= value;
+    break;
+  case eIncrement:
+    task->notify_value++;
+    break;
+  case eSetValueWithOverwrite:
+    task->notify_value = value;
+    break;
+  case eNoAction:
+    break;
+  }
+  task->notify_pending = true;
+  pthread_cond_broadcast(&task->notified);
+  pthread_mutex_unlock(&task->notify_lock);
+  return pdPASS;
+}
+
+BaseType_t xTaskNotifyFromISR(TaskHandle_t task, uint32_t value,
+                              eNotifyAction action,
+                              BaseType_t *higher_priority_task_woken) {
+  if (higher_priority_task_woken != NULL) {
+    *higher_priority_task_woken = pdFALSE;
+  }
+  return xTaskNotify(task, value, action);
+}
+
+BaseType_t xTaskNotifyWait(uint32_t bits_to_clear_on_entry,
+                           uint32_t bits_to_clear_on_exit,
+                           uint32_t *notification_value,
+                           TickType_t ticks_to_wait) {
+  struct sim_task *task = current_task;
+  uint64_t deadline = ticks_to_wait == portMAX_DELAY
+                          ? UINT64_MAX
+                          : sim_time_us() + (uint64_t)ticks_to_wait *
+                                                portTICK_PERIOD_MS * 1000;
+
+  pthread_mutex_lock(&task->notify_lock);
+  if (!task->notify_pending) {
+    task->notify_value &= ~bits_to_clear_on_entry;
+  }
+  while (!task->notify_pending) {
+    uint64_t now = sim_time_us();
+    if (now >= deadline || sim_stopping()) {
+      break;
+    }
+    uint64_t wall_ns = MIN(
+        (uint64_t)((double)(deadline - now) * 1000.0 / config.time_scale),
+        SIM_SLEEP_SLICE_NS);
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    uint64_t abs_ns = (uint64_t)ts.tv_nsec + wall_ns;
+    ts.tv_sec += abs_ns / 1000000000ULL;
+    ts.tv_nsec = abs_ns % 1000000000ULL;
+    pthread_cond_timedwait(&task->notified, &task->notify_lock, &ts);
+  }
+
+  BaseType_t received = task->notify_pending ? pdTRUE : pdFALSE;
+  if (notification_value != NULL) {
+    *notification_value = task->notify_value;
+  }
+  if (received) {
+    task->notify_value &= ~bits_to_clear_on_exit;
+    task->notify_pending = false;
+  }
+  pthread_mutex_unlock(&task->notify_lock);
+
+  sim_exit_if_stopping();
+  return received;
+}
+
+// MARK: lifecycle
+
+void sim_i2s_stop_all(void);
+void sim_timer_stop_all(void);
+
+void sim_start(void (*app_main)(void)) {
+  xTaskCreatePinnedToCore((TaskFunction_t)(void (*)(void))app_main, "main",
+                          3584, NULL, 1, NULL, 0);
+}
+
+void sim_run_for(double sim_seconds) {
+  sim_sleep_us((uint64_t)(sim_seconds * 1e6));
+}
+
+void sim_stop(void) {
+  atomic_store(&stopping, true);
+  sim_i2s_stop_all();
+  sim_timer_stop_all();
+
+  for (int i = 0; i < SIM_MAX_TASKS; ++i) {
+    pthread_mutex_lock(&tasks_lock);
+    bool used = tasks[i].used;
+    pthread_t thread = tasks[i].thread;
+    pthread_mutex_unlock(&tasks_lock);
+    if (!used) {
+      continue;
+    }
+
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += 2;
+    if (pthread_timedjoin_np(thread, NULL, &deadline) == ETIMEDOUT) {
+      fprintf(stderr, "sim: task %s did not stop, cancelling\n", tasks[i].name);
+      pthread_cancel(thread);
+      pthread_join(thread, NULL);
+    }
+    tasks[i].used = false;
+  }
+}
+
+int64_t esp_timer_get_time(void) { return (int64_t)sim_time_us(); }
+
+// CPU time of the calling thread, so mixing costs are not inflated by the
+// other simulated tasks sharing the host's cores
+esp_cpu_cycle_count_t esp_cpu_get_cycle_count(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return (esp_cpu_cycle_count_t)((uint64_t)ts.tv_sec * 1000000000ULL +
+                                 (uint64_t)ts.tv_nsec);
+}
+
+uint32_t esp_rom_get_cpu_ticks_per_us(void) { return 1000; }
+
+// Simulated nanoseconds, the same on every thread, in the cycle counter's
+// units for the trace's timeline
+uint32_t sim_trace_clock(void) {
+  return (uint32_t)((double)(sim_wall_ns() - start_ns) * config.time_scale);
+}
@@ -0,0 +1,103 @@
+/*
+ * sim_flash.c
+ *
+ * Flash partition stand-in: the partition is sim_config_t's flash_image host
+ * file, sized to it, and esp_partition_mmap maps the file read only, so the
+ * firmware reads it from the mapped address as it would through the flash
+ * cache. One mapping may be open at a time.
+ */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "esp_partition.h"
+#include "sim.h"
+
+// Where a real partition table would put a data partition after the app
+#define SIM_FLASH_PARTITION_ADDRESS 0x110000
+
+static esp_partition_t partition;
+static void *mapped = MAP_FAILED;
+static size_t mapped_size;
+
+const esp_partition_t *esp_partition_find_first(esp_partition_type_t type,
+                                                esp_partition_subtype_t subtype,
+                                                const char *label) {
+  (void)type;
+  (void)subtype;
+  const char *image = sim_flash_image();
+  const char *image_label = sim_flash_label();
+  if (image == NULL || image_label == NULL ||
+      (label != NULL && strcmp(label, image_label) != 0)) {
+    return NULL;
+  }
+
+  struct stat image_stat;
+  if (stat(image, &image_stat) != 0) {
+    return NULL;
+  }
+  memset(&partition, 0, sizeof(partition));
+  partition.type = ESP_PARTITION_TYPE_DATA;
+  partition.subtype = ESP_PARTITION_SUBTYPE_ANY;
+  partition.address = SIM_FLASH_PARTITION_ADDRESS;
+  partition.size = (uint32_t)image_stat.st_size;
+  partition.erase_size = 4096;
+  snprintf(partition.label, sizeof(partition.label), "%s", image_label);
+  partition.readonly = true;
+  return &partition;
+}
+
+esp_err_t esp_partition_read(const esp_partition_t *part, size_t src_offset,
+                             void *dst, size_t size) {
+  if (part != &partition || src_offset > part->size ||
+      size > part->size - src_offset) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  int fd = open(sim_flash_image(), O_RDONLY);
+  if (fd < 0) {
+    return ESP_FAIL;
+  }
+  ssize_t got = pread(fd, dst, size, (off_t)src_offset);
+  close(fd);
+  return got == (ssize_t)size ? ESP_OK : ESP_FAIL;
+}
+
+esp_err_t esp_partition_mmap(const esp_partition_t *part, size_t offset,
+                             size_t size, esp_partition_mmap_memory_t memory,
+                             const void **out_ptr,
+                             esp_partition_mmap_handle_t *out_handle) {
+  (void)memory;
+  // The flash MMU maps whole 64 KiB pages
+  if (part != &partition || offset % 0x10000 != 0 || offset > part->size ||
+      size > part->size - offset) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  if (mapped != MAP_FAILED) {
+    return ESP_ERR_NO_MEM;
+  }
+
+  int fd = open(sim_flash_image(), O_RDONLY);
+  if (fd < 0) {
+    return ESP_FAIL;
+  }
+  mapped = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, (off_t)offset);
+  close(fd);
+  if (mapped == MAP_FAILED) {
+    return ESP_ERR_NO_MEM;
+  }
+  mapped_size = size;
+  *out_ptr = mapped;
+  *out_handle = 1;
+  return ESP_OK;
+}
+
+void esp_partition_munmap(esp_partition_mmap_handle_t handle) {
+  if (handle == 1 && mapped != MAP_FAILED) {
+    munmap(mapped, mapped_size);
+    mapped = MAP_FAILED;
+  }
+}
@@ -0,0 +1,103 @@
+/*
+ * sim_gpio.c
+ *
+ * GPIO stand-in. sim_gpio_set_level() changes a pin and, when the pin is
+ * configured for a matching edge, calls its ISR handler on the caller's
+ * thread the way the GPIO interrupt would.
+ */
+
+#include "driver/gpio.h"
+
+#include <stdatomic.h>
+#include <stdbool.h>
+
+#include "sim_gpio.h"
+#include "soc/gpio_reg.h"
+
+#define SIM_GPIO_COUNT 40
+
+static gpio_int_type_t intr_types[SIM_GPIO_COUNT];
+static gpio_isr_t handlers[SIM_GPIO_COUNT];
+static void *handler_args[SIM_GPIO_COUNT];
+static atomic_uint_fast64_t levels;
+static bool isr_service_installed;
+
+esp_err_t gpio_config(const gpio_config_t *config) {
+  if (config == NULL || (config->pin_bit_mask >> SIM_GPIO_COUNT) != 0) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  for (int pin = 0; pin < SIM_GPIO_COUNT; ++pin) {
+    if (config->pin_bit_mask & (1ULL << pin)) {
+      intr_types[pin] = config->intr_type;
+    }
+  }
+  return ESP_OK;
+}
+
+esp_err_t gpio_install_isr_service(int intr_alloc_flags) {
+  (void)intr_alloc_flags;
+  if (isr_service_installed) {
+    return ESP_ERR_INVALID_STATE;
+  }
+  isr_service_installed = true;
+  return ESP_OK;
+}
+
+esp_err_t gpio_isr_handler_add(gpio_num_t gpio_num, gpio_isr_t isr_handler,
+                               void *args) {
+  if (!isr_service_installed) {
+    return ESP_ERR_INVALID_STATE;
+  }
+  if (gpio_num < 0 || gpio_num >= SIM_GPIO_COUNT) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  handlers[gpio_num] = isr_handler;
+  handler_args[gpio_num] = args;
+  return ESP_OK;
+}
+
+int gpio_get_level(gpio_num_t gpio_num) {
+  return (int)((atomic_load(&levels) >> gpio_num) & 1);
+}
+
+uint64_t sim_gpio_read_all(void) { return atomic_load(&levels); }
+
+uint32_t sim_reg_read(uint32_t reg) {
+  switch (reg) {
+  case GPIO_IN_REG:
+    return (uint32_t)atomic_load(&levels);
+  case GPIO_IN1_REG:
+    return (uint32_t)(atomic_load(&levels) >> 32);
+  default:
+    return 0;
+  }
+}
+
+void sim_gpio_set_level(int pin, int level) {
+  uint64_t mask = 1ULL << pin;
+  uint64_t before = level ? atomic_fetch_or(&levels, mask)
+                          : atomic_fetch_and(&levels, ~mask);
+  bool was_high = (before & mask) != 0;
+  if (was_high == (level != 0) || handlers[pin] == NULL) {
+    return;
+  }
+
+  bool rising = level != 0;
+  switch (intr_types[pin]) {
+  case GPIO_INTR_ANYEDGE:
+    break;
+  case GPIO_INTR_POSEDGE:
+    if (!rising) {
+      return;
+    }
+    break;
+  case GPIO_INTR_NEGEDGE:
+    if (rising) {
+      return;
+    }
+    break;
+  default:
+    return;
+  }
+  handlers[pin](handler_args[pin]);
+}
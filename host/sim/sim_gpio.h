@@ -0,0 +1,15 @@
+/*
+ * sim_gpio.h
+ *
+ * Benchmark-side control of the simulated GPIO pins.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+/** Drive a simulated input pin, firing its edge ISR if one is registered. */
+void sim_gpio_set_level(int pin, int level);
+
+/** Snapshot of every simulated pin level, bit n is GPIO n. */
+uint64_t sim_gpio_read_all(void);
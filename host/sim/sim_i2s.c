@@ -0,0 +1,428 @@
+/*
+ * sim_i2s.c
+ *
+ * Simulated I2S TX and RX channels. The DMA engine of a TX channel is a thread that "plays" one
+ * buffer of dma_frame_num frames per frame period on the simulation clock
+ * and then raises on_sent for that buffer, mirroring the target driver's
+ * EOF interrupt. A buffer that was not completely refilled between two
+ * plays is counted as an underrun. on_sent refills the buffer in place, so
+ * what it leaves is what plays; the firmware counts the buffers it could not
+ * fill from its ring buffer. When no writer took a played buffer
+ * before it came round again, on_send_q_ovf is raised as well.
+ *
+ * An RX channel's DMA engine fills one buffer per frame period from the
+ * simulated microphone (see sim_config_t::mic_tone_hz) and raises on_recv for
+ * it, as the target's EOF interrupt does. The microphone keeps time across
+ * the channel being disabled, so its signal carries on where it left off.
+ */
+
+#include "driver/i2s_std.h"
+
+#include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "sim.h"
+
+#define SIM_MAX_CHANNELS 4
+
+struct sim_i2s_channel {
+  i2s_chan_config_t cfg;
+  i2s_std_config_t std_cfg;
+  i2s_event_callbacks_t callbacks;
+  void *user_data;
+
+  uint8_t **dma_bufs;
+  size_t *filled; ///< fresh bytes in each DMA buffer since it last played
+  size_t buf_size;
+  uint32_t position; ///< index of the buffer currently being played
+
+  // Queue of played buffers waiting for i2s_channel_write()
+  pthread_mutex_t lock;
+  pthread_cond_t freed;
+  uint32_t *free_queue;
+  uint32_t free_head;
+  uint32_t free_count;
+  int32_t write_buf; ///< buffer being filled by i2s_channel_write, or -1
+  size_t write_pos;
+
+  pthread_t dma_thread;
+  atomic_bool running;
+  bool used;
+  bool rx;
+  uint64_t mic_frames; ///< frames the microphone has sent the RX channel
+};
+
+static struct sim_i2s_channel channels[SIM_MAX_CHANNELS];
+
+// DMA memory holds data_bit_width samples whatever the slot width on the
+// bus, 24 bit ones in 32 bit words
+static size_t sample_bytes(const struct sim_i2s_channel *ch) {
+  uint32_t data_bits = ch->std_cfg.slot_cfg.data_bit_width;
+  return data_bits == I2S_DATA_BIT_WIDTH_24BIT ? 4 : data_bits / 8;
+}
+
+static size_t frame_bytes(const struct sim_i2s_channel *ch) {
+  return sample_bytes(ch) * ch->std_cfg.slot_cfg.slot_mode;
+}
+
+static void free_dma_buffers(struct sim_i2s_channel *ch) {
+  if (ch->dma_bufs == NULL) {
+    return;
+  }
+  for (uint32_t i = 0; i < ch->cfg.dma_desc_num; ++i) {
+    free(ch->dma_bufs[i]);
+  }
+  free(ch->dma_bufs);
+  free(ch->filled);
+  free(ch->free_queue);
+  ch->dma_bufs = NULL;
+  ch->filled = NULL;
+  ch->free_queue = NULL;
+}
+
+static esp_err_t alloc_dma_buffers(struct sim_i2s_channel *ch) {
+  free_dma_buffers(ch);
+  ch->buf_size = ch->cfg.dma_frame_num * frame_bytes(ch);
+  ch->dma_bufs = calloc(ch->cfg.dma_desc_num, sizeof(uint8_t *));
+  ch->filled = calloc(ch->cfg.dma_desc_num, sizeof(size_t));
+  ch->free_queue = calloc(ch->cfg.dma_desc_num, sizeof(uint32_t));
+  if (ch->dma_bufs == NULL || ch->filled == NULL || ch->free_queue == NULL) {
+    return ESP_ERR_NO_MEM;
+  }
+  for (uint32_t i = 0; i < ch->cfg.dma_desc_num; ++i) {
+    ch->dma_bufs[i] = calloc(1, ch->buf_size);
+    if (ch->dma_bufs[i] == NULL) {
+      return ESP_ERR_NO_MEM;
+    }
+  }
+  ch->position = 0;
+  return ESP_OK;
+}
+
+// Fill an RX buffer with the microphone's next frames, left justified in
+// the sample width, the same sample in every slot
+static void mic_fill(struct sim_i2s_channel *ch, uint8_t *buf) {
+  size_t bytes = sample_bytes(ch);
+  uint32_t slots = ch->std_cfg.slot_cfg.slot_mode;
+  uint32_t tone_hz = sim_mic_tone_hz();
+  double rate = ch->std_cfg.clk_cfg.sample_rate_hz;
+
+  for (uint32_t frame = 0; frame < ch->cfg.dma_frame_num; ++frame) {
+    uint64_t n = ch->mic_frames++;
+    int16_t level = tone_hz == 0
+                        ? (int16_t)(uint16_t)n
+                        : (int16_t)lrint(32767.0 * sin(2.0 * M_PI * tone_hz *
+                                                       (double)n / rate));
+    uint32_t word = (uint32_t)(uint16_t)level << 16;
+    for (uint32_t slot = 0; slot < slots; ++slot) {
+      // Little endian, the top bytes of the word
+      memcpy(buf, (uint8_t *)&word + 4 - bytes, bytes);
+      buf += bytes;
+    }
+  }
+}
+
+static void *dma_engine(void *arg) {
+  struct sim_i2s_channel *ch = arg;
+  sim_stats_t *stats = sim_stats_mut();
+  uint64_t period_us = (uint64_t)ch->cfg.dma_frame_num * 1000000ULL /
+                       ch->std_cfg.clk_cfg.sample_rate_hz;
+  uint64_t next = sim_time_us() + period_us;
+
+  while (atomic_load(&ch->running) && !sim_stopping()) {
+    uint64_t now = sim_time_us();
+    if (now < next) {
+      sim_sleep_us(MIN(next - now, 1000));
+      continue;
+    }
+    next += period_us;
+
+    if (ch->rx) {
+      uint32_t done = ch->position;
+      ch->position = (ch->position + 1) % ch->cfg.dma_desc_num;
+      mic_fill(ch, ch->dma_bufs[done]);
+      stats->dma_buffers_received++;
+      stats->dma_bytes_received += ch->buf_size;
+      i2s_event_data_t event = {
+          .data = &ch->dma_bufs[done],
+          .dma_buf = ch->dma_bufs[done],
+          .size = ch->buf_size,
+      };
+      if (ch->callbacks.on_recv != NULL) {
+        ch->callbacks.on_recv(ch, &event, ch->user_data);
+      }
+      continue;
+    }
+
+    pthread_mutex_lock(&ch->lock);
+    uint32_t done = ch->position;
+    ch->position = (ch->position + 1) % ch->cfg.dma_desc_num;
+    stats->dma_buffers_played++;
+    stats->dma_bytes_played += ch->buf_size;
+    if (ch->filled[done] < ch->buf_size) {
+      stats->underruns++;
+    }
+    if (stats->first_audio_us == 0 && ch->filled[done] > 0) {
+      stats->first_audio_us = now - period_us; // it started a period ago
+    }
+    ch->filled[done] = 0;
+    if (ch->write_buf == (int32_t)done) {
+      ch->write_buf = -1; // played while still being written
+    }
+
+    // Hand the buffer to the writer, dropping the oldest on overflow
+    uint32_t desc_num = ch->cfg.dma_desc_num;
+    bool overflowed = ch->free_count == desc_num;
+    if (overflowed) {
+      ch->free_head = (ch->free_head + 1) % desc_num;
+      ch->free_count--;
+    }
+    ch->free_queue[(ch->free_head + ch->free_count) % desc_num] = done;
+    ch->free_count++;
+    pthread_cond_broadcast(&ch->freed);
+    pthread_mutex_unlock(&ch->lock);
+
+    i2s_event_data_t event = {
+        .data = &ch->dma_bufs[done],
+        .dma_buf = ch->dma_bufs[done],
+        .size = ch->buf_size,
+    };
+    if (overflowed && ch->callbacks.on_send_q_ovf != NULL) {
+      ch->callbacks.on_send_q_ovf(ch, &event, ch->user_data);
+    }
+    if (ch->callbacks.on_sent == NULL) {
+      continue;
+    }
+
+    uint64_t start = sim_wall_ns();
+    ch->callbacks.on_sent(ch, &event, ch->user_data);
+    uint64_t elapsed = sim_wall_ns() - start;
+
+    pthread_mutex_lock(&ch->lock);
+    ch->filled[done] = ch->buf_size;
+    pthread_mutex_unlock(&ch->lock);
+    stats->isr_calls++;
+    stats->isr_ns_total += elapsed;
+    stats->isr_ns_max = MAX(stats->isr_ns_max, elapsed);
+  }
+  return NULL;
+}
+
+static struct sim_i2s_channel *new_channel(const i2s_chan_config_t *chan_cfg,
+                                           bool rx) {
+  for (int i = 0; i < SIM_MAX_CHANNELS; ++i) {
+    if (!channels[i].used) {
+      memset(&channels[i], 0, sizeof(channels[i]));
+      channels[i].used = true;
+      channels[i].rx = rx;
+      channels[i].cfg = *chan_cfg;
+      channels[i].write_buf = -1;
+      pthread_mutex_init(&channels[i].lock, NULL);
+      pthread_cond_init(&channels[i].freed, NULL);
+      return &channels[i];
+    }
+  }
+  return NULL;
+}
+
+esp_err_t i2s_new_channel(const i2s_chan_config_t *chan_cfg,
+                          i2s_chan_handle_t *ret_tx_handle,
+                          i2s_chan_handle_t *ret_rx_handle) {
+  if (chan_cfg == NULL || (ret_tx_handle == NULL && ret_rx_handle == NULL)) {
+    return ESP_ERR_INVALID_ARG;
+  }
+
+  struct sim_i2s_channel *tx = NULL;
+  if (ret_tx_handle != NULL && (tx = new_channel(chan_cfg, false)) == NULL) {
+    return ESP_ERR_NOT_FOUND;
+  }
+  if (ret_rx_handle != NULL) {
+    struct sim_i2s_channel *rx = new_channel(chan_cfg, true);
+    if (rx == NULL) {
+      if (tx != NULL) {
+        tx->used = false;
+      }
+      return ESP_ERR_NOT_FOUND;
+    }
+    *ret_rx_handle = rx;
+  }
+  if (tx != NULL) {
+    *ret_tx_handle = tx;
+  }
+  return ESP_OK;
+}
+
+esp_err_t i2s_del_channel(i2s_chan_handle_t handle) {
+  if (handle == NULL || atomic_load(&handle->running)) {
+    return ESP_ERR_INVALID_STATE;
+  }
+  free_dma_buffers(handle);
+  handle->used = false;
+  return ESP_OK;
+}
+
+esp_err_t i2s_channel_init_std_mode(i2s_chan_handle_t handle,
+                                    const i2s_std_config_t *std_cfg) {
+  if (handle == NULL || std_cfg == NULL ||
+      std_cfg->clk_cfg.sample_rate_hz == 0) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  handle->std_cfg = *std_cfg;
+  return alloc_dma_buffers(handle);
+}
+
+esp_err_t i2s_channel_reconfig_std_clock(i2s_chan_handle_t handle,
+                                         const i2s_std_clk_config_t *clk_cfg) {
+  if (handle == NULL || clk_cfg == NULL || clk_cfg->sample_rate_hz == 0) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  if (atomic_load(&handle->running)) {
+    return ESP_ERR_INVALID_STATE;
+  }
+  handle->std_cfg.clk_cfg = *clk_cfg;
+  return ESP_OK;
+}
+
+esp_err_t i2s_channel_reconfig_std_slot(i2s_chan_handle_t handle,
+                                        const i2s_std_slot_config_t *slot_cfg) {
+  if (handle == NULL || slot_cfg == NULL) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  if (atomic_load(&handle->running)) {
+    return ESP_ERR_INVALID_STATE;
+  }
+  handle->std_cfg.slot_cfg = *slot_cfg;
+  return alloc_dma_buffers(handle);
+}
+
+esp_err_t i2s_channel_register_event_callback(
+    i2s_chan_handle_t handle, const i2s_event_callbacks_t *callbacks,
+    void *user_data) {
+  if (handle == NULL || callbacks == NULL) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  handle->callbacks = *callbacks;
+  handle->user_data = user_data;
+  return ESP_OK;
+}
+
+esp_err_t i2s_channel_preload_data(i2s_chan_handle_t tx_handle,
+                                   const void *src, size_t size,
+                                   size_t *bytes_loaded) {
+  if (tx_handle == NULL || tx_handle->rx || bytes_loaded == NULL ||
+      (src == NULL && size > 0)) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  if (atomic_load(&tx_handle->running)) {
+    return ESP_ERR_INVALID_STATE;
+  }
+
+  const uint8_t *in = src;
+  size_t loaded = 0;
+  for (uint32_t i = 0; i < tx_handle->cfg.dma_desc_num && loaded < size; ++i) {
+    uint32_t index = (tx_handle->position + i) % tx_handle->cfg.dma_desc_num;
+    size_t space = tx_handle->buf_size - tx_handle->filled[index];
+    size_t chunk = MIN(space, size - loaded);
+    memcpy(tx_handle->dma_bufs[index] + tx_handle->filled[index], in + loaded,
+           chunk);
+    tx_handle->filled[index] += chunk;
+    loaded += chunk;
+  }
+  sim_stats_mut()->i2s_bytes_preloaded += loaded;
+  *bytes_loaded = loaded;
+  return ESP_OK;
+}
+
+esp_err_t i2s_channel_write(i2s_chan_handle_t handle, const void *src,
+                            size_t size, size_t *bytes_written,
+                            uint32_t timeout_ms) {
+  if (handle == NULL || handle->rx || src == NULL || bytes_written == NULL) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  if (!atomic_load(&handle->running)) {
+    return ESP_ERR_INVALID_STATE;
+  }
+
+  const uint8_t *in = src;
+  uint64_t deadline = sim_time_us() + (uint64_t)timeout_ms * 1000;
+  esp_err_t ret = ESP_OK;
+  *bytes_written = 0;
+
+  pthread_mutex_lock(&handle->lock);
+  while (*bytes_written < size) {
+    if (handle->write_buf < 0) {
+      if (handle->free_count == 0) {
+        uint64_t now = sim_time_us();
+        if (now >= deadline || sim_stopping()) {
+          ret = ESP_ERR_TIMEOUT;
+          break;
+        }
+        uint64_t wall_ns = MIN(
+            (uint64_t)((deadline - now) * 1000.0 / sim_time_scale()), 2000000);
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        uint64_t abs_ns = (uint64_t)ts.tv_nsec + wall_ns;
+        ts.tv_sec += abs_ns / 1000000000ULL;
+        ts.tv_nsec = abs_ns % 1000000000ULL;
+        pthread_cond_timedwait(&handle->freed, &handle->lock, &ts);
+        continue;
+      }
+      handle->write_buf = handle->free_queue[handle->free_head];
+      handle->free_head = (handle->free_head + 1) % handle->cfg.dma_desc_num;
+      handle->free_count--;
+      handle->write_pos = 0;
+    }
+
+    size_t chunk = MIN(handle->buf_size - handle->write_pos,
+                       size - *bytes_written);
+    memcpy(handle->dma_bufs[handle->write_buf] + handle->write_pos,
+           in + *bytes_written, chunk);
+    handle->filled[handle->write_buf] += chunk;
+    handle->write_pos += chunk;
+    *bytes_written += chunk;
+    if (handle->write_pos == handle->buf_size) {
+      handle->write_buf = -1;
+    }
+  }
+  sim_stats_mut()->i2s_bytes_written += *bytes_written;
+  pthread_mutex_unlock(&handle->lock);
+
+  sim_exit_if_stopping();
+  return ret;
+}
+
+esp_err_t i2s_channel_enable(i2s_chan_handle_t handle) {
+  if (handle == NULL || handle->dma_bufs == NULL ||
+      atomic_load(&handle->running)) {
+    return ESP_ERR_INVALID_STATE;
+  }
+  handle->free_head = 0;
+  handle->free_count = 0;
+  handle->write_buf = -1;
+  atomic_store(&handle->running, true);
+  if (pthread_create(&handle->dma_thread, NULL, dma_engine, handle) != 0) {
+    atomic_store(&handle->running, false);
+    return ESP_FAIL;
+  }
+  return ESP_OK;
+}
+
+esp_err_t i2s_channel_disable(i2s_chan_handle_t handle) {
+  if (handle == NULL || !atomic_exchange(&handle->running, false)) {
+    return ESP_ERR_INVALID_STATE;
+  }
+  pthread_join(handle->dma_thread, NULL);
+  return ESP_OK;
+}
+
+void sim_i2s_stop_all(void) {
+  for (int i = 0; i < SIM_MAX_CHANNELS; ++i) {
+    if (channels[i].used && atomic_load(&channels[i].running)) {
+      i2s_channel_disable(&channels[i]);
+    }
+  }
+}
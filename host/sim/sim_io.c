@@ -0,0 +1,193 @@
+/*
+ * sim_io.c
+ *
+ * Counts the bytes the firmware moves in and out of files and charges the card
+ * cost model for them. Every executable linking the simulation is built with
+ * -Wl,--wrap=read,--wrap=write,--wrap=fopen,--wrap=fseek so those calls land
+ * here.
+ *
+ * Reads follow FatFs's f_read: from a sector boundary, whole sectors are read
+ * straight into the caller's buffer with one command per cluster, and a
+ * partial sector is read into the file's sector buffer, then copied out. The
+ * sector buffer holds one sector per file, so the next partial read of the
+ * same sector costs no card access.
+ *
+ * Writes follow f_write the same way: whole sectors from a sector boundary go
+ * straight to the card, a partial sector is first read into the sector buffer
+ * unless it already holds it, and the buffer is written back once a write
+ * moves on to another sector. Every card_busy_every-th write also waits out
+ * the card's busy period.
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "sim.h"
+
+#define SECTOR_SIZE 512
+#define CLUSTER_SECTORS 64
+#define MAX_FILES 64
+
+ssize_t __real_read(int fd, void *buf, size_t count);
+ssize_t __real_write(int fd, const void *buf, size_t count);
+FILE *__real_fopen(const char *path, const char *mode);
+int __real_fseek(FILE *stream, long offset, int whence);
+
+// Sector held in each open file's sector buffer, keyed by descriptor and
+// checked against the inode in case the descriptor was reused
+static struct {
+  ino_t inode;
+  int64_t sector;
+  bool dirty; ///< written to, not yet written back
+} windows[MAX_FILES];
+static pthread_mutex_t windows_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void charge_read(int fd, uint64_t position, uint64_t count) {
+  struct stat st;
+  bool tracked = fd >= 0 && fd < MAX_FILES && fstat(fd, &st) == 0;
+
+  pthread_mutex_lock(&windows_lock);
+  if (tracked && windows[fd].inode != st.st_ino) {
+    windows[fd].inode = st.st_ino;
+    windows[fd].sector = -1;
+    windows[fd].dirty = false;
+  }
+
+  while (count > 0) {
+    uint64_t offset = position % SECTOR_SIZE;
+    if (offset == 0 && count >= SECTOR_SIZE) {
+      uint64_t sector = position / SECTOR_SIZE;
+      uint64_t sectors = count / SECTOR_SIZE;
+      uint64_t to_cluster_end = CLUSTER_SECTORS - sector % CLUSTER_SECTORS;
+      sectors = sectors < to_cluster_end ? sectors : to_cluster_end;
+      pthread_mutex_unlock(&windows_lock);
+      sim_card_command(sectors);
+      pthread_mutex_lock(&windows_lock);
+      position += sectors * SECTOR_SIZE;
+      count -= sectors * SECTOR_SIZE;
+      continue;
+    }
+
+    int64_t sector = (int64_t)(position / SECTOR_SIZE);
+    if (!tracked || windows[fd].sector != sector) {
+      if (tracked) {
+        windows[fd].sector = sector;
+      }
+      pthread_mutex_unlock(&windows_lock);
+      sim_card_command(1);
+      pthread_mutex_lock(&windows_lock);
+    }
+    uint64_t copied = SECTOR_SIZE - offset < count ? SECTOR_SIZE - offset : count;
+    __atomic_fetch_add(&sim_stats_mut()->window_bytes, copied, __ATOMIC_RELAXED);
+    position += copied;
+    count -= copied;
+  }
+  pthread_mutex_unlock(&windows_lock);
+}
+
+ssize_t __wrap_read(int fd, void *buf, size_t count) {
+  off_t position = lseek(fd, 0, SEEK_CUR);
+  ssize_t result = __real_read(fd, buf, count);
+  if (result > 0) {
+    __atomic_fetch_add(&sim_stats_mut()->file_bytes_read, (uint64_t)result,
+                       __ATOMIC_RELAXED);
+    __atomic_fetch_add(&sim_stats_mut()->file_reads, 1, __ATOMIC_RELAXED);
+    sim_file_read_overhead();
+    if (position >= 0) {
+      charge_read(fd, (uint64_t)position, (uint64_t)result);
+    } else {
+      sim_card_command(((uint64_t)result + SECTOR_SIZE - 1) / SECTOR_SIZE);
+    }
+    sim_card_read_stall();
+  }
+  return result;
+}
+
+static void charge_write(int fd, uint64_t position, uint64_t count) {
+  struct stat st;
+  bool tracked = fd >= 0 && fd < MAX_FILES && fstat(fd, &st) == 0;
+
+  pthread_mutex_lock(&windows_lock);
+  if (tracked && windows[fd].inode != st.st_ino) {
+    windows[fd].inode = st.st_ino;
+    windows[fd].sector = -1;
+    windows[fd].dirty = false;
+  }
+
+  while (count > 0) {
+    uint64_t offset = position % SECTOR_SIZE;
+    if (offset == 0 && count >= SECTOR_SIZE) {
+      uint64_t sector = position / SECTOR_SIZE;
+      uint64_t sectors = count / SECTOR_SIZE;
+      uint64_t to_cluster_end = CLUSTER_SECTORS - sector % CLUSTER_SECTORS;
+      sectors = sectors < to_cluster_end ? sectors : to_cluster_end;
+      pthread_mutex_unlock(&windows_lock);
+      sim_card_command(sectors);
+      pthread_mutex_lock(&windows_lock);
+      position += sectors * SECTOR_SIZE;
+      count -= sectors * SECTOR_SIZE;
+      continue;
+    }
+
+    int64_t sector = (int64_t)(position / SECTOR_SIZE);
+    __atomic_fetch_add(&sim_stats_mut()->partial_sector_writes, 1,
+                       __ATOMIC_RELAXED);
+    if (!tracked || windows[fd].sector != sector) {
+      // Write back the sector held, then read in the one written to
+      int commands = tracked && windows[fd].dirty ? 2 : 1;
+      if (tracked) {
+        windows[fd].sector = sector;
+      }
+      pthread_mutex_unlock(&windows_lock);
+      for (int i = 0; i < commands; ++i) {
+        sim_card_command(1);
+      }
+      pthread_mutex_lock(&windows_lock);
+    }
+    if (tracked) {
+      windows[fd].dirty = true;
+    } else {
+      sim_card_command(1);
+    }
+    uint64_t copied = SECTOR_SIZE - offset < count ? SECTOR_SIZE - offset : count;
+    __atomic_fetch_add(&sim_stats_mut()->window_bytes, copied, __ATOMIC_RELAXED);
+    position += copied;
+    count -= copied;
+  }
+  pthread_mutex_unlock(&windows_lock);
+}
+
+ssize_t __wrap_write(int fd, const void *buf, size_t count) {
+  off_t position = lseek(fd, 0, SEEK_CUR);
+  ssize_t result = __real_write(fd, buf, count);
+  // Only regular files are on the card, not pipes or the terminal
+  if (result > 0 && position >= 0) {
+    __atomic_fetch_add(&sim_stats_mut()->file_bytes_written, (uint64_t)result,
+                       __ATOMIC_RELAXED);
+    __atomic_fetch_add(&sim_stats_mut()->file_writes, 1, __ATOMIC_RELAXED);
+    charge_write(fd, (uint64_t)position, (uint64_t)result);
+    sim_card_write_busy();
+  }
+  return result;
+}
+
+// Opening walks the directory for the name, then the first read fills the
+// stdio buffer with a sector
+FILE *__wrap_fopen(const char *path, const char *mode) {
+  FILE *file = __real_fopen(path, mode);
+  if (file != NULL) {
+    sim_card_access(sim_card_lookup_sectors(path) + 1);
+  }
+  return file;
+}
+
+// A seek drops the stdio buffer, so the next read costs a sector
+int __wrap_fseek(FILE *stream, long offset, int whence) {
+  int result = __real_fseek(stream, offset, whence);
+  if (result == 0) {
+    sim_card_access(1);
+  }
+  return result;
+}
@@ -0,0 +1,168 @@
+/*
+ * sim_queue.c
+ *
+ * FreeRTOS queue stand-in. Items are copied in and out under a mutex and
+ * receivers block on a condition variable until the simulated deadline.
+ */
+
+#include "freertos/queue.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "sim.h"
+
+struct sim_queue {
+  pthread_mutex_t lock;
+  pthread_cond_t changed;
+  uint8_t *items;
+  UBaseType_t length;
+  UBaseType_t item_size;
+  UBaseType_t head;  ///< next item to receive
+  UBaseType_t count;
+};
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size) {
+  if (length == 0 || item_size == 0) {
+    return NULL;
+  }
+  struct sim_queue *queue = calloc(1, sizeof(*queue));
+  if (queue == NULL) {
+    return NULL;
+  }
+  queue->items = malloc((size_t)length * item_size);
+  if (queue->items == NULL) {
+    free(queue);
+    return NULL;
+  }
+  queue->length = length;
+  queue->item_size = item_size;
+  pthread_mutex_init(&queue->lock, NULL);
+  pthread_cond_init(&queue->changed, NULL);
+  return queue;
+}
+
+void vQueueDelete(QueueHandle_t queue) {
+  if (queue == NULL) {
+    return;
+  }
+  pthread_mutex_destroy(&queue->lock);
+  pthread_cond_destroy(&queue->changed);
+  free(queue->items);
+  free(queue);
+}
+
+/** Wait on the queue's condition until the simulated deadline.
+ * @return false once it has passed. Exits the task on sim_stop(). */
+static bool wait_until(QueueHandle_t queue, uint64_t deadline_us) {
+  if (sim_stopping()) {
+    pthread_mutex_unlock(&queue->lock);
+    sim_exit_if_stopping();
+    pthread_mutex_lock(&queue->lock);
+    return false;
+  }
+  uint64_t now = sim_time_us();
+  if (now >= deadline_us) {
+    return false;
+  }
+
+  uint64_t wall_ns =
+      (uint64_t)((double)(deadline_us - now) * 1000.0 / sim_time_scale());
+  wall_ns = MIN(wall_ns, 2000000ULL);
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  uint64_t abs_ns = (uint64_t)ts.tv_nsec + wall_ns;
+  ts.tv_sec += abs_ns / 1000000000ULL;
+  ts.tv_nsec = abs_ns % 1000000000ULL;
+  pthread_cond_timedwait(&queue->changed, &queue->lock, &ts);
+  return true;
+}
+
+static uint64_t deadline_for(TickType_t ticks) {
+  if (ticks == portMAX_DELAY) {
+    return UINT64_MAX;
+  }
+  return sim_time_us() + (uint64_t)ticks * portTICK_PERIOD_MS * 1000;
+}
+
+static void push(QueueHandle_t queue, const void *item) {
+  UBaseType_t tail = (queue->head + queue->count) % queue->length;
+  memcpy(queue->items + (size_t)tail * queue->item_size, item,
+         queue->item_size);
+  queue->count++;
+  pthread_cond_broadcast(&queue->changed);
+}
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item,
+                      TickType_t ticks_to_wait) {
+  uint64_t deadline = deadline_for(ticks_to_wait);
+  pthread_mutex_lock(&queue->lock);
+  while (queue->count == queue->length) {
+    if (!wait_until(queue, deadline)) {
+      pthread_mutex_unlock(&queue->lock);
+      return pdFALSE;
+    }
+  }
+  push(queue, item);
+  pthread_mutex_unlock(&queue->lock);
+  return pdTRUE;
+}
+
+BaseType_t xQueueSendFromISR(QueueHandle_t queue, const void *item,
+                             BaseType_t *higher_priority_task_woken) {
+  if (higher_priority_task_woken != NULL) {
+    *higher_priority_task_woken = pdFALSE;
+  }
+  pthread_mutex_lock(&queue->lock);
+  BaseType_t sent = queue->count < queue->length ? pdTRUE : pdFALSE;
+  if (sent) {
+    push(queue, item);
+  }
+  pthread_mutex_unlock(&queue->lock);
+  return sent;
+}
+
+BaseType_t xQueueOverwrite(QueueHandle_t queue, const void *item) {
+  pthread_mutex_lock(&queue->lock);
+  // Only valid on queues of length one, as in FreeRTOS
+  queue->count = 0;
+  push(queue, item);
+  pthread_mutex_unlock(&queue->lock);
+  return pdPASS;
+}
+
+BaseType_t xQueueOverwriteFromISR(QueueHandle_t queue, const void *item,
+                                  BaseType_t *higher_priority_task_woken) {
+  if (higher_priority_task_woken != NULL) {
+    *higher_priority_task_woken = pdFALSE;
+  }
+  return xQueueOverwrite(queue, item);
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void *item,
+                         TickType_t ticks_to_wait) {
+  uint64_t deadline = deadline_for(ticks_to_wait);
+  pthread_mutex_lock(&queue->lock);
+  while (queue->count == 0) {
+    if (ticks_to_wait == 0 || !wait_until(queue, deadline)) {
+      pthread_mutex_unlock(&queue->lock);
+      return pdFALSE;
+    }
+  }
+  memcpy(item, queue->items + (size_t)queue->head * queue->item_size,
+         queue->item_size);
+  queue->head = (queue->head + 1) % queue->length;
+  queue->count--;
+  pthread_cond_broadcast(&queue->changed);
+  pthread_mutex_unlock(&queue->lock);
+  return pdTRUE;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue) {
+  pthread_mutex_lock(&queue->lock);
+  UBaseType_t count = queue->count;
+  pthread_mutex_unlock(&queue->lock);
+  return count;
+}
@@ -0,0 +1,195 @@
+/*
+ * sim_ringbuf.c
+ *
+ * Byte ring buffer with the same contract as the IDF RINGBUF_TYPE_BYTEBUF:
+ * sends are all-or-nothing, receives return the largest contiguous span up
+ * to the wrap point, and only one received item may be outstanding.
+ */
+
+#include "freertos/ringbuf.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sim.h"
+
+struct sim_ringbuf {
+  pthread_mutex_t lock;
+  pthread_cond_t changed;
+  uint8_t *storage;
+  size_t size;
+  size_t head;        ///< next write position
+  size_t tail;        ///< next read position
+  size_t used;        ///< bytes written and not yet returned
+  size_t outstanding; ///< size of the item currently handed out
+};
+
+RingbufHandle_t xRingbufferCreate(size_t buffer_size, RingbufferType_t type) {
+  if (type != RINGBUF_TYPE_BYTEBUF || buffer_size == 0) {
+    return NULL;
+  }
+
+  struct sim_ringbuf *rb = calloc(1, sizeof(*rb));
+  if (rb == NULL) {
+    return NULL;
+  }
+  rb->storage = malloc(buffer_size);
+  if (rb->storage == NULL) {
+    free(rb);
+    return NULL;
+  }
+  rb->size = buffer_size;
+  pthread_mutex_init(&rb->lock, NULL);
+  pthread_cond_init(&rb->changed, NULL);
+  return rb;
+}
+
+void vRingbufferDelete(RingbufHandle_t rb) {
+  if (rb == NULL) {
+    return;
+  }
+  pthread_mutex_destroy(&rb->lock);
+  pthread_cond_destroy(&rb->changed);
+  free(rb->storage);
+  free(rb);
+}
+
+/** Wait on the ring's condition for at most the given simulated ticks.
+ * @return false once the timeout has elapsed. Exits the task on sim_stop(). */
+static bool wait_ticks(RingbufHandle_t rb, uint64_t deadline_us) {
+  if (sim_stopping()) {
+    pthread_mutex_unlock(&rb->lock);
+    sim_exit_if_stopping();
+    pthread_mutex_lock(&rb->lock);
+    return false;
+  }
+  uint64_t now = sim_time_us();
+  if (now >= deadline_us) {
+    return false;
+  }
+
+  uint64_t wall_ns =
+      (uint64_t)((double)(deadline_us - now) * 1000.0 / sim_time_scale());
+  wall_ns = MIN(wall_ns, 2000000ULL);
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  uint64_t abs_ns = (uint64_t)ts.tv_nsec + wall_ns;
+  ts.tv_sec += abs_ns / 1000000000ULL;
+  ts.tv_nsec = abs_ns % 1000000000ULL;
+  pthread_cond_timedwait(&rb->changed, &rb->lock, &ts);
+  return true;
+}
+
+static uint64_t deadline_for(TickType_t ticks) {
+  if (ticks == portMAX_DELAY) {
+    return UINT64_MAX;
+  }
+  return sim_time_us() + (uint64_t)ticks * portTICK_PERIOD_MS * 1000;
+}
+
+BaseType_t xRingbufferSend(RingbufHandle_t rb, const void *item,
+                           size_t item_size, TickType_t ticks_to_wait) {
+  if (rb == NULL || item == NULL || item_size > rb->size) {
+    return pdFALSE;
+  }
+  sim_exit_if_stopping();
+
+  uint64_t deadline = deadline_for(ticks_to_wait);
+  pthread_mutex_lock(&rb->lock);
+  while (rb->size - rb->used < item_size) {
+    if (!wait_ticks(rb, deadline)) {
+      sim_stats_mut()->ringbuf_send_timeouts++;
+      pthread_mutex_unlock(&rb->lock);
+      return pdFALSE;
+    }
+  }
+
+  size_t first = MIN(item_size, rb->size - rb->head);
+  memcpy(rb->storage + rb->head, item, first);
+  memcpy(rb->storage, (const uint8_t *)item + first, item_size - first);
+  rb->head = (rb->head + item_size) % rb->size;
+  rb->used += item_size;
+  sim_stats_mut()->ringbuf_bytes_sent += item_size;
+
+  pthread_cond_broadcast(&rb->changed);
+  pthread_mutex_unlock(&rb->lock);
+  return pdTRUE;
+}
+
+/** Hand out the contiguous span at the read position. Caller holds the lock. */
+static void *take_locked(RingbufHandle_t rb, size_t *item_size,
+                         size_t max_size) {
+  size_t available = rb->used - rb->outstanding;
+  if (rb->outstanding != 0 || available == 0 || max_size == 0) {
+    return NULL;
+  }
+
+  size_t span = MIN(MIN(available, rb->size - rb->tail), max_size);
+  rb->outstanding = span;
+  *item_size = span;
+  sim_stats_mut()->ringbuf_bytes_received += span;
+  return rb->storage + rb->tail;
+}
+
+void *xRingbufferReceiveUpTo(RingbufHandle_t rb, size_t *item_size,
+                             TickType_t ticks_to_wait, size_t max_size) {
+  if (rb == NULL || item_size == NULL) {
+    return NULL;
+  }
+  sim_exit_if_stopping();
+
+  uint64_t deadline = deadline_for(ticks_to_wait);
+  pthread_mutex_lock(&rb->lock);
+  void *item;
+  while ((item = take_locked(rb, item_size, max_size)) == NULL) {
+    if (!wait_ticks(rb, deadline)) {
+      break;
+    }
+  }
+  pthread_mutex_unlock(&rb->lock);
+  return item;
+}
+
+void *xRingbufferReceiveUpToFromISR(RingbufHandle_t rb, size_t *item_size,
+                                    size_t max_size) {
+  if (rb == NULL || item_size == NULL) {
+    return NULL;
+  }
+
+  pthread_mutex_lock(&rb->lock);
+  void *item = take_locked(rb, item_size, max_size);
+  if (item != NULL) {
+    sim_stats_mut()->ringbuf_bytes_received_isr += *item_size;
+  }
+  pthread_mutex_unlock(&rb->lock);
+  return item;
+}
+
+void vRingbufferReturnItem(RingbufHandle_t rb, void *item) {
+  if (rb == NULL || item == NULL) {
+    return;
+  }
+
+  pthread_mutex_lock(&rb->lock);
+  rb->tail = (rb->tail + rb->outstanding) % rb->size;
+  rb->used -= rb->outstanding;
+  rb->outstanding = 0;
+  pthread_cond_broadcast(&rb->changed);
+  pthread_mutex_unlock(&rb->lock);
+}
+
+void vRingbufferReturnItemFromISR(RingbufHandle_t rb, void *item,
+                                  BaseType_t *higher_priority_task_woken) {
+  vRingbufferReturnItem(rb, item);
+  if (higher_priority_task_woken != NULL) {
+    *higher_priority_task_woken = pdFALSE;
+  }
+}
+
+size_t xRingbufferGetCurFreeSize(RingbufHandle_t rb) {
+  pthread_mutex_lock(&rb->lock);
+  size_t free_size = rb->size - rb->used;
+  pthread_mutex_unlock(&rb->lock);
+  return free_size;
+}
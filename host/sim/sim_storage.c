@@ -0,0 +1,532 @@
+/*
+ * sim_storage.c
+ *
+ * SD card, SPI bus and FatFs stand-ins. Mounting records the host directory
+ * behind the mount point; FatFs paths are resolved relative to it, while the
+ * firmware's POSIX calls (fopen/read/lseek) reach it directly through the
+ * host file system.
+ *
+ * Files are given clusters on the simulated card the first time FatFs opens
+ * them, in one contiguous run unless sim_card_fragment() split them first,
+ * so raw sector reads of the data area return the files' bytes. Sectors in
+ * front of the data area hold a fixed pattern.
+ */
+
+#include <dirent.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "driver/sdspi_host.h"
+#include "esp_vfs_fat.h"
+#include "ff.h"
+#include "sdmmc_cmd.h"
+#include "sim.h"
+
+// Simulated card: 4 GiB of 32 KiB clusters
+#define CARD_CLUSTER_SIZE 32768ULL
+#define CARD_CLUSTERS 131072ULL
+#define DIR_ENTRIES_PER_SECTOR 16
+
+static char mount_root[256] = ".";
+static sdmmc_card_t card;
+// Sector of cluster 2, after the reserved sectors and FATs
+#define CARD_DATA_START 8192
+#define CARD_SECTORS_PER_CLUSTER (CARD_CLUSTER_SIZE / 512)
+
+static FATFS fatfs = {.csize = CARD_SECTORS_PER_CLUSTER,
+                      .ssize = 512,
+                      .database = CARD_DATA_START};
+
+#define MAX_LAID_OUT_FILES 256
+#define MAX_RUNS 256
+
+struct laid_out_file {
+  dev_t dev;
+  ino_t inode;
+  off_t size;
+  char path[512];
+  uint32_t runs;
+  uint32_t run_start[MAX_RUNS]; ///< first cluster of each run
+  uint32_t run_length[MAX_RUNS];
+};
+
+static struct laid_out_file layout[MAX_LAID_OUT_FILES];
+static int laid_out_count;
+static uint32_t next_free_cluster = 3; // cluster 2 is the root directory
+static pthread_mutex_t layout_lock = PTHREAD_MUTEX_INITIALIZER;
+
+char *strnstr(const char *haystack, const char *needle, size_t len) {
+  size_t needle_len = strlen(needle);
+  if (needle_len == 0) {
+    return (char *)haystack;
+  }
+  for (size_t i = 0; i + needle_len <= len && haystack[i] != '\0'; ++i) {
+    if (strncmp(haystack + i, needle, needle_len) == 0) {
+      return (char *)haystack + i;
+    }
+  }
+  return NULL;
+}
+
+esp_err_t spi_bus_initialize(spi_host_device_t host_id,
+                             const spi_bus_config_t *bus_config, int dma_chan) {
+  (void)host_id;
+  (void)dma_chan;
+  return bus_config == NULL ? ESP_ERR_INVALID_ARG : ESP_OK;
+}
+
+static esp_err_t mount_card(const char *base_path, const sdmmc_host_t *host,
+                            uint32_t log_bus_width, sdmmc_card_t **out_card) {
+  struct stat st;
+  if (base_path == NULL || stat(base_path, &st) != 0 || !S_ISDIR(st.st_mode)) {
+    return ESP_FAIL;
+  }
+
+  snprintf(mount_root, sizeof(mount_root), "%s", base_path);
+  card.host = *host;
+  card.max_freq_khz = host->max_freq_khz;
+  card.real_freq_khz = host->max_freq_khz;
+  card.log_bus_width = log_bus_width;
+  card.csd.sector_size = 512;
+  card.csd.capacity = CARD_CLUSTERS * (CARD_CLUSTER_SIZE / 512);
+  sim_card_set_bus(card.real_freq_khz, 1u << log_bus_width);
+  if (out_card != NULL) {
+    *out_card = &card;
+  }
+  return ESP_OK;
+}
+
+esp_err_t esp_vfs_fat_sdspi_mount(const char *base_path,
+                                  const sdmmc_host_t *host_config_input,
+                                  const sdspi_device_config_t *slot_config,
+                                  const esp_vfs_fat_mount_config_t *mount_config,
+                                  sdmmc_card_t **out_card) {
+  (void)slot_config;
+  (void)mount_config;
+  return mount_card(base_path, host_config_input, 0, out_card);
+}
+
+esp_err_t esp_vfs_fat_sdmmc_mount(const char *base_path,
+                                  const sdmmc_host_t *host_config,
+                                  const sdmmc_slot_config_t *slot_config,
+                                  const esp_vfs_fat_mount_config_t *mount_config,
+                                  sdmmc_card_t **out_card) {
+  (void)mount_config;
+  uint32_t width = slot_config->width == 4 ? 2 : 0;
+  return mount_card(base_path, host_config, width, out_card);
+}
+
+static esp_err_t set_card_clk(uint32_t freq_khz) {
+  if (freq_khz == 0) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  card.real_freq_khz = (int)freq_khz;
+  sim_card_set_bus(freq_khz, 1u << card.log_bus_width);
+  return ESP_OK;
+}
+
+esp_err_t sdspi_host_set_card_clk(int handle, uint32_t freq_khz) {
+  (void)handle;
+  return set_card_clk(freq_khz);
+}
+
+esp_err_t sdmmc_host_set_card_clk(int slot, uint32_t freq_khz) {
+  (void)slot;
+  return set_card_clk(freq_khz);
+}
+
+esp_err_t sdspi_host_get_real_freq(int handle, int *real_freq_khz) {
+  (void)handle;
+  *real_freq_khz = card.real_freq_khz;
+  return ESP_OK;
+}
+
+esp_err_t sdmmc_host_get_real_freq(int slot, int *real_freq_khz) {
+  (void)slot;
+  *real_freq_khz = card.real_freq_khz;
+  return ESP_OK;
+}
+
+// Clusters for a file, in runs of clusters_per_run (0 for one run) with a
+// free cluster between runs. Called with layout_lock held.
+static struct laid_out_file *lay_out(const char *path, uint32_t clusters_per_run) {
+  struct stat st;
+  if (stat(path, &st) != 0 || !S_ISREG(st.st_mode)) {
+    return NULL;
+  }
+
+  struct laid_out_file *file = NULL;
+  for (int i = 0; i < laid_out_count; ++i) {
+    if (layout[i].dev == st.st_dev && layout[i].inode == st.st_ino) {
+      file = &layout[i];
+      break;
+    }
+  }
+  if (file != NULL && file->size == st.st_size && clusters_per_run == 0) {
+    return file;
+  }
+  if (file == NULL) {
+    if (laid_out_count == MAX_LAID_OUT_FILES) {
+      return NULL;
+    }
+    file = &layout[laid_out_count++];
+  }
+
+  file->dev = st.st_dev;
+  file->inode = st.st_ino;
+  file->size = st.st_size;
+  snprintf(file->path, sizeof(file->path), "%s", path);
+  file->runs = 0;
+
+  uint32_t clusters = (uint32_t)((st.st_size + CARD_CLUSTER_SIZE - 1) / CARD_CLUSTER_SIZE);
+  while (clusters > 0 && file->runs < MAX_RUNS) {
+    uint32_t length = clusters_per_run == 0 || file->runs == MAX_RUNS - 1
+                          ? clusters
+                          : (clusters < clusters_per_run ? clusters : clusters_per_run);
+    file->run_start[file->runs] = next_free_cluster;
+    file->run_length[file->runs] = length;
+    file->runs++;
+    next_free_cluster += length + 1;
+    clusters -= length;
+  }
+  return file;
+}
+
+bool sim_card_fragment(const char *path, uint32_t clusters_per_run) {
+  pthread_mutex_lock(&layout_lock);
+  bool laid_out = lay_out(path, clusters_per_run) != NULL;
+  pthread_mutex_unlock(&layout_lock);
+  return laid_out;
+}
+
+// Copies the file bytes behind a run of data area sectors, zeros where no
+// file has the cluster. Returns how many of the sectors it covered.
+static size_t read_data_sectors(uint8_t *out, size_t sector, size_t count) {
+  uint32_t cluster = 2 + (uint32_t)((sector - CARD_DATA_START) / CARD_SECTORS_PER_CLUSTER);
+  size_t in_cluster = (sector - CARD_DATA_START) % CARD_SECTORS_PER_CLUSTER;
+  size_t covered = CARD_SECTORS_PER_CLUSTER - in_cluster;
+  covered = covered < count ? covered : count;
+  memset(out, 0, covered * 512);
+
+  pthread_mutex_lock(&layout_lock);
+  for (int i = 0; i < laid_out_count; ++i) {
+    struct laid_out_file *file = &layout[i];
+    uint64_t file_cluster = 0;
+    for (uint32_t run = 0; run < file->runs; ++run) {
+      uint32_t start = file->run_start[run];
+      if (cluster >= start && cluster < start + file->run_length[run]) {
+        off_t offset = (off_t)((file_cluster + cluster - start) * CARD_CLUSTER_SIZE +
+                               in_cluster * 512);
+        int fd = open(file->path, O_RDONLY);
+        if (fd >= 0) {
+          if (pread(fd, out, covered * 512, offset) < 0) {
+            memset(out, 0, covered * 512);
+          }
+          close(fd);
+        }
+        pthread_mutex_unlock(&layout_lock);
+        return covered;
+      }
+      file_cluster += file->run_length[run];
+    }
+  }
+  pthread_mutex_unlock(&layout_lock);
+  return covered;
+}
+
+// Sectors in front of the data area hold a fixed pattern. Above the card's
+// clock limit a transfer picks up a flipped bit, and well above it fails its
+// CRC.
+esp_err_t sdmmc_read_sectors(sdmmc_card_t *card_info, void *dst,
+                             size_t start_sector, size_t sector_count) {
+  uint8_t *out = dst;
+  for (size_t sector = start_sector; sector < start_sector + sector_count;) {
+    if (sector >= CARD_DATA_START) {
+      size_t covered = read_data_sectors(out, sector,
+                                         start_sector + sector_count - sector);
+      out += covered * 512;
+      sector += covered;
+      continue;
+    }
+    uint32_t state = (uint32_t)sector * 2654435761u + 1;
+    for (size_t word = 0; word < 512 / 4; ++word) {
+      state ^= state << 13;
+      state ^= state >> 17;
+      state ^= state << 5;
+      memcpy(out, &state, 4);
+      out += 4;
+    }
+    ++sector;
+  }
+  sim_card_command(sector_count);
+
+  uint32_t max_khz = sim_card_max_khz();
+  uint32_t khz = (uint32_t)card_info->real_freq_khz;
+  if (max_khz != 0 && khz > max_khz) {
+    if (khz > max_khz + max_khz / 4) {
+      return ESP_ERR_INVALID_CRC;
+    }
+    ((uint8_t *)dst)[sector_count * 512 / 2] ^= 0x10;
+  }
+  return ESP_OK;
+}
+
+void sdmmc_card_print_info(FILE *stream, const sdmmc_card_t *card_info) {
+  fprintf(stream, "Name: SIMSD\nType: SDHC/SDXC (host directory %s)\n",
+          mount_root);
+  if (card_info == NULL) {
+    return;
+  }
+  fprintf(stream, "Speed: %d kHz\n", card_info->real_freq_khz);
+  fprintf(stream, "Bus width (1-bit): %d\n", 1 << card_info->log_bus_width);
+}
+
+static void host_path(char *out, size_t out_len, const char *path) {
+  while (*path == '/') {
+    ++path;
+  }
+  snprintf(out, out_len, "%s/%s", mount_root, path);
+}
+
+static void fill_info(FILINFO *fno, const char *name, const struct stat *st) {
+  struct tm tm;
+  localtime_r(&st->st_mtime, &tm);
+
+  snprintf(fno->fname, sizeof(fno->fname), "%s", name);
+  fno->fsize = (FSIZE_t)st->st_size;
+  fno->fattrib = S_ISDIR(st->st_mode) ? AM_DIR : AM_ARC;
+  fno->fdate = (WORD)(((tm.tm_year - 80) << 9) | ((tm.tm_mon + 1) << 5) |
+                      tm.tm_mday);
+  fno->ftime = (WORD)((tm.tm_hour << 11) | (tm.tm_min << 5) | (tm.tm_sec / 2));
+}
+
+uint64_t sim_card_lookup_sectors(const char *path) {
+  char dir_path[512];
+  snprintf(dir_path, sizeof(dir_path), "%s", path);
+  char *slash = strrchr(dir_path, '/');
+  if (slash != NULL) {
+    *slash = '\0';
+  } else {
+    snprintf(dir_path, sizeof(dir_path), ".");
+  }
+
+  DIR *dir = opendir(dir_path);
+  if (dir == NULL) {
+    return 1;
+  }
+
+  // FatFs scans the directory in order and stops at the matching entry. FAT
+  // directories keep creation order, which host inode numbers approximate.
+  struct stat target;
+  bool found = stat(path, &target) == 0;
+  uint64_t entries = 0;
+  struct dirent *entry;
+  while ((entry = readdir(dir)) != NULL) {
+    if (!found || entry->d_ino <= target.st_ino) {
+      ++entries;
+    }
+  }
+  closedir(dir);
+  return 1 + entries / DIR_ENTRIES_PER_SECTOR;
+}
+
+struct sim_dir {
+  DIR *dir;
+  char path[512];
+};
+
+FRESULT f_opendir(FF_DIR *dp, const char *path) {
+  struct sim_dir *handle = malloc(sizeof(*handle));
+  if (handle == NULL) {
+    return FR_INT_ERR;
+  }
+  host_path(handle->path, sizeof(handle->path), path);
+  handle->dir = opendir(handle->path);
+  if (handle->dir == NULL) {
+    free(handle);
+    return FR_NO_PATH;
+  }
+  dp->handle = handle;
+  dp->entries = 0;
+  return FR_OK;
+}
+
+FRESULT f_closedir(FF_DIR *dp) {
+  struct sim_dir *handle = dp->handle;
+  if (handle == NULL) {
+    return FR_INVALID_OBJECT;
+  }
+  closedir(handle->dir);
+  free(handle);
+  dp->handle = NULL;
+  return FR_OK;
+}
+
+FRESULT f_readdir(FF_DIR *dp, FILINFO *fno) {
+  struct sim_dir *handle = dp->handle;
+  if (handle == NULL) {
+    return FR_INVALID_OBJECT;
+  }
+
+  // FatFs never reports the dot entries of a directory.
+  struct dirent *entry;
+  do {
+    entry = readdir(handle->dir);
+  } while (entry != NULL && (strcmp(entry->d_name, ".") == 0 ||
+                             strcmp(entry->d_name, "..") == 0));
+
+  if (entry == NULL) {
+    fno->fname[0] = '\0';
+    return FR_OK;
+  }
+
+  if (dp->entries++ % DIR_ENTRIES_PER_SECTOR == 0) {
+    sim_card_access(1);
+  }
+  __atomic_fetch_add(&sim_stats_mut()->dir_entries_read, 1, __ATOMIC_RELAXED);
+
+  char full[768];
+  struct stat st;
+  snprintf(full, sizeof(full), "%s/%s", handle->path, entry->d_name);
+  if (stat(full, &st) != 0) {
+    return FR_DISK_ERR;
+  }
+  fill_info(fno, entry->d_name, &st);
+  return FR_OK;
+}
+
+FRESULT f_stat(const char *path, FILINFO *fno) {
+  char full[512];
+  struct stat st;
+  host_path(full, sizeof(full), path);
+  sim_card_access(sim_card_lookup_sectors(full));
+  if (stat(full, &st) != 0) {
+    return errno == ENOENT ? FR_NO_FILE : FR_DISK_ERR;
+  }
+  const char *name = strrchr(path, '/');
+  fill_info(fno, name != NULL ? name + 1 : path, &st);
+  return FR_OK;
+}
+
+// Clusters taken by everything under a host directory
+static uint64_t used_clusters(const char *path) {
+  DIR *dir = opendir(path);
+  if (dir == NULL) {
+    return 0;
+  }
+
+  uint64_t used = 1; // the directory's own entries
+  struct dirent *entry;
+  while ((entry = readdir(dir)) != NULL) {
+    if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+      continue;
+    }
+    char full[768];
+    struct stat st;
+    snprintf(full, sizeof(full), "%s/%s", path, entry->d_name);
+    if (stat(full, &st) != 0) {
+      continue;
+    }
+    if (S_ISDIR(st.st_mode)) {
+      used += used_clusters(full);
+    } else {
+      used += ((uint64_t)st.st_size + CARD_CLUSTER_SIZE - 1) / CARD_CLUSTER_SIZE;
+    }
+  }
+  closedir(dir);
+  return used;
+}
+
+// FAT32 keeps the free cluster count in its FSInfo sector
+FRESULT f_getfree(const char *path, DWORD *nclst, FATFS **fatfs_out) {
+  (void)path;
+  sim_card_access(1);
+  *nclst = (DWORD)(CARD_CLUSTERS - used_clusters(mount_root));
+  if (fatfs_out != NULL) {
+    *fatfs_out = &fatfs;
+  }
+  return FR_OK;
+}
+
+FRESULT f_open(FIL *fp, const char *path, BYTE mode) {
+  (void)mode;
+  char full[512];
+  host_path(full, sizeof(full), path);
+  sim_card_access(sim_card_lookup_sectors(full));
+
+  pthread_mutex_lock(&layout_lock);
+  struct laid_out_file *file = lay_out(full, 0);
+  if (file == NULL) {
+    pthread_mutex_unlock(&layout_lock);
+    return FR_NO_FILE;
+  }
+  fp->obj.fs = &fatfs;
+  fp->obj.sclust = file->runs > 0 ? file->run_start[0] : 0;
+  fp->obj.objsize = (FSIZE_t)file->size;
+  pthread_mutex_unlock(&layout_lock);
+
+  fp->flag = FA_READ;
+  fp->fptr = 0;
+  fp->cltbl = NULL;
+  return FR_OK;
+}
+
+FRESULT f_close(FIL *fp) {
+  fp->obj.fs = NULL;
+  return FR_OK;
+}
+
+static struct laid_out_file *file_at_cluster(DWORD cluster) {
+  for (int i = 0; i < laid_out_count; ++i) {
+    if (layout[i].runs > 0 && layout[i].run_start[0] == cluster) {
+      return &layout[i];
+    }
+  }
+  return NULL;
+}
+
+// Only CREATE_LINKMAP walks the FAT; other offsets just move the pointer
+FRESULT f_lseek(FIL *fp, FSIZE_t ofs) {
+  if (fp->obj.fs == NULL) {
+    return FR_INVALID_OBJECT;
+  }
+  if (ofs != CREATE_LINKMAP || fp->cltbl == NULL) {
+    fp->fptr = ofs < fp->obj.objsize ? ofs : fp->obj.objsize;
+    return FR_OK;
+  }
+
+  DWORD *tbl = fp->cltbl;
+  DWORD tlen = *tbl++;
+  DWORD ulen = 2;
+
+  pthread_mutex_lock(&layout_lock);
+  struct laid_out_file *file = file_at_cluster(fp->obj.sclust);
+  uint32_t clusters = 0;
+  for (uint32_t run = 0; file != NULL && run < file->runs; ++run) {
+    ulen += 2;
+    if (ulen <= tlen) {
+      *tbl++ = file->run_length[run];
+      *tbl++ = file->run_start[run];
+    }
+    clusters += file->run_length[run];
+  }
+  pthread_mutex_unlock(&layout_lock);
+
+  // Four bytes of FAT per cluster
+  sim_card_access((clusters * 4 + 511) / 512);
+
+  *fp->cltbl = ulen;
+  if (ulen > tlen) {
+    return FR_NOT_ENOUGH_CORE;
+  }
+  *tbl = 0;
+  return FR_OK;
+}
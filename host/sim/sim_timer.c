@@ -0,0 +1,149 @@
+/*
+ * sim_timer.c
+ *
+ * esp_timer stand-in. Armed timers are kept in a small table; one dispatch
+ * thread sleeps until the earliest expiry on the simulation clock and runs
+ * the callback, as the esp_timer task does.
+ */
+
+#include "esp_timer.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <sys/param.h>
+#include <time.h>
+
+#include "sim.h"
+
+#define SIM_MAX_TIMERS 8
+
+struct sim_timer {
+  esp_timer_cb_t callback;
+  void *arg;
+  uint64_t expiry_us; ///< 0 while not armed
+  bool used;
+};
+
+static struct sim_timer timers[SIM_MAX_TIMERS];
+static pthread_mutex_t timers_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t timers_changed = PTHREAD_COND_INITIALIZER;
+static pthread_t dispatch_thread;
+static bool dispatch_running;
+static bool dispatch_stopping;
+
+static void *dispatch(void *arg) {
+  (void)arg;
+  pthread_mutex_lock(&timers_lock);
+  while (!dispatch_stopping) {
+    struct sim_timer *next = NULL;
+    for (int i = 0; i < SIM_MAX_TIMERS; ++i) {
+      if (timers[i].used && timers[i].expiry_us != 0 &&
+          (next == NULL || timers[i].expiry_us < next->expiry_us)) {
+        next = &timers[i];
+      }
+    }
+
+    uint64_t now = sim_time_us();
+    if (next != NULL && next->expiry_us <= now) {
+      next->expiry_us = 0;
+      esp_timer_cb_t callback = next->callback;
+      void *callback_arg = next->arg;
+      pthread_mutex_unlock(&timers_lock);
+      callback(callback_arg);
+      pthread_mutex_lock(&timers_lock);
+      continue;
+    }
+
+    // Sleep until the next expiry, or briefly when nothing is armed
+    uint64_t wait_us = next != NULL ? next->expiry_us - now : 100000;
+    uint64_t wall_ns = (uint64_t)((double)wait_us * 1000.0 / sim_time_scale());
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    uint64_t abs_ns = (uint64_t)ts.tv_nsec + MIN(wall_ns, 100000000ULL);
+    ts.tv_sec += abs_ns / 1000000000ULL;
+    ts.tv_nsec = abs_ns % 1000000000ULL;
+    pthread_cond_timedwait(&timers_changed, &timers_lock, &ts);
+  }
+  pthread_mutex_unlock(&timers_lock);
+  return NULL;
+}
+
+esp_err_t esp_timer_create(const esp_timer_create_args_t *create_args,
+                           esp_timer_handle_t *out_handle) {
+  if (create_args == NULL || create_args->callback == NULL ||
+      out_handle == NULL) {
+    return ESP_ERR_INVALID_ARG;
+  }
+
+  pthread_mutex_lock(&timers_lock);
+  struct sim_timer *timer = NULL;
+  for (int i = 0; i < SIM_MAX_TIMERS && timer == NULL; ++i) {
+    if (!timers[i].used) {
+      timer = &timers[i];
+    }
+  }
+  if (timer == NULL) {
+    pthread_mutex_unlock(&timers_lock);
+    return ESP_ERR_NO_MEM;
+  }
+  timer->callback = create_args->callback;
+  timer->arg = create_args->arg;
+  timer->expiry_us = 0;
+  timer->used = true;
+
+  if (!dispatch_running) {
+    dispatch_stopping = false;
+    dispatch_running = pthread_create(&dispatch_thread, NULL, dispatch, NULL) == 0;
+  }
+  pthread_mutex_unlock(&timers_lock);
+
+  *out_handle = timer;
+  return ESP_OK;
+}
+
+esp_err_t esp_timer_start_once(esp_timer_handle_t timer, uint64_t timeout_us) {
+  pthread_mutex_lock(&timers_lock);
+  if (timer->expiry_us != 0) {
+    pthread_mutex_unlock(&timers_lock);
+    return ESP_ERR_INVALID_STATE;
+  }
+  timer->expiry_us = sim_time_us() + MAX(timeout_us, 1);
+  pthread_cond_broadcast(&timers_changed);
+  pthread_mutex_unlock(&timers_lock);
+  return ESP_OK;
+}
+
+esp_err_t esp_timer_stop(esp_timer_handle_t timer) {
+  pthread_mutex_lock(&timers_lock);
+  bool armed = timer->expiry_us != 0;
+  timer->expiry_us = 0;
+  pthread_mutex_unlock(&timers_lock);
+  return armed ? ESP_OK : ESP_ERR_INVALID_STATE;
+}
+
+esp_err_t esp_timer_delete(esp_timer_handle_t timer) {
+  pthread_mutex_lock(&timers_lock);
+  timer->used = false;
+  timer->expiry_us = 0;
+  pthread_mutex_unlock(&timers_lock);
+  return ESP_OK;
+}
+
+void sim_timer_stop_all(void) {
+  pthread_mutex_lock(&timers_lock);
+  if (!dispatch_running) {
+    pthread_mutex_unlock(&timers_lock);
+    return;
+  }
+  dispatch_stopping = true;
+  pthread_cond_broadcast(&timers_changed);
+  pthread_mutex_unlock(&timers_lock);
+
+  pthread_join(dispatch_thread, NULL);
+  pthread_mutex_lock(&timers_lock);
+  dispatch_running = false;
+  for (int i = 0; i < SIM_MAX_TIMERS; ++i) {
+    timers[i].used = false;
+  }
+  pthread_mutex_unlock(&timers_lock);
+}
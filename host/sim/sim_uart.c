@@ -0,0 +1,36 @@
+/*
+ * sim_uart.c
+ *
+ * UART stand-in: the driver installs, and reads time out with no input.
+ */
+
+#include "driver/uart.h"
+
+#include "sim.h"
+
+esp_err_t uart_driver_install(uart_port_t uart_num, int rx_buffer_size,
+                              int tx_buffer_size, int queue_size,
+                              void *uart_queue, int intr_alloc_flags) {
+  (void)uart_num;
+  (void)rx_buffer_size;
+  (void)tx_buffer_size;
+  (void)queue_size;
+  (void)uart_queue;
+  (void)intr_alloc_flags;
+  return ESP_OK;
+}
+
+int uart_read_bytes(uart_port_t uart_num, void *buf, uint32_t length,
+                    TickType_t ticks_to_wait) {
+  (void)uart_num;
+  (void)buf;
+  (void)length;
+  // Wait in slices so sim_stop() can end a task waiting forever
+  uint64_t wait_us = (uint64_t)ticks_to_wait * portTICK_PERIOD_MS * 1000;
+  if (ticks_to_wait == portMAX_DELAY || wait_us > 100000) {
+    wait_us = 100000;
+  }
+  sim_sleep_us(wait_us);
+  sim_exit_if_stopping();
+  return 0;
+}
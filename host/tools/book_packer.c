@@ -0,0 +1,70 @@
+/*
+ * book_packer.c
+ *
+ * Packs a book directory's WAV files into one book pack (src/book_pack.h).
+ * Copy the pack into the card's book directory, best onto a freshly
+ * formatted card so it lies in one run of clusters and is read raw, and the
+ * firmware plays it in place of the loose tracks.
+ *
+ * --bits and --rate must match the firmware build's I2S_SAMPLE_BITS and
+ * OUTPUT_SAMPLE_RATE: 16 bits and each track's own rate by default. --taps
+ * is the resampling filter length, RESAMPLE_TAPS. PACK defaults to
+ * BOOK_DIR/BOOK.MBP.
+ *
+ * Usage: book_packer [--bits 16|32] [--rate HZ] [--taps N] [--quiet]
+ *                    BOOK_DIR [PACK]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "book_pack.h"
+#include "packer.h"
+#include "resample.h"
+
+static int usage(void) {
+  fprintf(stderr, "Usage: book_packer [--bits 16|32] [--rate HZ] [--taps N] "
+                  "[--quiet] BOOK_DIR [PACK]\n");
+  return 2;
+}
+
+int main(int argc, char **argv) {
+  packer_options_t options = {.sample_bits = 16, .sample_rate = 0, .taps = 16, .verbose = true};
+  const char *paths[2] = {NULL, NULL};
+  int num_paths = 0;
+
+  for (int i = 1; i < argc; ++i) {
+    bool has_value = i + 1 < argc;
+    if (strcmp(argv[i], "--bits") == 0 && has_value) {
+      options.sample_bits = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--rate") == 0 && has_value) {
+      options.sample_rate = (uint32_t)strtoul(argv[++i], NULL, 10);
+    } else if (strcmp(argv[i], "--taps") == 0 && has_value) {
+      options.taps = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--quiet") == 0) {
+      options.verbose = false;
+    } else if (argv[i][0] != '-' && num_paths < 2) {
+      paths[num_paths++] = argv[i];
+    } else {
+      return usage();
+    }
+  }
+  if (num_paths == 0 || options.taps < 2 || options.taps > RESAMPLE_MAX_TAPS ||
+      options.taps % 2 != 0) {
+    return usage();
+  }
+
+  char default_pack[4096];
+  if (paths[1] == NULL) {
+    snprintf(default_pack, sizeof(default_pack), "%s/%s", paths[0], BOOK_PACK_FILE);
+    paths[1] = default_pack;
+  }
+
+  int packed = packer_write(paths[0], paths[1], &options);
+  if (packed < 0) {
+    return 1;
+  }
+  printf("%d tracks packed into %s\n", packed, paths[1]);
+  return 0;
+}
@@ -0,0 +1,372 @@
+/*
+ * packer.c
+ *
+ * Finds a book's tracks, numbers their pages as the firmware does
+ * (src/file_managment.c), and writes each one converted to the format the
+ * firmware plays it in, with src/convert.c and src/resample.c.
+ */
+
+#include "packer.h"
+
+#include <ctype.h>
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+
+#include "book_pack.h"
+#include "convert.h"
+#include "file_managment.h"
+#include "resample.h"
+#include "tinywav.h"
+
+// Page id given to files without a number while scanning
+#define UNNUMBERED_PAGE UINT16_MAX
+
+typedef struct source {
+  char path[MAX_PATH_LENGTH]; // relative to the book directory
+  uint16_t page;
+} source_t;
+
+typedef struct sources {
+  source_t *items;
+  int count;
+  int capacity;
+} sources_t;
+
+static bool is_wav_file(const char *name) {
+  size_t length = strlen(name);
+  return length > 4 && strcasecmp(name + length - 4, ".wav") == 0;
+}
+
+// Page id from the first number in a file name
+static uint16_t page_from_name(const char *name) {
+  while (*name != '\0' && !isdigit((unsigned char)*name)) {
+    ++name;
+  }
+  if (*name == '\0') {
+    return UNNUMBERED_PAGE;
+  }
+  unsigned long page = strtoul(name, NULL, 10);
+  return page < UNNUMBERED_PAGE ? (uint16_t)page : UNNUMBERED_PAGE;
+}
+
+static bool add_source(sources_t *sources, const char *path, const char *name) {
+  if (sources->count == sources->capacity) {
+    int capacity = sources->capacity == 0 ? 16 : sources->capacity * 2;
+    source_t *grown = realloc(sources->items, capacity * sizeof(source_t));
+    if (grown == NULL) {
+      return false;
+    }
+    sources->items = grown;
+    sources->capacity = capacity;
+  }
+  source_t *source = &sources->items[sources->count++];
+  snprintf(source->path, sizeof(source->path), "%s", path);
+  source->page = page_from_name(name);
+  return true;
+}
+
+// Walk a directory of the book, relative to book_dir, adding every WAV file
+// in it and its subdirectories
+static bool scan_directory(const char *book_dir, const char *path, int depth,
+                           sources_t *sources) {
+  char dir_path[2 * MAX_PATH_LENGTH];
+  snprintf(dir_path, sizeof(dir_path), "%s/%s", book_dir, path);
+  DIR *dir = opendir(dir_path);
+  if (dir == NULL) {
+    perror(dir_path);
+    return false;
+  }
+
+  bool ok = true;
+  struct dirent *entry;
+  while (ok && (entry = readdir(dir)) != NULL) {
+    if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+      continue;
+    }
+    char entry_path[MAX_PATH_LENGTH];
+    int length = snprintf(entry_path, sizeof(entry_path), "%s%s%s", path,
+                          path[0] != '\0' ? "/" : "", entry->d_name);
+    if (length + 1 > MAX_PATH_LENGTH) {
+      fprintf(stderr, "Path too long, skipping %s\n", entry->d_name);
+      continue;
+    }
+
+    char full_path[2 * MAX_PATH_LENGTH];
+    snprintf(full_path, sizeof(full_path), "%s/%s", book_dir, entry_path);
+    struct stat st;
+    if (stat(full_path, &st) != 0) {
+      continue;
+    }
+    if (S_ISDIR(st.st_mode)) {
+      if (depth < MAX_BOOK_DEPTH) {
+        ok = scan_directory(book_dir, entry_path, depth + 1, sources);
+      }
+    } else if (is_wav_file(entry->d_name)) {
+      ok = add_source(sources, entry_path, entry->d_name);
+    }
+  }
+  closedir(dir);
+  return ok;
+}
+
+static int compare_sources(const void *a, const void *b) {
+  const source_t *source_a = a;
+  const source_t *source_b = b;
+  if (source_a->page != source_b->page) {
+    return source_a->page < source_b->page ? -1 : 1;
+  }
+  return strcmp(source_a->path, source_b->path);
+}
+
+// Sort by page id, numbering the files without one after the highest page
+// and dropping files that repeat a page, as number_tracks() does
+static void number_sources(sources_t *sources) {
+  qsort(sources->items, sources->count, sizeof(source_t), compare_sources);
+
+  int numbered = 0;
+  while (numbered < sources->count &&
+         sources->items[numbered].page != UNNUMBERED_PAGE) {
+    numbered++;
+  }
+  uint32_t next_page = numbered > 0 ? sources->items[numbered - 1].page + 1u : 1u;
+  for (int i = numbered; i < sources->count; ++i) {
+    sources->items[i].page = next_page < UNNUMBERED_PAGE ? next_page++ : UNNUMBERED_PAGE;
+  }
+
+  int kept = 0;
+  for (int i = 0; i < sources->count; ++i) {
+    source_t *source = &sources->items[i];
+    if (source->page == UNNUMBERED_PAGE ||
+        (kept > 0 && sources->items[kept - 1].page == source->page)) {
+      fprintf(stderr, "Skipping %s, its page is already taken\n", source->path);
+      continue;
+    }
+    sources->items[kept++] = *source;
+  }
+  sources->count = kept;
+}
+
+static const char *format_name(const TinyWav *tw) {
+  static const char *names[] = {"?", "u8", "s16", "s24", "f32", "s32"};
+  if (tw->h.AudioFormat == TINYWAV_FORMAT_IMA_ADPCM) {
+    return "ima";
+  }
+  return tw->sampFmt <= TW_INT32 ? names[tw->sampFmt] : "?";
+}
+
+// A track's samples as played: read whole, converted to the sample width and
+// resampled. The track's frame count and loop are updated to match.
+static void *convert_track(TinyWav *tw, const packer_options_t *options,
+                           uint32_t *frames, uint32_t *rate,
+                           uint32_t *loop_start, uint32_t *loop_end) {
+  const int channels = tw->numChannels;
+  const size_t in_frame = (size_t)channels * tinywav_sample_size(tw->sampFmt);
+  const size_t out_frame = (size_t)channels * options->sample_bits / 8;
+  uint32_t wanted = (uint32_t)tw->numFramesInHeader;
+
+  uint8_t *raw = malloc(wanted * in_frame + 1);
+  uint32_t got = 0;
+  while (raw != NULL && got < wanted) {
+    int read = tinywav_read_f(tw, raw + got * in_frame, (int)((wanted - got) * in_frame));
+    if (read <= 0) {
+      break;
+    }
+    got += (uint32_t)read;
+  }
+
+  // A loop past the frames the file holds is dropped, as sections would
+  // loop where they end
+  *loop_end = tw->loopEnd <= got ? tw->loopEnd : 0;
+  *loop_start = *loop_end != 0 ? tw->loopStart : 0;
+  *frames = got;
+  *rate = tw->h.SampleRate;
+
+  uint8_t *converted = raw != NULL ? malloc(got * out_frame + 1) : NULL;
+  if (converted == NULL) {
+    free(raw);
+    return NULL;
+  }
+  convert_fn_t convert = convert_select(tw->sampFmt, options->sample_bits);
+  if (convert != NULL) {
+    convert(converted, raw, (size_t)got * channels);
+  } else {
+    memcpy(converted, raw, got * out_frame);
+  }
+  free(raw);
+
+  if (options->sample_rate == 0 || options->sample_rate == tw->h.SampleRate) {
+    return converted;
+  }
+
+  // Silence either side of the track centres the first output frame's filter
+  // on the first frame, as sections do, and lets the last ones finish
+  resampler_t resampler;
+  if (!resampler_init(&resampler, tw->h.SampleRate, options->sample_rate, channels,
+                      options->taps)) {
+    free(converted);
+    return NULL;
+  }
+  size_t lead = options->taps / 2 - 1;
+  size_t in_frames = lead + got + options->taps / 2;
+  uint8_t *input = calloc(in_frames, out_frame);
+  uint32_t out_frames =
+      (uint32_t)((uint64_t)got * options->sample_rate / tw->h.SampleRate);
+  uint8_t *resampled = malloc(out_frames * out_frame + 1);
+  if (input == NULL || resampled == NULL) {
+    free(input);
+    free(resampled);
+    free(converted);
+    resampler_free(&resampler);
+    return NULL;
+  }
+  memcpy(input + lead * out_frame, converted, got * out_frame);
+  free(converted);
+
+  int made = options->sample_bits == 16
+                 ? resample_s16(&resampler, (int16_t *)resampled, out_frames,
+                                (const int16_t *)input, in_frames)
+                 : resample_s32(&resampler, (int32_t *)resampled, out_frames,
+                                (const int32_t *)input, in_frames);
+  free(input);
+  resampler_free(&resampler);
+
+  *loop_start = (uint32_t)((uint64_t)*loop_start * options->sample_rate / *rate);
+  *loop_end = (uint32_t)((uint64_t)*loop_end * options->sample_rate / *rate);
+  if (*loop_end > (uint32_t)made || *loop_end <= *loop_start) {
+    *loop_start = *loop_end = 0;
+  }
+  *frames = (uint32_t)made;
+  *rate = options->sample_rate;
+  return resampled;
+}
+
+static bool pad_to_sector(FILE *pack) {
+  static const uint8_t zeros[BOOK_PACK_ALIGN];
+  long position = ftell(pack);
+  size_t padding = (BOOK_PACK_ALIGN - position % BOOK_PACK_ALIGN) % BOOK_PACK_ALIGN;
+  return position >= 0 && fwrite(zeros, 1, padding, pack) == padding;
+}
+
+// The entry's name is only for logs, so a path too long for it keeps its end,
+// where the file name is
+static void set_entry_name(book_pack_entry_t *entry, const char *path) {
+  size_t length = strlen(path);
+  if (length < sizeof(entry->name)) {
+    memcpy(entry->name, path, length + 1);
+    return;
+  }
+  memcpy(entry->name, "...", 3);
+  memcpy(entry->name + 3, path + length - (sizeof(entry->name) - 4), sizeof(entry->name) - 3);
+}
+
+static bool pack_track(FILE *pack, const char *book_dir, const source_t *source,
+                       const packer_options_t *options, book_pack_entry_t *entry) {
+  char path[2 * MAX_PATH_LENGTH];
+  snprintf(path, sizeof(path), "%s/%s", book_dir, source->path);
+  TinyWav tw;
+  if (tinywav_open_read(&tw, path, TW_INTERLEAVED) != 0) {
+    fprintf(stderr, "%s: not a WAV file TinyWav reads\n", path);
+    return false;
+  }
+  if ((tw.numChannels != 1 && tw.numChannels != 2) ||
+      !convert_supported(tw.sampFmt, options->sample_bits)) {
+    fprintf(stderr, "%s: %d channels of %d bit samples cannot be played\n", path,
+            tw.numChannels, tw.h.BitsPerSample);
+    tinywav_close_read(&tw);
+    return false;
+  }
+
+  uint32_t frames, rate, loop_start, loop_end;
+  void *samples = convert_track(&tw, options, &frames, &rate, &loop_start, &loop_end);
+  if (samples == NULL || frames == 0) {
+    fprintf(stderr, "%s: %s\n", path, samples == NULL ? "out of memory" : "no audio");
+    free(samples);
+    tinywav_close_read(&tw);
+    return false;
+  }
+
+  memset(entry, 0, sizeof(*entry));
+  entry->page = source->page;
+  entry->channels = (uint8_t)tw.numChannels;
+  entry->sample_format = options->sample_bits == 16 ? TW_INT16 : TW_INT32;
+  entry->sample_rate = rate;
+  entry->data_offset = (uint32_t)ftell(pack);
+  entry->data_size = frames * tw.numChannels * (options->sample_bits / 8);
+  entry->loop_start = loop_start;
+  entry->loop_end = loop_end;
+  entry->loudness = tw.loudness;
+  set_entry_name(entry, source->path);
+
+  bool written = fwrite(samples, 1, entry->data_size, pack) == entry->data_size &&
+                 pad_to_sector(pack);
+  if (written && options->verbose) {
+    printf("page %-5u %-32s %-3s %5lu Hz %d ch -> s%d %5lu Hz, %lu bytes at %lu\n",
+           (unsigned)entry->page, source->path, format_name(&tw),
+           (unsigned long)tw.h.SampleRate, tw.numChannels, options->sample_bits,
+           (unsigned long)rate, (unsigned long)entry->data_size,
+           (unsigned long)entry->data_offset);
+  }
+  free(samples);
+  tinywav_close_read(&tw);
+  return written;
+}
+
+int packer_write(const char *book_dir, const char *pack_path,
+                 const packer_options_t *options) {
+  if (options->sample_bits != 16 && options->sample_bits != 32) {
+    fprintf(stderr, "Tracks play at 16 or 32 bits, not %d\n", options->sample_bits);
+    return -1;
+  }
+
+  sources_t sources = {NULL, 0, 0};
+  if (!scan_directory(book_dir, "", 0, &sources)) {
+    free(sources.items);
+    return -1;
+  }
+  number_sources(&sources);
+  if (sources.count == 0) {
+    fprintf(stderr, "%s: no WAV files to pack\n", book_dir);
+    free(sources.items);
+    return -1;
+  }
+
+  FILE *pack = fopen(pack_path, "wb");
+  if (pack == NULL) {
+    perror(pack_path);
+    free(sources.items);
+    return -1;
+  }
+
+  // The table is written last, once every track's offset is known
+  book_pack_header_t header = {.magic = BOOK_PACK_MAGIC,
+                               .version = BOOK_PACK_VERSION,
+                               .entry_size = sizeof(book_pack_entry_t),
+                               .num_tracks = (uint32_t)sources.count,
+                               .pack_size = 0};
+  book_pack_entry_t *entries = calloc(sources.count, sizeof(book_pack_entry_t));
+  bool ok = entries != NULL &&
+            fseek(pack, sizeof(header) + sources.count * sizeof(book_pack_entry_t), SEEK_SET) == 0 &&
+            pad_to_sector(pack);
+  for (int i = 0; ok && i < sources.count; ++i) {
+    ok = pack_track(pack, book_dir, &sources.items[i], options, &entries[i]);
+  }
+
+  long size = ftell(pack);
+  header.pack_size = (uint32_t)size;
+  ok = ok && size > 0 && size <= (long)UINT32_MAX && fseek(pack, 0, SEEK_SET) == 0 &&
+       fwrite(&header, sizeof(header), 1, pack) == 1 &&
+       fwrite(entries, sizeof(book_pack_entry_t), sources.count, pack) == (size_t)sources.count;
+  ok = fclose(pack) == 0 && ok;
+  if (!ok) {
+    fprintf(stderr, "Could not write %s\n", pack_path);
+    remove(pack_path);
+  }
+
+  free(entries);
+  free(sources.items);
+  return ok ? (int)header.num_tracks : -1;
+}
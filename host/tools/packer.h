@@ -0,0 +1,29 @@
+/*
+ * packer.h
+ *
+ * Writes book packs (src/book_pack.h), for the book_packer tool and the
+ * benchmarks.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef struct packer_options {
+  int sample_bits;      ///< the firmware's I2S_SAMPLE_BITS, 16 or 32
+  uint32_t sample_rate; ///< its OUTPUT_SAMPLE_RATE, 0 to keep each track's
+  int taps;             ///< its RESAMPLE_TAPS
+  bool verbose;         ///< print a line per track packed
+} packer_options_t;
+
+/**
+ * Pack the WAV files under book_dir, up to MAX_BOOK_DEPTH directories down,
+ * into pack_path. Pages are numbered from the file names as the firmware
+ * numbers loose tracks, and the samples converted with the firmware's own
+ * kernels, so a packed track plays as the loose one would.
+ *
+ * @return  The number of tracks packed, or -1 with the reason on stderr.
+ */
+int packer_write(const char *book_dir, const char *pack_path,
+                 const packer_options_t *options);
@@ -15,43 +15,13 @@
  */
 
 #include "tinywav.h"
+#include <stdlib.h>
 #include <string.h> // for memcpy
 #include <unistd.h>
 #include "esp_attr.h"
 
-// MARK: Processor Helpers
-#if !defined(TINYWAV_USE_ALLOCA) && !defined(TINYWAV_USE_VLA) &&               \
-    !defined(TINYWAV_USE_MALLOC)
-#define TINYWAV_USE_ALLOCA 1 // default
-#endif
-
-#if defined(_WIN32) && (TINYWAV_USE_ALLOCA || TINYWAV_USE_MALLOC)
-#include <malloc.h>
-#elif TINYWAV_USE_ALLOCA
-#include <alloca.h>
-#elif TINYWAV_USE_MALLOC
-#include <stdlib.h>
-#elif TINYWAV_USE_VLA
-#if _MSC_VER && (__STDC__ || __STDC_NO_VLA__)
-#pragma message("Cannot use VLA -- MSVC is not a C99-compliant compiler!")
-#elif defined(__STDC__) && (__STDC_VERSION__ < 199901L)
-#error Cannot use VLA -- C standard must be at least C99 / have VLA support!
-#endif
-#endif
-
-#if TINYWAV_USE_ALLOCA
-#define TW_ALLOC(type, var, sz) type *var = (type *)alloca((sz) * sizeof(type))
-#elif TINYWAV_USE_VLA
-#define TW_ALLOC(type, var, sz) type var[(sz)]
-#elif TINYWAV_USE_MALLOC
-#define TW_ALLOC(type, var, sz) type *var = (type *)malloc((sz) * sizeof(type))
-#endif
-
-#if TINYWAV_USE_MALLOC
-#define TW_DEALLOC(x) free(x)
-#else
-#define TW_DEALLOC(x)
-#endif
+/// Bytes of the header tinywav_open_write() writes
+#define TW_HEADER_SIZE 44
 
 // MARK: private functions
 
@@ -65,6 +35,304 @@ static bool chunkIDMatches(char chunk[4], const char *chunkName) {
   return true;
 }
 
+/** Lay the header out as the file stores it. @returns its size. */
+static uint32_t packHeader(const TinyWavHeader *h, uint8_t *out) {
+  uint8_t *p = out;
+#define TW_PUT(field) (memcpy(p, &(field), sizeof(field)), p += sizeof(field))
+  TW_PUT(h->ChunkID);
+  TW_PUT(h->ChunkSize);
+  TW_PUT(h->Format);
+  TW_PUT(h->Subchunk1ID);
+  TW_PUT(h->Subchunk1Size);
+  TW_PUT(h->AudioFormat);
+  TW_PUT(h->NumChannels);
+  TW_PUT(h->SampleRate);
+  TW_PUT(h->ByteRate);
+  TW_PUT(h->BlockAlign);
+  TW_PUT(h->BitsPerSample);
+  TW_PUT(h->Subchunk2ID);
+  TW_PUT(h->Subchunk2Size);
+#undef TW_PUT
+  return (uint32_t)(p - out);
+}
+
+// MARK: IMA ADPCM
+
+// Step sizes and index adjustments of the IMA ADPCM recommended practice
+static const DRAM_ATTR int16_t imaStepTable[89] = {
+    7,     8,     9,     10,    11,    12,    13,    14,    16,    17,
+    19,    21,    23,    25,    28,    31,    34,    37,    41,    45,
+    50,    55,    60,    66,    73,    80,    88,    97,    107,   118,
+    130,   143,   157,   173,   190,   209,   230,   253,   279,   307,
+    337,   371,   408,   449,   494,   544,   598,   658,   724,   796,
+    876,   963,   1060,  1166,  1282,  1411,  1552,  1707,  1878,  2066,
+    2272,  2499,  2749,  3024,  3327,  3660,  4026,  4428,  4871,  5358,
+    5894,  6484,  7132,  7845,  8630,  9493,  10442, 11487, 12635, 13899,
+    15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794, 32767};
+
+static const DRAM_ATTR int8_t imaIndexTable[16] = {
+    -1, -1, -1, -1, 2, 4, 6, 8, -1, -1, -1, -1, 2, 4, 6, 8};
+
+/** Frames in a block of len bytes: the header's sample, then eight per four
+ * byte word of each channel. */
+static uint32_t adpcmBlockFrames(const TinyWav *tw, uint32_t len) {
+  uint32_t header = 4 * tw->numChannels;
+  if (len < header) {
+    return 0;
+  }
+  return (len - header) / header * 8 + 1;
+}
+
+/** Reads the first forward loop of a smpl chunk of size bytes, from its
+ * start, into loopStart and loopEnd, and skips to the chunk's end. */
+static void readSmplLoop(TinyWav *tw, uint32_t size) {
+  long end = ftell(tw->f) + size + (size & 1);
+  // 36 bytes of sampler details, the last two the loop count and the size of
+  // the sampler specific data after the loops, then 24 bytes per loop
+  uint32_t fields[9];
+  uint32_t loop[6];
+  if (size >= sizeof(fields) &&
+      fread(fields, sizeof(uint32_t), 9, tw->f) == 9) {
+    for (uint32_t i = 0; i < fields[7] && 36 + (i + 1) * 24 <= size; ++i) {
+      if (fread(loop, sizeof(uint32_t), 6, tw->f) != 6) {
+        break;
+      }
+      // Type 0 loops forward; the end is the loop's last frame
+      if (loop[1] == 0) {
+        tw->loopStart = loop[2];
+        tw->loopEnd = loop[3] + 1;
+        break;
+      }
+    }
+  }
+  fseek(tw->f, end, SEEK_SET);
+}
+
+/** Reads the integrated loudness of a bext chunk of size bytes, from its
+ * start, into loudness, and skips to the chunk's end. Only version 2 of the
+ * chunk (EBU Tech 3285) has it, 412 bytes in. */
+static void readBextLoudness(TinyWav *tw, uint32_t size) {
+  long end = ftell(tw->f) + size + (size & 1);
+  uint16_t version;
+  int16_t loudness;
+  if (size >= 414 && fseek(tw->f, 346, SEEK_CUR) == 0 &&
+      fread(&version, sizeof(version), 1, tw->f) == 1 && version >= 2 &&
+      fseek(tw->f, 64, SEEK_CUR) == 0 &&
+      fread(&loudness, sizeof(loudness), 1, tw->f) == 1) {
+    tw->loudness = loudness;
+  }
+  fseek(tw->f, end, SEEK_SET);
+}
+
+/** Checks the block layout and sizes the frame count and read ahead buffer.
+ * @returns 0, or -1 for a layout this decoder does not handle. */
+static int open_adpcm(TinyWav *tw, uint32_t factFrames) {
+  uint32_t header = 4 * tw->numChannels;
+  if (tw->numChannels < 1 || tw->numChannels > TINYWAV_ADPCM_MAX_CHANNELS ||
+      tw->h.BlockAlign <= header || (tw->h.BlockAlign - header) % header != 0) {
+    printf("[tinywav] Error: IMA ADPCM with %d channels and %d byte blocks "
+           "is not supported.\n",
+           tw->numChannels, tw->h.BlockAlign);
+    return -1;
+  }
+
+  tw->adpcmFramesPerBlock = adpcmBlockFrames(tw, tw->h.BlockAlign);
+  uint32_t blocks = tw->h.Subchunk2Size / tw->h.BlockAlign;
+  uint32_t frames = blocks * tw->adpcmFramesPerBlock +
+                    adpcmBlockFrames(tw, tw->h.Subchunk2Size % tw->h.BlockAlign);
+  // The last block is padded out; the fact chunk says where the audio ends
+  tw->numFramesInHeader =
+      factFrames > 0 && factFrames < frames ? factFrames : frames;
+
+  uint32_t perRead = (TINYWAV_ADPCM_READ_SIZE + tw->h.BlockAlign - 1) / tw->h.BlockAlign;
+  tw->adpcmBufSize = perRead * tw->h.BlockAlign;
+  tw->adpcmBuf = (uint8_t *)malloc(tw->adpcmBufSize);
+  tw->adpcmBufLen = 0;
+  tw->adpcmBlockPos = 0;
+  tw->adpcmFrame = 0;
+  tw->adpcmSkip = 0;
+  return tw->adpcmBuf != NULL ? 0 : -1;
+}
+
+/** Decodes one nibble of a channel, updating its predictor and step index. */
+static inline int32_t adpcmExpand(int32_t *predictor, int32_t *index,
+                                  uint32_t nibble) {
+  int32_t step = imaStepTable[*index];
+  int32_t diff = step >> 3;
+  if (nibble & 1) {
+    diff += step >> 2;
+  }
+  if (nibble & 2) {
+    diff += step >> 1;
+  }
+  if (nibble & 4) {
+    diff += step;
+  }
+  int32_t p = (nibble & 8) ? *predictor - diff : *predictor + diff;
+  *predictor = p > INT16_MAX ? INT16_MAX : p < INT16_MIN ? INT16_MIN : p;
+
+  int32_t i = *index + imaIndexTable[nibble];
+  *index = i < 0 ? 0 : i > 88 ? 88 : i;
+  return *predictor;
+}
+
+/** Decodes frames [tw->adpcmFrame, + frames) of block into out, interleaved.
+ * Runs of eight frames that start a word are decoded a word per channel. */
+static void IRAM_ATTR adpcmDecode(TinyWav *tw, const uint8_t *block,
+                                  int16_t *out, uint32_t frames) {
+  const int channels = tw->numChannels;
+  const uint8_t *data = block + 4 * channels;
+  uint32_t f = tw->adpcmFrame;
+  uint32_t end = f + frames;
+
+  if (f == 0 && end > 0) {
+    for (int c = 0; c < channels; ++c) {
+      const uint8_t *h = block + 4 * c;
+      tw->adpcmPredictor[c] = (int16_t)(h[0] | (h[1] << 8));
+      tw->adpcmIndex[c] = h[2] > 88 ? 88 : h[2];
+      out[c] = tw->adpcmPredictor[c];
+    }
+    out += channels;
+    f = 1;
+  }
+
+  while (f < end) {
+    uint32_t j = f - 1; // sample in the channel's nibbles
+    const uint8_t *word = data + (j / 8) * 4 * channels;
+
+    if ((j & 7) == 0 && end - f >= 8) {
+      for (int c = 0; c < channels; ++c, word += 4) {
+        int32_t predictor = tw->adpcmPredictor[c];
+        int32_t index = tw->adpcmIndex[c];
+        int16_t *o = out + c;
+        for (int b = 0; b < 4; ++b, o += 2 * channels) {
+          o[0] = (int16_t)adpcmExpand(&predictor, &index, word[b] & 0x0f);
+          o[channels] = (int16_t)adpcmExpand(&predictor, &index, word[b] >> 4);
+        }
+        tw->adpcmPredictor[c] = (int16_t)predictor;
+        tw->adpcmIndex[c] = (uint8_t)index;
+      }
+      out += 8 * channels;
+      f += 8;
+    } else {
+      for (int c = 0; c < channels; ++c) {
+        uint8_t byte = word[4 * c + (j & 7) / 2];
+        int32_t predictor = tw->adpcmPredictor[c];
+        int32_t index = tw->adpcmIndex[c];
+        out[c] = (int16_t)adpcmExpand(&predictor, &index,
+                                      (j & 1) ? byte >> 4 : byte & 0x0f);
+        tw->adpcmPredictor[c] = (int16_t)predictor;
+        tw->adpcmIndex[c] = (uint8_t)index;
+      }
+      out += channels;
+      f++;
+    }
+  }
+  tw->adpcmFrame = (uint16_t)end;
+}
+
+static uint32_t read_aligned(TinyWav *tw, uint8_t *out, uint32_t len);
+
+/** Reads up to len bytes of the sample data as stored, from dataPos.
+ * @returns the bytes read, 0 at the end of the data, or -1 on error. */
+static int IRAM_ATTR readStored(TinyWav *tw, uint8_t *out, uint32_t len) {
+  uint32_t left = tw->h.Subchunk2Size - tw->dataPos;
+  if (len > left) {
+    len = left;
+  }
+
+  if (tw->readBuf != NULL) {
+    return (int)read_aligned(tw, out, len);
+  }
+  int got = (int)read(tw->fileno, out, len);
+  if (got > 0) {
+    tw->dataPos += got;
+  }
+  return got;
+}
+
+/** Reads the next whole blocks into adpcmBuf. @returns the bytes read, 0 at
+ * the end of the data, or -1 on error. */
+static int IRAM_ATTR adpcmFill(TinyWav *tw) {
+  int got = readStored(tw, tw->adpcmBuf, tw->adpcmBufSize);
+  tw->adpcmBufLen = got > 0 ? (uint32_t)got : 0;
+  tw->adpcmBlockPos = 0;
+  return got;
+}
+
+/** Decodes up to frames frames into out. @returns the frames decoded, or -1
+ * on a read error. */
+static int IRAM_ATTR read_adpcm(TinyWav *tw, int16_t *out, uint32_t frames) {
+  uint32_t done = 0;
+  uint32_t left = tw->numFramesInHeader - tw->totalFramesReadWritten;
+  if (frames > left) {
+    frames = left;
+  }
+
+  while (done < frames) {
+    uint32_t blockLen = tw->adpcmBufLen - tw->adpcmBlockPos;
+    if (blockLen > tw->h.BlockAlign) {
+      blockLen = tw->h.BlockAlign;
+    }
+    uint32_t blockFrames = adpcmBlockFrames(tw, blockLen);
+
+    if (tw->adpcmFrame >= blockFrames) {
+      // Move on to the next block, reading more once they run out
+      if (blockFrames > 0) {
+        tw->adpcmBlockPos += blockLen;
+        tw->adpcmFrame = 0;
+        if (tw->adpcmBlockPos < tw->adpcmBufLen) {
+          continue;
+        }
+      }
+      int got = adpcmFill(tw);
+      tw->adpcmFrame = 0;
+      if (got <= 0) {
+        if (got < 0 && done == 0) {
+          return -1;
+        }
+        break;
+      }
+      continue;
+    }
+
+    const uint8_t *block = tw->adpcmBuf + tw->adpcmBlockPos;
+
+    // After a seek, decode up to the frame it landed on
+    while (tw->adpcmSkip > 0) {
+      int16_t scratch[8 * TINYWAV_ADPCM_MAX_CHANNELS];
+      uint32_t n = tw->adpcmSkip < 8 ? tw->adpcmSkip : 8;
+      adpcmDecode(tw, block, scratch, n);
+      tw->adpcmSkip -= n;
+    }
+
+    uint32_t n = blockFrames - tw->adpcmFrame;
+    if (n > frames - done) {
+      n = frames - done;
+    }
+    adpcmDecode(tw, block, out + done * tw->numChannels, n);
+    done += n;
+  }
+  tw->totalFramesReadWritten += done;
+  return (int)done;
+}
+
+/** Moves the decoder to frame, from the start of its block. */
+static int adpcmSeek(TinyWav *tw, uint32_t frame) {
+  uint32_t block = frame / tw->adpcmFramesPerBlock;
+  tw->totalFramesReadWritten = frame;
+  tw->dataPos = block * tw->h.BlockAlign;
+  tw->adpcmBufLen = 0;
+  tw->adpcmBlockPos = 0;
+  tw->adpcmFrame = 0;
+  tw->adpcmSkip = (uint16_t)(frame % tw->adpcmFramesPerBlock);
+  if (tw->readBuf == NULL &&
+      lseek(tw->fileno, tw->dataStart + (long)tw->dataPos, SEEK_SET) < 0) {
+    return -1;
+  }
+  return 0;
+}
+
 // MARK: public functions
 
 int tinywav_open_write(TinyWav *tw, int16_t numChannels, int32_t samplerate,
@@ -113,12 +381,12 @@ int tinywav_open_write(TinyWav *tw, int16_t numChannels, int32_t samplerate,
   tw->h.Subchunk1ID[2] = 't';
   tw->h.Subchunk1ID[3] = ' ';
   tw->h.Subchunk1Size = 16;              // PCM
-  tw->h.AudioFormat = (tw->sampFmt - 1); // 1 PCM, 3 IEEE float
+  tw->h.AudioFormat = tw->sampFmt == TW_FLOAT32 ? 3 : 1; // 1 PCM, 3 IEEE float
   tw->h.NumChannels = numChannels;
   tw->h.SampleRate = samplerate;
-  tw->h.ByteRate = samplerate * numChannels * tw->sampFmt;
-  tw->h.BlockAlign = numChannels * tw->sampFmt;
-  tw->h.BitsPerSample = 8 * tw->sampFmt;
+  tw->h.ByteRate = samplerate * numChannels * tinywav_sample_size(sampFmt);
+  tw->h.BlockAlign = numChannels * tinywav_sample_size(sampFmt);
+  tw->h.BitsPerSample = 8 * tinywav_sample_size(sampFmt);
   tw->h.Subchunk2ID[0] = 'd';
   tw->h.Subchunk2ID[1] = 'a';
   tw->h.Subchunk2ID[2] = 't';
@@ -126,22 +394,12 @@ int tinywav_open_write(TinyWav *tw, int16_t numChannels, int32_t samplerate,
   tw->h.Subchunk2Size = 0; // fill this in on file-close
 
   // write WAV header
-  size_t elementCount = fwrite(tw->h.ChunkID, sizeof(char), 4, tw->f);
-  elementCount += fwrite(&tw->h.ChunkSize, sizeof(uint32_t), 1, tw->f);
-  elementCount += fwrite(tw->h.Format, sizeof(char), 4, tw->f);
-  elementCount += fwrite(tw->h.Subchunk1ID, sizeof(char), 4, tw->f);
-  elementCount += fwrite(&tw->h.Subchunk1Size, sizeof(uint32_t), 1, tw->f);
-  elementCount += fwrite(&tw->h.AudioFormat, sizeof(uint16_t), 1, tw->f);
-  elementCount += fwrite(&tw->h.NumChannels, sizeof(uint16_t), 1, tw->f);
-  elementCount += fwrite(&tw->h.SampleRate, sizeof(uint32_t), 1, tw->f);
-  elementCount += fwrite(&tw->h.ByteRate, sizeof(uint32_t), 1, tw->f);
-  elementCount += fwrite(&tw->h.BlockAlign, sizeof(uint16_t), 1, tw->f);
-  elementCount += fwrite(&tw->h.BitsPerSample, sizeof(uint16_t), 1, tw->f);
-  elementCount += fwrite(tw->h.Subchunk2ID, sizeof(char), 4, tw->f);
-  elementCount += fwrite(&tw->h.Subchunk2Size, sizeof(uint32_t), 1, tw->f);
-  if (elementCount != 25) {
+  uint8_t header[TW_HEADER_SIZE];
+  uint32_t headerLen = packHeader(&tw->h, header);
+  if (fwrite(header, 1, headerLen, tw->f) != headerLen) {
     return -1;
   }
+  tw->writeBuf = NULL;
 
   return 0;
 }
@@ -166,6 +424,8 @@ int tinywav_open_read(TinyWav *tw, const char *path,
     perror("[tinywav] Failed to open file for reading");
     return -1;
   }
+  tw->fileno = fileno(tw->f);
+  tw->adpcmBuf = NULL;
 
   // Parse WAV header
   /** @note: We do this byte-by-byte to avoid dependencies (htonl() et al.) and
@@ -207,38 +467,256 @@ int tinywav_open_read(TinyWav *tw, const char *path,
     return -1;
   }
 
+  // WAVE_FORMAT_EXTENSIBLE keeps the format code in the first two bytes of
+  // its sub format GUID, 24 bytes into the fmt chunk
+  if (tw->h.AudioFormat == 0xFFFE && tw->h.Subchunk1Size >= 26) {
+    fseek(tw->f, data_chunk_start + 24, SEEK_SET);
+    if (fread(&tw->h.AudioFormat, sizeof(uint16_t), 1, tw->f) != 1) {
+      tinywav_close_read(tw);
+      return -1;
+    }
+  }
+
   fseek(tw->f, data_chunk_start + tw->h.Subchunk1Size, SEEK_SET);
 
   // skip over any other chunks before the "data" chunk (e.g. JUNK, INFO, bext,
-  // ...)
+  // ...), keeping the frame count of a "fact" chunk, the loop of a "smpl"
+  // chunk and the loudness of a "bext" chunk
+  uint32_t factFrames = 0;
+  tw->loopStart = 0;
+  tw->loopEnd = 0;
+  tw->loudness = TINYWAV_LOUDNESS_UNKNOWN;
   while (fread(tw->h.Subchunk2ID, sizeof(char), 4, tw->f) == 4) {
     fread(&tw->h.Subchunk2Size, sizeof(uint32_t), 1, tw->f);
     if (chunkIDMatches(tw->h.Subchunk2ID, "data")) {
       break;
+    } else if (chunkIDMatches(tw->h.Subchunk2ID, "fact") &&
+               tw->h.Subchunk2Size >= 4 &&
+               fread(&factFrames, sizeof(uint32_t), 1, tw->f) == 1) {
+      fseek(tw->f, tw->h.Subchunk2Size - 4, SEEK_CUR);
+    } else if (chunkIDMatches(tw->h.Subchunk2ID, "smpl")) {
+      readSmplLoop(tw, tw->h.Subchunk2Size);
+    } else if (chunkIDMatches(tw->h.Subchunk2ID, "bext")) {
+      readBextLoudness(tw, tw->h.Subchunk2Size);
     } else {
       fseek(tw->f, tw->h.Subchunk2Size, SEEK_CUR); // skip this subchunk
     }
   }
+  long data_start = ftell(tw->f);
+
+  // Editors mostly write the smpl chunk after the data, and tagging tools the
+  // bext chunk
+  if ((tw->loopEnd == 0 || tw->loudness == TINYWAV_LOUDNESS_UNKNOWN) &&
+      fseek(tw->f, data_start + tw->h.Subchunk2Size + (tw->h.Subchunk2Size & 1),
+            SEEK_SET) == 0) {
+    char id[4];
+    uint32_t size;
+    while ((tw->loopEnd == 0 || tw->loudness == TINYWAV_LOUDNESS_UNKNOWN) &&
+           fread(id, sizeof(char), 4, tw->f) == 4 &&
+           fread(&size, sizeof(uint32_t), 1, tw->f) == 1) {
+      if (chunkIDMatches(id, "smpl") && tw->loopEnd == 0) {
+        readSmplLoop(tw, size);
+      } else if (chunkIDMatches(id, "bext") &&
+                 tw->loudness == TINYWAV_LOUDNESS_UNKNOWN) {
+        readBextLoudness(tw, size);
+      } else if (fseek(tw->f, size + (size & 1), SEEK_CUR) != 0) {
+        break;
+      }
+    }
+  }
+  fseek(tw->f, data_start, SEEK_SET);
 
   tw->numChannels = tw->h.NumChannels;
   tw->chanFmt = chanFmt;
 
   if (tw->h.BitsPerSample == 32 && tw->h.AudioFormat == 3) {
     tw->sampFmt = TW_FLOAT32; // file has 32-bit IEEE float samples
-  } else if (tw->h.BitsPerSample == 16 && tw->h.AudioFormat == 1) {
-    tw->sampFmt = TW_INT16; // file has 16-bit int samples
+  } else if (tw->h.AudioFormat == 1 && tw->h.BitsPerSample == 8) {
+    tw->sampFmt = TW_UINT8;
+  } else if (tw->h.AudioFormat == 1 && tw->h.BitsPerSample == 16) {
+    tw->sampFmt = TW_INT16;
+  } else if (tw->h.AudioFormat == 1 && tw->h.BitsPerSample == 24) {
+    tw->sampFmt = TW_INT24;
+  } else if (tw->h.AudioFormat == 1 && tw->h.BitsPerSample == 32) {
+    tw->sampFmt = TW_INT32;
+  } else if (tw->h.AudioFormat == TINYWAV_FORMAT_IMA_ADPCM &&
+             tw->h.BitsPerSample == 4) {
+    tw->sampFmt = TW_INT16; // as decoded
+  } else {
+    printf("[tinywav] Error: wav file has format %d with %d bits per sample, "
+           "which is not supported.\n",
+           tw->h.AudioFormat, tw->h.BitsPerSample);
+    tinywav_close_read(tw);
+    return -1;
+  }
+
+  if (tw->h.AudioFormat == TINYWAV_FORMAT_IMA_ADPCM) {
+    if (open_adpcm(tw, factFrames) != 0) {
+      tinywav_close_read(tw);
+      return -1;
+    }
+  } else if (tw->numChannels < 1 ||
+             tw->h.BlockAlign != tw->numChannels * tinywav_sample_size(tw->sampFmt)) {
+    tinywav_close_read(tw);
+    return -1;
   } else {
-    tw->sampFmt = TW_FLOAT32;
-    printf("[tinywav] Warning: wav file has %d bits per sample (int), which is "
-           "not natively supported yet. Treating them as float; you may want "
-           "to convert them manually after reading.\n",
-           tw->h.BitsPerSample);
+    tw->numFramesInHeader = tw->h.Subchunk2Size / tw->h.BlockAlign;
+  }
+
+  // A loop must lie within the audio
+  if (tw->loopEnd <= tw->loopStart ||
+      tw->loopEnd > (uint32_t)tw->numFramesInHeader) {
+    tw->loopStart = 0;
+    tw->loopEnd = 0;
   }
 
-  tw->numFramesInHeader = tw->h.Subchunk2Size / (tw->numChannels * tw->sampFmt);
   tw->totalFramesReadWritten = 0;
   tw->fileno = fileno(tw->f);
+  tw->dataStart = ftell(tw->f);
+  tw->dataPos = 0;
+  tw->readBuf = NULL;
+  tw->sectorReader = NULL;
+  tw->bytesStaged = 0;
+
+  // The decoder reads the descriptor, which stdio has read ahead of, as do
+  // plain reads; looking for a smpl chunk after the data moved it further
+  if (tw->adpcmBuf != NULL ? adpcmSeek(tw, 0) != 0
+                           : lseek(tw->fileno, tw->dataStart, SEEK_SET) != tw->dataStart) {
+    tinywav_close_read(tw);
+    return -1;
+  }
+
+  return 0;
+}
+
+/** Reads len bytes, a whole number of sectors, from the sector aligned file
+ * offset, through the sector reader when one is set. @returns the number of
+ * bytes read, less than len only at the end of the file, or -1 on error. */
+static ssize_t IRAM_ATTR read_sectors(TinyWav *tw, long offset, void *dst,
+                                      uint32_t len) {
+  if (tw->sectorReader != NULL) {
+    int sectors = tw->sectorReader(tw->sectorReaderContext,
+                                   (uint32_t)(offset / TINYWAV_SECTOR_SIZE), dst,
+                                   len / TINYWAV_SECTOR_SIZE);
+    return sectors < 0 ? -1 : (ssize_t)sectors * TINYWAV_SECTOR_SIZE;
+  }
+
+  if (tw->filePos != offset) {
+    if (lseek(tw->fileno, offset, SEEK_SET) != offset) {
+      tw->filePos = -1;
+      return -1;
+    }
+    tw->filePos = offset;
+  }
+  ssize_t got = read(tw->fileno, dst, len);
+  tw->filePos = got > 0 ? tw->filePos + got : -1;
+  return got;
+}
+
+/** Reads len bytes of sample data from whole sectors, see
+ * tinywav_set_read_buffer(). @returns the number of bytes read. */
+static uint32_t IRAM_ATTR read_aligned(TinyWav *tw, uint8_t *out, uint32_t len) {
+  uint32_t done = 0;
+
+  while (done < len) {
+    long offset = tw->dataStart + (long)tw->dataPos;
+    uint32_t n;
+
+    if (offset >= tw->readBufOffset &&
+        offset < tw->readBufOffset + (long)tw->readBufLen) {
+      n = (uint32_t)(tw->readBufOffset + (long)tw->readBufLen - offset);
+      if (n > len - done) {
+        n = len - done;
+      }
+      memcpy(out + done, tw->readBuf + (offset - tw->readBufOffset), n);
+      tw->bytesStaged += n;
+    } else {
+      long sector = offset - offset % TINYWAV_SECTOR_SIZE;
+
+      if (offset == sector && len - done >= TINYWAV_SECTOR_SIZE) {
+        n = (len - done) - (len - done) % TINYWAV_SECTOR_SIZE;
+        ssize_t got = read_sectors(tw, sector, out + done, n);
+        if (got <= 0) {
+          break;
+        }
+        n = (uint32_t)got < n ? (uint32_t)got : n;
+      } else {
+        // Small requests read ahead a whole readBuf; the tail of a large one
+        // only reads the sector it ends in
+        uint32_t fill = tw->readBufSize;
+        if (len >= TINYWAV_SECTOR_SIZE) {
+          uint32_t tail = (uint32_t)(offset - sector) + (len - done);
+          tail += TINYWAV_SECTOR_SIZE - 1;
+          tail -= tail % TINYWAV_SECTOR_SIZE;
+          fill = tail < fill ? tail : fill;
+        }
+        ssize_t got = read_sectors(tw, sector, tw->readBuf, fill);
+        tw->readBufOffset = sector;
+        tw->readBufLen = got > 0 ? (uint32_t)got : 0;
+        if (got <= 0 || offset >= sector + got) {
+          break;
+        }
+        continue;
+      }
+    }
+
+    done += n;
+    tw->dataPos += n;
+  }
+  return done;
+}
+
+int tinywav_set_sector_reader(TinyWav *tw, TinyWavSectorReader reader,
+                              void *context) {
+  if (tw == NULL || tw->readBuf == NULL) {
+    return -1;
+  }
+  tw->sectorReader = reader;
+  tw->sectorReaderContext = context;
+  tw->readBufLen = 0;
+  return 0;
+}
 
+int tinywav_set_read_buffer(TinyWav *tw, void *read_buffer,
+                            uint32_t read_buffer_len) {
+  if (tw == NULL || read_buffer == NULL || read_buffer_len == 0 ||
+      read_buffer_len % TINYWAV_SECTOR_SIZE != 0 || !tinywav_isOpen(tw)) {
+    return -1;
+  }
+
+  tw->readBuf = (uint8_t *)read_buffer;
+  tw->readBufSize = read_buffer_len;
+  tw->readBufLen = 0;
+  tw->readBufOffset = 0;
+  tw->filePos = -1;
+  if (tw->adpcmBuf != NULL) {
+    return adpcmSeek(tw, tw->totalFramesReadWritten);
+  }
+  tw->dataPos = tw->totalFramesReadWritten * tw->h.BlockAlign;
+  return 0;
+}
+
+int tinywav_seek_data(TinyWav *tw, uint32_t offset) {
+  if (tw != NULL && tw->adpcmBuf != NULL) {
+    uint32_t frame = offset / (2 * tw->numChannels);
+    if (!tinywav_isOpen(tw) || frame > (uint32_t)tw->numFramesInHeader) {
+      return -1;
+    }
+    return adpcmSeek(tw, frame);
+  }
+  if (tw == NULL || !tinywav_isOpen(tw) || offset > tw->h.Subchunk2Size) {
+    return -1;
+  }
+
+  offset -= offset % tw->h.BlockAlign;
+  tw->dataPos = offset;
+  tw->totalFramesReadWritten = offset / tw->h.BlockAlign;
+
+  // Aligned reads seek lazily, so a position still in readBuf costs nothing
+  if (tw->readBuf == NULL &&
+      lseek(tw->fileno, tw->dataStart + (long)offset, SEEK_SET) < 0) {
+    return -1;
+  }
   return 0;
 }
 
@@ -248,28 +726,78 @@ int IRAM_ATTR tinywav_read_f(TinyWav *tw, void *buffer, int buffer_len) {
     return -1;
   }
   
+  if (tw->adpcmBuf != NULL) {
+    return read_adpcm(tw, (int16_t *)buffer,
+                      (uint32_t)buffer_len / (2 * tw->numChannels));
+  }
+
   if (tw->totalFramesReadWritten * tw->h.BlockAlign >= tw->h.Subchunk2Size) {
     // We are past the 'data' subchunk (size as declared in header).
     // Sometimes there are additional chunks *after* -- ignore these.
     return 0; // there's nothing more to read, not an error.
   }
 
-  switch (tw->sampFmt) {
-  case TW_INT16: {
-      size_t bytes_read = read(tw->fileno, buffer, buffer_len);
-      int frames_read = (int) bytes_read / (tw->numChannels * sizeof(uint16_t));
-      tw->totalFramesReadWritten += frames_read;
-      return frames_read;
-  }
-  case TW_FLOAT32: {
-    size_t bytes_read = read(tw->fileno, buffer, buffer_len);
-    int frames_read = (int)bytes_read / (tw->numChannels * sizeof(uint32_t));
+  if (tw->readBuf != NULL) {
+    uint32_t len = tw->h.Subchunk2Size - tw->dataPos;
+    if ((uint32_t)buffer_len < len) {
+      len = (uint32_t)buffer_len;
+    }
+    len -= len % tw->h.BlockAlign;
+    int frames_read = (int)(read_aligned(tw, (uint8_t *)buffer, len) / tw->h.BlockAlign);
     tw->totalFramesReadWritten += frames_read;
     return frames_read;
   }
-  default:
+
+  // Whole frames only, so a 24 bit frame is never split between reads
+  ssize_t bytes_read =
+      read(tw->fileno, buffer, buffer_len - buffer_len % tw->h.BlockAlign);
+  if (bytes_read < 0) {
+    return -1;
+  }
+  int frames_read = (int)bytes_read / tw->h.BlockAlign;
+  tw->totalFramesReadWritten += frames_read;
+  return frames_read;
+}
+
+int IRAM_ATTR tinywav_read_blocks(TinyWav *tw, void *buffer, int buffer_len) {
+  if (tw == NULL || buffer == NULL || buffer_len < 0 || tw->adpcmBuf == NULL ||
+      !tinywav_isOpen(tw)) {
+    return -1;
+  }
+  return readStored(tw, (uint8_t *)buffer,
+                    (uint32_t)buffer_len - (uint32_t)buffer_len % tw->h.BlockAlign);
+}
+
+int IRAM_ATTR tinywav_decode_block(const TinyWav *tw, const void *block,
+                                   int block_len, int16_t *out) {
+  const int channels = tw->numChannels;
+  const uint8_t *b = (const uint8_t *)block;
+  uint32_t frames = adpcmBlockFrames(tw, (uint32_t)block_len);
+  if (frames == 0) {
     return 0;
   }
+
+  int32_t predictor[TINYWAV_ADPCM_MAX_CHANNELS];
+  int32_t index[TINYWAV_ADPCM_MAX_CHANNELS];
+  for (int c = 0; c < channels; ++c) {
+    predictor[c] = (int16_t)(b[4 * c] | (b[4 * c + 1] << 8));
+    index[c] = b[4 * c + 2] > 88 ? 88 : b[4 * c + 2];
+    out[c] = (int16_t)predictor[c];
+  }
+
+  // A block holds whole words, so the frames after the header come in eights
+  const uint8_t *word = b + 4 * channels;
+  int16_t *o = out + channels;
+  for (uint32_t f = 1; f < frames; f += 8, o += 8 * channels) {
+    for (int c = 0; c < channels; ++c, word += 4) {
+      int16_t *s = o + c;
+      for (int i = 0; i < 4; ++i, s += 2 * channels) {
+        s[0] = (int16_t)adpcmExpand(&predictor[c], &index[c], word[i] & 0x0f);
+        s[channels] = (int16_t)adpcmExpand(&predictor[c], &index[c], word[i] >> 4);
+      }
+    }
+  }
+  return (int)frames;
 }
 
 void tinywav_close_read(TinyWav *tw) {
@@ -279,101 +807,269 @@ void tinywav_close_read(TinyWav *tw) {
 
   fclose(tw->f);
   close(tw->fileno);
-  
+  free(tw->adpcmBuf);
+
+  tw->adpcmBuf = NULL;
   tw->f = NULL;
 }
 
-int tinywav_write_f(TinyWav *tw, void *f, int len) {
-
-  if (tw == NULL || f == NULL || len < 0 || !tinywav_isOpen(tw)) {
-    return -1;
+/** @returns sample j of frame i of the float32 input in its channel format */
+static float input_sample(TinyWavChannelFormat chanFmt, int numChannels,
+                          const void *f, int len, int i, int j) {
+  switch (chanFmt) {
+  case TW_INLINE:
+    return ((const float *)f)[j * len + i];
+  case TW_SPLIT:
+    return ((const float *const *)f)[j][i];
+  default:
+    return ((const float *)f)[i * numChannels + j];
   }
+}
 
-  // 1. Bring samples into interleaved format
-  // 2. write to disk
+/** Converts count float32 samples, from sample first in interleaved order
+ * on, into the file's sample format at out. */
+static void encodeSamples(const TinyWav *tw, const void *f, int len, int first,
+                          int count, uint8_t *out) {
+  // Copies, as out may point into tw's write buffer
+  const TinyWavChannelFormat chanFmt = tw->chanFmt;
+  const TinyWavSampleFormat sampFmt = tw->sampFmt;
+  const int numChannels = tw->numChannels;
+  const int size = tinywav_sample_size(sampFmt);
+  int i = first / numChannels;
+  int j = first % numChannels;
 
-  switch (tw->sampFmt) {
-  case TW_INT16: {
-    TW_ALLOC(int16_t, z, tw->numChannels * len);
-    switch (tw->chanFmt) {
-    case TW_INTERLEAVED: {
-      const float *const x = (const float *const)f;
-      for (int i = 0; i < tw->numChannels * len; ++i) {
-        z[i] = (int16_t)(x[i] * (float)INT16_MAX);
-      }
+  for (int k = 0; k < count; ++k, out += size) {
+    float x = input_sample(chanFmt, numChannels, f, len, i, j);
+    switch (sampFmt) {
+    case TW_UINT8:
+      *out = (uint8_t)(int)(x * (float)INT8_MAX + 128.0f);
+      break;
+    case TW_INT16: {
+      int16_t v = (int16_t)(x * (float)INT16_MAX);
+      memcpy(out, &v, sizeof(v));
       break;
     }
-    case TW_INLINE: {
-      const float *const x = (const float *const)f;
-      for (int i = 0, k = 0; i < len; ++i) {
-        for (int j = 0; j < tw->numChannels; ++j) {
-          z[k++] = (int16_t)(x[j * len + i] * (float)INT16_MAX);
-        }
-      }
+    case TW_INT24: {
+      int32_t v = (int32_t)(x * 8388607.0f);
+      out[0] = (uint8_t)v;
+      out[1] = (uint8_t)(v >> 8);
+      out[2] = (uint8_t)(v >> 16);
       break;
     }
-    case TW_SPLIT: {
-      const float **const x = (const float **const)f;
-      for (int i = 0, k = 0; i < len; ++i) {
-        for (int j = 0; j < tw->numChannels; ++j) {
-          z[k++] = (int16_t)(x[j][i] * (float)INT16_MAX);
-        }
-      }
+    case TW_INT32: {
+      int32_t v = (int32_t)((double)x * INT32_MAX);
+      memcpy(out, &v, sizeof(v));
       break;
     }
-    default:
-      return 0;
+    case TW_FLOAT32:
+      memcpy(out, &x, sizeof(x));
+      break;
     }
+    if (++j == numChannels) {
+      j = 0;
+      ++i;
+    }
+  }
+}
 
-    size_t samples_written =
-        fwrite(z, sizeof(int16_t), tw->numChannels * len, tw->f);
-    size_t frames_written = samples_written / tw->numChannels;
-    tw->totalFramesReadWritten += frames_written;
-    TW_DEALLOC(z);
-    return (int)frames_written;
-  }
-  case TW_FLOAT32: {
-    TW_ALLOC(float, z, tw->numChannels *len);
-    switch (tw->chanFmt) {
-    case TW_INTERLEAVED: {
-      const float *const x = (const float *const)f;
-      for (int i = 0; i < tw->numChannels * len; ++i) {
-        z[i] = x[i];
-      }
-      break;
+/** Writes the RIFF and data sizes for data_len bytes of sample data into the
+ * header on the file. @returns 0, or -1 on error. */
+static int writeSizes(TinyWav *tw, uint32_t data_len) {
+  uint32_t chunkSize_len = 36 + data_len; // header minus RIFF and this field
+
+  tw->h.ChunkSize = chunkSize_len;
+  tw->h.Subchunk2Size = data_len;
+  tw->filePos = -1;
+  if (lseek(tw->fileno, 4, SEEK_SET) != 4 ||
+      write(tw->fileno, &chunkSize_len, sizeof(uint32_t)) != sizeof(uint32_t) ||
+      lseek(tw->fileno, 40, SEEK_SET) != 40 ||
+      write(tw->fileno, &data_len, sizeof(uint32_t)) != sizeof(uint32_t)) {
+    return -1;
+  }
+  return 0;
+}
+
+/** Writes the first len bytes of writeBuf to the file and moves the rest, a
+ * partial sector at most, to its start. @returns 0, or -1 on error. */
+static int flushWriteBuffer(TinyWav *tw, uint32_t len) {
+  if (len == 0) {
+    return 0;
+  }
+  if (tw->filePos != tw->writeBufOffset) {
+    if (lseek(tw->fileno, tw->writeBufOffset, SEEK_SET) != tw->writeBufOffset) {
+      tw->filePos = -1;
+      return -1;
     }
-    case TW_INLINE: {
-      const float *const x = (const float *const)f;
-      for (int i = 0, k = 0; i < len; ++i) {
-        for (int j = 0; j < tw->numChannels; ++j) {
-          z[k++] = x[j * len + i];
-        }
-      }
-      break;
+    tw->filePos = tw->writeBufOffset;
+  }
+  if (write(tw->fileno, tw->writeBuf, len) != (ssize_t)len) {
+    tw->filePos = -1;
+    return -1;
+  }
+  tw->filePos += len;
+  tw->writeBufOffset += len;
+  tw->writeBufLen -= len;
+  memmove(tw->writeBuf, tw->writeBuf + len, tw->writeBufLen);
+  return 0;
+}
+
+/** Declares the whole frames written out so far in the header and syncs the
+ * file. @returns 0, or -1 on error. */
+static int syncHeader(TinyWav *tw) {
+  if (tw->writeBufOffset <= TW_HEADER_SIZE) {
+    return 0;
+  }
+  const uint32_t frameSize =
+      tw->numChannels * tinywav_sample_size(tw->sampFmt);
+  uint32_t written = (uint32_t)(tw->writeBufOffset - TW_HEADER_SIZE);
+  uint32_t data_len = written - written % frameSize;
+  if (data_len == tw->dataSynced) {
+    return 0;
+  }
+  if (writeSizes(tw, data_len) != 0 || fsync(tw->fileno) != 0) {
+    return -1;
+  }
+  tw->dataSynced = data_len;
+  tw->headerSyncs++;
+  return 0;
+}
+
+/** Writes out the full writeBuf, then updates the header if a sync interval
+ * of samples went out since it last was. @returns 0, or -1 on error. */
+static int commitWriteBuffer(TinyWav *tw) {
+  if (flushWriteBuffer(tw, tw->writeBufLen) != 0) {
+    return -1;
+  }
+  uint32_t written = (uint32_t)(tw->writeBufOffset - TW_HEADER_SIZE);
+  if (tw->syncInterval != 0 && written - tw->dataSynced >= tw->syncInterval) {
+    return syncHeader(tw);
+  }
+  return 0;
+}
+
+/** Appends len bytes to writeBuf, writing it out whenever it fills.
+ * @returns 0, or -1 on error. */
+static int appendBytes(TinyWav *tw, const uint8_t *src, uint32_t len) {
+  while (len > 0) {
+    uint32_t n = tw->writeBufSize - tw->writeBufLen;
+    n = n < len ? n : len;
+    memcpy(tw->writeBuf + tw->writeBufLen, src, n);
+    tw->writeBufLen += n;
+    src += n;
+    len -= n;
+    if (tw->writeBufLen == tw->writeBufSize && commitWriteBuffer(tw) != 0) {
+      return -1;
     }
-    case TW_SPLIT: {
-      const float **const x = (const float **const)f;
-      for (int i = 0, k = 0; i < len; ++i) {
-        for (int j = 0; j < tw->numChannels; ++j) {
-          z[k++] = x[j][i];
+  }
+  return 0;
+}
+
+int tinywav_write_f(TinyWav *tw, void *f, int len) {
+
+  if (tw == NULL || f == NULL || len < 0 || !tinywav_isOpen(tw)) {
+    return -1;
+  }
+
+  const int size = tinywav_sample_size(tw->sampFmt);
+  const int total = tw->numChannels * len;
+
+  if (tw->writeBuf != NULL) {
+    // Convert straight into the write buffer, but for a sample straddling
+    // its end
+    for (int k = 0; k < total;) {
+      int room = (int)(tw->writeBufSize - tw->writeBufLen) / size;
+      if (room == 0) {
+        uint8_t sample[4];
+        encodeSamples(tw, f, len, k++, 1, sample);
+        if (appendBytes(tw, sample, (uint32_t)size) != 0) {
+          return -1;
         }
+        continue;
       }
+      int n = room < total - k ? room : total - k;
+      encodeSamples(tw, f, len, k, n, tw->writeBuf + tw->writeBufLen);
+      tw->writeBufLen += (uint32_t)(n * size);
+      k += n;
+      if (tw->writeBufLen == tw->writeBufSize && commitWriteBuffer(tw) != 0) {
+        return -1;
+      }
+    }
+    tw->totalFramesReadWritten += len;
+    return len;
+  }
+
+  uint8_t z[TINYWAV_WRITE_CHUNK];
+  const int chunk = (int)sizeof(z) / size;
+  size_t samples_written = 0;
+
+  for (int k = 0; k < total; k += chunk) {
+    int n = chunk < total - k ? chunk : total - k;
+    encodeSamples(tw, f, len, k, n, z);
+    size_t written = fwrite(z, size, n, tw->f);
+    samples_written += written;
+    if (written != (size_t)n) {
       break;
     }
-    default:
-      return 0;
+  }
+
+  size_t frames_written = samples_written / tw->numChannels;
+  tw->totalFramesReadWritten += frames_written;
+  return (int)frames_written;
+}
+
+int tinywav_write_interleaved(TinyWav *tw, const void *frames, int len) {
+  if (tw == NULL || frames == NULL || len < 0 || !tinywav_isOpen(tw)) {
+    return -1;
+  }
+
+  const uint32_t frameSize =
+      tw->numChannels * tinywav_sample_size(tw->sampFmt);
+  if (tw->writeBuf != NULL) {
+    if (appendBytes(tw, (const uint8_t *)frames, frameSize * (uint32_t)len) != 0) {
+      return -1;
     }
+  } else {
+    len = (int)fwrite(frames, frameSize, (size_t)len, tw->f);
+  }
+  tw->totalFramesReadWritten += len;
+  return len;
+}
 
-    size_t samples_written =
-        fwrite(z, sizeof(float), tw->numChannels * len, tw->f);
-    size_t frames_written = samples_written / tw->numChannels;
-    tw->totalFramesReadWritten += frames_written;
-    TW_DEALLOC(z);
-    return (int)frames_written;
+int tinywav_set_write_buffer(TinyWav *tw, void *write_buffer,
+                             uint32_t write_buffer_len, uint32_t sync_interval) {
+  if (tw == NULL || write_buffer == NULL || write_buffer_len == 0 ||
+      write_buffer_len % TINYWAV_SECTOR_SIZE != 0 || !tinywav_isOpen(tw) ||
+      tw->writeBuf != NULL || tw->totalFramesReadWritten != 0) {
+    return -1;
   }
-  default:
-    return 0;
+
+  // stdio still holds the header. It goes out again with the first sectors
+  // of samples; FatFs keeps the sector until then, so flushing it here costs
+  // the card nothing.
+  if (fflush(tw->f) != 0) {
+    return -1;
+  }
+  tw->fileno = fileno(tw->f);
+  tw->filePos = -1;
+  tw->writeBuf = (uint8_t *)write_buffer;
+  tw->writeBufSize = write_buffer_len;
+  tw->writeBufLen = packHeader(&tw->h, tw->writeBuf);
+  tw->writeBufOffset = 0;
+  tw->syncInterval = sync_interval;
+  tw->dataSynced = 0;
+  tw->headerSyncs = 0;
+  return 0;
+}
+
+int tinywav_sync_write(TinyWav *tw) {
+  if (tw == NULL || tw->writeBuf == NULL || !tinywav_isOpen(tw)) {
+    return -1;
+  }
+  uint32_t whole = tw->writeBufLen - tw->writeBufLen % TINYWAV_SECTOR_SIZE;
+  if (flushWriteBuffer(tw, whole) != 0) {
+    return -1;
   }
+  return syncHeader(tw);
 }
 
 void tinywav_close_write(TinyWav *tw) {
@@ -381,8 +1077,20 @@ void tinywav_close_write(TinyWav *tw) {
     return; // fclose(NULL) is undefined behaviour
   }
 
-  uint32_t data_len =
-      tw->totalFramesReadWritten * tw->numChannels * tw->sampFmt;
+  uint32_t data_len = tw->totalFramesReadWritten * tw->numChannels *
+                      tinywav_sample_size(tw->sampFmt);
+
+  if (tw->writeBuf != NULL) {
+    // The partial last sector, then the sizes of everything written
+    if (flushWriteBuffer(tw, tw->writeBufLen) == 0) {
+      writeSizes(tw, data_len);
+    }
+    tw->writeBuf = NULL;
+    fclose(tw->f);
+    tw->f = NULL;
+    return;
+  }
+
   uint32_t chunkSize_len =
       36 + data_len; // 36 is size of header minus 8 (RIFF + this field)
 
@@ -27,6 +27,25 @@ extern "C" {
 
 // http://soundfile.sapp.org/doc/WaveFormat/
 
+/// Card sector size, see tinywav_set_read_buffer()
+#define TINYWAV_SECTOR_SIZE 512
+
+/// Bytes tinywav_write_f() converts on the stack at a time, without a write
+/// buffer
+#define TINYWAV_WRITE_CHUNK 512
+
+/// WAVE format tag of IMA ADPCM, 4 bits per sample
+#define TINYWAV_FORMAT_IMA_ADPCM 0x11
+
+/// Compressed bytes read ahead of the decoder, rounded up to whole blocks
+#define TINYWAV_ADPCM_READ_SIZE 2048
+
+/// Most channels an IMA ADPCM file may have
+#define TINYWAV_ADPCM_MAX_CHANNELS 2
+
+/// TinyWav.loudness of a file without it, as a bext chunk marks it
+#define TINYWAV_LOUDNESS_UNKNOWN 0x7FFF
+
 typedef struct TinyWavHeader {
   char ChunkID[4];
   uint32_t ChunkSize;
@@ -50,10 +69,26 @@ typedef enum TinyWavChannelFormat {
 } TinyWavChannelFormat;
 
 typedef enum TinyWavSampleFormat {
-  TW_INT16 = 2,  // two byte signed integer
-  TW_FLOAT32 = 4 // four byte IEEE float
+  TW_UINT8 = 1,   // one byte unsigned integer, 128 is silence
+  TW_INT16 = 2,   // two byte signed integer
+  TW_INT24 = 3,   // three byte signed integer, packed
+  TW_FLOAT32 = 4, // four byte IEEE float
+  TW_INT32 = 5    // four byte signed integer
 } TinyWavSampleFormat;
 
+/** @returns the bytes one sample of sampFmt takes in the file. */
+static inline int tinywav_sample_size(TinyWavSampleFormat sampFmt) {
+  return sampFmt == TW_INT32 ? 4 : (int)sampFmt;
+}
+
+/**
+ * Reads count whole sectors of the file, starting at its sector'th, into
+ * buffer. @returns the number of sectors read, fewer only past the end of the
+ * file, or a negative value on error.
+ */
+typedef int (*TinyWavSectorReader)(void *context, uint32_t sector,
+                                   void *buffer, uint32_t count);
+
 typedef struct TinyWav {
   FILE *f;
   int fileno;
@@ -65,6 +100,43 @@ typedef struct TinyWav {
                                    ///< been read or written
   TinyWavChannelFormat chanFmt;
   TinyWavSampleFormat sampFmt;
+
+  long dataStart;        ///< file offset of the first sample
+  uint32_t loopStart;    ///< first frame of the smpl chunk's forward loop
+  uint32_t loopEnd;      ///< frame after its last, 0 if the file has none
+  int16_t loudness;      ///< bext chunk's integrated loudness in 0.01 LUFS
+  // Aligned reads, only used once tinywav_set_read_buffer() was called
+  uint32_t dataPos;      ///< bytes of sample data read
+  uint8_t *readBuf;
+  uint32_t readBufSize;
+  uint32_t readBufLen;   ///< bytes held in readBuf
+  long readBufOffset;    ///< file offset of readBuf[0], sector aligned
+  long filePos;          ///< file offset of the descriptor, -1 if unknown
+  uint64_t bytesStaged;  ///< sample bytes copied out of readBuf
+  TinyWavSectorReader sectorReader; ///< NULL to read through the file
+  void *sectorReaderContext;
+
+  // Buffered writes, only used once tinywav_set_write_buffer() was called.
+  // writeBuf holds the file from writeBufOffset on, the header included.
+  uint8_t *writeBuf;
+  uint32_t writeBufSize;
+  uint32_t writeBufLen;  ///< bytes held in writeBuf
+  long writeBufOffset;   ///< file offset of writeBuf[0], sector aligned
+  uint32_t syncInterval; ///< sample data bytes between header updates
+  uint32_t dataSynced;   ///< sample data bytes the header declares on the file
+  uint32_t headerSyncs;  ///< header updates so far
+
+  // IMA ADPCM decoding, only used when h.AudioFormat is
+  // TINYWAV_FORMAT_IMA_ADPCM. dataPos counts compressed bytes.
+  uint16_t adpcmFramesPerBlock;
+  uint16_t adpcmFrame;   ///< next frame of the block being decoded
+  uint16_t adpcmSkip;    ///< frames of it to decode and drop, after a seek
+  uint8_t *adpcmBuf;     ///< whole compressed blocks read ahead
+  uint32_t adpcmBufSize;
+  uint32_t adpcmBufLen;  ///< bytes held in adpcmBuf
+  uint32_t adpcmBlockPos; ///< offset of the block being decoded in adpcmBuf
+  int16_t adpcmPredictor[TINYWAV_ADPCM_MAX_CHANNELS];
+  uint8_t adpcmIndex[TINYWAV_ADPCM_MAX_CHANNELS];
 } TinyWav;
 
 /**
@@ -92,7 +164,18 @@ int tinywav_open_write(TinyWav *tw, int16_t numChannels, int32_t samplerate,
  * @param chanFmt  The desired channel format (how the channel data is laid out
  * in memory) when read.
  *
- * @return  The error code. Zero if no error.
+ * 8, 16, 24 and 32 bit PCM and 32 bit float are read, also from
+ * WAVE_FORMAT_EXTENSIBLE headers, whose sub format replaces h.AudioFormat.
+ * Samples are read as stored in the file, in sampFmt. Mono and stereo IMA
+ * ADPCM (TINYWAV_FORMAT_IMA_ADPCM) is decoded as it is read, a block at a
+ * time straight into the caller's buffer, and read as TW_INT16; the frame
+ * count comes from its fact chunk.
+ *
+ * The first forward loop of a smpl chunk, before or after the data, sets
+ * loopStart and loopEnd. The reader does not loop by itself. The integrated
+ * loudness of a version 2 bext chunk sets loudness.
+ *
+ * @return  The error code. Zero if no error, -1 for other sample formats.
  */
 int tinywav_open_read(TinyWav *tw, const char *path,
                       TinyWavChannelFormat chanFmt);
@@ -113,23 +196,129 @@ int tinywav_open_read(TinyWav *tw, const char *path,
  */
 int tinywav_read_f(TinyWav *tw, void *buffer, int buffer_len);
 
+/**
+ * Make tinywav_read_f() read whole, sector aligned runs of the file only, so
+ * FatFs never reads a partial sector through its window buffer. Runs of whole
+ * sectors go straight to the caller's buffer in one multi-sector read, which
+ * the SD driver does by DMA when that buffer is DMA capable and word aligned.
+ * The unaligned start and end of a request are served from read_buffer,
+ * refilled a read_buffer_len run at a time.
+ *
+ * @param read_buffer      DMA capable buffer owned by the caller, kept until
+ * the file is closed.
+ * @param read_buffer_len  A multiple of TINYWAV_SECTOR_SIZE.
+ *
+ * @return  The error code. Zero if no error.
+ */
+int tinywav_set_read_buffer(TinyWav *tw, void *read_buffer,
+                            uint32_t read_buffer_len);
+
+/**
+ * Fetch the sectors of aligned reads with reader instead of read(), e.g.
+ * straight from the card for a file known to be contiguous. Only valid after
+ * tinywav_set_read_buffer().
+ *
+ * @return  The error code. Zero if no error.
+ */
+int tinywav_set_sector_reader(TinyWav *tw, TinyWavSectorReader reader,
+                              void *context);
+
+/**
+ * Move the read position to a byte offset in the sample data, rounded down to
+ * a whole frame. For IMA ADPCM the offset counts decoded bytes, as
+ * tinywav_read_f() returns them.
+ *
+ * @return  The error code. Zero if no error.
+ */
+int tinywav_seek_data(TinyWav *tw, uint32_t offset);
+
+/**
+ * Read whole blocks of IMA ADPCM data as stored, from the block holding the
+ * frame tinywav_seek_data() last moved to, for a decoder of the caller's own
+ * (see tinywav_decode_block()). Aligned reads are used once
+ * tinywav_set_read_buffer() was called. Not to be mixed with
+ * tinywav_read_f() without a seek in between.
+ *
+ * @return  The bytes read, a whole number of blocks but for the last block of
+ * the data, 0 at its end, or -1 on error.
+ */
+int tinywav_read_blocks(TinyWav *tw, void *buffer, int buffer_len);
+
+/**
+ * Decode one whole IMA ADPCM block read by tinywav_read_blocks() into
+ * interleaved 16 bit frames. Only reads the channel count from tw, so another
+ * task may decode while the reader carries on.
+ *
+ * @param out  Room for tw->adpcmFramesPerBlock frames.
+ *
+ * @return  The frames decoded, the last block's padding included.
+ */
+int tinywav_decode_block(const TinyWav *tw, const void *block, int block_len,
+                         int16_t *out);
+
 /** Stop reading the file. The Tinywav struct is now invalid. */
 void tinywav_close_read(TinyWav *tw);
 
 /**
  * Write sample data to file.
  * @note Samples are always expected in float32 format, regardless of file
- * sample format
+ * sample format, and are truncated to integer formats
+ *
+ * Without a write buffer the samples are converted and passed to stdio
+ * TINYWAV_WRITE_CHUNK bytes at a time; with one they are converted straight
+ * into it. Neither allocates, so any len is safe on a small task stack.
  *
  * @param tw   The TinyWav structure which has already been prepared.
  * @param f    A pointer to the sample data to write.
  * @param len  The number of frames (samples per channel) to write.
  *
- * @return The number of frames (samples per channel) written to file.
+ * @return The number of frames (samples per channel) written to file, or -1
+ * if writing out the write buffer failed.
  */
 int tinywav_write_f(TinyWav *tw, void *f, int len);
 
-/** Stop writing to the file. The Tinywav struct is now invalid. */
+/**
+ * Write interleaved frames already in the file's sample format, e.g. as I2S
+ * receives them, without conversion.
+ *
+ * @return The number of frames written, or -1 on error.
+ */
+int tinywav_write_interleaved(TinyWav *tw, const void *frames, int len);
+
+/**
+ * Stream the rest of the file through write_buffer instead of stdio, for long
+ * recordings. Samples are converted or copied into it and it is written out
+ * whole, from a sector boundary of the file, with write() on the file's
+ * descriptor, so FatFs passes every write straight to the card and never
+ * reads a sector back to modify it. Only the header's sizes, when updated,
+ * and the last sector, on closing, are written in part.
+ *
+ * Whenever sync_interval more bytes of sample data were written out, the RIFF
+ * and data sizes in the header are updated to them and the file is synced, so
+ * a file cut short by a power loss still opens, with the audio up to that
+ * point. Must be called before any sample is written.
+ *
+ * @param write_buffer      Buffer owned by the caller, DMA capable for the SD
+ * driver to write it without a bounce buffer, kept until the file is closed.
+ * @param write_buffer_len  A multiple of TINYWAV_SECTOR_SIZE.
+ * @param sync_interval     Bytes of sample data between header updates, 0 to
+ * update it on closing only.
+ *
+ * @return  The error code. Zero if no error.
+ */
+int tinywav_set_write_buffer(TinyWav *tw, void *write_buffer,
+                             uint32_t write_buffer_len, uint32_t sync_interval);
+
+/**
+ * Write out the whole sectors held in the write buffer and update the header
+ * to them now, e.g. before the supply is cut.
+ *
+ * @return  The error code. Zero if no error.
+ */
+int tinywav_sync_write(TinyWav *tw);
+
+/** Stop writing to the file, writing out the write buffer first. The Tinywav
+ * struct is now invalid. */
 void tinywav_close_write(TinyWav *tw);
 
 /** Returns true if the Tinywav struct is available to read or write. False
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <stdint.h>
+
+// Book pack: every track of a book in one file, converted ahead of time to the
+// sample width (and, for a build with OUTPUT_SAMPLE_RATE, the rate) it plays
+// at. A fixed table of entries, sorted by page, follows the header; each
+// track's samples start on a card sector, so the pack is read with the same
+// aligned and raw sector reads as a loose track. A pack in the book directory
+// takes the place of its WAV files: it is opened once at boot, and a page
+// turn seeks within it instead of opening and parsing a file.
+//
+// host/tools/book_packer writes packs. Fields are little endian.
+#define BOOK_PACK_FILE "BOOK.MBP"
+#define BOOK_PACK_MAGIC 0x4b50424dUL // "MBPK"
+#define BOOK_PACK_VERSION 1
+#define BOOK_PACK_ALIGN 512 // TINYWAV_SECTOR_SIZE
+
+// Longest track path kept, relative to the book directory packed
+#define BOOK_PACK_NAME_SIZE 48
+
+typedef struct book_pack_header {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t entry_size;
+  uint32_t num_tracks;
+  uint32_t pack_size; // bytes, so a truncated copy is refused
+} book_pack_header_t;
+
+typedef struct book_pack_entry {
+  uint16_t page;
+  uint8_t channels;
+  uint8_t sample_format; // TinyWavSampleFormat, TW_INT16 or TW_INT32
+  uint32_t sample_rate;
+  uint32_t data_offset;  // from the start of the pack, a multiple of BOOK_PACK_ALIGN
+  uint32_t data_size;
+  uint32_t loop_start;   // the track's loop, in frames; loop_end is the frame
+  uint32_t loop_end;     // after it, 0 to loop the whole track
+  int16_t loudness;      // integrated, 0.01 LUFS, TINYWAV_LOUDNESS_UNKNOWN if not tagged
+  uint16_t reserved;
+  char name[BOOK_PACK_NAME_SIZE]; // the packed file's path, for logs
+} book_pack_entry_t;
@@ -0,0 +1,123 @@
+#include "convert.h"
+
+#include "esp_attr.h"
+
+// Kernels for formats whose samples are whole words, four samples per
+// iteration. `sample` converts the sample at a pointer into the input.
+#define CONVERT_KERNEL(name, out_t, in_t, sample)                             \
+  static void IRAM_ATTR name(void *dst, const void *src, size_t samples) {    \
+    out_t *restrict out = (out_t *)dst;                                       \
+    const in_t *restrict in = (const in_t *)src;                              \
+    size_t i = 0;                                                             \
+    for (; i + 4 <= samples; i += 4) {                                        \
+      out_t s0 = sample(in + i);                                              \
+      out_t s1 = sample(in + i + 1);                                          \
+      out_t s2 = sample(in + i + 2);                                          \
+      out_t s3 = sample(in + i + 3);                                          \
+      out[i] = s0;                                                            \
+      out[i + 1] = s1;                                                        \
+      out[i + 2] = s2;                                                        \
+      out[i + 3] = s3;                                                        \
+    }                                                                         \
+    for (; i < samples; ++i) {                                                \
+      out[i] = sample(in + i);                                                \
+    }                                                                         \
+  }
+
+static inline int16_t u8_s16(const uint8_t *in) {
+  return (int16_t)((*in - 128) * 256);
+}
+
+static inline int32_t u8_s32(const uint8_t *in) {
+  return (int32_t)((*in - 128) * 16777216);
+}
+
+static inline int32_t s16_s32(const int16_t *in) {
+  return (int32_t)*in * 65536;
+}
+
+static inline int16_t s32_s16(const int32_t *in) {
+  return (int16_t)(*in >> 16);
+}
+
+// Offsetting by half the range before truncating rounds to nearest with a
+// positive value, so the conversion is a floor. The comparisons are written to
+// send NaN to the lower bound.
+static inline int16_t f32_s16(const float *in) {
+  float v = *in * 32768.0f + 32768.5f;
+  v = !(v >= 0.0f) ? 0.0f : v;
+  v = v > 65535.0f ? 65535.0f : v;
+  return (int16_t)((int32_t)v - 32768);
+}
+
+// Floats carry 24 bits, so past that rounding makes no difference. Full scale
+// and above, 2^31, is out of range of an int32 and saturates.
+static inline int32_t f32_s32(const float *in) {
+  float v = *in * 2147483648.0f;
+  v = !(v >= -2147483648.0f) ? -2147483648.0f : v;
+  return v >= 2147483648.0f ? INT32_MAX : (int32_t)v;
+}
+
+CONVERT_KERNEL(u8_to_s16, int16_t, uint8_t, u8_s16)
+CONVERT_KERNEL(u8_to_s32, int32_t, uint8_t, u8_s32)
+CONVERT_KERNEL(s16_to_s32, int32_t, int16_t, s16_s32)
+CONVERT_KERNEL(s32_to_s16, int16_t, int32_t, s32_s16)
+CONVERT_KERNEL(f32_to_s16, int16_t, float, f32_s16)
+CONVERT_KERNEL(f32_to_s32, int32_t, float, f32_s32)
+
+// Packed 24 bit samples are read four at a time as three aligned words,
+// rather than byte by byte, and shifted into the top of an int32
+static inline int32_t s24_s32(const uint8_t *in) {
+  return (int32_t)((uint32_t)in[0] << 8 | (uint32_t)in[1] << 16 | (uint32_t)in[2] << 24);
+}
+
+#define S24_KERNEL(name, out_t, shift)                                        \
+  static void IRAM_ATTR name(void *dst, const void *src, size_t samples) {    \
+    out_t *restrict out = (out_t *)dst;                                       \
+    const uint32_t *restrict in = (const uint32_t *)src;                      \
+    size_t i = 0;                                                             \
+    for (; i + 4 <= samples; i += 4, in += 3) {                               \
+      uint32_t w0 = in[0], w1 = in[1], w2 = in[2];                            \
+      out[i] = (out_t)((int32_t)(w0 << 8) >> (shift));                        \
+      out[i + 1] = (out_t)((int32_t)((w0 >> 24 << 8) | (w1 << 16)) >> (shift)); \
+      out[i + 2] = (out_t)((int32_t)((w1 >> 16 << 8) | (w2 << 24)) >> (shift)); \
+      out[i + 3] = (out_t)((int32_t)(w2 & 0xffffff00u) >> (shift));           \
+    }                                                                         \
+    const uint8_t *rest = (const uint8_t *)in;                                \
+    for (; i < samples; ++i, rest += 3) {                                     \
+      out[i] = (out_t)(s24_s32(rest) >> (shift));                             \
+    }                                                                         \
+  }
+
+S24_KERNEL(s24_to_s16, int16_t, 16)
+S24_KERNEL(s24_to_s32, int32_t, 0)
+
+convert_fn_t convert_select(TinyWavSampleFormat format, int out_bits) {
+  if (out_bits != 16 && out_bits != 32) {
+    return NULL;
+  }
+  bool narrow = out_bits == 16;
+
+  switch (format) {
+  case TW_UINT8:
+    return narrow ? u8_to_s16 : u8_to_s32;
+  case TW_INT16:
+    return narrow ? NULL : s16_to_s32;
+  case TW_INT24:
+    return narrow ? s24_to_s16 : s24_to_s32;
+  case TW_INT32:
+    return narrow ? s32_to_s16 : NULL;
+  case TW_FLOAT32:
+    return narrow ? f32_to_s16 : f32_to_s32;
+  }
+  return NULL;
+}
+
+bool convert_supported(TinyWavSampleFormat format, int out_bits) {
+  if (out_bits != 16 && out_bits != 32) {
+    return false;
+  }
+  return convert_select(format, out_bits) != NULL ||
+         (format == TW_INT16 && out_bits == 16) ||
+         (format == TW_INT32 && out_bits == 32);
+}
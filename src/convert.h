@@ -0,0 +1,24 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "tinywav.h"
+
+// Sample format conversion from a track's samples to the I2S sample width.
+// One kernel per source format and output width, picked once per track, so
+// converting a block is a single unrolled loop with no per sample branches.
+// Integer formats are shifted to the output width, dropping the low bits when
+// narrowing; float samples are scaled, rounded and clipped to full scale.
+
+// Convert `samples` samples from src to dst. src must be word aligned and the
+// buffers must not overlap.
+typedef void (*convert_fn_t)(void *dst, const void *src, size_t samples);
+
+// Kernel converting `format` to out_bits (16 or 32) wide samples. NULL when
+// the track is already in that format, or it cannot be converted.
+convert_fn_t convert_select(TinyWavSampleFormat format, int out_bits);
+
+// True if `format` can be played at out_bits, with or without a kernel
+bool convert_supported(TinyWavSampleFormat format, int out_bits);
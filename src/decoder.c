@@ -0,0 +1,400 @@
+#include "decoder.h"
+
+#include <string.h>
+#include <sys/param.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "esp_attr.h"
+#include "esp_cpu.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+
+#include "spsc.h"
+
+static const char* ourTaskName = "decoder";
+
+// Longest a reader waits on the decode task before looking again
+#define DECODE_WAIT_TICKS pdMS_TO_TICKS(20)
+
+// MARK: inline
+
+static bool tinywav_probe(const TinyWav *file) {
+  (void)file;
+  return true;
+}
+
+static bool tinywav_open(decoder_t *decoder) {
+  (void)decoder;
+  return true;
+}
+
+static int IRAM_ATTR tinywav_read_frames(decoder_t *decoder, void *buffer, int frames) {
+  return tinywav_read_f(decoder->file, buffer, frames * decoder->frame_size);
+}
+
+static bool tinywav_seek(decoder_t *decoder, uint32_t frame) {
+  return tinywav_seek_data(decoder->file, frame * decoder->frame_size) == 0;
+}
+
+static void tinywav_close(decoder_t *decoder) {
+  (void)decoder;
+}
+
+// Every format TinyWav reads, PCM and IMA ADPCM alike, decoded as it is read
+static const decoder_backend_t tinywav_backend = {
+  .name = "tinywav",
+  .probe = tinywav_probe,
+  .open = tinywav_open,
+  .read_frames = tinywav_read_frames,
+  .seek = tinywav_seek,
+  .close = tinywav_close,
+};
+
+// MARK: decode task
+
+// Slots of the block queue hold a block's length and then the block as read;
+// slots of the PCM queue the block's frame count and then its frames
+#define SLOT_HEADER 4
+
+struct decode_job {
+  spsc_queue_t blocks;  // reader to decode task
+  spsc_queue_t pcm;     // decode task to reader
+  const TinyWav *file;  // only its channel count is read by the decode task
+  uint16_t block_size;
+  uint16_t pcm_offset;  // frames of the oldest decoded block already read
+  uint16_t skip;        // frames to drop ahead of the frame seeked to
+  bool read_all;        // every block of the file is queued
+  bool discard;         // drop queued blocks undecoded, while seeking
+  TaskHandle_t waiter;  // reader waiting for a decoded block, or NULL
+  uint8_t *memory;
+};
+
+static TaskHandle_t decode_task;
+static decode_job_t *jobs[DECODE_MAX_JOBS];
+static int busy_job = -1;
+static decode_stats_t decode_stats;
+
+static void notify_decode_task(void) {
+  xTaskNotify(decode_task, 1, eSetBits);
+}
+
+// Decode the job's queued blocks while there is room for them. Returns true
+// if it did anything.
+static bool IRAM_ATTR decode_blocks(decode_job_t *job) {
+  bool progress = false;
+  uint8_t *block;
+
+  while ((block = (uint8_t *)spsc_read_slot(&job->blocks)) != NULL) {
+    if (!__atomic_load_n(&job->discard, __ATOMIC_ACQUIRE)) {
+      uint8_t *out = (uint8_t *)spsc_write_slot(&job->pcm);
+      if (out == NULL) {
+        break;
+      }
+      int32_t len;
+      memcpy(&len, block, sizeof(len));
+
+      uint32_t start = esp_cpu_get_cycle_count();
+      int32_t frames = tinywav_decode_block(job->file, block + SLOT_HEADER, len, (int16_t *)(out + SLOT_HEADER));
+      decode_stats.cycles += esp_cpu_get_cycle_count() - start;
+      decode_stats.frames += frames;
+
+      memcpy(out, &frames, sizeof(frames));
+      spsc_push(&job->pcm);
+    }
+    // Popped only once its frames are queued, so a reader that finds no
+    // blocks left knows every frame they held is queued too
+    spsc_pop(&job->blocks);
+    progress = true;
+
+    TaskHandle_t waiter = __atomic_load_n(&job->waiter, __ATOMIC_ACQUIRE);
+    if (waiter != NULL) {
+      xTaskNotify(waiter, DECODER_NOTIFY, eSetBits);
+    }
+  }
+  return progress;
+}
+
+// Pinned to DECODE_TASK_CORE. Sleeps until a reader queues blocks or frees
+// decoded ones, then decodes every job's blocks while there is room.
+static void decode_blocks_task(void *arg) {
+  (void)arg;
+  while (1) {
+    xTaskNotifyWait(0, UINT32_MAX, NULL, portMAX_DELAY);
+
+    bool progress;
+    do {
+      progress = false;
+      for (int i = 0; i < DECODE_MAX_JOBS; ++i) {
+        // A closing reader waits until the task is off its job
+        __atomic_store_n(&busy_job, i, __ATOMIC_SEQ_CST);
+        decode_job_t *job = __atomic_load_n(&jobs[i], __ATOMIC_SEQ_CST);
+        if (job != NULL) {
+          progress |= decode_blocks(job);
+        }
+        __atomic_store_n(&busy_job, -1, __ATOMIC_RELEASE);
+      }
+    } while (progress);
+  }
+}
+
+static bool adpcm_task_probe(const TinyWav *file) {
+  return file->h.AudioFormat == TINYWAV_FORMAT_IMA_ADPCM && file->h.BlockAlign <= DECODE_MAX_BLOCK_SIZE;
+}
+
+static bool adpcm_task_open(decoder_t *decoder) {
+  if (decode_task == NULL &&
+      xTaskCreatePinnedToCore(decode_blocks_task, "decode", 4096, NULL, DECODE_TASK_PRIORITY,
+                              &decode_task, DECODE_TASK_CORE) != pdPASS) {
+    ESP_LOGE(ourTaskName, "Could not start the decode task");
+    return false;
+  }
+
+  int slot = 0;
+  while (slot < DECODE_MAX_JOBS && jobs[slot] != NULL) {
+    slot++;
+  }
+  if (slot == DECODE_MAX_JOBS) {
+    ESP_LOGE(ourTaskName, "The decode task already serves %d tracks", DECODE_MAX_JOBS);
+    return false;
+  }
+
+  const TinyWav *file = decoder->file;
+  decode_job_t *job = (decode_job_t *)heap_caps_calloc(1, sizeof(*job), MALLOC_CAP_INTERNAL);
+  uint32_t block_slot = (SLOT_HEADER + file->h.BlockAlign + 3) & ~3u;
+  uint32_t pcm_slot = SLOT_HEADER + file->adpcmFramesPerBlock * decoder->frame_size;
+  // Whole sectors of a read land in the block slots by DMA
+  uint8_t *memory = (uint8_t *)heap_caps_malloc(DECODE_BLOCK_SLOTS * block_slot + DECODE_PCM_SLOTS * pcm_slot, MALLOC_CAP_DMA);
+  if (job == NULL || memory == NULL) {
+    ESP_LOGE(ourTaskName, "No memory to decode %u byte blocks", (unsigned)file->h.BlockAlign);
+    heap_caps_free(memory);
+    heap_caps_free(job);
+    return false;
+  }
+
+  job->file = file;
+  job->block_size = file->h.BlockAlign;
+  job->memory = memory;
+  spsc_init(&job->blocks, memory, block_slot, DECODE_BLOCK_SLOTS);
+  spsc_init(&job->pcm, memory + DECODE_BLOCK_SLOTS * block_slot, pcm_slot, DECODE_PCM_SLOTS);
+  decoder->job = job;
+  __atomic_store_n(&jobs[slot], job, __ATOMIC_SEQ_CST);
+  return true;
+}
+
+// Read blocks from the card into every free block slot. Returns false on a
+// read error.
+static bool IRAM_ATTR queue_blocks(decoder_t *decoder) {
+  decode_job_t *job = decoder->job;
+  uint8_t *slot;
+  bool queued = false;
+
+  while (!job->read_all && (slot = (uint8_t *)spsc_write_slot(&job->blocks)) != NULL) {
+    int32_t len = tinywav_read_blocks(decoder->file, slot + SLOT_HEADER, job->block_size);
+    if (len < 0) {
+      return false;
+    }
+    if (len < job->block_size) {
+      job->read_all = true;
+      if (len == 0) {
+        break;
+      }
+    }
+    memcpy(slot, &len, sizeof(len));
+    spsc_push(&job->blocks);
+    queued = true;
+  }
+  if (queued) {
+    notify_decode_task();
+  }
+  return true;
+}
+
+// Sleep until the decode task queues a block. Notification bits meant for
+// the reader itself are collected in kept, to be notified again once it stops
+// waiting.
+static void wait_decoded(decode_job_t *job, uint32_t *kept) {
+  __atomic_store_n(&job->waiter, xTaskGetCurrentTaskHandle(), __ATOMIC_SEQ_CST);
+  if (spsc_read_slot(&job->pcm) == NULL) {
+    uint32_t bits = 0;
+    decode_stats.waits++;
+    xTaskNotifyWait(0, UINT32_MAX, &bits, DECODE_WAIT_TICKS);
+    *kept |= bits & ~DECODER_NOTIFY;
+  }
+  __atomic_store_n(&job->waiter, NULL, __ATOMIC_RELEASE);
+}
+
+static int IRAM_ATTR adpcm_task_read_frames(decoder_t *decoder, void *buffer, int frames) {
+  decode_job_t *job = decoder->job;
+  uint8_t *out = (uint8_t *)buffer;
+  uint32_t kept = 0;
+  int done = 0;
+
+  while (done < frames) {
+    if (!queue_blocks(decoder)) {
+      done = done > 0 ? done : -1;
+      break;
+    }
+
+    uint8_t *slot = (uint8_t *)spsc_read_slot(&job->pcm);
+    if (slot == NULL) {
+      // Blocks are popped after their frames are queued, so none left queued
+      // means none left at all
+      if (job->read_all && spsc_used(&job->blocks) == 0 && spsc_read_slot(&job->pcm) == NULL) {
+        break;
+      }
+      wait_decoded(job, &kept);
+      continue;
+    }
+
+    int32_t slot_frames;
+    memcpy(&slot_frames, slot, sizeof(slot_frames));
+    int available = slot_frames - job->pcm_offset;
+    int dropped = MIN(available, job->skip);
+    job->skip -= dropped;
+    job->pcm_offset += dropped;
+    available -= dropped;
+
+    int n = MIN(available, frames - done);
+    memcpy(out + done * decoder->frame_size,
+           slot + SLOT_HEADER + job->pcm_offset * decoder->frame_size, n * decoder->frame_size);
+    job->pcm_offset += n;
+    done += n;
+
+    if (job->pcm_offset == slot_frames) {
+      job->pcm_offset = 0;
+      spsc_pop(&job->pcm);
+      // The decode task may have stopped for want of room
+      if (spsc_used(&job->blocks) > 0) {
+        notify_decode_task();
+      }
+    }
+  }
+
+  if (kept != 0) {
+    xTaskNotify(xTaskGetCurrentTaskHandle(), kept, eSetBits);
+  }
+  return done;
+}
+
+// Empty both queues. The decode task drops the blocks it has not started on,
+// and finishes the one it is decoding, if any, before the last is popped.
+static void drain_job(decode_job_t *job) {
+  __atomic_store_n(&job->discard, true, __ATOMIC_RELEASE);
+  if (spsc_used(&job->blocks) > 0) {
+    notify_decode_task();
+  }
+  while (spsc_used(&job->blocks) > 0) {
+    while (spsc_read_slot(&job->pcm) != NULL) {
+      spsc_pop(&job->pcm);
+    }
+    vTaskDelay(0);
+  }
+  while (spsc_read_slot(&job->pcm) != NULL) {
+    spsc_pop(&job->pcm);
+  }
+  job->pcm_offset = 0;
+  __atomic_store_n(&job->discard, false, __ATOMIC_RELEASE);
+}
+
+static bool adpcm_task_seek(decoder_t *decoder, uint32_t frame) {
+  decode_job_t *job = decoder->job;
+  drain_job(job);
+
+  // Reads start again from the block holding the frame
+  if (tinywav_seek_data(decoder->file, frame * decoder->frame_size) != 0) {
+    return false;
+  }
+  job->skip = frame % decoder->file->adpcmFramesPerBlock;
+  job->read_all = false;
+  return true;
+}
+
+static void adpcm_task_close(decoder_t *decoder) {
+  decode_job_t *job = decoder->job;
+  if (job == NULL) {
+    return;
+  }
+
+  for (int i = 0; i < DECODE_MAX_JOBS; ++i) {
+    if (jobs[i] == job) {
+      __atomic_store_n(&jobs[i], NULL, __ATOMIC_SEQ_CST);
+      while (__atomic_load_n(&busy_job, __ATOMIC_SEQ_CST) == i) {
+        vTaskDelay(0);
+      }
+    }
+  }
+  heap_caps_free(job->memory);
+  heap_caps_free(job);
+  decoder->job = NULL;
+}
+
+static const decoder_backend_t adpcm_task_backend = {
+  .name = "ima_adpcm_task",
+  .probe = adpcm_task_probe,
+  .open = adpcm_task_open,
+  .read_frames = adpcm_task_read_frames,
+  .seek = adpcm_task_seek,
+  .close = adpcm_task_close,
+};
+
+// MARK: public functions
+
+const decoder_backend_t *const decoder_backends[] = {
+#if DECODE_TASK
+  &adpcm_task_backend,
+#endif
+  &tinywav_backend,
+};
+const int decoder_backend_count = sizeof(decoder_backends) / sizeof(decoder_backends[0]);
+
+bool decoder_open_with(decoder_t *decoder, TinyWav *file, const decoder_backend_t *backend) {
+  memset(decoder, 0, sizeof(*decoder));
+  decoder->backend = backend;
+  decoder->file = file;
+  decoder->frame_size = tinywav_sample_size(file->sampFmt) * file->numChannels;
+  decoder->position = file->totalFramesReadWritten;
+  if (!backend->probe(file) || !backend->open(decoder)) {
+    decoder->backend = NULL;
+    return false;
+  }
+  return true;
+}
+
+bool decoder_open(decoder_t *decoder, TinyWav *file) {
+  for (int i = 0; i < decoder_backend_count; ++i) {
+    if (decoder_backends[i]->probe(file)) {
+      return decoder_open_with(decoder, file, decoder_backends[i]);
+    }
+  }
+  return false;
+}
+
+int IRAM_ATTR decoder_read_frames(decoder_t *decoder, void *buffer, int frames) {
+  uint32_t left = decoder->file->numFramesInHeader - MIN(decoder->position, (uint32_t)decoder->file->numFramesInHeader);
+  int read = decoder->backend->read_frames(decoder, buffer, MIN((uint32_t)frames, left));
+  if (read > 0) {
+    decoder->position += read;
+  }
+  return read;
+}
+
+bool decoder_seek(decoder_t *decoder, uint32_t frame) {
+  if (frame > (uint32_t)decoder->file->numFramesInHeader || !decoder->backend->seek(decoder, frame)) {
+    return false;
+  }
+  decoder->position = frame;
+  return true;
+}
+
+void decoder_close(decoder_t *decoder) {
+  if (decoder->backend != NULL) {
+    decoder->backend->close(decoder);
+  }
+  decoder->backend = NULL;
+}
+
+const decode_stats_t *decoder_task_stats(void) {
+  return &decode_stats;
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "tinywav.h"
+
+// Tracks are read through a decoder, whose backend is picked from the file's
+// header when it opens: the first in decoder_backends whose probe takes it.
+// Inline backends decode in the calling task as they read. A task backend
+// only reads the file's compressed blocks in the calling task, so the card is
+// still only touched by the reader on core 1, and hands them to the decode
+// task on DECODE_TASK_CORE, which decodes them into a queue of PCM blocks the
+// reader copies from. Both queues are lock-free single producer, single
+// consumer (see spsc.h).
+
+// With DECODE_TASK, IMA ADPCM tracks are decoded by the decode task;
+// without it TinyWav decodes them inline like any other track
+#ifndef DECODE_TASK
+#define DECODE_TASK 1
+#endif
+#define DECODE_TASK_CORE 0
+#define DECODE_TASK_PRIORITY 10
+
+// Compressed blocks read ahead and decoded blocks queued, per track. A 2048
+// byte stereo block decodes to 8164 bytes, so such a track takes about 22 KB.
+#define DECODE_BLOCK_SLOTS 3
+#define DECODE_PCM_SLOTS 2
+
+// Largest block the decode task takes; tracks of larger blocks decode inline
+#define DECODE_MAX_BLOCK_SIZE 4096
+
+// Tracks the decode task serves at once
+#define DECODE_MAX_JOBS 4
+
+// Notification bit the decode task wakes a reader waiting on it with. Other
+// bits the reader is notified with while it waits are kept for it.
+#define DECODER_NOTIFY (1u << 31)
+
+typedef struct decoder decoder_t;
+typedef struct decode_job decode_job_t;
+
+typedef struct decoder_backend {
+  const char *name;
+  // True if the backend plays a file with this header
+  bool (*probe)(const TinyWav *file);
+  bool (*open)(decoder_t *decoder);
+  // Up to `frames` frames, in the layout tinywav_read_f returns them. Returns
+  // the frames read, 0 at the end of the track, or a negative value on error.
+  int (*read_frames)(decoder_t *decoder, void *buffer, int frames);
+  bool (*seek)(decoder_t *decoder, uint32_t frame);
+  void (*close)(decoder_t *decoder);
+} decoder_backend_t;
+
+struct decoder {
+  const decoder_backend_t *backend;
+  TinyWav *file;
+  uint16_t frame_size; // bytes of a decoded frame
+  uint32_t position;   // frame the next read starts at
+  decode_job_t *job;   // the decode task's state, for task backends
+};
+
+// Every backend, in the order they are tried
+extern const decoder_backend_t *const decoder_backends[];
+extern const int decoder_backend_count;
+
+// Decode the opened file with the first backend that takes its header
+bool decoder_open(decoder_t *decoder, TinyWav *file);
+
+// Decode the opened file with a given backend, e.g. to compare them
+bool decoder_open_with(decoder_t *decoder, TinyWav *file, const decoder_backend_t *backend);
+
+// Read up to `frames` frames. Returns the frames read, 0 at the end of the
+// track, or a negative value on error.
+int decoder_read_frames(decoder_t *decoder, void *buffer, int frames);
+
+// Move to a frame of the track
+bool decoder_seek(decoder_t *decoder, uint32_t frame);
+
+// Stop decoding; the file stays open
+void decoder_close(decoder_t *decoder);
+
+static inline bool decoder_at_end(const decoder_t *decoder) {
+  return decoder->position >= (uint32_t)decoder->file->numFramesInHeader;
+}
+
+typedef struct decode_stats {
+  uint64_t frames; // decoded by the decode task
+  uint64_t cycles; // it spent decoding them
+  uint32_t waits;  // times a reader found no decoded block and waited
+} decode_stats_t;
+
+// Work done by the decode task since boot
+const decode_stats_t *decoder_task_stats(void);
@@ -1,15 +1,53 @@
 #include "file_managment.h"
 
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/param.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "driver/sdmmc_host.h"
 #include "driver/sdspi_host.h"
 #include "sdmmc_cmd.h"
 
 #include "esp_log.h"
+#include "esp_partition.h"
 #include "esp_vfs.h"
 #include "esp_vfs_fat.h"
 
+#include "book_pack.h"
+#include "sd_card.h"
+
 static const char* ourTaskName = "file_management";
 
-static char files[NUM_SECTIONS][MAX_FILE_NAME_LENGTH];
+// Track table, sorted by page id. Paths live in one name pool so the table
+// stays compact: 44 bytes per track plus the path.
+static track_info_t *tracks = NULL;
+static int num_tracks = 0;
+static int tracks_capacity = 0;
+static char *names = NULL;
+static uint32_t names_size = 0;
+static uint32_t names_capacity = 0;
+
+// Tracks loaded from the track index and checked against the card since,
+// one bit per table position. NULL when the table comes from a scan.
+static uint32_t *tracks_checked = NULL;
+
+static sdmmc_card_t *mounted_card = NULL;
+
+// Book pack, when the book directory holds one. It stays open from boot on,
+// and its tracks are read from it by offset.
+static FILE *pack_file = NULL;
+static track_extent_t pack_extent;
+static bool pack_mapped = false;
+
+// Book pack in the book partition, mapped at boot with BOOK_STORAGE_FLASH.
+// Its tracks are read from the mapping, and it stays mapped.
+static const uint8_t *flash_book = NULL;
+static uint32_t flash_book_size = 0;
 
 bool mount_fs(sdmmc_card_t *card) {
     /*
@@ -25,12 +63,23 @@ bool mount_fs(sdmmc_card_t *card) {
 
   esp_vfs_fat_mount_config_t mount_config = {.format_if_mount_failed = true,
                                              .disk_status_check_enable = true,
-                                             .max_files = 1,
+                                             .max_files = SECTION_POOL_SIZE + 1,
                                              .allocation_unit_size = 4096};
 
+  esp_err_t ret;
+
+#if SD_BUS == SD_BUS_SDMMC
+  sdmmc_host_t host = SDMMC_HOST_DEFAULT();
+  host.max_freq_khz = SD_MOUNT_FREQ_KHZ;
+
+  sdmmc_slot_config_t slot_config = SDMMC_SLOT_CONFIG_DEFAULT();
+  slot_config.width = SD_BUS_WIDTH;
+  slot_config.flags |= SDMMC_SLOT_FLAG_INTERNAL_PULLUP;
+#else
   sdmmc_host_t host = SDSPI_HOST_DEFAULT();
   // Speed set at about .7 max speed that did not through a 109 improper error.
-  host.max_freq_khz = 5000;
+  // Faster clocks are probed once the card is up.
+  host.max_freq_khz = SD_MOUNT_FREQ_KHZ;
   
   spi_bus_config_t bus_cfg =  {.mosi_io_num = PIN_NUM_MOSI,
                               .miso_io_num = PIN_NUM_MISO,
@@ -38,7 +87,6 @@ bool mount_fs(sdmmc_card_t *card) {
                               .quadhd_io_num = -1,
                               .quadwp_io_num = -1};
 
-  esp_err_t ret;
   ret = spi_bus_initialize(host.slot, &bus_cfg, SDSPI_DEFAULT_DMA);
   
   if (ret != ESP_OK)
@@ -50,13 +98,19 @@ bool mount_fs(sdmmc_card_t *card) {
   sdspi_device_config_t slot_config = SDSPI_DEVICE_CONFIG_DEFAULT();
   slot_config.gpio_cs = PIN_NUM_CS;
   slot_config.host_id = host.slot;
+#endif
 
   ESP_LOGI(ourTaskName, "Mounting FS");
 
   const char mount_point[] = MOUNT_POINT;
 
+#if SD_BUS == SD_BUS_SDMMC
+  ret = esp_vfs_fat_sdmmc_mount(mount_point, &host, &slot_config, &mount_config,
+                                &card);
+#else
   ret = esp_vfs_fat_sdspi_mount(mount_point, &host, &slot_config, &mount_config,
                                 &card);
+#endif
 
   if (ret != ESP_OK)
   {
@@ -76,30 +130,491 @@ bool mount_fs(sdmmc_card_t *card) {
 
   ESP_LOGI(ourTaskName, "FS mounted");
 
-  sdmmc_card_print_info(stdout, card);
+  mounted_card = card;
+  probe_card_clock(card);
 
   return true;
 }
 
+bool mount_flash(void) {
+  const esp_partition_t *partition =
+      esp_partition_find_first(ESP_PARTITION_TYPE_ANY, ESP_PARTITION_SUBTYPE_ANY, BOOK_PARTITION);
+  if (partition == NULL) {
+    ESP_LOGE(ourTaskName, "No %s partition in the partition table", BOOK_PARTITION);
+    return false;
+  }
+
+  // Only the pack is mapped, not the rest of the partition, as the data
+  // address space is shared with the app's constants
+  book_pack_header_t header;
+  esp_err_t err = esp_partition_read(partition, 0, &header, sizeof(header));
+  if (err != ESP_OK || header.magic != BOOK_PACK_MAGIC || header.pack_size > partition->size) {
+    ESP_LOGE(ourTaskName, "No book pack in the %s partition", BOOK_PARTITION);
+    return false;
+  }
 
-void sort_filenames () {
+  const void *mapped;
+  esp_partition_mmap_handle_t handle;
+  err = esp_partition_mmap(partition, 0, header.pack_size, ESP_PARTITION_MMAP_DATA, &mapped, &handle);
+  if (err != ESP_OK) {
+    ESP_LOGE(ourTaskName, "Could not map the %s partition (%s)", BOOK_PARTITION, esp_err_to_name(err));
+    return false;
+  }
+
+  flash_book = (const uint8_t *)mapped;
+  flash_book_size = header.pack_size;
+  ESP_LOGI(ourTaskName, "Book partition mapped: %lu bytes at flash 0x%lx", (unsigned long)flash_book_size,
+           (unsigned long)partition->address);
+  return true;
+}
+
+#if BOOK_STORAGE != BOOK_STORAGE_FLASH
+// Track index kept in the book directory, so boot does not walk it. FAT keeps
+// no modification time for directories, so the index is checked against the
+// card's free cluster count, which changes whenever files are added, removed
+// or resized. Each track's size and modification stamp are checked the first
+// time it is opened (see check_track).
+#define TRACK_INDEX_FILE "INDEX.MBI"
+#define TRACK_INDEX_MAGIC 0x4958424dUL // "MBXI"
+#define TRACK_INDEX_VERSION 5
+
+// Page id given to files without a number while scanning
+#define UNNUMBERED_PAGE UINT16_MAX
+
+typedef struct track_index_header {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t entry_size;
+  uint32_t free_clusters;
+  uint32_t num_tracks;
+  uint32_t names_size;
+} track_index_header_t;
+
+// A track no longer matches the index, which was dropped for the next boot
+// to scan the book again
+static bool track_index_stale = false;
+#endif
+
+// Header details learnt since the index was written
+static bool track_index_dirty = false;
+
+
+// Path of a file in the book directory for POSIX calls
+static void card_path(char *out, size_t out_len, const char *relative) {
+  if (BOOK_DIR[0] == '\0') {
+    snprintf(out, out_len, "%s/%s", MOUNT_POINT, relative);
+  } else {
+    snprintf(out, out_len, "%s/%s/%s", MOUNT_POINT, BOOK_DIR, relative);
+  }
+}
+
+// Stereo float32 at 48 kHz, the heaviest format playback takes
+#define PLAYBACK_PEAK_BYTE_RATE (48000 * 2 * 4)
+
+void print_card_info(void) {
+  if (mounted_card == NULL) {
+    return;
+  }
+
+  sdmmc_card_print_info(stdout, mounted_card);
+
+  if (CARD_BENCH_BYTES == 0 || track_count() == 0) {
+    return;
+  }
+
+  char file_name[sizeof(MOUNT_POINT) + sizeof(BOOK_DIR) + MAX_PATH_LENGTH + 1];
+  card_path(file_name, sizeof(file_name), pack_file != NULL ? BOOK_PACK_FILE : track_name(track_at(0)));
+  uint32_t byte_rate = card_read_throughput(file_name, CARD_BENCH_BYTES);
+
+  if (byte_rate == 0) {
+    ESP_LOGE(ourTaskName, "Could not read %s to measure the card", file_name);
+    return;
+  }
+
+  ESP_LOGI(ourTaskName, "Card reads %lu.%02lu MB/s, %lu%% of the card busy at %u B/s playback",
+           (unsigned long)(byte_rate / 1000000), (unsigned long)(byte_rate / 10000 % 100),
+           (unsigned long)((uint64_t)PLAYBACK_PEAK_BYTE_RATE * 100 / byte_rate),
+           PLAYBACK_PEAK_BYTE_RATE);
+}
+
+// Path of a file in the book directory for FATFS calls
+static void fatfs_path(char *out, size_t out_len, const char *relative) {
+  if (BOOK_DIR[0] == '\0') {
+    snprintf(out, out_len, "%s", relative);
+  } else if (relative[0] == '\0') {
+    snprintf(out, out_len, "%s", BOOK_DIR);
+  } else {
+    snprintf(out, out_len, "%s/%s", BOOK_DIR, relative);
+  }
+}
+
+static void free_tracks(void) {
+  if (pack_file != NULL) {
+    fclose(pack_file);
+    pack_file = NULL;
+  }
+  pack_mapped = false;
+  free(tracks);
+  free(names);
+  free(tracks_checked);
+  tracks = NULL;
+  names = NULL;
+  tracks_checked = NULL;
+  num_tracks = tracks_capacity = 0;
+  names_size = names_capacity = 0;
+}
+
+static bool map_file(const char *path, track_extent_t *extent);
+
+// Append a pack entry to the track table, false if it does not describe
+// samples within the pack in page order
+static bool add_packed_track(const book_pack_entry_t *entry, uint32_t pack_size) {
+  int sample_size = tinywav_sample_size((TinyWavSampleFormat)entry->sample_format);
+  if ((entry->sample_format != TW_INT16 && entry->sample_format != TW_INT32) || entry->channels == 0 ||
+      entry->data_offset % BOOK_PACK_ALIGN != 0 || entry->data_offset > pack_size ||
+      entry->data_size > pack_size - entry->data_offset || entry->data_size % (sample_size * entry->channels) != 0 ||
+      (num_tracks > 0 && tracks[num_tracks - 1].page >= entry->page)) {
+    return false;
+  }
+
+  size_t name_size = strnlen(entry->name, BOOK_PACK_NAME_SIZE - 1) + 1;
+  track_info_t *track = &tracks[num_tracks++];
+  memset(track, 0, sizeof(*track));
+  track->page = entry->page;
+  track->channels = entry->channels;
+  track->sample_format = entry->sample_format;
+  track->audio_format = 1; // PCM
+  track->bits_per_sample = 8 * sample_size;
+  track->sample_rate = entry->sample_rate;
+  track->data_offset = entry->data_offset;
+  track->data_size = entry->data_size;
+  track->file_size = pack_size;
+  track->loop_start = entry->loop_start;
+  track->loop_end = entry->loop_end;
+  track->loudness = entry->loudness;
+  track->name_offset = names_size;
+  memcpy(names + names_size, entry->name, name_size - 1);
+  names[names_size + name_size - 1] = '\0';
+  names_size += name_size;
+  return true;
+}
+
+// Read the next size bytes of a pack's header and table, from the pack file
+// or, without one, the mapped partition
+static bool read_pack_table(FILE *file, uint32_t *offset, void *out, size_t size) {
+  if (file != NULL) {
+    if (fread(out, size, 1, file) != 1) {
+      return false;
+    }
+  } else {
+    if (*offset > flash_book_size || size > flash_book_size - *offset) {
+      return false;
+    }
+    memcpy(out, flash_book + *offset, size);
+  }
+  *offset += size;
+  return true;
+}
+
+// Build the track table from the book pack in the book directory, or in the
+// mapped partition once mount_flash has mapped it
+static bool load_book_pack(void) {
+  char pack_path[sizeof(MOUNT_POINT) + sizeof(BOOK_DIR) + sizeof(BOOK_PACK_FILE) + 2];
+  const char *where = "in the " BOOK_PARTITION " partition";
+  FILE *file = NULL;
+  uint32_t stored_size = flash_book_size;
+
+  if (flash_book == NULL) {
+    where = pack_path;
+    card_path(pack_path, sizeof(pack_path), BOOK_PACK_FILE);
+    file = fopen(pack_path, "rb");
+    if (file == NULL) {
+      ESP_LOGD(ourTaskName, "No book pack on the card");
+      return false;
+    }
+    struct stat file_stat;
+    stored_size = fstat(fileno(file), &file_stat) == 0 ? (uint32_t)file_stat.st_size : 0;
+  }
+
+  book_pack_header_t header;
+  uint32_t offset = 0;
+  bool read_ok = read_pack_table(file, &offset, &header, sizeof(header)) &&
+                 header.magic == BOOK_PACK_MAGIC &&
+                 header.version == BOOK_PACK_VERSION &&
+                 header.entry_size == sizeof(book_pack_entry_t) &&
+                 header.num_tracks > 0 && header.num_tracks <= UINT16_MAX &&
+                 header.pack_size % BOOK_PACK_ALIGN == 0 && header.pack_size == stored_size;
+
+  if (read_ok) {
+    tracks = (track_info_t *)malloc(header.num_tracks * sizeof(track_info_t));
+    names = (char *)malloc(header.num_tracks * BOOK_PACK_NAME_SIZE);
+    read_ok = tracks != NULL && names != NULL;
+    tracks_capacity = header.num_tracks;
+    names_capacity = header.num_tracks * BOOK_PACK_NAME_SIZE;
+  }
+  for (uint32_t i = 0; read_ok && i < header.num_tracks; ++i) {
+    book_pack_entry_t entry;
+    read_ok = read_pack_table(file, &offset, &entry, sizeof(entry)) && add_packed_track(&entry, header.pack_size);
+  }
+
+  if (!read_ok) {
+    ESP_LOGE(ourTaskName, "Book pack %s unreadable%s", where, file != NULL ? ", playing the loose tracks" : "");
+    if (file != NULL) {
+      fclose(file);
+    }
+    free_tracks();
+    return false;
+  }
+  if (file == NULL) {
+    ESP_LOGI(ourTaskName, "Book pack: %d tracks, %lu bytes mapped from flash", num_tracks,
+             (unsigned long)header.pack_size);
+    return true;
+  }
+  pack_file = file;
+
+  // Mapped once, for every track's raw reads
+  char path[sizeof(BOOK_DIR) + sizeof(BOOK_PACK_FILE) + 1];
+  fatfs_path(path, sizeof(path), BOOK_PACK_FILE);
+  pack_mapped = map_file(path, &pack_extent);
+
+  ESP_LOGI(ourTaskName, "Book pack: %d tracks, %lu bytes in %lu runs", num_tracks,
+           (unsigned long)header.pack_size, (unsigned long)pack_extent.runs);
+  return true;
+}
+
+#if BOOK_STORAGE != BOOK_STORAGE_FLASH
+// The track index, scanning and recordings only concern a book of loose
+// tracks on the card
+static bool card_free_clusters(uint32_t *free_clusters) {
+  DWORD clusters;
+  FATFS *fs;
+
+  FRESULT f_res = f_getfree("", &clusters, &fs);
+  if (f_res != FR_OK) {
+    ESP_LOGE(ourTaskName, "FATFS Error when reading free space: %d", f_res);
+    return false;
+  }
+  *free_clusters = clusters;
+  return true;
+}
+
+static bool load_track_index(void) {
+  char index_path[sizeof(MOUNT_POINT) + sizeof(BOOK_DIR) + sizeof(TRACK_INDEX_FILE) + 2];
+  card_path(index_path, sizeof(index_path), TRACK_INDEX_FILE);
+
+  FILE *index_file = fopen(index_path, "rb");
+  if (index_file == NULL) {
+    ESP_LOGI(ourTaskName, "No track index on the card");
+    return false;
+  }
+
+  track_index_header_t header;
+  bool read_ok = fread(&header, sizeof(header), 1, index_file) == 1 &&
+                 header.magic == TRACK_INDEX_MAGIC &&
+                 header.version == TRACK_INDEX_VERSION &&
+                 header.entry_size == sizeof(track_info_t) &&
+                 header.num_tracks <= UINT16_MAX;
+
+  if (read_ok) {
+    tracks = (track_info_t *)malloc(MAX(header.num_tracks, 1) * sizeof(track_info_t));
+    names = (char *)malloc(MAX(header.names_size, 1));
+    tracks_checked = (uint32_t *)calloc(header.num_tracks / 32 + 1, sizeof(uint32_t));
+    read_ok = tracks != NULL && names != NULL && tracks_checked != NULL &&
+              fread(tracks, sizeof(track_info_t), header.num_tracks, index_file) == header.num_tracks &&
+              fread(names, 1, header.names_size, index_file) == header.names_size;
+  }
+  fclose(index_file);
+
+  if (!read_ok) {
+    ESP_LOGI(ourTaskName, "Track index unreadable, rebuilding");
+    free_tracks();
+    return false;
+  }
+
+  num_tracks = tracks_capacity = header.num_tracks;
+  names_size = names_capacity = header.names_size;
+
+  uint32_t free_clusters;
+  if (!card_free_clusters(&free_clusters) || free_clusters != header.free_clusters) {
+    ESP_LOGI(ourTaskName, "Card contents changed, rebuilding track index");
+    free_tracks();
+    return false;
+  }
+  return true;
+}
+
+static void save_track_index(void) {
+  char index_path[sizeof(MOUNT_POINT) + sizeof(BOOK_DIR) + sizeof(TRACK_INDEX_FILE) + 2];
+  card_path(index_path, sizeof(index_path), TRACK_INDEX_FILE);
+
+  track_index_header_t header = {.magic = TRACK_INDEX_MAGIC,
+                                 .version = TRACK_INDEX_VERSION,
+                                 .entry_size = sizeof(track_info_t),
+                                 .free_clusters = 0,
+                                 .num_tracks = num_tracks,
+                                 .names_size = names_size};
+
+  FILE *index_file = fopen(index_path, "wb");
+  if (index_file == NULL) {
+    ESP_LOGE(ourTaskName, "Could not create track index");
+    return;
+  }
+  bool written = fwrite(&header, sizeof(header), 1, index_file) == 1 &&
+                 fwrite(tracks, sizeof(track_info_t), num_tracks, index_file) == (size_t)num_tracks &&
+                 fwrite(names, 1, names_size, index_file) == names_size;
+  fclose(index_file);
+
+  // The free cluster count only settles once the index itself is on the
+  // card. Rewriting the header in place does not allocate, so it stays valid.
+  if (!written || !card_free_clusters(&header.free_clusters)) {
+    ESP_LOGE(ourTaskName, "Could not write track index");
+    return;
+  }
+
+  index_file = fopen(index_path, "r+b");
+  if (index_file == NULL || fwrite(&header, sizeof(header), 1, index_file) != 1) {
+    ESP_LOGE(ourTaskName, "Could not write track index");
+  }
+  if (index_file != NULL) {
+    fclose(index_file);
+  }
+
+  track_index_dirty = false;
+  ESP_LOGI(ourTaskName, "Track index written for %d tracks", num_tracks);
+}
+
+void flush_track_index(void) {
+  if (!track_index_dirty || track_index_stale) {
+    return;
+  }
+
+  char index_path[sizeof(MOUNT_POINT) + sizeof(BOOK_DIR) + sizeof(TRACK_INDEX_FILE) + 2];
+  card_path(index_path, sizeof(index_path), TRACK_INDEX_FILE);
+
+  // Entries have a fixed size, so rewriting them in place keeps the free
+  // cluster count the index was validated with
+  FILE *index_file = fopen(index_path, "r+b");
+  if (index_file == NULL) {
+    ESP_LOGE(ourTaskName, "Could not update track index");
+    return;
+  }
+  if (fseek(index_file, sizeof(track_index_header_t), SEEK_SET) != 0 ||
+      fwrite(tracks, sizeof(track_info_t), num_tracks, index_file) != (size_t)num_tracks) {
+    ESP_LOGE(ourTaskName, "Could not update track index");
+  }
+  fclose(index_file);
+  track_index_dirty = false;
+}
+
+// A file re-exported at the same size, renamed to another page or swapped
+// with another leaves the free cluster count as it was, so a track from the
+// index is checked against its directory entry the first time it is opened.
+// On a mismatch its header is parsed again, and the index is dropped so the
+// next boot scans the book.
+static void check_track(track_info_t *track) {
+  int position = track - tracks;
+  uint32_t bit = 1u << (position % 32);
+  if (tracks_checked == NULL || (tracks_checked[position / 32] & bit) != 0) {
+    return;
+  }
+  tracks_checked[position / 32] |= bit;
+
+  static FILINFO file_info;
+  char path[sizeof(BOOK_DIR) + MAX_PATH_LENGTH + 1];
+  fatfs_path(path, sizeof(path), track_name(track));
+  FRESULT f_res = f_stat(path, &file_info);
+  if (f_res == FR_OK && file_info.fsize == track->file_size &&
+      file_info.fdate == track->fdate && file_info.ftime == track->ftime) {
+    return;
+  }
+
+  ESP_LOGW(ourTaskName, "%s changed, dropping the track index", path);
+  track->sample_format = 0;
+  if (f_res == FR_OK) {
+    track->file_size = file_info.fsize;
+    track->fdate = file_info.fdate;
+    track->ftime = file_info.ftime;
+  }
+  if (!track_index_stale) {
+    char index_path[sizeof(MOUNT_POINT) + sizeof(BOOK_DIR) + sizeof(TRACK_INDEX_FILE) + 2];
+    card_path(index_path, sizeof(index_path), TRACK_INDEX_FILE);
+    unlink(index_path);
+    track_index_stale = true;
+  }
+}
+
+static bool is_wav_file(const char *name) {
+  size_t length = strlen(name);
+  return length > 4 && strcasecmp(name + length - 4, ".wav") == 0;
+}
+
+// Page id from the first number in a file name
+static uint16_t page_from_name(const char *name) {
+  while (*name != '\0' && !isdigit((unsigned char)*name)) {
+    ++name;
+  }
+  if (*name == '\0') {
+    return UNNUMBERED_PAGE;
+  }
+  unsigned long page = strtoul(name, NULL, 10);
+  return page < UNNUMBERED_PAGE ? (uint16_t)page : UNNUMBERED_PAGE;
+}
+
+static bool add_track(const char *path, const FILINFO *file_info) {
+  size_t path_size = strlen(path) + 1;
+
+  if (num_tracks == tracks_capacity) {
+    int capacity = tracks_capacity == 0 ? 16 : tracks_capacity * 2;
+    track_info_t *grown = (track_info_t *)realloc(tracks, capacity * sizeof(track_info_t));
+    if (grown == NULL) {
+      return false;
+    }
+    tracks = grown;
+    tracks_capacity = capacity;
+  }
+  if (names_size + path_size > names_capacity) {
+    uint32_t capacity = MAX(names_capacity * 2, names_size + path_size + 256);
+    char *grown = (char *)realloc(names, capacity);
+    if (grown == NULL) {
+      return false;
+    }
+    names = grown;
+    names_capacity = capacity;
+  }
+
+  track_info_t *track = &tracks[num_tracks++];
+  memset(track, 0, sizeof(*track));
+  track->page = page_from_name(file_info->fname);
+  track->file_size = file_info->fsize;
+  track->fdate = file_info->fdate;
+  track->ftime = file_info->ftime;
+  track->name_offset = names_size;
+  memcpy(names + names_size, path, path_size);
+  names_size += path_size;
+  return true;
+}
+
+// Walk a directory of the book, relative to BOOK_DIR, adding every WAV file in
+// it and its subdirectories. path is extended in place while walking.
+static void scan_directory(char *path, int depth) {
   FF_DIR baseDir;
-  FILINFO file_info;
+  static FILINFO file_info;
 
   FRESULT f_res;
+  char dir_path[sizeof(BOOK_DIR) + MAX_PATH_LENGTH + 1];
+  fatfs_path(dir_path, sizeof(dir_path), path);
   
-  // Open directory were SD card resides (base directory)
   // Use FATFS file functions, not ANSI C
-  f_res = f_opendir(&baseDir, "");
+  f_res = f_opendir(&baseDir, dir_path);
 
   if (f_res != F_OK)
   {
-    ESP_LOGE(ourTaskName, "Could not open directory (%s)\n", MOUNT_POINT);
+    ESP_LOGE(ourTaskName, "Could not open directory (%s)\n", dir_path);
     ESP_LOGE(ourTaskName, "FATFS Error: %d", f_res);
     return;
   }
 
-  int file = 0;
+  size_t path_length = strlen(path);
 
   // Read all files in and directories, only add files to list
   for (;;)
@@ -108,32 +623,42 @@ void sort_filenames () {
     if (f_res != FR_OK || file_info.fname[0] == 0)
       break;
 
-    if (file_info.fattrib & AM_DIR)
+    size_t name_length = strlen(file_info.fname);
+    if (path_length + name_length + 2 > MAX_PATH_LENGTH)
     {
-      ESP_LOGI(ourTaskName, "Folder: %s", file_info.fname);
+      ESP_LOGW(ourTaskName, "Path too long, skipping %s", file_info.fname);
+      continue;
     }
-    else
+
+    // Append this entry's name to the path being walked
+    char *name = path + path_length;
+    if (path_length > 0)
     {
+      *name++ = '/';
+    }
+    strcpy(name, file_info.fname);
 
-      ESP_LOGI(ourTaskName, "File Name: %s", file_info.fname);
-      ESP_LOGI(ourTaskName, "\tSize: %10lu", file_info.fsize);
-      if (file >= NUM_SECTIONS)
+    if (file_info.fattrib & AM_DIR)
+    {
+      ESP_LOGD(ourTaskName, "Folder: %s", path);
+      if (depth < MAX_BOOK_DEPTH)
       {
-        continue;
+        scan_directory(path, depth + 1);
       }
+    }
+    else if (is_wav_file(file_info.fname))
+    {
+      ESP_LOGD(ourTaskName, "File Name: %s", path);
+      ESP_LOGD(ourTaskName, "\tSize: %10lu", (unsigned long)file_info.fsize);
 
-      // Search string for wav type. if type is present, then sub_address will
-      // not be null
-      char *sub_address =
-          strnstr(file_info.fname, ".WAV", MAX_FILE_NAME_LENGTH);
-
-      if (file < NUM_SECTIONS && sub_address != NULL)
+      if (!add_track(path, &file_info))
       {
-        strcpy(files[file], file_info.fname);
-        ESP_LOGI(ourTaskName, "File Name Copy: %s", files[file]);
-        file++;
+        ESP_LOGE(ourTaskName, "No memory for the track table");
+        path[path_length] = '\0';
+        break;
       }
     }
+    path[path_length] = '\0';
   }
 
   // Close directory to save on resources
@@ -142,52 +667,392 @@ void sort_filenames () {
   if (f_res != F_OK)
   {
     ESP_LOGE(ourTaskName, "FATFS Error when opening a file: %d", f_res);
-    return;
   }
+}
 
-  ESP_LOGI(ourTaskName, "File Order pre sort: \n");
-  for (int i = 0; i < file; ++i)
-  {
-    ESP_LOGI(ourTaskName, "%s\n", files[i]);
+static bool is_recording(const char *path) {
+  return strncasecmp(path, RECORD_DIR "/", sizeof(RECORD_DIR)) == 0;
+}
+
+static int compare_tracks(const void *a, const void *b) {
+  const track_info_t *track_a = (const track_info_t *)a;
+  const track_info_t *track_b = (const track_info_t *)b;
+  const char *name_a = names + track_a->name_offset;
+  const char *name_b = names + track_b->name_offset;
+
+  if (track_a->page != track_b->page) {
+    return track_a->page < track_b->page ? -1 : 1;
   }
+  // A recording sorts first, so it keeps the page
+  if (is_recording(name_a) != is_recording(name_b)) {
+    return is_recording(name_a) ? -1 : 1;
+  }
+  return strcmp(name_a, name_b);
+}
 
-  for (int i = 0; i < file; i++) {
-    for (int j = i + 1; j < file; j++) {
-      if (strcmp(files[i], files[j]) > 0) {
-        char temp[MAX_FILE_NAME_LENGTH];
-        strcpy(temp, files[i]);
-        strcpy(files[i], files[j]);
-        strcpy(files[j], temp);
-      }
+// Sort the scanned tracks by page id, numbering the files without one after
+// the highest page and dropping files that repeat a page
+static void number_tracks(void) {
+  qsort(tracks, num_tracks, sizeof(track_info_t), compare_tracks);
+
+  int numbered = 0;
+  while (numbered < num_tracks && tracks[numbered].page != UNNUMBERED_PAGE) {
+    numbered++;
+  }
+  uint32_t next_page = numbered > 0 ? tracks[numbered - 1].page + 1u : 1u;
+  for (int i = numbered; i < num_tracks; ++i) {
+    // Sorted by name already, as they all share UNNUMBERED_PAGE
+    tracks[i].page = next_page < UNNUMBERED_PAGE ? next_page++ : UNNUMBERED_PAGE;
+  }
+
+  int kept = 0;
+  for (int i = 0; i < num_tracks; ++i) {
+    if (tracks[i].page == UNNUMBERED_PAGE ||
+        (kept > 0 && tracks[kept - 1].page == tracks[i].page)) {
+      ESP_LOGW(ourTaskName, "Skipping %s, its page is already taken", names + tracks[i].name_offset);
+      continue;
     }
+    tracks[kept++] = tracks[i];
+  }
+  num_tracks = kept;
+}
+#endif
+
+void sort_filenames () {
+  free_tracks();
 
+#if BOOK_STORAGE == BOOK_STORAGE_FLASH
+  // The partition holds the pack alone, with nothing to scan or index
+  if (flash_book != NULL) {
+    load_book_pack();
   }
- 
-  ESP_LOGI(ourTaskName, "File Order: \n");
-  for (int i = 0; i < file; ++i)
+#else
+  if (!load_book_pack() && !load_track_index()) {
+    char path[MAX_PATH_LENGTH] = "";
+    scan_directory(path, 0);
+    number_tracks();
+    save_track_index();
+  }
+#endif
+
+  ESP_LOGI(ourTaskName, "Track table: %d tracks, %u bytes", num_tracks,
+           (unsigned)(num_tracks * sizeof(track_info_t) + names_size));
+  for (int i = 0; i < num_tracks; ++i)
   {
-    ESP_LOGI(ourTaskName, "%s\n", files[i]);
+    ESP_LOGD(ourTaskName, "Page %u: %s", tracks[i].page, track_name(&tracks[i]));
+  }
+}
+
+#if BOOK_STORAGE != BOOK_STORAGE_FLASH
+int commit_recordings(void) {
+  FF_DIR dir;
+  static FILINFO file_info;
+  char dir_path[sizeof(BOOK_DIR) + sizeof(RECORD_DIR) + 1];
+  fatfs_path(dir_path, sizeof(dir_path), RECORD_DIR);
+
+  // Nothing was ever recorded
+  if (f_opendir(&dir, dir_path) != FR_OK) {
+    return 0;
   }
+
+  int committed = 0;
+  for (;;) {
+    FRESULT f_res = f_readdir(&dir, &file_info);
+    if (f_res != FR_OK || file_info.fname[0] == 0) {
+      break;
+    }
+    size_t length = strlen(file_info.fname);
+    if ((file_info.fattrib & AM_DIR) || length <= 4 ||
+        strcasecmp(file_info.fname + length - 4, ".tmp") != 0) {
+      continue;
+    }
+
+    char relative[sizeof(RECORD_DIR) + sizeof(file_info.fname) + 1];
+    char from[sizeof(MOUNT_POINT) + sizeof(BOOK_DIR) + sizeof(relative) + 2];
+    char to[sizeof(from)];
+    snprintf(relative, sizeof(relative), "%s/%s", RECORD_DIR, file_info.fname);
+    card_path(from, sizeof(from), relative);
+    memcpy(relative + strlen(relative) - 4, ".WAV", 4);
+    card_path(to, sizeof(to), relative);
+
+    // FAT does not rename over an existing file
+    unlink(to);
+    if (rename(from, to) != 0) {
+      ESP_LOGE(ourTaskName, "Could not rename %s to %s", from, to);
+      continue;
+    }
+    ESP_LOGI(ourTaskName, "Recording %s added to the book", to);
+    committed++;
+  }
+  f_closedir(&dir);
+
+  // The free cluster count may well match the index's again
+  if (committed > 0) {
+    char index_path[sizeof(MOUNT_POINT) + sizeof(BOOK_DIR) + sizeof(TRACK_INDEX_FILE) + 2];
+    card_path(index_path, sizeof(index_path), TRACK_INDEX_FILE);
+    unlink(index_path);
+  }
+  return committed;
+}
+#endif
+
+int track_count(void) {
+  return num_tracks;
+}
+
+bool book_packed(void) {
+  return pack_file != NULL;
+}
+
+const uint8_t *track_mapping(const track_info_t *track) {
+  return flash_book != NULL ? flash_book + track->data_offset : NULL;
+}
+
+track_info_t *track_at(int position) {
+  return position >= 0 && position < num_tracks ? &tracks[position] : NULL;
 }
 
-int open_file(const int index, TinyWav* tiny_wav_output) {
+track_info_t *find_track(uint16_t page) {
+  int low = 0;
+  int high = num_tracks - 1;
+
+  while (low <= high) {
+    int middle = low + (high - low) / 2;
+    if (tracks[middle].page == page) {
+      return &tracks[middle];
+    }
+    if (tracks[middle].page < page) {
+      low = middle + 1;
+    } else {
+      high = middle - 1;
+    }
+  }
+  return NULL;
+}
+
+const char *track_name(const track_info_t *track) {
+  return names + track->name_offset;
+}
+
+// Fill in an open track's header from its known details
+static void describe_track(const track_info_t *track, TinyWav *tw) {
+  memcpy(tw->h.ChunkID, "RIFF", 4);
+  memcpy(tw->h.Format, "WAVE", 4);
+  memcpy(tw->h.Subchunk1ID, "fmt ", 4);
+  memcpy(tw->h.Subchunk2ID, "data", 4);
+  tw->h.AudioFormat = track->audio_format;
+  tw->h.NumChannels = track->channels;
+  tw->h.SampleRate = track->sample_rate;
+  tw->h.BitsPerSample = track->bits_per_sample;
+  tw->h.BlockAlign = track->channels * tinywav_sample_size((TinyWavSampleFormat)track->sample_format);
+  tw->h.ByteRate = track->sample_rate * tw->h.BlockAlign;
+  tw->h.Subchunk2Size = track->data_size;
+
+  tw->numChannels = track->channels;
+  tw->chanFmt = TW_INTERLEAVED;
+  tw->sampFmt = (TinyWavSampleFormat)track->sample_format;
+  tw->numFramesInHeader = track->data_size / tw->h.BlockAlign;
+  tw->loopStart = track->loop_start;
+  tw->loopEnd = track->loop_end;
+  tw->loudness = track->loudness;
+  tw->totalFramesReadWritten = 0;
+
+  tw->dataStart = track->data_offset;
+}
+
+// Open a track from its known header details, without parsing the header.
+// Fails if the file's size changed since they were recorded.
+static int open_known_track(const track_info_t *track, const char *file_name, TinyWav *tw) {
+  memset(tw, 0, sizeof(*tw));
+  tw->f = fopen(file_name, "rb");
+  if (tw->f == NULL) {
+    return -1;
+  }
+  tw->fileno = fileno(tw->f);
+
+  struct stat file_stat;
+  if (fstat(tw->fileno, &file_stat) != 0 || (uint32_t)file_stat.st_size != track->file_size) {
+    fclose(tw->f);
+    tw->f = NULL;
+    return -1;
+  }
+
+  describe_track(track, tw);
+  fseek(tw->f, track->data_offset, SEEK_SET);
+  return 0;
+}
+
+// A packed track shares the pack's descriptor and leaves it where it is;
+// read_pack_sectors seeks it for every read
+static int open_packed_track(const track_info_t *track, TinyWav *tw) {
+  memset(tw, 0, sizeof(*tw));
+  tw->f = pack_file;
+  tw->fileno = fileno(pack_file);
+  describe_track(track, tw);
+  ESP_LOGD(ourTaskName, "Track to open: %s, %lu bytes into the book pack", track_name(track),
+           (unsigned long)track->data_offset);
+  return 0;
+}
+
+// A mapped track has no file at all; its section reads the mapping
+static int open_mapped_track(const track_info_t *track, TinyWav *tw) {
+  memset(tw, 0, sizeof(*tw));
+  tw->fileno = -1;
+  describe_track(track, tw);
+  ESP_LOGD(ourTaskName, "Track to open: %s, %lu bytes into the book partition", track_name(track),
+           (unsigned long)track->data_offset);
+  return 0;
+}
+
+int open_track(track_info_t *track, TinyWav* tiny_wav_output) {
+  if (flash_book != NULL) {
+    return open_mapped_track(track, tiny_wav_output);
+  }
+  if (pack_file != NULL) {
+    return open_packed_track(track, tiny_wav_output);
+  }
+
     // File opening section:
   // Open file for reading
 
-  // file_name length is size of mount point plus maximum size of file name
-  char file_name[sizeof(MOUNT_POINT) + MAX_FILE_NAME_LENGTH];
-  strncpy(file_name, MOUNT_POINT, sizeof(MOUNT_POINT));
-  strncpy(&file_name[sizeof(MOUNT_POINT) - 1], "/", 2);
-  strncpy(&file_name[sizeof(MOUNT_POINT) - 1 + 1], files[index], sizeof(files[index]));
+  char file_name[sizeof(MOUNT_POINT) + sizeof(BOOK_DIR) + MAX_PATH_LENGTH + 1];
+  card_path(file_name, sizeof(file_name), track_name(track));
 
   ESP_LOGI(ourTaskName, "File to open:  %s", file_name);
 
+#if BOOK_STORAGE != BOOK_STORAGE_FLASH
+  check_track(track);
+#endif
+
+  // IMA ADPCM block layouts and frame counts are not in the index, so their
+  // headers are always parsed
+  if (track->sample_format != 0 && track->audio_format != TINYWAV_FORMAT_IMA_ADPCM &&
+      open_known_track(track, file_name, tiny_wav_output) == 0) {
+    return 0;
+  }
+
   int err = tinywav_open_read(tiny_wav_output, file_name, TW_INTERLEAVED);
   
   if (err != 0)
   {
     ESP_LOGE(ourTaskName, "Tiny wave could not open file to read.");
     ESP_LOGE(ourTaskName, "Error: %d", err);
+    return err;
+  }
+
+  // Remember the header details for the next open and the next boot
+  struct stat file_stat;
+  TinyWav *tw = tiny_wav_output;
+  track->channels = tw->h.NumChannels;
+  track->sample_format = tw->sampFmt;
+  track->audio_format = tw->h.AudioFormat;
+  track->bits_per_sample = tw->h.BitsPerSample;
+  track->sample_rate = tw->h.SampleRate;
+  track->data_offset = ftell(tw->f);
+  track->data_size = tw->h.Subchunk2Size;
+  track->loop_start = tw->loopStart;
+  track->loop_end = tw->loopEnd;
+  track->loudness = tw->loudness;
+  if (fstat(tw->fileno, &file_stat) == 0) {
+    track->file_size = file_stat.st_size;
   }
+  track_index_dirty = true;
   return err;
-}
\ No newline at end of file
+}
+
+void close_track(TinyWav *file) {
+  if (pack_file != NULL && file->f == pack_file) {
+    file->f = NULL;
+    return;
+  }
+  tinywav_close_read(file);
+}
+
+// Link map entries: the table size, then a length and first cluster for each
+// run, then a terminator. Room for three runs; only one is streamed raw, the
+// rest just count how fragmented a track is.
+#define LINK_MAP_SIZE 8
+
+static bool map_file(const char *path, track_extent_t *extent) {
+  memset(extent, 0, sizeof(*extent));
+
+  FIL file;
+  FRESULT f_res = f_open(&file, path, FA_READ);
+  if (f_res != FR_OK) {
+    ESP_LOGE(ourTaskName, "FATFS Error opening %s: %d", path, f_res);
+    return false;
+  }
+
+  DWORD link_map[LINK_MAP_SIZE] = {LINK_MAP_SIZE};
+  file.cltbl = link_map;
+  f_res = f_lseek(&file, CREATE_LINKMAP);
+
+  if (f_res != FR_OK && f_res != FR_NOT_ENOUGH_CORE) {
+    ESP_LOGE(ourTaskName, "FATFS Error mapping %s: %d", path, f_res);
+    f_close(&file);
+    return false;
+  }
+
+  // FatFs leaves the table size the chain needs in the first entry
+  extent->runs = (link_map[0] - 2) / 2;
+
+  FATFS *fs = file.obj.fs;
+  bool sector_sized = true;
+#if FF_MAX_SS != FF_MIN_SS
+  sector_sized = fs->ssize == TINYWAV_SECTOR_SIZE;
+#endif
+  if (f_res == FR_OK && extent->runs > 0 && sector_sized) {
+    extent->first_sector = fs->database + (link_map[2] - 2) * fs->csize;
+    extent->sectors = link_map[1] * fs->csize;
+  }
+
+  f_close(&file);
+  return true;
+}
+
+bool map_track(const track_info_t *track, track_extent_t *extent) {
+  if (flash_book != NULL) {
+    memset(extent, 0, sizeof(*extent));
+    return false;
+  }
+  if (pack_file != NULL) {
+    *extent = pack_extent;
+    return pack_mapped;
+  }
+
+  char path[sizeof(BOOK_DIR) + MAX_PATH_LENGTH + 1];
+  fatfs_path(path, sizeof(path), track_name(track));
+  return map_file(path, extent);
+}
+
+int read_track_sectors(void *extent, uint32_t sector, void *buffer, uint32_t count) {
+  const track_extent_t *run = (const track_extent_t *)extent;
+  if (sector >= run->sectors) {
+    return 0;
+  }
+  count = MIN(count, run->sectors - sector);
+
+  esp_err_t err = sdmmc_read_sectors(mounted_card, buffer, run->first_sector + sector, count);
+  if (err != ESP_OK) {
+    ESP_LOGE(ourTaskName, "Raw read of %lu sectors failed (%s)", (unsigned long)count, esp_err_to_name(err));
+    return -1;
+  }
+  return count;
+}
+
+int read_pack_sectors(void *context, uint32_t sector, void *buffer, uint32_t count) {
+  int fd = fileno(pack_file);
+  off_t offset = (off_t)sector * TINYWAV_SECTOR_SIZE;
+  if (lseek(fd, offset, SEEK_SET) != offset) {
+    ESP_LOGE(ourTaskName, "Could not seek the book pack to sector %lu", (unsigned long)sector);
+    return -1;
+  }
+
+  // The pack ends on a whole sector, so only its end reads short
+  ssize_t got = read(fd, buffer, (size_t)count * TINYWAV_SECTOR_SIZE);
+  if (got < 0) {
+    ESP_LOGE(ourTaskName, "Read of %lu book pack sectors failed", (unsigned long)count);
+    return -1;
+  }
+  return got / TINYWAV_SECTOR_SIZE;
+}
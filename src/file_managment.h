@@ -4,18 +4,181 @@
 #include "tinywav.h"
 
 // SD card file system definitions
+
+// Bus the card is wired to. SDMMC uses the dedicated host in 4-bit mode on its
+// fixed slot 1 pins: CLK 14, CMD 15, D0 2, D1 4, D2 12, D3 13. Those pins need
+// 10k pull-ups, and GPIO 12 is a strapping pin that must read low at reset
+// (burn the VDD_SDIO eFuse for 3.3 V flash, or use 1-bit mode). The default
+// page id pins sit on the same lines, so move PAGE_ID_PINS when using it.
+#define SD_BUS_SPI 0
+#define SD_BUS_SDMMC 1
+#ifndef SD_BUS
+#define SD_BUS SD_BUS_SPI
+#endif
+#ifndef SD_BUS_WIDTH
+#define SD_BUS_WIDTH 4
+#endif
+#define SDMMC_PINS {14, 15, 2, 4, 12, 13}
+
+// Clock the card is mounted at, and the faster ones tried after mounting. The
+// fastest that reads back cleanly is kept. Default speed mode tops out at
+// 20 MHz; anything above needs the card switched to high speed first.
+#ifndef SD_MOUNT_FREQ_KHZ
+#define SD_MOUNT_FREQ_KHZ 5000
+#endif
+#ifndef SD_PROBE_FREQS_KHZ
+#define SD_PROBE_FREQS_KHZ {10000, 16000, 20000}
+#endif
+
+// Bytes of the first track read at boot to log the card's throughput, 0 to
+// skip the test
+#ifndef CARD_BENCH_BYTES
+#define CARD_BENCH_BYTES 32768
+#endif
+
 #define PIN_NUM_MOSI 23
 #define PIN_NUM_MISO 19
 #define PIN_NUM_CLK 18
 #define PIN_NUM_CS 5
 
+// Where the book is stored. BOOK_STORAGE_FLASH plays a book pack (see
+// book_pack.h) written to the data partition labelled BOOK_PARTITION instead
+// of a card: mount_flash maps it into the address space once at boot, and
+// sections read their samples from the mapped address, through the flash
+// cache, with no card, FatFs or read() in the way. The book must fit the
+// partition; see partitions_book.csv.
+#define BOOK_STORAGE_CARD 0
+#define BOOK_STORAGE_FLASH 1
+#ifndef BOOK_STORAGE
+#define BOOK_STORAGE BOOK_STORAGE_CARD
+#endif
+#define BOOK_PARTITION "book"
+
+#ifndef MOUNT_POINT
 #define MOUNT_POINT "/sdc"
+#endif
+
+// Directory holding the book's tracks, relative to the card root. Tracks may
+// sit in subdirectories of it, up to MAX_BOOK_DEPTH levels down.
+#ifndef BOOK_DIR
+#define BOOK_DIR ""
+#endif
+#define MAX_BOOK_DEPTH 4
 
-#define NUM_SECTIONS 3
-#define MAX_FILE_NAME_LENGTH 13
+// Narration recorded on the device (see recorder.h) is kept in this
+// subdirectory of BOOK_DIR as one PAGEn.WAV per page, and takes its page from
+// any other track of the book with the same page id
+#define RECORD_DIR "REC"
+
+// Longest track path, relative to BOOK_DIR
+#define MAX_PATH_LENGTH 256
+
+// Sections kept open with their audio head in memory at once
+#ifndef SECTION_POOL_SIZE
+#define SECTION_POOL_SIZE 3
+#endif
+
+// Track metadata, one per page of the book. The page id is the first number in
+// the file name; files without one are numbered after the highest page, in
+// name order. Header fields are filled the first time the track is opened.
+typedef struct track_info {
+  uint16_t page;
+  uint8_t channels;
+  uint8_t sample_format;    // TinyWavSampleFormat, 0 until the header is parsed
+  uint16_t audio_format;
+  uint16_t bits_per_sample;
+  uint32_t sample_rate;
+  uint32_t data_offset;
+  uint32_t data_size;
+  uint32_t file_size;
+  uint32_t loop_start;      // the smpl chunk's loop, in frames; loop_end is
+  uint32_t loop_end;        // the frame after it, 0 to loop the whole track
+  uint16_t fdate;           // FAT modification stamp, checked with file_size
+  uint16_t ftime;           // when a track from the index is first opened
+  int16_t loudness;         // integrated, 0.01 LUFS, TINYWAV_LOUDNESS_UNKNOWN if not tagged
+  uint32_t name_offset;     // path relative to BOOK_DIR, in the name pool
+} track_info_t;
+
+// Where a track's clusters sit on the card
+typedef struct track_extent {
+  uint32_t first_sector; // card sector of the file's first byte
+  uint32_t sectors;      // in the first run, whole clusters
+  uint32_t runs;         // contiguous runs of clusters, 0 for an empty file
+} track_extent_t;
 
 bool mount_fs(sdmmc_card_t *card);
 
+// Map the book pack in the BOOK_PARTITION flash partition, in place of
+// mount_fs for a book stored in flash
+bool mount_flash(void);
+
+// Log the mounted card's details and its measured read throughput against the
+// rate playback needs
+void print_card_info(void);
+
+// Build the track table: with BOOK_STORAGE_FLASH from the mapped book
+// partition. Otherwise from the book pack when the book directory holds one
+// (see book_pack.h), else from the on-card track index when it is still valid
+// and otherwise by scanning the book directory, which rewrites the index
 void sort_filenames();
 
-int open_file(const int index, TinyWav *file_opened);
\ No newline at end of file
+#if BOOK_STORAGE != BOOK_STORAGE_FLASH
+// Take the recordings finished since the last boot into the book, before
+// sort_filenames: every RECORD_DIR/PAGEn.TMP replaces RECORD_DIR/PAGEn.WAV,
+// and the track index is dropped so the book is scanned again. A recording
+// is written under its .TMP name, so a track the sections may still hold open
+// is never overwritten. Returns the number of recordings taken.
+int commit_recordings(void);
+#endif
+
+// True when the tracks come from a book pack on the card. They share its one
+// descriptor, so they are read with aligned reads through a sector reader only.
+bool book_packed(void);
+
+// The track's samples, as stored, in the mapped book partition. NULL when
+// the track is read from the card.
+const uint8_t *track_mapping(const track_info_t *track);
+
+int track_count(void);
+
+// Track at a position in page order, NULL past the end
+track_info_t *track_at(int position);
+
+// Track for a page id, NULL if the book has no such page. O(log n).
+track_info_t *find_track(uint16_t page);
+
+const char *track_name(const track_info_t *track);
+
+int open_track(track_info_t *track, TinyWav *file_opened);
+
+// Close a track opened with open_track. The book pack stays open, as does the
+// mapped partition.
+void close_track(TinyWav *file);
+
+#if BOOK_STORAGE == BOOK_STORAGE_FLASH
+// The partition's pack holds every header detail, so there is no index
+static inline void flush_track_index(void) {
+}
+#else
+// Write header details learnt since boot back to the track index
+void flush_track_index(void);
+#endif
+
+// Resolve a track's cluster chain with a FatFs link map. A track in a single
+// run can be streamed with read_track_sectors; extent->runs says how
+// fragmented the others are. A packed track gets the pack's extent, mapped
+// once at boot, as its data offsets are offsets into the pack.
+bool map_track(const track_info_t *track, track_extent_t *extent);
+
+// TinyWavSectorReader for a track mapped into a single run: raw sector reads
+// straight from the card, past VFS and FatFs. Nothing locks the card, so
+// these must never interleave with FatFs's own commands: the reader task
+// reads tracks only while it plays, and the recorder's writer task writes
+// through FatFs only while it records. The reader stops playback before
+// recorder_start and recorder_stop, which block until the writer has opened
+// or closed its file (see recorder.h), so the two never overlap.
+int read_track_sectors(void *extent, uint32_t sector, void *buffer, uint32_t count);
+
+// TinyWavSectorReader for packed tracks not read raw: seeks the pack's
+// descriptor to the sector for every read, as other tracks move it
+int read_pack_sectors(void *context, uint32_t sector, void *buffer, uint32_t count);
@@ -0,0 +1,63 @@
+#include "gain.h"
+
+#include <math.h>
+
+#include "esp_attr.h"
+#include "tinywav.h"
+
+// Two 16 bit samples read and written as one word
+typedef uint32_t __attribute__((may_alias)) sample_pair_t;
+
+uint16_t gain_from_db(int32_t db) {
+  float gain = powf(10.0f, db / 2000.0f) * GAIN_UNITY + 0.5f;
+  return gain >= GAIN_MAX ? GAIN_MAX : (uint16_t)gain;
+}
+
+int32_t gain_normalize_db(int16_t loudness) {
+  if (loudness == TINYWAV_LOUDNESS_UNKNOWN) {
+    return 0;
+  }
+  int32_t db = LOUDNESS_TARGET - loudness;
+  return db > LOUDNESS_MAX_BOOST ? LOUDNESS_MAX_BOOST : db;
+}
+
+// Round to nearest and saturate. The product fits 32 bits for any 16 bit
+// gain, and the compares against both limits compile to CLAMPS on Xtensa.
+static inline int32_t scale_s16(int32_t sample, int32_t gain) {
+  int32_t scaled = (sample * gain + (1 << (GAIN_SHIFT - 1))) >> GAIN_SHIFT;
+  return scaled < INT16_MIN ? INT16_MIN : (scaled > INT16_MAX ? INT16_MAX : scaled);
+}
+
+static inline uint32_t scale_pair(uint32_t pair, int32_t gain) {
+  int32_t low = scale_s16((int16_t)pair, gain);
+  int32_t high = scale_s16((int32_t)pair >> 16, gain);
+  return ((uint32_t)high << 16) | (uint16_t)low;
+}
+
+void IRAM_ATTR gain_apply_s16(int16_t *samples, size_t count, uint16_t gain) {
+  sample_pair_t *pairs = (sample_pair_t *)samples;
+  const int32_t g = gain;
+  size_t n = count / 2;
+  size_t i = 0;
+
+  // A load and a store per two samples, two words per iteration
+  for (; i + 2 <= n; i += 2) {
+    uint32_t p0 = pairs[i];
+    uint32_t p1 = pairs[i + 1];
+    pairs[i] = scale_pair(p0, g);
+    pairs[i + 1] = scale_pair(p1, g);
+  }
+  for (; i < n; ++i) {
+    pairs[i] = scale_pair(pairs[i], g);
+  }
+  if (count % 2 != 0) {
+    samples[count - 1] = scale_s16(samples[count - 1], g);
+  }
+}
+
+void IRAM_ATTR gain_apply_s32(int32_t *samples, size_t count, uint16_t gain) {
+  for (size_t i = 0; i < count; ++i) {
+    int64_t scaled = ((int64_t)samples[i] * gain + (1 << (GAIN_SHIFT - 1))) >> GAIN_SHIFT;
+    samples[i] = scaled < INT32_MIN ? INT32_MIN : (scaled > INT32_MAX ? INT32_MAX : (int32_t)scaled);
+  }
+}
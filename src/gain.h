@@ -0,0 +1,37 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Volume: each track is brought to LOUDNESS_TARGET by the integrated loudness
+// stored in its bext chunk, then scaled by the master volume. The gain is
+// fixed point Q4.12, applied to the samples as played with rounding and
+// saturation. Levels are in hundredths of a dB (LUFS for loudness, as the
+// bext chunk stores them).
+#ifndef LOUDNESS_TARGET
+#define LOUDNESS_TARGET -1600 // -16 LUFS
+#endif
+#ifndef LOUDNESS_MAX_BOOST
+#define LOUDNESS_MAX_BOOST 1200 // quiet tracks are raised by 12 dB at most
+#endif
+#ifndef MASTER_VOLUME
+#define MASTER_VOLUME 0
+#endif
+
+#define GAIN_SHIFT 12
+#define GAIN_UNITY (1 << GAIN_SHIFT)
+#define GAIN_MAX UINT16_MAX // just under +24 dB
+
+// Gain of `db` hundredths of a dB, clamped to GAIN_MAX
+uint16_t gain_from_db(int32_t db);
+
+// The level change bringing a track of `loudness` to LOUDNESS_TARGET, 0 for a
+// track of unknown loudness (TINYWAV_LOUDNESS_UNKNOWN)
+int32_t gain_normalize_db(int16_t loudness);
+
+// Scale `count` 16 bit samples in place. Works on pairs of samples packed in
+// a word, so samples must be word aligned.
+void gain_apply_s16(int16_t *samples, size_t count, uint16_t gain);
+
+// Scale `count` 32 bit samples in place
+void gain_apply_s32(int32_t *samples, size_t count, uint16_t gain);
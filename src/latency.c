@@ -0,0 +1,56 @@
+#include "latency.h"
+
+#include <string.h>
+#include <sys/param.h>
+
+#include "esp_attr.h"
+
+#define LATENCY_MAX_US ((1u << 24) - 1)
+
+// Values below 4 get a bucket each. From there every power of two 2^e is
+// split into four buckets of 2^(e - 2).
+static inline uint32_t bucket_of(uint32_t us) {
+  if (us < 4) {
+    return us;
+  }
+  uint32_t exponent = 31 - __builtin_clz(us);
+  return (exponent - 1) * 4 + ((us >> (exponent - 2)) & 3);
+}
+
+static uint32_t bucket_upper_bound(uint32_t bucket) {
+  if (bucket < 4) {
+    return bucket;
+  }
+  uint32_t exponent = bucket / 4 + 1;
+  uint32_t lower = (4 + bucket % 4) << (exponent - 2);
+  return lower + (1u << (exponent - 2)) - 1;
+}
+
+void IRAM_ATTR latency_record(latency_histogram_t *histogram, uint32_t us) {
+  histogram->counts[bucket_of(MIN(us, LATENCY_MAX_US))]++;
+  histogram->samples++;
+  histogram->max_us = MAX(histogram->max_us, us);
+}
+
+uint32_t latency_percentile(const latency_histogram_t *histogram, uint32_t permille) {
+  if (histogram->samples == 0) {
+    return 0;
+  }
+
+  // Rank of the sample, counting from 1
+  uint32_t rank = ((uint64_t)histogram->samples * permille + 999) / 1000;
+  rank = MAX(rank, 1);
+
+  uint32_t seen = 0;
+  for (uint32_t bucket = 0; bucket < LATENCY_BUCKETS; ++bucket) {
+    seen += histogram->counts[bucket];
+    if (seen >= rank) {
+      return MIN(bucket_upper_bound(bucket), histogram->max_us);
+    }
+  }
+  return histogram->max_us;
+}
+
+void latency_reset(latency_histogram_t *histogram) {
+  memset(histogram, 0, sizeof(*histogram));
+}
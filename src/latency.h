@@ -0,0 +1,22 @@
+#pragma once
+
+#include <stdint.h>
+
+// Histogram of durations in microseconds. Buckets are four per power of two,
+// so a percentile is reported to within 25% while the whole range up to 16 s
+// costs LATENCY_BUCKETS counters.
+#define LATENCY_BUCKETS 96
+
+typedef struct latency_histogram {
+  uint32_t counts[LATENCY_BUCKETS];
+  uint32_t samples;
+  uint32_t max_us;  // exact, unlike the percentiles
+} latency_histogram_t;
+
+void latency_record(latency_histogram_t *histogram, uint32_t us);
+
+// Upper bound of the bucket holding the permille-th sample, e.g. 990 for p99.
+// 0 when the histogram is empty.
+uint32_t latency_percentile(const latency_histogram_t *histogram, uint32_t permille);
+
+void latency_reset(latency_histogram_t *histogram);
@@ -3,7 +3,6 @@
 
 #include "freertos/FreeRTOS.h"
 #include "freertos/queue.h"
-#include "freertos/ringbuf.h"
 #include "freertos/task.h"
 #include "soc/lldesc.h"
 
@@ -16,37 +15,103 @@
 #include "main.h"
 
 #include "driver/gpio.h"
-#include "esp_intr_alloc.h"
 
 #include "file_managment.h"
+#include "sections.h"
+#include "page_input.h"
+#include "recorder.h"
+#include "mixer.h"
+#include "spsc.h"
+#include "latency.h"
+#include "trace.h"
+#include "esp_cpu.h"
+#include "esp_heap_caps.h"
+#include "esp_rom_sys.h"
+#include "esp_timer.h"
 #include "esp_vfs.h"
 #include "esp_vfs_fat.h"
+#include "sdkconfig.h"
 
-#define SECTION_1_PIN 2
-#define SECTION_2_PIN 0
-#define SECTION_3_PIN 4
-#define SECTION_PIN_SELECT ((1ULL<<SECTION_1_PIN) | (1ULL<<SECTION_2_PIN) | (1ULL<<SECTION_3_PIN))
+#if CONFIG_PM_ENABLE
+#include "esp_pm.h"
+#endif
 
 // I2S driver and output
 #define I2S_CLK_PIN 25
 #define I2S_DOUT 26
 #define I2S_WS 27
 
-#define MIN_DATA_SIZE 96   
-#define DATA_MULTIPLIER 64
-#define BUFF_SIZE MIN_DATA_SIZE * DATA_MULTIPLIER
-#define BUFF_READ_SIZE MIN_DATA_SIZE * DATA_MULTIPLIER / 16
+// Frames faded out and in around a page change that keeps the channel running
+// when the sections cannot be crossfaded
+#define SWITCH_FADE_FRAMES 64
 
-TaskHandle_t read_task;
+// Audio that was queued for output but not yet in a DMA buffer when the page
+// changed: the ring buffer's contents and the block the reader had not sent
+#if PLAYBACK_MODE == PLAYBACK_RINGBUFFER
+#define CARRY_SIZE (BUFF_MAX_SIZE + BUFF_READ_MAX_SIZE)
+#else
+#define CARRY_SIZE (BUFF_READ_MAX_SIZE)
+#endif
 
-static RingbufHandle_t audio_handle;
+// Events the reader task sleeps on, as notification bits
+#define NOTIFY_AUDIO_LOW (1 << 0) // the ring buffer drained to refill_level
+#define NOTIFY_PAGE (1 << 1)      // a page change is waiting
+#define NOTIFY_RECORD (1 << 2)    // the record button was pressed or released
 
-volatile uint8_t selection = 0;
-volatile IRAM_DATA_ATTR bool selection_changed = false;
+// How often the reader logs its wakeups, core 1's idle time, card read
+// latency and buffer levels. The buffers are sized from the slowest read of
+// the last two periods.
+#define READER_STATS_PERIOD_US 10000000
 
-static void set_file_read_from(void* arg) { 
-  selection_changed = true;
-}
+TaskHandle_t read_task;
+
+#if PLAYBACK_MODE == PLAYBACK_RINGBUFFER
+// The ring buffer. Its positions count the bytes through it, used to find
+// when the first byte of a new section is copied into a DMA buffer.
+static spsc_fifo_t audio_fifo;
+static uint64_t ring_bytes_queued = 0;          // written by the reader
+static volatile uint64_t ring_bytes_played = 0; // copied out by the ISR
+static volatile bool refill_wanted = false;
+static volatile uint32_t ring_depth = BUFF_SIZE;
+// The reader sleeps until the ring buffer has drained to half its depth, then
+// refills it in one batch
+static volatile uint32_t refill_level = BUFF_SIZE / 2;
+static volatile uint32_t ring_low_water = UINT32_MAX;
+static volatile uint32_t ring_high_water = 0;
+static volatile uint32_t new_audio_at_byte = 0;
+static volatile bool new_audio_waiting = false;
+#endif
+
+// Page switch latency is measured from the page input to the first sample of
+// the new section reaching a DMA buffer, plus the DMA buffers queued ahead of it
+static int64_t page_changed_at = 0;
+static volatile int64_t new_audio_queued_at = 0;
+static page_switch_stats_t page_switch_stats;
+
+// Crossfade from the outgoing section: its carried-over queued audio first,
+// then the rest of its file
+static crossfade_t crossfade;
+static section_source_t *fading_out = NULL;
+static uint8_t carry_buf[CARRY_SIZE];
+static size_t carry_size = 0;
+static size_t carry_pos = 0;
+static uint8_t fade_scratch[BUFF_READ_MAX_SIZE];
+static uint32_t crossfade_cycles = 0;
+
+// The reader's time awake, from which core 1's idle share follows
+static reader_stats_t reader_stats;
+static int64_t reader_started_at = 0;
+static int64_t awake_since = 0;
+static reader_stats_t reader_stats_logged;
+
+// Output buffering, sized from the measured card read latency
+static size_t read_size = BUFF_READ_SIZE;
+static uint32_t covered_stall_us = 0;
+static uint32_t previous_read_max_us = 0;
+static volatile uint32_t underruns = 0;
+static uint32_t sized_byte_rate = 0;
+static uint16_t sized_frame_size = 0;
+static uint16_t sized_file_frame_size = 0;
 
 void app_main(void)
 {  
@@ -55,27 +120,63 @@ void app_main(void)
   ESP_LOGI(ourTaskName, "Starting up!\n");
   ESP_LOGI(ourTaskName, "Task name pointer: %p", ourTaskName);
 
-  bool gpio_set = gpio_setup();
+  bool input_set = page_input_setup();
 
-  if (!gpio_set) {
+  if (!input_set) {
     return;
   }
 
+#if CONFIG_PM_ENABLE
+  // Scale the CPU down between refills and light sleep while the book is
+  // closed. The I2S driver holds a no-light-sleep lock while its APLL clock
+  // runs, so playback itself is never put to sleep.
+  esp_pm_config_t pm_config = {
+    .max_freq_mhz = CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ,
+    .min_freq_mhz = 80,
+    .light_sleep_enable = true,
+  };
+  esp_err_t pm_err = esp_pm_configure(&pm_config);
+
+  if (pm_err != ESP_OK) {
+    ESP_LOGE(ourTaskName, "Error configuring power management (%s)", esp_err_to_name(pm_err));
+  }
+#endif
+
+#if BOOK_STORAGE == BOOK_STORAGE_FLASH
+  bool mounted = mount_flash();
+#else
   sdmmc_card_t card;
 
   bool mounted = mount_fs(&card);
+
+  // Takes the recordings made since the last boot into the book before it is
+  // indexed. Without a microphone the book still plays.
+  if (mounted) {
+    recorder_setup();
+  }
+#endif
   sort_filenames();
 
   if (!mounted) {
     return;
   }
 
-  audio_handle = xRingbufferCreate(BUFF_SIZE, RINGBUF_TYPE_BYTEBUF);
+  print_card_info();
+
+  // Console commands for the trace, when it is built in
+  trace_start_console();
 
-  if (audio_handle == NULL)
+#if PLAYBACK_MODE == PLAYBACK_RINGBUFFER
+  // Read by the ISR, so in internal RAM
+  uint32_t fifo_size = spsc_fifo_capacity(BUFF_MAX_SIZE);
+  uint8_t *fifo_data = (uint8_t *)heap_caps_malloc(fifo_size, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+
+  if (fifo_data == NULL || !spsc_fifo_init(&audio_fifo, fifo_data, fifo_size))
   {
     ESP_LOGE(ourTaskName, "Could not create ring buffer");
+    return;
   }
+#endif
 
   BaseType_t result =
       xTaskCreatePinnedToCore(read_file_to_shared_buffer, "read_file", 8192 * 8,
@@ -89,94 +190,491 @@ void app_main(void)
   vTaskDelete(NULL);
 }
 
-void read_file_to_shared_buffer()
-{
-  char *ourTaskName = pcTaskGetName(NULL);
+void get_page_switch_stats(page_switch_stats_t *stats) {
+  *stats = page_switch_stats;
+}
 
-  TinyWav audio_file;
+void get_reader_stats(reader_stats_t *stats) {
+  *stats = reader_stats;
+  stats->elapsed_us = reader_started_at != 0 ? esp_timer_get_time() - reader_started_at : 0;
+}
 
-  open_file(0, &audio_file);
+void get_buffer_stats(buffer_stats_t *stats) {
+  const latency_histogram_t *reads = section_read_latency();
+
+  stats->read_p50_us = latency_percentile(reads, 500);
+  stats->read_p99_us = latency_percentile(reads, 990);
+  stats->read_max_us = reads->max_us;
+  stats->read_size = read_size;
+  stats->underruns = underruns;
+#if PLAYBACK_MODE == PLAYBACK_RINGBUFFER
+  stats->ring_depth = ring_depth;
+  stats->low_water = ring_low_water == UINT32_MAX ? 0 : ring_low_water;
+  stats->high_water = ring_high_water;
+  stats->bytes_queued = ring_bytes_queued;
+  stats->bytes_played = ring_bytes_played;
+#else
+  stats->ring_depth = 0;
+  stats->low_water = 0;
+  stats->high_water = 0;
+  stats->bytes_queued = 0;
+  stats->bytes_played = 0;
+#endif
+}
 
-  ESP_LOGI(ourTaskName, "WAV file information: ");
-  ESP_LOGI(ourTaskName, "File format (2 for signed, 4 for float) %d",
-           audio_file.sampFmt);
-  ESP_LOGI(ourTaskName, "Number of audio channels: %d", audio_file.numChannels);
-  ESP_LOGI(ourTaskName, "Number of frames in header: %ld",
-           audio_file.numFramesInHeader);
-  ESP_LOGI(ourTaskName, "Sample rate: %lu", audio_file.h.SampleRate);
+// Size the ring buffer's depth and the read blocks so the audio queued when
+// a refill starts, half the depth, plays through a card read of stall_us.
+// frame_size is the frame as played, file_frame_size as stored in the file.
+static void size_buffers(uint32_t byte_rate, uint16_t frame_size, uint16_t file_frame_size, uint32_t stall_us)
+{
+  covered_stall_us = stall_us;
+  sized_byte_rate = byte_rate;
+  sized_frame_size = frame_size;
+  sized_file_frame_size = file_frame_size;
+
+#if ADAPTIVE_BUFFERS
+  uint32_t stall_bytes = (uint64_t)stall_us * byte_rate / 1000000;
+  uint32_t depth = 2 * stall_bytes + BUFF_READ_MAX_SIZE;
+  depth = MIN(MAX(depth, BUFF_SIZE), BUFF_MAX_SIZE);
+
+  // A sixteenth of the depth is read from the file at a time, counted in the
+  // file's own bytes so the card sees the same reads whatever the format
+  size_t size = depth / 16 / file_frame_size * frame_size;
+  size = MIN(MAX(size, frame_size), BUFF_READ_MAX_SIZE);
+#if ALIGNED_READS
+  // Whole sectors of a read skip the sections' staging copy, so reads are
+  // whole runs of the frames that fill a number of the file's sectors: the
+  // sector over the largest power of two dividing the file's frame. A read
+  // short of one run is raised to a run, while that fits the block buffer.
+  size_t sector_frames = TINYWAV_SECTOR_SIZE / MIN(file_frame_size & -file_frame_size, TINYWAV_SECTOR_SIZE);
+  size_t frames = size / frame_size;
+  if (frames >= sector_frames) {
+    size = (frames - frames % sector_frames) * frame_size;
+  } else if (sector_frames * frame_size <= BUFF_READ_MAX_SIZE) {
+    size = sector_frames * frame_size;
+  }
+#endif
 
-  if (audio_file.numChannels != 1 && audio_file.numChannels != 2)
-  {
-    ESP_LOGI(ourTaskName, "Unsupported number of audio channels. Only Mono or "
-                          "Stereo audio is supported.");
+#if PLAYBACK_MODE == PLAYBACK_RINGBUFFER
+  if (depth == ring_depth && size == read_size) {
     return;
   }
+  ring_depth = depth;
+  refill_level = depth / 2;
+#endif
+  read_size = size;
+
+  ESP_LOGI("buffers", "Sized for %lu us reads: ring depth %lu bytes (%lu ms), reads of %u bytes",
+           (unsigned long)stall_us, (unsigned long)depth,
+           (unsigned long)((uint64_t)depth * 1000 / byte_rate), (unsigned)size);
+#endif
+}
 
-  size_t size_wav_data_bytes = 0;
-  switch (audio_file.sampFmt)
-  {
-  case TW_INT16:
-    size_wav_data_bytes = sizeof(uint16_t);
-    break;
-  case TW_FLOAT32:
-    size_wav_data_bytes = sizeof(float);
-    break;
+static void log_buffer_stats(void)
+{
+  buffer_stats_t stats;
+  get_buffer_stats(&stats);
+
+  ESP_LOGI("buffers", "Card reads p50 %lu us, p99 %lu us, max %lu us over %lu reads",
+           (unsigned long)stats.read_p50_us, (unsigned long)stats.read_p99_us,
+           (unsigned long)stats.read_max_us, (unsigned long)section_read_latency()->samples);
+#if PLAYBACK_MODE == PLAYBACK_RINGBUFFER
+  ESP_LOGI("buffers", "Ring depth %lu bytes, low water %lu, high water %lu, %lu underruns",
+           (unsigned long)stats.ring_depth, (unsigned long)stats.low_water,
+           (unsigned long)stats.high_water, (unsigned long)stats.underruns);
+#else
+  ESP_LOGI("buffers", "%lu underruns", (unsigned long)stats.underruns);
+#endif
+
+  // Cost of converting tracks to I2S_SAMPLE_BITS since boot
+  const convert_stats_t *converted = section_convert_stats();
+  if (converted->samples > 0) {
+    uint32_t tenths = converted->cycles * 10 / converted->samples;
+    ESP_LOGI("buffers", "Converted %llu samples, %lu.%lu cycles/sample",
+             (unsigned long long)converted->samples, (unsigned long)tenths / 10,
+             (unsigned long)tenths % 10);
+  }
+
+  // Cost of the tracks' gains since boot
+  const gain_stats_t *scaled = section_gain_stats();
+  if (scaled->samples > 0) {
+    uint32_t tenths = scaled->cycles * 10 / scaled->samples;
+    ESP_LOGI("buffers", "Scaled %llu samples, %lu.%lu cycles/sample",
+             (unsigned long long)scaled->samples, (unsigned long)tenths / 10,
+             (unsigned long)tenths % 10);
+  }
+
+  // Decoding moved off this core since boot, and how often the reader had
+  // to wait for it
+  const decode_stats_t *decoded = decoder_task_stats();
+  if (decoded->frames > 0) {
+    uint32_t tenths = decoded->cycles * 10 / decoded->frames;
+    ESP_LOGI("buffers", "Decoded %llu frames on core %d, %lu.%lu cycles/frame, %lu waits",
+             (unsigned long long)decoded->frames, DECODE_TASK_CORE, (unsigned long)tenths / 10,
+             (unsigned long)tenths % 10, (unsigned long)decoded->waits);
+  }
+
+  // Sections opened from the track cache rather than the card
+  const track_cache_stats_t *cached = track_cache_stats();
+  if (cached->hits + cached->misses > 0) {
+    ESP_LOGI("buffers", "Track cache: %lu hits, %lu misses, %lu evictions, %llu bytes served, %u bytes held",
+             (unsigned long)cached->hits, (unsigned long)cached->misses, (unsigned long)cached->evictions,
+             (unsigned long long)cached->bytes_served, (unsigned)cached->bytes_used);
+  }
+
+#if OUTPUT_SAMPLE_RATE
+  // Cost of resampling tracks to OUTPUT_SAMPLE_RATE since boot, and the share
+  // of a core it takes, which is also its CPU milliseconds per output second
+  const resample_stats_t *resampled = section_resample_stats();
+  if (resampled->frames > 0) {
+    uint32_t tenths = resampled->cycles * 10 / resampled->frames;
+    uint32_t permille = resampled->cycles * OUTPUT_SAMPLE_RATE /
+                        (resampled->frames * esp_rom_get_cpu_ticks_per_us() * 1000);
+    ESP_LOGI("buffers", "Resampled %llu frames, %lu.%lu cycles/frame, %lu.%lu%% of a core",
+             (unsigned long long)resampled->frames, (unsigned long)tenths / 10,
+             (unsigned long)tenths % 10, (unsigned long)permille / 10, (unsigned long)permille % 10);
+  }
+#endif
+}
+
+// Start a new stats period. The buffers follow the slowest read of this
+// period and the last, so they shrink again once a slow patch has passed.
+static void next_buffer_period(void)
+{
+  latency_histogram_t *reads = section_read_latency();
+  uint32_t stall_us = MAX(reads->max_us, previous_read_max_us);
+
+  previous_read_max_us = reads->max_us;
+  latency_reset(reads);
+#if PLAYBACK_MODE == PLAYBACK_RINGBUFFER
+  ring_low_water = UINT32_MAX;
+  ring_high_water = 0;
+#endif
+
+  if (sized_byte_rate != 0) {
+    size_buffers(sized_byte_rate, sized_frame_size, sized_file_frame_size, stall_us);
+  }
+}
+
+static void log_reader_stats(int64_t now)
+{
+  uint32_t elapsed = now - reader_started_at - reader_stats_logged.elapsed_us;
+  uint32_t busy = reader_stats.busy_us - reader_stats_logged.busy_us;
+  uint32_t wakeups = reader_stats.wakeups - reader_stats_logged.wakeups;
+  uint32_t idle_permille = 1000 - (uint64_t)busy * 1000 / MAX(elapsed, 1);
+
+  ESP_LOGI("reader", "%lu wakeups/s, core 1 idle %lu.%lu%%",
+           (unsigned long)((uint64_t)wakeups * 1000000 / MAX(elapsed, 1)),
+           (unsigned long)idle_permille / 10, (unsigned long)idle_permille % 10);
+
+  reader_stats_logged = reader_stats;
+  reader_stats_logged.elapsed_us = now - reader_started_at;
+
+  log_buffer_stats();
+  next_buffer_period();
+}
+
+static void reader_sleeps(void)
+{
+  int64_t now = esp_timer_get_time();
+  reader_stats.busy_us += now - awake_since;
+  if (now - reader_started_at - reader_stats_logged.elapsed_us >= READER_STATS_PERIOD_US) {
+    log_reader_stats(now);
+  }
+}
+
+static void reader_wakes(void)
+{
+  awake_since = esp_timer_get_time();
+  reader_stats.wakeups++;
+}
+
+// Sleep until a page change, or with refill set until the ring buffer has
+// drained to refill_level
+static void wait_for_event(bool refill)
+{
+#if PLAYBACK_MODE == PLAYBACK_RINGBUFFER
+  if (refill) {
+    refill_wanted = true;
+    // The ISR may have drained it past the mark before the flag was seen
+    if (spsc_fifo_used(&audio_fifo) <= refill_level) {
+      refill_wanted = false;
+      return;
+    }
+  }
+#endif
+
+  reader_sleeps();
+  xTaskNotifyWait(0, UINT32_MAX, NULL, portMAX_DELAY);
+  reader_wakes();
+}
+
+// Queue a block of PCM for output, waiting at most ticks_to_wait for space.
+static bool write_audio_output(i2s_chan_handle_t tx_handle, const uint8_t *data, size_t size, TickType_t ticks_to_wait)
+{
+  uint32_t traced = trace_begin();
+#if PLAYBACK_MODE == PLAYBACK_DIRECT
+  size_t bytes_written = 0;
+  uint32_t timeout_ms = ticks_to_wait == portMAX_DELAY ? portMAX_DELAY : ticks_to_wait * portTICK_PERIOD_MS;
+  esp_err_t ret = i2s_channel_write(tx_handle, data, size, &bytes_written, timeout_ms);
+  trace_end(TRACE_ENQUEUE, traced, bytes_written);
+  return ret == ESP_OK && bytes_written == size;
+#else
+  // The ISR frees space as DMA buffers play
+  TickType_t waited = 0;
+  while (!spsc_fifo_write(&audio_fifo, data, size)) {
+    if (waited++ >= ticks_to_wait) {
+      return false;
+    }
+    vTaskDelay(1);
+  }
+  ring_bytes_queued += size;
+  trace_end(TRACE_ENQUEUE, traced, size);
+  return true;
+#endif
+}
+
+// Drop audio that is queued but not yet in the DMA buffers, including the
+// pending block the reader has not sent. Up to max_tail bytes from the front of
+// the queue, which continue what the DMA buffers hold, are copied to tail so
+// they can be faded out. Returns the number of bytes copied.
+static size_t drop_queued_audio(const uint8_t *pending, size_t pending_size, uint8_t *tail, size_t max_tail)
+{
+#if PLAYBACK_MODE == PLAYBACK_DIRECT
+  // Nothing is queued outside the driver; the block not yet written is next
+  size_t tail_size = MIN(pending_size, max_tail);
+  if (tail_size > 0) {
+    memcpy(tail, pending, tail_size);
+  }
+  return tail_size;
+#else
+  // Whatever the ISR takes meanwhile is played, not copied
+  size_t tail_size = spsc_fifo_drain(&audio_fifo, tail, max_tail);
+
+  // The block the reader has not sent yet follows the ring's contents
+  size_t copy = MIN(pending_size, max_tail - tail_size);
+  if (copy > 0) {
+    memcpy(tail + tail_size, pending, copy);
+    tail_size += copy;
+  }
+  return tail_size;
+#endif
+}
+
+// Linear gain ramp over a block of interleaved PCM, so cutting between
+// sections does not click
+static void ramp_audio(uint8_t *data, size_t size, const section_source_t *format, bool fade_in)
+{
+  int channels = format->file.numChannels;
+  int frames = size / format->bytes_in_frame;
+
+  for (int i = 0; i < frames; ++i) {
+    int gain = fade_in ? i : frames - 1 - i;
+
+    for (int c = 0; c < channels; ++c) {
+#if I2S_SAMPLE_BITS == 16
+      int16_t *sample = (int16_t *)data + i * channels + c;
+      *sample = (int32_t)*sample * gain / frames;
+#else
+      int32_t *sample = (int32_t *)data + i * channels + c;
+      *sample = (int64_t)*sample * gain / frames;
+#endif
+    }
+  }
+}
+
+static void record_page_switch(int64_t queued_at, uint32_t queue_us, bool gapless)
+{
+  const char *ourTaskName = "page_switch";
+  uint32_t latency = (uint32_t)(queued_at - page_changed_at) + queue_us;
+
+  page_switch_stats.switches++;
+  if (gapless) {
+    page_switch_stats.gapless_switches++;
+  }
+  page_switch_stats.last_latency_us = latency;
+  page_switch_stats.max_latency_us = MAX(page_switch_stats.max_latency_us, latency);
+
+  ESP_LOGD(ourTaskName, "Page switch latency: %lu us (%s)", (unsigned long)latency,
+           gapless ? "gapless" : "channel reconfigured");
+}
+
+// Start an equal-power crossfade from the outgoing section, whose next
+// carried bytes are in carry_buf. Returns false if the sections cannot be mixed.
+static bool start_crossfade(section_source_t *from, const section_source_t *to, size_t carried)
+{
+  fading_out = NULL;
+
+  if (CROSSFADE_MS == 0 || I2S_SAMPLE_BITS != 16) {
+    return false;
+  }
+
+  carry_size = carried;
+  carry_pos = 0;
+  crossfade_cycles = 0;
+  crossfade_start(&crossfade, section_sample_rate(to) * CROSSFADE_MS / 1000, to->file.numChannels);
+  fading_out = from;
+  return true;
+}
+
+// Read the outgoing section for a crossfade. Returns frames read.
+static int read_fading_out(uint8_t *buffer, int buffer_len)
+{
+  size_t from_carry = MIN((size_t)buffer_len, carry_size - carry_pos);
+  memcpy(buffer, carry_buf + carry_pos, from_carry);
+  carry_pos += from_carry;
+
+  int filled = from_carry;
+
+  while (filled < buffer_len) {
+    int frames = read_section(fading_out, buffer + filled, buffer_len - filled);
+    if (frames < 0) {
+      return frames;
+    }
+    if (frames == 0) {
+      break;
+    }
+    filled += frames * fading_out->bytes_in_frame;
+  }
+  return filled / fading_out->bytes_in_frame;
+}
+
+static void log_crossfade_cost(const section_source_t *source)
+{
+  uint32_t cycles_per_frame = crossfade_cycles / MAX(crossfade.length, 1);
+  // Cycles available while one DMA buffer plays
+  uint64_t dma_buffer_cycles = (uint64_t)DMA_FRAME_NUM * esp_rom_get_cpu_ticks_per_us() * 1000000 / section_sample_rate(source);
+  uint32_t budget_permille = (uint64_t)cycles_per_frame * DMA_FRAME_NUM * 1000 / dma_buffer_cycles;
+
+  page_switch_stats.crossfade_cycles_per_frame = cycles_per_frame;
+  ESP_LOGI("crossfade", "Mixed %lu frames, %lu cycles/frame, %lu.%lu%% of each DMA buffer's play time",
+           (unsigned long)crossfade.length, (unsigned long)cycles_per_frame,
+           (unsigned long)budget_permille / 10, (unsigned long)budget_permille % 10);
+}
+
+// Read the next block of a section, mixed with the outgoing section while a
+// crossfade is running. Returns frames read.
+static int read_block(section_source_t *source, uint8_t *buffer)
+{
+  int frames = read_section(source, buffer, read_size);
+
+  if (frames <= 0 || fading_out == NULL) {
+    return frames;
+  }
+
+  int from_frames = read_fading_out(fade_scratch, frames * source->bytes_in_frame);
+  if (from_frames < 0) {
+    fading_out = NULL;
+    return frames;
+  }
+
+  uint32_t start = esp_cpu_get_cycle_count();
+  crossfade_mix_s16(&crossfade, (int16_t *)buffer, (const int16_t *)fade_scratch, MIN(frames, from_frames));
+  crossfade_cycles += esp_cpu_get_cycle_count() - start;
+
+  if (!crossfade_active(&crossfade)) {
+    log_crossfade_cost(source);
+    fading_out = NULL;
   }
+  return frames;
+}
+
+// Time the DMA buffers queued ahead of a freshly filled one take to play
+static uint32_t dma_queue_us(uint32_t sample_rate)
+{
+  return (uint64_t)(DMA_DESC_NUM - 1) * DMA_FRAME_NUM * 1000000 / sample_rate;
+}
+
+void read_file_to_shared_buffer()
+{
+  char *ourTaskName = pcTaskGetName(NULL);
+  read_task = xTaskGetCurrentTaskHandle();
+
+  section_source_t *current = first_section();
 
-  if (size_wav_data_bytes == 0)
+  if (current == NULL)
   {
-    ESP_LOGE(ourTaskName, "Unsupported audio file type");
+    ESP_LOGE(ourTaskName, "Could not open the first section");
     return;
   }
 
-  long int data_start = ftell(audio_file.f);
-  ESP_LOGI(ourTaskName, "Test file read %lx bytes in header", data_start);
+  TinyWav *audio_file = &current->file;
 
-  uint8_t *w_buf = (uint8_t *)calloc(1, BUFF_READ_SIZE);
-  assert(w_buf);
+  ESP_LOGI(ourTaskName, "WAV file information: ");
+  ESP_LOGI(ourTaskName, "Bits per sample: %d%s, played at %d",
+           audio_file->h.BitsPerSample, audio_file->sampFmt == TW_FLOAT32 ? " float" : "", I2S_SAMPLE_BITS);
+  ESP_LOGI(ourTaskName, "Number of audio channels: %d", audio_file->numChannels);
+  ESP_LOGI(ourTaskName, "Number of frames in header: %ld",
+           audio_file->numFramesInHeader);
+  ESP_LOGI(ourTaskName, "Sample rate: %lu, played at %lu", (unsigned long)audio_file->h.SampleRate,
+           (unsigned long)section_sample_rate(current));
+  ESP_LOGI(ourTaskName, "Test file read %lx bytes in header", current->data_start);
 
-  uint16_t bytes_in_frame = size_wav_data_bytes * audio_file.numChannels;
-  uint16_t frames_in_buff = BUFF_READ_SIZE / bytes_in_frame;
+  // Aligned reads DMA whole sectors straight into the block buffer
+  uint8_t *w_buf = (uint8_t *)heap_caps_calloc(1, BUFF_READ_MAX_SIZE, MALLOC_CAP_DMA);
+  assert(w_buf);
+  size_buffers(section_byte_rate(current), current->bytes_in_frame, current->file_bytes_in_frame, 0);
 
   ESP_LOGI(ourTaskName, "Setup for file reading passed");
-  ESP_LOGI(ourTaskName, "Frames in buffer: %d", frames_in_buff);
-
-  int frames = tinywav_read_f(&audio_file, w_buf, BUFF_READ_SIZE);
+  ESP_LOGI(ourTaskName, "Frames in buffer: %d", (int)(read_size / current->bytes_in_frame));
 
-  //ESP_LOGI(ourTaskName, "Frames read: %d", frames);
+  int frames = read_block(current, w_buf);
 
   if (frames < 0)
   {
     ESP_LOGE(ourTaskName, "Error in reading WAV file");
     return;
   }
-  
-  BaseType_t res = xRingbufferSend(audio_handle, w_buf, BUFF_READ_SIZE, 5);
-  if (res != pdTRUE) {
-    ESP_LOGE(ourTaskName, "Undetected error in ring buffer creation");
-    return;
-  }
 
   i2s_chan_handle_t audio_output;
 
-  bool success = setup_audio_output(&audio_output, audio_file.h.SampleRate, audio_file.h.BitsPerSample, audio_file.h.NumChannels);
+  bool success = setup_audio_output(&audio_output, section_sample_rate(current), I2S_SAMPLE_BITS, audio_file->h.NumChannels, w_buf, frames * current->bytes_in_frame);
 
   if (!success) {
     return;
   }
+  ESP_LOGI(ourTaskName, "First audio queued %lld us after boot", (long long)esp_timer_get_time());
+
+  // The first block went straight to the DMA buffers, start with the next one
+  frames = read_block(current, w_buf);
+  if (frames < 0)
+  {
+    ESP_LOGE(ourTaskName, "Error in reading WAV file");
+    return;
+  }
 
   bool playing = true;
+  bool latency_pending = false;
+
+  page_input_notify(read_task, NOTIFY_PAGE);
+  recorder_notify(read_task, NOTIFY_RECORD);
+  reader_started_at = esp_timer_get_time();
+  awake_since = reader_started_at;
 
   while (1)
   { 
+    bool written = false;
+
     if (playing) {
-      res = xRingbufferSend(audio_handle, w_buf, MIN(frames * bytes_in_frame, BUFF_READ_SIZE), 5);
-      if (res != pdTRUE) {
-        vTaskDelay(0);
-        continue;
+#if PLAYBACK_MODE == PLAYBACK_DIRECT
+      // The driver puts the task to sleep until a DMA buffer frees up
+      reader_sleeps();
+      written = write_audio_output(audio_output, w_buf, frames * current->bytes_in_frame, portMAX_DELAY);
+      reader_wakes();
+#else
+      // Only fill the ring to its current depth
+      size_t size = frames * current->bytes_in_frame;
+      written = spsc_fifo_used(&audio_fifo) + size <= ring_depth && write_audio_output(audio_output, w_buf, size, 0);
+#endif
+    }
+
+    if (written) {
+      if (latency_pending && new_audio_queued_at != 0) {
+        latency_pending = false;
+        record_page_switch(new_audio_queued_at, dma_queue_us(section_sample_rate(current)), true);
       }
 
-      frames = tinywav_read_f(&audio_file, w_buf, BUFF_READ_SIZE);
+      frames = read_block(current, w_buf);
       
       if (frames < 0)
       {
@@ -184,100 +682,202 @@ void read_file_to_shared_buffer()
         return;
       }
 
-      if (frames == 0 || frames * bytes_in_frame < BUFF_READ_SIZE)
-      {
-        lseek(audio_file.fileno, data_start, SEEK_SET);
-        audio_file.totalFramesReadWritten = 0;
-        continue;
+      // Open the neighbouring pages while the output queue is full. The
+      // outgoing section of a crossfade must stay open until it is done.
+      if (fading_out == NULL) {
+        prefetch_section(current);
       }
-    }
-
-    if (selection_changed && playing) {
-      ESP_LOGI(ourTaskName, "selection has changed");
-      selection_changed = false;
-      
-      ESP_LOGI(ourTaskName, "Doing selection change");
-      
-      disable_audio_output(&audio_output);
-      tinywav_close_read(&audio_file);
 
-      if (selection > NUM_SECTIONS) {
-        playing = false;
-        continue;
+      // Grow the buffers as soon as a read is slower than they cover
+      if (section_read_latency()->max_us > covered_stall_us) {
+        size_buffers(section_byte_rate(current), current->bytes_in_frame, current->file_bytes_in_frame, section_read_latency()->max_us);
       }
+    }
 
-      tinywav_close_read(&audio_file);
-      open_file(selection, &audio_file);
-
-      frames = tinywav_read_f(&audio_file, w_buf, BUFF_READ_SIZE);
-      if (frames < 0)
-      {
-        ESP_LOGE(ourTaskName, "Error in reading WAV file");
-        return;
+    // Holding the record button stops playback and records the open page, the
+    // card then belonging to the recorder's writer. Releasing it plays the
+    // page again.
+    bool record_held;
+    if (recorder_button_changed(&record_held)) {
+      if (record_held) {
+        fading_out = NULL;
+        if (playing) {
+          disable_audio_output(&audio_output);
+          playing = false;
+        }
+        // Nothing recorded, so the page plays on
+        if (!recorder_start(page_input_page())) {
+          page_input_repeat();
+        }
+      } else if (recorder_recording()) {
+        recorder_stop();
+        page_input_repeat();
       }
+      continue;
+    }
 
-      res = xRingbufferSend(audio_handle, w_buf, BUFF_READ_SIZE, 5);
-      if (res != pdTRUE) {
-        vTaskDelay(0);
+    // A page change is picked up between blocks. With nothing to do the task
+    // sleeps until the output has drained to refill_level or the page changes.
+    page_event_t event;
+    if (page_input_receive(&event, 0)) {
+      uint16_t page = event.page;
+      // Turning the page ends a recording
+      if (recorder_recording()) {
+        recorder_stop();
+      }
+      page_changed_at = event.changed_at;
+      section_source_t *next = get_section(page, current);
+
+      if (next == NULL) {
+        fading_out = NULL;
+        if (playing) {
+          disable_audio_output(&audio_output);
+          playing = false;
+        }
+        // Idle, so the card is free to take what was learnt about the tracks
+        flush_track_index();
         continue;
       }
-      
-      reconfigure_audio_output(audio_handle, audio_file.h.SampleRate, audio_file.h.BitsPerSample, audio_file.h.AudioFormat);
 
-    } else if (selection_changed && !playing) {
-      if (selection > NUM_SECTIONS) {
-        break;
+      if (playing && next == current) {
+        continue;
       }
 
-      ESP_LOGI(ourTaskName, "selection has changed");
-      selection_changed = false;
-      
-      ESP_LOGI(ourTaskName, "Doing selection change");
-
-      open_file(selection, &audio_file);
+      ESP_LOGD(ourTaskName, "Doing selection change to page %u", page);
+      uint32_t switch_traced = trace_begin();
+
+      section_source_t *previous = current;
+      current = next;
+      rewind_section(current);
+
+      if (playing && sections_match(previous, current)) {
+        // Same I2S configuration: keep the channel running and replace the old
+        // section's queued audio with a fade into the new one
+        size_t carried = drop_queued_audio(w_buf, frames * previous->bytes_in_frame, carry_buf, sizeof(carry_buf));
+        carried -= carried % previous->bytes_in_frame;
+
+        bool mixing = start_crossfade(previous, current, carried);
+        if (!mixing) {
+          size_t tail_size = MIN(carried, SWITCH_FADE_FRAMES * previous->bytes_in_frame);
+          ramp_audio(carry_buf, tail_size, previous, false);
+          if (tail_size > 0) {
+            write_audio_output(audio_output, carry_buf, tail_size, 5);
+          }
+        }
+
+        frames = read_block(current, w_buf);
+        if (frames < 0)
+        {
+          ESP_LOGE(ourTaskName, "Error in reading WAV file");
+          return;
+        }
+        if (!mixing) {
+          ramp_audio(w_buf, MIN(frames, SWITCH_FADE_FRAMES) * current->bytes_in_frame, current, true);
+        }
+
+#if PLAYBACK_MODE == PLAYBACK_DIRECT
+        if (write_audio_output(audio_output, w_buf, frames * current->bytes_in_frame, 5)) {
+          record_page_switch(esp_timer_get_time(), dma_queue_us(section_sample_rate(current)), true);
+        }
+#else
+        new_audio_queued_at = 0;
+        new_audio_at_byte = audio_fifo.written;
+        new_audio_waiting = true;
+        latency_pending = write_audio_output(audio_output, w_buf, frames * current->bytes_in_frame, 5);
+#endif
+      } else {
+        fading_out = NULL;
+        if (playing) {
+          disable_audio_output(&audio_output);
+        }
+
+        size_buffers(section_byte_rate(current), current->bytes_in_frame, current->file_bytes_in_frame, covered_stall_us);
+        frames = read_block(current, w_buf);
+        if (frames < 0)
+        {
+          ESP_LOGE(ourTaskName, "Error in reading WAV file");
+          return;
+        }
+
+        audio_file = &current->file;
+        reconfigure_audio_output(&audio_output, section_sample_rate(current), I2S_SAMPLE_BITS, audio_file->h.NumChannels, w_buf, frames * current->bytes_in_frame);
+        record_page_switch(esp_timer_get_time(), 0, false);
+      }
 
-      frames = tinywav_read_f(&audio_file, w_buf, BUFF_READ_SIZE);
+      frames = read_block(current, w_buf);
       if (frames < 0)
       {
         ESP_LOGE(ourTaskName, "Error in reading WAV file");
         return;
       }
-
-      res = xRingbufferSend(audio_handle, w_buf, BUFF_READ_SIZE, 5);
-      if (res != pdTRUE) {
-        vTaskDelay(0);
-        continue;
-      }
-
-      reconfigure_audio_output(audio_handle, audio_file.h.SampleRate, audio_file.h.BitsPerSample, audio_file.h.AudioFormat);
+      playing = true;
+      trace_end(TRACE_PAGE_SWITCH, switch_traced, page);
+    } else if (!written) {
+      wait_for_event(playing);
     }
-    //ESP_LOGI(ourTaskName, "Frames read: %d", frames);
-    vTaskDelay(0);
   }
 }
 
+#if PLAYBACK_MODE == PLAYBACK_RINGBUFFER
 static IRAM_ATTR bool on_data_sent(i2s_chan_handle_t handle, i2s_event_data_t *event, void *user_ctx) {
-  size_t received_data_size;
-  uint8_t* data = xRingbufferReceiveUpToFromISR(audio_handle, &received_data_size, event->size);
-  
-  if (data == NULL) {
-    return false;
+  uint32_t traced = trace_begin();
+  uint32_t level = spsc_fifo_used(&audio_fifo);
+  ring_low_water = MIN(ring_low_water, level);
+  ring_high_water = MAX(ring_high_water, level);
+
+  // Both spans, so a buffer is filled in full whenever the ring holds enough,
+  // wherever it wraps. A drain by the reader while copying leaves the copy
+  // stale; it is made again from what the ring holds after it.
+  uint8_t *dma_buf = (uint8_t *)event->dma_buf;
+  spsc_fifo_spans_t spans;
+  uint32_t received;
+  do {
+    received = spsc_fifo_peek(&audio_fifo, &spans, event->size);
+    memcpy(dma_buf, spans.span[0].data, spans.span[0].len);
+    memcpy(dma_buf + spans.span[0].len, spans.span[1].data, spans.span[1].len);
+  } while (!spsc_fifo_consume(&audio_fifo, &spans, received));
+  ring_bytes_played += received;
+
+  // Never replay stale audio: pad a short buffer with silence
+  if (received < event->size) {
+    memset(dma_buf + received, 0, event->size - received);
+    underruns++;
+    trace_instant(TRACE_UNDERRUN, received);
   }
-  
-  memcpy(event->dma_buf, data, received_data_size);
-  BaseType_t woke_higher_task;
-  
-  vRingbufferReturnItemFromISR(audio_handle, data, &woke_higher_task);
+
+  if (new_audio_waiting && (int32_t)(spans.start + received - new_audio_at_byte) > 0) {
+    new_audio_waiting = false;
+    new_audio_queued_at = esp_timer_get_time();
+  }
+
+  BaseType_t woke_higher_task = pdFALSE;
+
+  // Wake the reader once for a whole batch, not for every DMA buffer
+  if (refill_wanted && spsc_fifo_used(&audio_fifo) <= refill_level) {
+    refill_wanted = false;
+    BaseType_t woke_reader = pdFALSE;
+    xTaskNotifyFromISR(read_task, NOTIFY_AUDIO_LOW, eSetBits, &woke_reader);
+    woke_higher_task |= woke_reader;
+  }
+  trace_end(TRACE_ISR_REFILL, traced, received);
   return woke_higher_task;
 }
+#else
+// The reader did not write a whole DMA ring in time and a buffer played again
+static IRAM_ATTR bool on_send_overflow(i2s_chan_handle_t handle, i2s_event_data_t *event, void *user_ctx) {
+  underruns++;
+  trace_instant(TRACE_UNDERRUN, 0);
+  return false;
+}
+#endif
 
 static void setup_i2s_channel(i2s_chan_handle_t *tx_handle, uint32_t sample_frequency, i2s_data_bit_width_t bits_sample, i2s_slot_mode_t slot_mode) {
   
   i2s_chan_config_t chan_cfg = {
     .id = I2S_NUM_AUTO,
     .role = I2S_ROLE_MASTER,
-    .dma_desc_num = 6, 
-    .dma_frame_num = 240,
+    .dma_desc_num = DMA_DESC_NUM,
+    .dma_frame_num = DMA_FRAME_NUM,
     .auto_clear_after_cb = false,
     .auto_clear_before_cb = false,
     .intr_priority = 0,
@@ -318,17 +918,34 @@ static void setup_i2s_channel(i2s_chan_handle_t *tx_handle, uint32_t sample_freq
   ESP_LOGI("i2s_channel_setup", "Initializing channel");
   ESP_ERROR_CHECK(i2s_channel_init_std_mode(*tx_handle, &tx_std_cfg));
 
+#if PLAYBACK_MODE == PLAYBACK_RINGBUFFER
   i2s_event_callbacks_t cbs = {
     .on_recv = NULL,
     .on_recv_q_ovf = NULL,
     .on_sent = on_data_sent,
     .on_send_q_ovf = NULL,
   };
+#else
+  i2s_event_callbacks_t cbs = {
+    .on_recv = NULL,
+    .on_recv_q_ovf = NULL,
+    .on_sent = NULL,
+    .on_send_q_ovf = on_send_overflow,
+  };
+#endif
 
   ESP_ERROR_CHECK(i2s_channel_register_event_callback(*tx_handle, &cbs, NULL));
 }
 
-bool setup_audio_output(i2s_chan_handle_t *tx_handle, uint32_t sample_frequency, i2s_data_bit_width_t bits_sample, i2s_slot_mode_t slot_mode)
+// Copy the first block of a stream into the DMA buffers before enabling the channel
+static bool preload_audio_output(i2s_chan_handle_t *tx_handle, const uint8_t *first_block, size_t first_block_size) {
+  size_t data_read = 0;
+
+  ESP_ERROR_CHECK(i2s_channel_preload_data(*tx_handle, first_block, first_block_size, &data_read));
+  return data_read == first_block_size;
+}
+
+bool setup_audio_output(i2s_chan_handle_t *tx_handle, uint32_t sample_frequency, i2s_data_bit_width_t bits_sample, i2s_slot_mode_t slot_mode, const uint8_t *first_block, size_t first_block_size)
 {
   char *ourTaskName = pcTaskGetName(NULL);
 
@@ -336,20 +953,10 @@ bool setup_audio_output(i2s_chan_handle_t *tx_handle, uint32_t sample_frequency,
 
   ESP_LOGI(ourTaskName, "Pre-Loading mem to CPU");
 
-  size_t total_received;
-  size_t data_read = 0;
-  uint8_t* data = NULL;
-    
-  data = xRingbufferReceiveUpTo(audio_handle, &total_received, 0, BUFF_READ_SIZE); 
-
-  ESP_ERROR_CHECK(i2s_channel_preload_data(*tx_handle, data, total_received, &data_read));
-  vTaskDelay(0);
-  if (data_read != total_received) {
+  if (!preload_audio_output(tx_handle, first_block, first_block_size)) {
     return false;
   }
 
-  vRingbufferReturnItem(audio_handle, data);
-
   ESP_LOGI(ourTaskName, "Enabling Channel");
   ESP_ERROR_CHECK(i2s_channel_enable(*tx_handle));
   ESP_LOGI(ourTaskName, "Channel Enabled");
@@ -359,9 +966,6 @@ bool setup_audio_output(i2s_chan_handle_t *tx_handle, uint32_t sample_frequency,
 
 bool disable_audio_output(i2s_chan_handle_t *tx_handle) {
   static const char *ourTaskName = "disable_audio";
-  
-  size_t total_received;
-  uint8_t* data = NULL;
 
   esp_err_t ret = i2s_channel_disable(*tx_handle);
   
@@ -371,26 +975,15 @@ bool disable_audio_output(i2s_chan_handle_t *tx_handle) {
   }
 
   ESP_LOGI(ourTaskName, "Detected change in file name, flushing buffers");
-  while (1) {
-    data = xRingbufferReceiveUpTo(audio_handle, &total_received, 0, BUFF_READ_SIZE); 
-    if (data == NULL) {
-      ESP_LOGI(ourTaskName, "Buffer flushed");
-      break;
-    }
-    vRingbufferReturnItem(audio_handle, data);
-    vTaskDelay(5);
-  }
+  drop_queued_audio(NULL, 0, NULL, 0);
+  ESP_LOGI(ourTaskName, "Buffer flushed");
 
   return true;
 }
 
-bool reconfigure_audio_output(i2s_chan_handle_t *tx_handle, uint32_t sample_frequency, i2s_data_bit_width_t bits_sample, i2s_slot_mode_t slot_mode) {
+bool reconfigure_audio_output(i2s_chan_handle_t *tx_handle, uint32_t sample_frequency, i2s_data_bit_width_t bits_sample, i2s_slot_mode_t slot_mode, const uint8_t *first_block, size_t first_block_size) {
   static const char *ourTaskName = "reconfigure_audio";
 
-  size_t total_received;
-  size_t data_read = 0;
-  uint8_t* data = NULL;
-
   i2s_std_clk_config_t clock_config = {
     .clk_src = SOC_MOD_CLK_APLL,
     .mclk_multiple = I2S_MCLK_MULTIPLE_256,
@@ -406,66 +999,11 @@ bool reconfigure_audio_output(i2s_chan_handle_t *tx_handle, uint32_t sample_freq
   i2s_std_slot_config_t slot_cnfg = I2S_STD_MSB_SLOT_DEFAULT_CONFIG(bits_sample, slot_mode);
   i2s_channel_reconfig_std_slot(*tx_handle, &slot_cnfg);
   
-  data = xRingbufferReceiveUpTo(audio_handle, &total_received, 0, BUFF_READ_SIZE); 
-
-  ESP_ERROR_CHECK(i2s_channel_preload_data(*tx_handle, data, total_received, &data_read));
-  vTaskDelay(0);
-  if (data_read != total_received) {
+  if (!preload_audio_output(tx_handle, first_block, first_block_size)) {
     return false;
   }
-
-  vRingbufferReturnItem(audio_handle, data);
   
   ESP_ERROR_CHECK(i2s_channel_enable(*tx_handle));
 
   return true;
 }
-
-bool gpio_setup() {
-  const static char* ourTaskName = "gpio_setup";
-
-  gpio_config_t io_conf = {};
-
-  io_conf.intr_type = GPIO_INTR_ANYEDGE;
-  io_conf.mode = GPIO_MODE_INPUT;
-  io_conf.pull_down_en = GPIO_PULLDOWN_ENABLE;
-  io_conf.intr_type = GPIO_INTR_ANYEDGE;
-  io_conf.pin_bit_mask = ((1ULL<<2) | (1ULL<<0) | (1ULL<<4));
-
-  esp_err_t err = gpio_config(&io_conf);
-
-  if (err != ESP_OK) {
-    ESP_LOGE(ourTaskName, "Error configuring IO pins (%s)", esp_err_to_name(err));
-    return false;
-  }
-  
-  err = gpio_install_isr_service(ESP_INTR_FLAG_EDGE | ESP_INTR_FLAG_LEVEL3);
-  
-  if (err != ESP_OK) {
-    ESP_LOGE(ourTaskName, "Error installing isr service (%s)", esp_err_to_name(err));
-    return false;
-  }
-
-  err = gpio_isr_handler_add(SECTION_1_PIN, set_file_read_from, (void*) SECTION_1_PIN);
-
-  if (err != ESP_OK) {
-    ESP_LOGE(ourTaskName, "Error adding interrupt handler to pin %d, (%s)", SECTION_1_PIN, esp_err_to_name(err));
-    return false;
-  }
-
-  err = gpio_isr_handler_add(SECTION_2_PIN, set_file_read_from, (void*) SECTION_2_PIN);
-
-  if (err != ESP_OK) {
-    ESP_LOGE(ourTaskName, "Error adding interrupt handler to pin %d, (%s)", SECTION_2_PIN, esp_err_to_name(err));
-    return false;
-  }
-  
-  err = gpio_isr_handler_add(SECTION_3_PIN, set_file_read_from, (void*) SECTION_3_PIN);
-
-  if (err != ESP_OK) {
-    ESP_LOGE(ourTaskName, "Error adding interrupt handler to pin %d, (%s)", SECTION_3_PIN, esp_err_to_name(err));
-    return false;
-  }
-
-  return true;
-}
\ No newline at end of file
@@ -6,12 +6,98 @@
 #ifndef MAIN_MAIN_H_
 #define MAIN_MAIN_H_
 
+// Audio buffer configuration. Each value may be overridden at build time so
+// the host benchmark can compare configurations without editing sources.
+#ifndef MIN_DATA_SIZE
+#define MIN_DATA_SIZE 96
+#endif
+#ifndef DATA_MULTIPLIER
+#define DATA_MULTIPLIER 64
+#endif
+#define BUFF_SIZE MIN_DATA_SIZE * DATA_MULTIPLIER
+#define BUFF_READ_SIZE MIN_DATA_SIZE * DATA_MULTIPLIER / 16
+
+// With ADAPTIVE_BUFFERS the ring buffer is allocated at BUFF_MAX_SIZE but
+// only filled to a depth that lets it play through the slowest recent card
+// read at the stream's byte rate, BUFF_SIZE at least. Reads are a sixteenth
+// of that depth. Without it both stay at BUFF_SIZE and BUFF_READ_SIZE.
+#ifndef ADAPTIVE_BUFFERS
+#define ADAPTIVE_BUFFERS 1
+#endif
+#if ADAPTIVE_BUFFERS
+#ifndef BUFF_MAX_SIZE
+#define BUFF_MAX_SIZE (BUFF_SIZE * 4)
+#endif
+#else
+#define BUFF_MAX_SIZE BUFF_SIZE
+#endif
+#define BUFF_READ_MAX_SIZE (BUFF_MAX_SIZE / 16)
+
+// Length of the equal-power crossfade between sections on a page change, for
+// 16 bit sections that share a format. 0 falls back to a short fade out/in.
+#ifndef CROSSFADE_MS
+#define CROSSFADE_MS 30
+#endif
+
+// I2S DMA ring: number of descriptors and frames per descriptor. A new
+// section starts playing after the DMA_DESC_NUM - 1 buffers queued ahead of
+// it, about 9 ms at 44.1 kHz.
+#ifndef DMA_DESC_NUM
+#define DMA_DESC_NUM 4
+#endif
+#ifndef DMA_FRAME_NUM
+#define DMA_FRAME_NUM 128
+#endif
+
+// Playback path from the reader task to the I2S DMA buffers.
+// PLAYBACK_RINGBUFFER: the reader copies blocks into a ring buffer, a
+//   lock-free FIFO (see spsc.h), and the on_sent ISR copies them into each
+//   DMA buffer as it frees up, padding a buffer the ring cannot fill with
+//   silence.
+// PLAYBACK_DIRECT: the reader copies blocks straight into the driver's DMA
+//   buffers with i2s_channel_write, so the ISR only hands buffers back to the
+//   driver and each sample is copied once less.
+#define PLAYBACK_RINGBUFFER 0
+#define PLAYBACK_DIRECT 1
+#ifndef PLAYBACK_MODE
+#define PLAYBACK_MODE PLAYBACK_RINGBUFFER
+#endif
+
+typedef struct page_switch_stats {
+  uint32_t switches;         // page changes that started a new section
+  uint32_t gapless_switches; // of those, how many kept the I2S channel running
+  uint32_t last_latency_us;  // page input to new audio, see main.c
+  uint32_t max_latency_us;
+  uint32_t crossfade_cycles_per_frame; // mixing cost of the last crossfade
+} page_switch_stats_t;
+
+typedef struct reader_stats {
+  uint32_t wakeups;    // times the reader woke from waiting on an event
+  uint64_t busy_us;    // time the reader was awake
+  uint64_t elapsed_us; // since playback started; the rest of it core 1 idled
+} reader_stats_t;
+
+typedef struct buffer_stats {
+  uint32_t read_p50_us;  // card reads since the last stats period
+  uint32_t read_p99_us;
+  uint32_t read_max_us;
+  uint32_t ring_depth;   // bytes the ring buffer is filled to
+  uint32_t read_size;    // bytes per read
+  uint32_t low_water;    // fewest bytes queued when a DMA buffer was refilled
+  uint32_t high_water;   // most bytes queued
+  uint32_t underruns;    // DMA buffers that could not be refilled in full
+  uint64_t bytes_queued; // into the ring buffer since boot
+  uint64_t bytes_played; // out of it into DMA buffers
+} buffer_stats_t;
+
 void app_main();
 void read_file_to_shared_buffer();
 
-bool setup_audio_output(i2s_chan_handle_t *tx_handle, uint32_t sample_frequency, i2s_data_bit_width_t bits_sample, i2s_slot_mode_t slot_mode);
+bool setup_audio_output(i2s_chan_handle_t *tx_handle, uint32_t sample_frequency, i2s_data_bit_width_t bits_sample, i2s_slot_mode_t slot_mode, const uint8_t *first_block, size_t first_block_size);
 bool disable_audio_output(i2s_chan_handle_t *tx_handle);
-bool reconfigure_audio_output(i2s_chan_handle_t *tx_handle, uint32_t sample_frequency, i2s_data_bit_width_t bits_sample, i2s_slot_mode_t slot_mode);
-bool gpio_setup();
+bool reconfigure_audio_output(i2s_chan_handle_t *tx_handle, uint32_t sample_frequency, i2s_data_bit_width_t bits_sample, i2s_slot_mode_t slot_mode, const uint8_t *first_block, size_t first_block_size);
+void get_page_switch_stats(page_switch_stats_t *stats);
+void get_reader_stats(reader_stats_t *stats);
+void get_buffer_stats(buffer_stats_t *stats);
 
 #endif /* MAIN_MAIN_H_ */
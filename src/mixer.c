@@ -0,0 +1,123 @@
+#include "mixer.h"
+
+#include "esp_attr.h"
+
+#define GAIN_STEPS 256
+
+// sin(i / GAIN_STEPS * pi / 2) in Q15, with the last entry repeated so the
+// interpolation at the top of the table stays in bounds
+static const DRAM_ATTR int16_t fade_gain[GAIN_STEPS + 2] = {
+  0, 201, 402, 603, 804, 1005, 1206, 1407, 1608, 1809, 2009, 2210,
+  2410, 2611, 2811, 3012, 3212, 3412, 3612, 3811, 4011, 4210, 4410, 4609,
+  4808, 5007, 5205, 5404, 5602, 5800, 5998, 6195, 6393, 6590, 6786, 6983,
+  7179, 7375, 7571, 7767, 7962, 8157, 8351, 8545, 8739, 8933, 9126, 9319,
+  9512, 9704, 9896, 10087, 10278, 10469, 10659, 10849, 11039, 11228, 11417, 11605,
+  11793, 11980, 12167, 12353, 12539, 12725, 12910, 13094, 13279, 13462, 13645, 13828,
+  14010, 14191, 14372, 14553, 14732, 14912, 15090, 15269, 15446, 15623, 15800, 15976,
+  16151, 16325, 16499, 16673, 16846, 17018, 17189, 17360, 17530, 17700, 17869, 18037,
+  18204, 18371, 18537, 18703, 18868, 19032, 19195, 19357, 19519, 19680, 19841, 20000,
+  20159, 20317, 20475, 20631, 20787, 20942, 21096, 21250, 21403, 21554, 21705, 21856,
+  22005, 22154, 22301, 22448, 22594, 22739, 22884, 23027, 23170, 23311, 23452, 23592,
+  23731, 23870, 24007, 24143, 24279, 24413, 24547, 24680, 24811, 24942, 25072, 25201,
+  25329, 25456, 25582, 25708, 25832, 25955, 26077, 26198, 26319, 26438, 26556, 26674,
+  26790, 26905, 27019, 27133, 27245, 27356, 27466, 27575, 27683, 27790, 27896, 28001,
+  28105, 28208, 28310, 28411, 28510, 28609, 28706, 28803, 28898, 28992, 29085, 29177,
+  29268, 29358, 29447, 29534, 29621, 29706, 29791, 29874, 29956, 30037, 30117, 30195,
+  30273, 30349, 30424, 30498, 30571, 30643, 30714, 30783, 30852, 30919, 30985, 31050,
+  31113, 31176, 31237, 31297, 31356, 31414, 31470, 31526, 31580, 31633, 31685, 31736,
+  31785, 31833, 31880, 31926, 31971, 32014, 32057, 32098, 32137, 32176, 32213, 32250,
+  32285, 32318, 32351, 32382, 32412, 32441, 32469, 32495, 32521, 32545, 32567, 32589,
+  32609, 32628, 32646, 32663, 32678, 32692, 32705, 32717, 32728, 32737, 32745, 32752,
+  32757, 32761, 32765, 32766, 32767, 32767,
+};
+
+#define FULL_PHASE ((uint32_t)GAIN_STEPS << 16)
+
+// Gain at a 16.16 table position, interpolated between neighbouring entries
+static inline int32_t gain_at(uint32_t phase) {
+  uint32_t index = phase >> 16;
+  int32_t low = fade_gain[index];
+  int32_t high = fade_gain[index + 1];
+  return low + (((high - low) * (int32_t)(phase & 0xffff)) >> 16);
+}
+
+void crossfade_start(crossfade_t *fade, uint32_t length_frames, uint16_t channels) {
+  fade->length = length_frames;
+  fade->position = 0;
+  fade->phase = 0;
+  fade->phase_step = length_frames > 0 ? FULL_PHASE / length_frames : 0;
+  fade->channels = channels;
+}
+
+static inline int16_t mix_sample(int32_t from, int32_t to, int32_t gain_out, int32_t gain_in) {
+  int32_t mixed = (from * gain_out + to * gain_in) >> 15;
+
+  // Equal power gains sum to up to sqrt(2) for correlated input
+  if (mixed > INT16_MAX) {
+    return INT16_MAX;
+  }
+  if (mixed < INT16_MIN) {
+    return INT16_MIN;
+  }
+  return (int16_t)mixed;
+}
+
+void IRAM_ATTR crossfade_mix_s16(crossfade_t *fade, int16_t *to, const int16_t *from, int frames) {
+  uint32_t remaining = fade->length - fade->position;
+  if (fade->position >= fade->length) {
+    return;
+  }
+  if ((uint32_t)frames > remaining) {
+    frames = remaining;
+  }
+
+  uint32_t phase = fade->phase;
+  const uint32_t step = fade->phase_step;
+  int i = 0;
+
+  if (fade->channels == 2) {
+    // Two stereo frames per iteration, one gain pair per frame
+    for (; i + 2 <= frames; i += 2) {
+      int32_t in0 = gain_at(phase), out0 = gain_at(FULL_PHASE - phase);
+      int32_t in1 = gain_at(phase + step), out1 = gain_at(FULL_PHASE - phase - step);
+      phase += 2 * step;
+
+      to[0] = mix_sample(from[0], to[0], out0, in0);
+      to[1] = mix_sample(from[1], to[1], out0, in0);
+      to[2] = mix_sample(from[2], to[2], out1, in1);
+      to[3] = mix_sample(from[3], to[3], out1, in1);
+      to += 4;
+      from += 4;
+    }
+  } else if (fade->channels == 1) {
+    // Four mono frames per iteration
+    for (; i + 4 <= frames; i += 4) {
+      uint32_t phase1 = phase + step;
+      uint32_t phase2 = phase + 2 * step;
+      uint32_t phase3 = phase + 3 * step;
+
+      to[0] = mix_sample(from[0], to[0], gain_at(FULL_PHASE - phase), gain_at(phase));
+      to[1] = mix_sample(from[1], to[1], gain_at(FULL_PHASE - phase1), gain_at(phase1));
+      to[2] = mix_sample(from[2], to[2], gain_at(FULL_PHASE - phase2), gain_at(phase2));
+      to[3] = mix_sample(from[3], to[3], gain_at(FULL_PHASE - phase3), gain_at(phase3));
+      phase += 4 * step;
+      to += 4;
+      from += 4;
+    }
+  }
+
+  // Remaining frames, and any other channel count
+  for (; i < frames; ++i) {
+    int32_t gain_in = gain_at(phase), gain_out = gain_at(FULL_PHASE - phase);
+    phase += step;
+
+    for (int c = 0; c < fade->channels; ++c) {
+      *to = mix_sample(*from, *to, gain_out, gain_in);
+      ++to;
+      ++from;
+    }
+  }
+
+  fade->phase = phase;
+  fade->position += frames;
+}
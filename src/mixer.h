@@ -0,0 +1,25 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Equal-power crossfade between two interleaved 16 bit PCM streams. Gains
+// follow a quarter sine (incoming) and cosine (outgoing) from a Q15 table, so
+// the summed power stays constant for uncorrelated material.
+typedef struct crossfade {
+  uint32_t length;     // frames in the whole fade
+  uint32_t position;   // frames already mixed
+  uint32_t phase;      // gain table position, 16.16 fixed point
+  uint32_t phase_step; // phase advance per frame
+  uint16_t channels;
+} crossfade_t;
+
+void crossfade_start(crossfade_t *fade, uint32_t length_frames, uint16_t channels);
+
+static inline bool crossfade_active(const crossfade_t *fade) {
+  return fade->position < fade->length;
+}
+
+// Mix `frames` frames of `from` into `to`, fading `from` out and `to` in.
+// Frames beyond the end of the fade are left as `to`.
+void crossfade_mix_s16(crossfade_t *fade, int16_t *to, const int16_t *from, int frames);
@@ -0,0 +1,222 @@
+#include "page_input.h"
+
+#include "freertos/queue.h"
+
+#include "driver/gpio.h"
+#include "esp_attr.h"
+#include "esp_intr_alloc.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "file_managment.h"
+#include "sdkconfig.h"
+#include "soc/gpio_reg.h"
+#include "soc/soc.h"
+
+#if CONFIG_PM_ENABLE
+#include "esp_sleep.h"
+#endif
+
+static const char* ourTaskName = "page_input";
+
+static const DRAM_ATTR uint8_t page_pins[] = PAGE_ID_PINS;
+#define PAGE_ID_BITS (sizeof(page_pins) / sizeof(page_pins[0]))
+
+static QueueHandle_t page_queue;
+static esp_timer_handle_t debounce_timer;
+static uint16_t last_page = 0;
+static TaskHandle_t notify_task = NULL;
+static uint32_t notify_bits = 0;
+
+// Set by the ISR at the first edge of a change, cleared once it settles
+static volatile DRAM_ATTR bool settling = false;
+static volatile DRAM_ATTR int64_t settle_started_at = 0;
+
+#if CONFIG_PM_ENABLE
+// With the book closed every pin is low and the chip may be in light sleep,
+// which edge interrupts cannot wake it from. The pins are switched to high
+// level wakeup until the first one rises.
+static volatile DRAM_ATTR bool wakeup_armed = false;
+
+static void arm_wakeup(void) {
+  for (unsigned bit = 0; bit < PAGE_ID_BITS; ++bit) {
+    gpio_wakeup_enable(page_pins[bit], GPIO_INTR_HIGH_LEVEL);
+  }
+  wakeup_armed = true;
+}
+
+static void disarm_wakeup(void) {
+  wakeup_armed = false;
+  for (unsigned bit = 0; bit < PAGE_ID_BITS; ++bit) {
+    gpio_wakeup_disable(page_pins[bit]);
+    gpio_set_intr_type(page_pins[bit], GPIO_INTR_ANYEDGE);
+  }
+}
+#endif
+
+static uint16_t decode_page(uint32_t levels) {
+  uint16_t value = 0;
+  for (unsigned bit = 0; bit < PAGE_ID_BITS; ++bit) {
+    value |= ((levels >> page_pins[bit]) & 1) << bit;
+  }
+
+#if PAGE_INPUT_MODE == PAGE_INPUT_GRAY
+  for (uint16_t shifted = value >> 1; shifted != 0; shifted >>= 1) {
+    value ^= shifted;
+  }
+#elif PAGE_INPUT_MODE == PAGE_INPUT_ONE_HOT
+  // The highest pin set wins
+  value = value != 0 ? 32 - __builtin_clz(value) : 0;
+#endif
+  return value;
+}
+
+// Every edge on the bank restarts the debounce timer. The cost does not depend
+// on the number of pages.
+static void IRAM_ATTR page_edge_isr(void *arg) {
+#if CONFIG_PM_ENABLE
+  if (wakeup_armed) {
+    disarm_wakeup();
+  }
+#endif
+  if (!settling) {
+    settle_started_at = esp_timer_get_time();
+    settling = true;
+  }
+  esp_timer_stop(debounce_timer);
+  esp_timer_start_once(debounce_timer, PAGE_DEBOUNCE_US);
+}
+
+// Runs on the esp_timer task once the bank has been still for PAGE_DEBOUNCE_US
+static void page_settled(void *arg) {
+  int64_t changed_at = settle_started_at;
+  settling = false;
+
+  uint16_t page = decode_page(REG_READ(GPIO_IN_REG));
+
+#if PAGE_INPUT_MODE == PAGE_INPUT_ONE_HOT
+  // Releasing a button leaves its page playing
+  if (page == 0) {
+    return;
+  }
+#endif
+  if (page == last_page) {
+    return;
+  }
+  last_page = page;
+
+  page_event_t event = {.page = page, .changed_at = changed_at};
+  xQueueOverwrite(page_queue, &event);
+
+  if (notify_task != NULL) {
+    xTaskNotify(notify_task, notify_bits, eSetBits);
+  }
+#if CONFIG_PM_ENABLE
+  if (page == 0) {
+    arm_wakeup();
+  }
+#endif
+}
+
+bool page_input_setup(void) {
+#if SD_BUS == SD_BUS_SDMMC
+  static const uint8_t sdmmc_pins[] = SDMMC_PINS;
+  for (unsigned bit = 0; bit < PAGE_ID_BITS; ++bit) {
+    for (unsigned pin = 0; pin < sizeof(sdmmc_pins); ++pin) {
+      if (page_pins[bit] == sdmmc_pins[pin]) {
+        ESP_LOGE(ourTaskName, "Page id pin %d is an SDMMC line", page_pins[bit]);
+        return false;
+      }
+    }
+  }
+#endif
+
+  page_queue = xQueueCreate(1, sizeof(page_event_t));
+  if (page_queue == NULL) {
+    ESP_LOGE(ourTaskName, "Could not create page queue");
+    return false;
+  }
+
+  esp_timer_create_args_t timer_args = {.callback = page_settled,
+                                        .arg = NULL,
+                                        .dispatch_method = ESP_TIMER_TASK,
+                                        .name = "page_debounce",
+                                        .skip_unhandled_events = true};
+  esp_err_t err = esp_timer_create(&timer_args, &debounce_timer);
+
+  if (err != ESP_OK) {
+    ESP_LOGE(ourTaskName, "Error creating debounce timer (%s)", esp_err_to_name(err));
+    return false;
+  }
+
+  gpio_config_t io_conf = {};
+  io_conf.intr_type = GPIO_INTR_ANYEDGE;
+  io_conf.mode = GPIO_MODE_INPUT;
+  io_conf.pull_down_en = GPIO_PULLDOWN_ENABLE;
+  for (unsigned bit = 0; bit < PAGE_ID_BITS; ++bit) {
+    io_conf.pin_bit_mask |= 1ULL << page_pins[bit];
+  }
+
+  err = gpio_config(&io_conf);
+
+  if (err != ESP_OK) {
+    ESP_LOGE(ourTaskName, "Error configuring IO pins (%s)", esp_err_to_name(err));
+    return false;
+  }
+  
+  err = gpio_install_isr_service(ESP_INTR_FLAG_EDGE | ESP_INTR_FLAG_LEVEL3);
+  
+  if (err != ESP_OK) {
+    ESP_LOGE(ourTaskName, "Error installing isr service (%s)", esp_err_to_name(err));
+    return false;
+  }
+
+  for (unsigned bit = 0; bit < PAGE_ID_BITS; ++bit) {
+    err = gpio_isr_handler_add(page_pins[bit], page_edge_isr, NULL);
+
+    if (err != ESP_OK) {
+      ESP_LOGE(ourTaskName, "Error adding interrupt handler to pin %d, (%s)", page_pins[bit], esp_err_to_name(err));
+      return false;
+    }
+  }
+
+#if CONFIG_PM_ENABLE
+  esp_sleep_enable_gpio_wakeup();
+#endif
+
+  last_page = decode_page(REG_READ(GPIO_IN_REG));
+  if (last_page != 0) {
+    page_event_t event = {.page = last_page, .changed_at = esp_timer_get_time()};
+    xQueueOverwrite(page_queue, &event);
+  }
+#if CONFIG_PM_ENABLE
+  else {
+    arm_wakeup();
+  }
+#endif
+
+  ESP_LOGI(ourTaskName, "%u page id pins, pages up to %u", (unsigned)PAGE_ID_BITS,
+           PAGE_INPUT_MODE == PAGE_INPUT_ONE_HOT ? (unsigned)PAGE_ID_BITS : (1u << PAGE_ID_BITS) - 1);
+  return true;
+}
+
+void page_input_notify(TaskHandle_t task, uint32_t bits) {
+  notify_bits = bits;
+  notify_task = task;
+}
+
+bool page_input_receive(page_event_t *event, TickType_t ticks_to_wait) {
+  return xQueueReceive(page_queue, event, ticks_to_wait) == pdTRUE;
+}
+
+uint16_t page_input_page(void) {
+  return last_page;
+}
+
+void page_input_repeat(void) {
+  page_event_t event = {.page = last_page, .changed_at = esp_timer_get_time()};
+  xQueueOverwrite(page_queue, &event);
+
+  if (notify_task != NULL) {
+    xTaskNotify(notify_task, notify_bits, eSetBits);
+  }
+}
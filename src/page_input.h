@@ -0,0 +1,54 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+// Page id input: a bank of pins read together as one number, so a board
+// scales to many pages with one ISR per edge whatever the page count
+#define PAGE_INPUT_ONE_HOT 0 // one pin per page, pin n selects page n + 1
+#define PAGE_INPUT_BINARY 1
+#define PAGE_INPUT_GRAY 2    // only one pin changes between adjacent pages
+
+#ifndef PAGE_INPUT_MODE
+#define PAGE_INPUT_MODE PAGE_INPUT_GRAY
+#endif
+
+// Pins of the page id, least significant bit first. They must all be below
+// GPIO 32, so one read of GPIO_IN_REG samples the whole bank.
+#ifndef PAGE_ID_PINS
+#define PAGE_ID_PINS {2, 0, 4}
+#endif
+
+// The bank must stay unchanged this long after an edge before its page is
+// taken, which rides out contact bounce and multi-pin transitions
+#ifndef PAGE_DEBOUNCE_US
+#define PAGE_DEBOUNCE_US 2000
+#endif
+
+// Page 0 means no page is open: the book is closed
+typedef struct page_event {
+  uint16_t page;
+  int64_t changed_at;  // esp_timer time of the first edge of the change
+} page_event_t;
+
+// Configure the page id pins and their interrupt. A page already open at boot
+// is posted as the first event.
+bool page_input_setup(void);
+
+// Also notify task with bits (eSetBits) on every settled page change, so it
+// can sleep on one notification for input and audio events
+void page_input_notify(TaskHandle_t task, uint32_t bits);
+
+// Wait up to ticks_to_wait for the next settled page change. Only the latest
+// change is kept.
+bool page_input_receive(page_event_t *event, TickType_t ticks_to_wait);
+
+// The page open now, 0 with the book closed
+uint16_t page_input_page(void);
+
+// Post the open page again as a change, so the reader plays it from the start
+// once it is done with whatever stopped playback, such as a recording
+void page_input_repeat(void);
@@ -0,0 +1,418 @@
+#include "recorder.h"
+
+#if RECORD_ENABLE
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/param.h>
+#include <sys/stat.h>
+
+#include "freertos/queue.h"
+
+#include "driver/gpio.h"
+#include "driver/i2s_std.h"
+#include "esp_attr.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "spsc.h"
+#include "tinywav.h"
+
+static const char* ourTaskName = "recorder";
+
+#define RECORD_DMA_BUFFER_SIZE (RECORD_DMA_FRAME_NUM * RECORD_FRAME_BYTES)
+_Static_assert(RECORD_BLOCK_SIZE % RECORD_DMA_BUFFER_SIZE == 0,
+               "RECORD_BLOCK_SIZE must hold a whole number of DMA buffers");
+
+typedef struct record_command {
+  bool start;
+  uint16_t page;
+} record_command_t;
+
+static i2s_chan_handle_t rx_handle;
+static TaskHandle_t writer_task;
+static QueueHandle_t command_queue; // to the writer
+static QueueHandle_t done_queue;    // its answer
+
+// Filled blocks, from the ISR to the writer. The ISR fills fill_block, its
+// write slot, a DMA buffer at a time.
+static spsc_queue_t blocks;
+static uint8_t *fill_block = NULL;
+static uint32_t fill_pos = 0;
+
+static TinyWav record_file;
+static uint8_t *write_buffer;
+static bool recording = false;
+static bool write_failed = false;
+
+static volatile DRAM_ATTR uint64_t buffers_captured = 0;
+static volatile DRAM_ATTR uint64_t buffers_dropped = 0;
+static volatile DRAM_ATTR uint32_t max_blocks_queued = 0;
+static uint32_t recordings = 0;
+static uint64_t bytes_written = 0;
+static uint32_t write_max_us = 0;
+
+static esp_timer_handle_t debounce_timer;
+static TaskHandle_t notify_task = NULL;
+static uint32_t notify_bits = 0;
+static bool button_held = false;
+static bool button_changed = false;
+
+static IRAM_ATTR bool on_data_received(i2s_chan_handle_t handle, i2s_event_data_t *event, void *user_ctx) {
+  buffers_captured++;
+
+  if (fill_block == NULL) {
+    fill_block = (uint8_t *)spsc_write_slot(&blocks);
+    if (fill_block == NULL) {
+      buffers_dropped++;
+      return false;
+    }
+  }
+  memcpy(fill_block + fill_pos, event->dma_buf, event->size);
+  fill_pos += event->size;
+  if (fill_pos < RECORD_BLOCK_SIZE) {
+    return false;
+  }
+
+  spsc_push(&blocks);
+  fill_block = NULL;
+  fill_pos = 0;
+  max_blocks_queued = MAX(max_blocks_queued, spsc_used(&blocks));
+
+  BaseType_t woke_writer = pdFALSE;
+  xTaskNotifyFromISR(writer_task, 1, eSetBits, &woke_writer);
+  return woke_writer;
+}
+
+static void write_frames(const uint8_t *data, uint32_t size) {
+  if (write_failed || size == 0) {
+    return;
+  }
+
+  int64_t started = esp_timer_get_time();
+  int written = tinywav_write_interleaved(&record_file, data, size / RECORD_FRAME_BYTES);
+  write_max_us = MAX(write_max_us, (uint32_t)(esp_timer_get_time() - started));
+
+  if (written < 0) {
+    // The card is full or gone; the file keeps what was synced
+    ESP_LOGE(ourTaskName, "Error writing the recording, dropping the rest");
+    write_failed = true;
+    return;
+  }
+  bytes_written += size;
+}
+
+static void write_blocks(void) {
+  uint8_t *block;
+  while ((block = (uint8_t *)spsc_read_slot(&blocks)) != NULL) {
+    write_frames(block, RECORD_BLOCK_SIZE);
+    spsc_pop(&blocks);
+  }
+}
+
+static void record_path(char *out, size_t out_len, uint16_t page) {
+  if (BOOK_DIR[0] == '\0') {
+    snprintf(out, out_len, "%s/%s/PAGE%u.TMP", MOUNT_POINT, RECORD_DIR, page);
+  } else {
+    snprintf(out, out_len, "%s/%s/%s/PAGE%u.TMP", MOUNT_POINT, BOOK_DIR, RECORD_DIR, page);
+  }
+}
+
+static bool start_recording(uint16_t page) {
+  if (page == 0) {
+    ESP_LOGE(ourTaskName, "No page open to record");
+    return false;
+  }
+  // A pack plays in place of the loose tracks, so a recording would never play
+  if (book_packed()) {
+    ESP_LOGW(ourTaskName, "The book is packed, not recording page %u", page);
+    return false;
+  }
+
+  char path[sizeof(MOUNT_POINT) + sizeof(BOOK_DIR) + sizeof(RECORD_DIR) + 20];
+  record_path(path, sizeof(path), page);
+  *strrchr(path, '/') = '\0';
+  if (mkdir(path, 0777) != 0 && errno != EEXIST) {
+    ESP_LOGE(ourTaskName, "Could not create %s", path);
+    return false;
+  }
+  record_path(path, sizeof(path), page);
+
+  if (tinywav_open_write(&record_file, 1, RECORD_SAMPLE_RATE, TW_INT16, TW_INTERLEAVED, path) != 0) {
+    ESP_LOGE(ourTaskName, "Could not create %s", path);
+    return false;
+  }
+  if (tinywav_set_write_buffer(&record_file, write_buffer, RECORD_WRITE_BUFFER_SIZE, RECORD_SYNC_BYTES) != 0) {
+    ESP_LOGE(ourTaskName, "Could not set up writing %s", path);
+    tinywav_close_write(&record_file);
+    return false;
+  }
+
+  // The ISR is stopped, so both ends of the queue may be reset
+  spsc_init(&blocks, blocks.slots, RECORD_BLOCK_SIZE, RECORD_BLOCK_SLOTS);
+  fill_block = NULL;
+  fill_pos = 0;
+  write_failed = false;
+
+  esp_err_t err = i2s_channel_enable(rx_handle);
+  if (err != ESP_OK) {
+    ESP_LOGE(ourTaskName, "Error enabling the microphone (%s)", esp_err_to_name(err));
+    tinywav_close_write(&record_file);
+    return false;
+  }
+
+  recording = true;
+  recordings++;
+  ESP_LOGI(ourTaskName, "Recording page %u to %s", page, path);
+  return true;
+}
+
+static void stop_recording(void) {
+  esp_err_t err = i2s_channel_disable(rx_handle);
+  if (err != ESP_OK) {
+    ESP_LOGE(ourTaskName, "Error disabling the microphone (%s)", esp_err_to_name(err));
+  }
+
+  // Then the block the ISR was still filling
+  write_blocks();
+  if (fill_block != NULL) {
+    write_frames(fill_block, fill_pos);
+    fill_block = NULL;
+    fill_pos = 0;
+  }
+  tinywav_close_write(&record_file);
+  recording = false;
+
+  ESP_LOGI(ourTaskName, "Recording closed. Since boot: %llu bytes, %llu of %llu DMA buffers dropped, slowest write %lu us",
+           (unsigned long long)bytes_written, (unsigned long long)buffers_dropped,
+           (unsigned long long)buffers_captured, (unsigned long)write_max_us);
+}
+
+// Streams full blocks to the card as the ISR queues them, and starts and
+// stops recordings for the reader
+static void record_writer(void *arg) {
+  for (;;) {
+    xTaskNotifyWait(0, UINT32_MAX, NULL, portMAX_DELAY);
+
+    if (recording) {
+      write_blocks();
+    }
+
+    record_command_t command;
+    if (xQueueReceive(command_queue, &command, 0) == pdTRUE) {
+      bool done = true;
+      if (command.start && !recording) {
+        done = start_recording(command.page);
+      } else if (!command.start && recording) {
+        stop_recording();
+      }
+      xQueueSend(done_queue, &done, portMAX_DELAY);
+    }
+  }
+}
+
+static bool send_command(bool start, uint16_t page) {
+  record_command_t command = {.start = start, .page = page};
+  bool done = false;
+
+  xQueueSend(command_queue, &command, portMAX_DELAY);
+  xTaskNotify(writer_task, 1, eSetBits);
+  xQueueReceive(done_queue, &done, portMAX_DELAY);
+  return done;
+}
+
+static void IRAM_ATTR button_edge_isr(void *arg) {
+  esp_timer_stop(debounce_timer);
+  esp_timer_start_once(debounce_timer, RECORD_DEBOUNCE_US);
+}
+
+// Runs on the esp_timer task once the button has been still for
+// RECORD_DEBOUNCE_US
+static void button_settled(void *arg) {
+  bool held = gpio_get_level(RECORD_BUTTON_PIN) != 0;
+  if (held == button_held) {
+    return;
+  }
+  button_held = held;
+  __atomic_store_n(&button_changed, true, __ATOMIC_RELEASE);
+
+  if (notify_task != NULL) {
+    xTaskNotify(notify_task, notify_bits, eSetBits);
+  }
+}
+
+static bool setup_microphone(void) {
+  i2s_chan_config_t chan_cfg = {
+    .id = RECORD_I2S_PORT,
+    .role = I2S_ROLE_MASTER,
+    .dma_desc_num = RECORD_DMA_DESC_NUM,
+    .dma_frame_num = RECORD_DMA_FRAME_NUM,
+    .auto_clear_after_cb = false,
+    .auto_clear_before_cb = false,
+    .intr_priority = 0,
+  };
+  esp_err_t err = i2s_new_channel(&chan_cfg, NULL, &rx_handle);
+
+  if (err != ESP_OK) {
+    ESP_LOGE(ourTaskName, "Error creating the microphone channel (%s)", esp_err_to_name(err));
+    return false;
+  }
+
+  // The output holds the APLL, so the microphone runs off the PLL
+  i2s_std_config_t rx_std_cfg = {
+      .clk_cfg =
+          {
+              .sample_rate_hz = RECORD_SAMPLE_RATE,
+              .clk_src = SOC_MOD_CLK_PLL_F160M,
+              .mclk_multiple = I2S_MCLK_MULTIPLE_256,
+          },
+      .slot_cfg = I2S_STD_PHILIPS_SLOT_DEFAULT_CONFIG(I2S_DATA_BIT_WIDTH_16BIT, I2S_SLOT_MODE_MONO),
+      .gpio_cfg =
+          {
+              .mclk = I2S_GPIO_UNUSED,
+              .bclk = RECORD_BCLK_PIN,
+              .ws = RECORD_WS_PIN,
+              .dout = I2S_GPIO_UNUSED,
+              .din = RECORD_DIN_PIN,
+              .invert_flags =
+                  {
+                      .mclk_inv = false,
+                      .bclk_inv = false,
+                      .ws_inv = false,
+                  },
+          },
+  };
+  rx_std_cfg.slot_cfg.slot_bit_width = I2S_SLOT_BIT_WIDTH_32BIT;
+
+  err = i2s_channel_init_std_mode(rx_handle, &rx_std_cfg);
+
+  if (err != ESP_OK) {
+    ESP_LOGE(ourTaskName, "Error initializing the microphone channel (%s)", esp_err_to_name(err));
+    return false;
+  }
+
+  i2s_event_callbacks_t cbs = {
+    .on_recv = on_data_received,
+    .on_recv_q_ovf = NULL,
+    .on_sent = NULL,
+    .on_send_q_ovf = NULL,
+  };
+
+  err = i2s_channel_register_event_callback(rx_handle, &cbs, NULL);
+
+  if (err != ESP_OK) {
+    ESP_LOGE(ourTaskName, "Error registering the microphone callback (%s)", esp_err_to_name(err));
+    return false;
+  }
+  return true;
+}
+
+static bool setup_button(void) {
+  esp_timer_create_args_t timer_args = {.callback = button_settled,
+                                        .arg = NULL,
+                                        .dispatch_method = ESP_TIMER_TASK,
+                                        .name = "record_debounce",
+                                        .skip_unhandled_events = true};
+  esp_err_t err = esp_timer_create(&timer_args, &debounce_timer);
+
+  if (err != ESP_OK) {
+    ESP_LOGE(ourTaskName, "Error creating debounce timer (%s)", esp_err_to_name(err));
+    return false;
+  }
+
+  gpio_config_t io_conf = {};
+  io_conf.intr_type = GPIO_INTR_ANYEDGE;
+  io_conf.mode = GPIO_MODE_INPUT;
+  io_conf.pin_bit_mask = 1ULL << RECORD_BUTTON_PIN;
+
+  err = gpio_config(&io_conf);
+
+  if (err != ESP_OK) {
+    ESP_LOGE(ourTaskName, "Error configuring the record button (%s)", esp_err_to_name(err));
+    return false;
+  }
+
+  // page_input_setup installed the ISR service
+  err = gpio_isr_handler_add(RECORD_BUTTON_PIN, button_edge_isr, NULL);
+
+  if (err != ESP_OK) {
+    ESP_LOGE(ourTaskName, "Error adding interrupt handler to pin %d, (%s)", RECORD_BUTTON_PIN, esp_err_to_name(err));
+    return false;
+  }
+  button_held = gpio_get_level(RECORD_BUTTON_PIN) != 0;
+  return true;
+}
+
+bool recorder_setup(void) {
+  int committed = commit_recordings();
+  if (committed > 0) {
+    ESP_LOGI(ourTaskName, "%d new recordings in the book", committed);
+  }
+
+  // Written by the ISR, so in internal RAM
+  uint8_t *slots = (uint8_t *)heap_caps_malloc(RECORD_BLOCK_SLOTS * RECORD_BLOCK_SIZE, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+  write_buffer = (uint8_t *)heap_caps_malloc(RECORD_WRITE_BUFFER_SIZE, MALLOC_CAP_DMA);
+  command_queue = xQueueCreate(1, sizeof(record_command_t));
+  done_queue = xQueueCreate(1, sizeof(bool));
+
+  if (slots == NULL || write_buffer == NULL || command_queue == NULL || done_queue == NULL) {
+    ESP_LOGE(ourTaskName, "No memory to record");
+    return false;
+  }
+  spsc_init(&blocks, slots, RECORD_BLOCK_SIZE, RECORD_BLOCK_SLOTS);
+
+  // Away from the reader on core 1. app_main runs on core 0 too, so the
+  // microphone's interrupt is allocated on the writer's core.
+  if (xTaskCreatePinnedToCore(record_writer, "record", 4096, NULL, RECORD_TASK_PRIORITY,
+                              &writer_task, RECORD_TASK_CORE) != pdPASS) {
+    ESP_LOGE(ourTaskName, "Could not start the writer task");
+    return false;
+  }
+
+  if (!setup_microphone() || !setup_button()) {
+    return false;
+  }
+
+  ESP_LOGI(ourTaskName, "Hold the button on pin %d to record a page, %d Hz mono",
+           RECORD_BUTTON_PIN, RECORD_SAMPLE_RATE);
+  return true;
+}
+
+void recorder_notify(TaskHandle_t task, uint32_t bits) {
+  notify_bits = bits;
+  notify_task = task;
+}
+
+bool recorder_button_changed(bool *held) {
+  if (!__atomic_exchange_n(&button_changed, false, __ATOMIC_ACQUIRE)) {
+    return false;
+  }
+  *held = button_held;
+  return true;
+}
+
+bool recorder_start(uint16_t page) {
+  return writer_task != NULL && send_command(true, page);
+}
+
+void recorder_stop(void) {
+  if (writer_task != NULL) {
+    send_command(false, 0);
+  }
+}
+
+bool recorder_recording(void) {
+  return recording;
+}
+
+void get_record_stats(record_stats_t *stats) {
+  stats->recordings = recordings;
+  stats->buffers_captured = buffers_captured;
+  stats->buffers_dropped = buffers_dropped;
+  stats->bytes_written = bytes_written;
+  stats->max_blocks_queued = max_blocks_queued;
+  stats->write_max_us = write_max_us;
+}
+
+#endif
@@ -0,0 +1,138 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "file_managment.h"
+
+// Record-and-play: while the record button is held, narration from an I2S
+// microphone is recorded for the open page, to RECORD_DIR/PAGEn.TMP on the
+// card, and playback stops. The recording plays on that page from the next
+// boot, when commit_recordings takes it into the book in place of the page's
+// track (see file_managment.h). A packed book (see book_pack.h) plays in place
+// of the loose tracks, so with one on the card nothing is recorded.
+//
+// The microphone has an RX channel of its own on RECORD_I2S_PORT. Its ISR
+// copies every DMA buffer into a double buffer of RECORD_BLOCK_SIZE blocks,
+// a lock-free queue (see spsc.h), and the writer task on RECORD_TASK_CORE
+// streams full blocks to the file through TinyWav's sector buffered writer.
+// A DMA buffer that arrives while both blocks wait on the card is dropped
+// and counted. Off by default; with RECORD_ENABLE 0 every call compiles away.
+#ifndef RECORD_ENABLE
+#define RECORD_ENABLE 0
+#endif
+
+#if RECORD_ENABLE && BOOK_STORAGE == BOOK_STORAGE_FLASH
+#error "RECORD_ENABLE needs the book on a card"
+#endif
+
+// 16 bit mono, the top of the microphone's samples
+#ifndef RECORD_SAMPLE_RATE
+#define RECORD_SAMPLE_RATE 16000
+#endif
+#define RECORD_FRAME_BYTES 2
+
+// An INMP441 style microphone, Philips format with 32 bit slots and its L/R
+// pin low. Clear of the output, card and page id pins; GPIO 34 and 35 are
+// inputs only. The button is active high and needs an external pull-down.
+#define RECORD_I2S_PORT I2S_NUM_1
+#ifndef RECORD_BCLK_PIN
+#define RECORD_BCLK_PIN 32
+#endif
+#ifndef RECORD_WS_PIN
+#define RECORD_WS_PIN 33
+#endif
+#ifndef RECORD_DIN_PIN
+#define RECORD_DIN_PIN 34
+#endif
+#ifndef RECORD_BUTTON_PIN
+#define RECORD_BUTTON_PIN 35
+#endif
+
+// The button must stay put this long after an edge before it counts
+#define RECORD_DEBOUNCE_US 20000
+
+#ifndef RECORD_DMA_DESC_NUM
+#define RECORD_DMA_DESC_NUM 4
+#endif
+#ifndef RECORD_DMA_FRAME_NUM
+#define RECORD_DMA_FRAME_NUM 256
+#endif
+
+// Each block holds a whole number of DMA buffers. While the writer waits on
+// the card the ISR fills the other one, so a card may stay busy for up to a
+// block's time without a buffer dropped: 0.5 s at 16 kHz.
+#ifndef RECORD_BLOCK_SIZE
+#define RECORD_BLOCK_SIZE 16384
+#endif
+#define RECORD_BLOCK_SLOTS 2
+
+// TinyWav's write buffer, in DMA capable memory, and the sample data between
+// header updates, so a recording cut by a power loss keeps all but the last
+// second
+#define RECORD_WRITE_BUFFER_SIZE (16 * TINYWAV_SECTOR_SIZE)
+#define RECORD_SYNC_BYTES (RECORD_SAMPLE_RATE * RECORD_FRAME_BYTES)
+
+#define RECORD_TASK_CORE 0
+#define RECORD_TASK_PRIORITY 12
+
+typedef struct record_stats {
+  uint32_t recordings;        // started since boot
+  uint64_t buffers_captured;  // DMA buffers the ISR received
+  uint64_t buffers_dropped;   // of those, the ones with no block free
+  uint64_t bytes_written;     // sample data handed to TinyWav
+  uint32_t max_blocks_queued; // most full blocks waiting on the writer
+  uint32_t write_max_us;      // slowest block write
+} record_stats_t;
+
+#if RECORD_ENABLE
+
+// Take the recordings made since the last boot into the book, then set up
+// the microphone, the writer task and the record button. Call after mounting
+// the card and page_input_setup, and before sort_filenames.
+bool recorder_setup(void);
+
+// Notify task with bits (eSetBits) whenever the record button settles into
+// another state
+void recorder_notify(TaskHandle_t task, uint32_t bits);
+
+// True once for every settled change of the record button, held saying how
+// it is now
+bool recorder_button_changed(bool *held);
+
+// Start recording page, waiting until the file is open and the microphone
+// runs. Returns true if recording already, false when the page cannot be
+// recorded: no page open, a packed book or the file not created.
+bool recorder_start(uint16_t page);
+
+// Stop recording, waiting until the file is closed, so the card is free
+// again when it returns
+void recorder_stop(void);
+
+bool recorder_recording(void);
+
+void get_record_stats(record_stats_t *stats);
+
+#else
+
+static inline bool recorder_setup(void) {
+  return true;
+}
+static inline void recorder_notify(TaskHandle_t task, uint32_t bits) {
+}
+static inline bool recorder_button_changed(bool *held) {
+  return false;
+}
+static inline bool recorder_start(uint16_t page) {
+  return false;
+}
+static inline void recorder_stop(void) {
+}
+static inline bool recorder_recording(void) {
+  return false;
+}
+
+#endif
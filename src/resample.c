@@ -0,0 +1,199 @@
+#include "resample.h"
+
+#include <math.h>
+
+#include "esp_attr.h"
+#include "esp_heap_caps.h"
+
+// Filters in use at once: one per open section at most, and most share the
+// upsampling one
+#define RESAMPLE_FILTERS 4
+
+// Fraction of the lower Nyquist frequency passed, leaving the rest for the
+// filter's transition band
+#define RESAMPLE_PASSBAND 0.9f
+
+// Kaiser window shape, trading stopband attenuation against the width of the
+// transition band
+#define RESAMPLE_KAISER_BETA 6.0f
+
+#define COEFF_BITS 14
+
+typedef struct filter {
+  int16_t *coeffs;
+  uint32_t cutoff; // fraction of the input's Nyquist frequency, 16.16
+  uint16_t taps;
+  uint16_t users;
+} filter_t;
+
+static filter_t filters[RESAMPLE_FILTERS];
+
+// Zeroth order modified Bessel function of the first kind, for the window
+static float bessel_i0(float x) {
+  float sum = 1.0f;
+  float term = 1.0f;
+  for (int k = 1; k < 32 && term > sum * 1e-7f; ++k) {
+    term *= (x / (2.0f * k)) * (x / (2.0f * k));
+    sum += term;
+  }
+  return sum;
+}
+
+// Row p holds the taps for an output frame p / RESAMPLE_PHASES of an input
+// frame past input frame taps / 2 - 1. Each row sums to exactly 1.0 so DC
+// passes unchanged whatever the phase.
+static void build_filter(int16_t *coeffs, int taps, uint32_t cutoff) {
+  float fc = RESAMPLE_PASSBAND * cutoff / 65536.0f; // of the input's Nyquist
+  float half = taps / 2;
+  float window_scale = 1.0f / bessel_i0(RESAMPLE_KAISER_BETA);
+
+  for (int p = 0; p <= RESAMPLE_PHASES; ++p) {
+    float h[RESAMPLE_MAX_TAPS];
+    float sum = 0.0f;
+    for (int k = 0; k < taps; ++k) {
+      float d = k - (half - 1) - (float)p / RESAMPLE_PHASES;
+      float x = d / half;
+      float window = x * x < 1.0f ? bessel_i0(RESAMPLE_KAISER_BETA * sqrtf(1.0f - x * x)) * window_scale : 0.0f;
+      float sinc = d == 0.0f ? 1.0f : sinf((float)M_PI * fc * d) / ((float)M_PI * fc * d);
+      h[k] = sinc * window;
+      sum += h[k];
+    }
+
+    // Round to Q14 and put the rounding error on the largest tap
+    int16_t *row = coeffs + p * taps;
+    int32_t total = 0;
+    int largest = 0;
+    for (int k = 0; k < taps; ++k) {
+      row[k] = (int16_t)lrintf(h[k] / sum * (1 << COEFF_BITS));
+      total += row[k];
+      if (row[k] > row[largest]) {
+        largest = k;
+      }
+    }
+    row[largest] += (1 << COEFF_BITS) - total;
+  }
+}
+
+static filter_t *acquire_filter(int taps, uint32_t cutoff) {
+  filter_t *free_slot = NULL;
+  for (int i = 0; i < RESAMPLE_FILTERS; ++i) {
+    filter_t *f = &filters[i];
+    if (f->users > 0 && f->taps == taps && f->cutoff == cutoff) {
+      f->users++;
+      return f;
+    }
+    if (f->users == 0 && free_slot == NULL) {
+      free_slot = f;
+    }
+  }
+  if (free_slot == NULL) {
+    return NULL;
+  }
+
+  int16_t *coeffs = (int16_t *)heap_caps_malloc((RESAMPLE_PHASES + 1) * taps * sizeof(int16_t), MALLOC_CAP_INTERNAL);
+  if (coeffs == NULL) {
+    return NULL;
+  }
+  build_filter(coeffs, taps, cutoff);
+  free_slot->coeffs = coeffs;
+  free_slot->taps = taps;
+  free_slot->cutoff = cutoff;
+  free_slot->users = 1;
+  return free_slot;
+}
+
+bool resampler_init(resampler_t *r, uint32_t in_rate, uint32_t out_rate, int channels, int taps) {
+  r->coeffs = NULL;
+  if (taps < 2 || taps > RESAMPLE_MAX_TAPS || taps % 2 != 0 || in_rate == 0 || out_rate == 0) {
+    return false;
+  }
+
+  // Downsampling has to cut off below the output's Nyquist frequency
+  uint32_t cutoff = out_rate < in_rate ? (uint32_t)(((uint64_t)out_rate << 16) / in_rate) : 1 << 16;
+  filter_t *filter = acquire_filter(taps, cutoff);
+  if (filter == NULL) {
+    return false;
+  }
+
+  r->coeffs = filter->coeffs;
+  r->step = ((uint64_t)in_rate << 32) / out_rate;
+  r->position = 0;
+  r->taps = taps;
+  r->channels = channels;
+  return true;
+}
+
+void resampler_free(resampler_t *r) {
+  for (int i = 0; i < RESAMPLE_FILTERS; ++i) {
+    filter_t *f = &filters[i];
+    if (r->coeffs != NULL && f->users > 0 && f->coeffs == r->coeffs && --f->users == 0) {
+      heap_caps_free(f->coeffs);
+      f->coeffs = NULL;
+    }
+  }
+  r->coeffs = NULL;
+}
+
+// Coefficients for the fractional part of a 32.32 position, interpolated
+// between the two nearest phases
+static inline void phase_coeffs(const resampler_t *r, uint64_t position, int16_t *coeffs) {
+  uint32_t fraction = (uint32_t)position;
+  const int16_t *low = r->coeffs + (fraction >> (32 - RESAMPLE_PHASE_BITS)) * r->taps;
+  const int16_t *high = low + r->taps;
+  int32_t weight = (fraction >> (17 - RESAMPLE_PHASE_BITS)) & 0x7fff;
+  for (int k = 0; k < r->taps; ++k) {
+    coeffs[k] = (int16_t)(low[k] + (((high[k] - low[k]) * weight) >> 15));
+  }
+}
+
+// Kernels for one sample width. Stereo, the common case, keeps both channels'
+// sums in registers and takes two taps per iteration; taps are always even.
+#define RESAMPLE_KERNEL(name, sample_t, acc_t, min, max)                       \
+  int IRAM_ATTR name(resampler_t *r, sample_t *out, int out_frames,            \
+                     const sample_t *in, size_t in_frames) {                   \
+    const int taps = r->taps;                                                  \
+    const int channels = r->channels;                                          \
+    const uint64_t step = r->step;                                             \
+    uint64_t position = r->position;                                           \
+    int i = 0;                                                                 \
+    for (; i < out_frames; ++i) {                                              \
+      size_t base = (size_t)(position >> 32);                                  \
+      if (base + taps > in_frames) {                                           \
+        break;                                                                 \
+      }                                                                        \
+      int16_t c[RESAMPLE_MAX_TAPS];                                            \
+      phase_coeffs(r, position, c);                                            \
+      const sample_t *x = in + base * channels;                                \
+      if (channels == 2) {                                                     \
+        acc_t left = (acc_t)1 << (COEFF_BITS - 1);                             \
+        acc_t right = left;                                                    \
+        for (int k = 0; k < taps; k += 2) {                                    \
+          left += (acc_t)c[k] * x[0] + (acc_t)c[k + 1] * x[2];                 \
+          right += (acc_t)c[k] * x[1] + (acc_t)c[k + 1] * x[3];                \
+          x += 4;                                                              \
+        }                                                                      \
+        left >>= COEFF_BITS;                                                   \
+        right >>= COEFF_BITS;                                                  \
+        out[0] = (sample_t)(left > max ? max : left < min ? min : left);       \
+        out[1] = (sample_t)(right > max ? max : right < min ? min : right);    \
+      } else {                                                                 \
+        for (int ch = 0; ch < channels; ++ch) {                                \
+          acc_t sum = (acc_t)1 << (COEFF_BITS - 1);                            \
+          for (int k = 0; k < taps; ++k) {                                     \
+            sum += (acc_t)c[k] * x[k * channels + ch];                         \
+          }                                                                    \
+          sum >>= COEFF_BITS;                                                  \
+          out[ch] = (sample_t)(sum > max ? max : sum < min ? min : sum);       \
+        }                                                                      \
+      }                                                                        \
+      out += channels;                                                         \
+      position += step;                                                        \
+    }                                                                          \
+    r->position = position;                                                    \
+    return i;                                                                  \
+  }
+
+// Q14 taps of 16 bit samples sum to well inside 32 bits, even with the
+// overshoot of the largest taps
+RESAMPLE_KERNEL(resample_s16, int16_t, int32_t, INT16_MIN, INT16_MAX)
+RESAMPLE_KERNEL(resample_s32, int32_t, int64_t, INT32_MIN, INT32_MAX)
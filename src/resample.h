@@ -0,0 +1,63 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Polyphase sample rate conversion of interleaved PCM, so every track can be
+// played at one output rate. Each output frame is a windowed sinc FIR of
+// `taps` input frames, with the coefficients for the frame's fractional
+// position interpolated from a table of RESAMPLE_PHASES phases in Q14, built
+// once for each cutoff and shared by every resampler using it. Upsampling
+// filters all cut off at the input's Nyquist frequency, so they share one
+// table per tap count; downsampling needs one per ratio.
+
+// Fractional positions the coefficient table is built for
+#define RESAMPLE_PHASE_BITS 8
+#define RESAMPLE_PHASES (1 << RESAMPLE_PHASE_BITS)
+
+// Longest filter, in input frames
+#define RESAMPLE_MAX_TAPS 32
+
+typedef struct resampler {
+  const int16_t *coeffs; // RESAMPLE_PHASES + 1 rows of taps coefficients
+  uint64_t step;         // input frames per output frame, 32.32 fixed point
+  uint64_t position;     // of the next output frame in the input, 32.32
+  uint16_t taps;
+  uint16_t channels;
+} resampler_t;
+
+// Set up a resampler from in_rate to out_rate with a filter of `taps` (an
+// even number up to RESAMPLE_MAX_TAPS) input frames. False if the filter
+// table cannot be allocated.
+bool resampler_init(resampler_t *r, uint32_t in_rate, uint32_t out_rate, int channels, int taps);
+
+// Release the resampler's filter table
+void resampler_free(resampler_t *r);
+
+// Start again from the first input frame
+static inline void resampler_reset(resampler_t *r) {
+  r->position = 0;
+}
+
+// Input frames the next `frames` output frames need, counted from the start
+// of the input, which holds the frames resampler_consume left unused
+static inline size_t resampler_input_needed(const resampler_t *r, size_t frames) {
+  if (frames == 0) {
+    return 0;
+  }
+  return (size_t)((r->position + (frames - 1) * r->step) >> 32) + r->taps;
+}
+
+// Drop the input frames no later output frame needs. Returns how many frames
+// from the start of the input the caller should discard.
+static inline size_t resampler_consume(resampler_t *r) {
+  size_t used = (size_t)(r->position >> 32);
+  r->position -= (uint64_t)used << 32;
+  return used;
+}
+
+// Resample up to out_frames frames from in_frames input frames. Returns the
+// frames written, fewer once the input runs out.
+int resample_s16(resampler_t *r, int16_t *out, int out_frames, const int16_t *in, size_t in_frames);
+int resample_s32(resampler_t *r, int32_t *out, int out_frames, const int32_t *in, size_t in_frames);
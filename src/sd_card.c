@@ -0,0 +1,132 @@
+#include "sd_card.h"
+
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "sdmmc_cmd.h"
+
+#include "file_managment.h"
+
+static const char* ourTaskName = "sd_card";
+
+// Raw sectors read at every clock, from the start of the card where the boot
+// sector and FAT give a varied pattern, and how often. A marginal clock tends
+// to fail only some transfers.
+#define PROBE_SECTORS 32
+#define PROBE_ROUNDS 4
+
+// Block size of the throughput test
+#define THROUGHPUT_BLOCK_SIZE 16384
+
+static const uint32_t probe_freqs_khz[] = SD_PROBE_FREQS_KHZ;
+
+// FNV-1a, so the reference read needs no second buffer
+static uint32_t hash_sectors(const uint8_t *data, size_t size) {
+  uint32_t hash = 2166136261u;
+  for (size_t i = 0; i < size; ++i) {
+    hash = (hash ^ data[i]) * 16777619u;
+  }
+  return hash;
+}
+
+static bool verified_read(sdmmc_card_t *card, uint8_t *buffer, uint32_t reference) {
+  for (int round = 0; round < PROBE_ROUNDS; ++round) {
+    esp_err_t err = sdmmc_read_sectors(card, buffer, 0, PROBE_SECTORS);
+
+    if (err != ESP_OK) {
+      ESP_LOGW(ourTaskName, "Read failed at %lu kHz (%s)", (unsigned long)card->real_freq_khz, esp_err_to_name(err));
+      return false;
+    }
+    if (hash_sectors(buffer, PROBE_SECTORS * 512) != reference) {
+      ESP_LOGW(ourTaskName, "Read back wrong data at %lu kHz", (unsigned long)card->real_freq_khz);
+      return false;
+    }
+  }
+  return true;
+}
+
+static esp_err_t set_clock(sdmmc_card_t *card, uint32_t freq_khz) {
+  esp_err_t err = card->host.set_card_clk(card->host.slot, freq_khz);
+  if (err != ESP_OK) {
+    return err;
+  }
+
+  int real_freq_khz = freq_khz;
+  if (card->host.get_real_freq != NULL) {
+    card->host.get_real_freq(card->host.slot, &real_freq_khz);
+  }
+  card->real_freq_khz = real_freq_khz;
+  card->max_freq_khz = freq_khz;
+  return ESP_OK;
+}
+
+uint32_t probe_card_clock(sdmmc_card_t *card) {
+  uint32_t kept = card->max_freq_khz;
+
+  if (card->host.set_card_clk == NULL) {
+    return kept;
+  }
+
+  uint8_t *buffer = (uint8_t *)malloc(PROBE_SECTORS * 512);
+  if (buffer == NULL) {
+    ESP_LOGE(ourTaskName, "No memory to probe the card clock");
+    return kept;
+  }
+
+  esp_err_t err = sdmmc_read_sectors(card, buffer, 0, PROBE_SECTORS);
+  if (err != ESP_OK) {
+    ESP_LOGE(ourTaskName, "Reference read failed (%s)", esp_err_to_name(err));
+    free(buffer);
+    return kept;
+  }
+  uint32_t reference = hash_sectors(buffer, PROBE_SECTORS * 512);
+
+  for (size_t i = 0; i < sizeof(probe_freqs_khz) / sizeof(probe_freqs_khz[0]); ++i) {
+    uint32_t freq_khz = probe_freqs_khz[i];
+    if (freq_khz <= kept) {
+      continue;
+    }
+
+    if (set_clock(card, freq_khz) != ESP_OK || !verified_read(card, buffer, reference)) {
+      set_clock(card, kept);
+      break;
+    }
+    kept = freq_khz;
+  }
+
+  free(buffer);
+  ESP_LOGI(ourTaskName, "Card clock %lu kHz (%d kHz real)", (unsigned long)kept, card->real_freq_khz);
+  return kept;
+}
+
+uint32_t card_read_throughput(const char *path, size_t max_bytes) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    return 0;
+  }
+
+  uint8_t *buffer = (uint8_t *)malloc(THROUGHPUT_BLOCK_SIZE);
+  if (buffer == NULL) {
+    close(fd);
+    return 0;
+  }
+
+  size_t total = 0;
+  int64_t start = esp_timer_get_time();
+  while (total < max_bytes) {
+    ssize_t got = read(fd, buffer, THROUGHPUT_BLOCK_SIZE);
+    if (got <= 0) {
+      break;
+    }
+    total += got;
+  }
+  int64_t elapsed = esp_timer_get_time() - start;
+
+  free(buffer);
+  close(fd);
+  return total == 0 ? 0 : (uint64_t)total * 1000000 / (elapsed > 0 ? elapsed : 1);
+}
@@ -0,0 +1,17 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "driver/sdspi_host.h"
+
+// Raise the card clock through SD_PROBE_FREQS_KHZ, checking each step with
+// repeated raw reads that must match a reference read at the mount clock. The
+// first clock that fails, by CRC error, timeout or mismatched data, ends the
+// probe and the card drops back to the last one that passed. Returns the clock
+// kept, in kHz.
+uint32_t probe_card_clock(sdmmc_card_t *card);
+
+// Sequential read speed through read() over the first max_bytes of a file, in
+// bytes per second. 0 if the file could not be read.
+uint32_t card_read_throughput(const char *path, size_t max_bytes);
@@ -0,0 +1,636 @@
+#include "sections.h"
+
+#include <stdlib.h>
+#include <sys/param.h>
+#include <string.h>
+
+#include "esp_attr.h"
+#include "esp_cpu.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "trace.h"
+
+static const char* ourTaskName = "sections";
+
+static section_source_t pool[SECTION_POOL_SIZE];
+static latency_histogram_t read_latency;
+static uint64_t staged_bytes;
+static convert_stats_t convert_stats;
+static resample_stats_t resample_stats;
+static gain_stats_t gain_stats;
+static int32_t master_volume = MASTER_VOLUME;
+
+// File samples waiting to be converted. Only the reader task reads sections,
+// so one buffer serves them all.
+static DMA_ATTR uint8_t convert_buffer[SECTION_CONVERT_BUFFER_SIZE];
+
+// The whole track is in memory, from the track cache or the mapped book
+// partition, and is read from there alone
+static inline bool in_memory(const section_source_t *source) {
+  return source->cached || source->mapped;
+}
+
+// Bytes of a head starting at a frame: up to SECTION_HEAD_SIZE of the frames
+// before the loop end
+static size_t head_bytes(const section_source_t *source, uint32_t first) {
+  size_t frame = source->file_bytes_in_frame;
+  size_t to_loop_end = (size_t)(source->loop_end - first) * frame;
+  size_t size = MIN(SECTION_HEAD_SIZE, to_loop_end);
+  size -= size % frame;
+#if ALIGNED_READS
+  // End the head on a sector boundary of the file, when a whole frame does,
+  // so card reads after it start aligned and whole sectors skip the staging.
+  // Compressed tracks are read a whole block at a time whatever the head.
+  size_t end = (source->data_start + first * frame + size) % TINYWAV_SECTOR_SIZE;
+  if (source->file.h.AudioFormat != TINYWAV_FORMAT_IMA_ADPCM && size < to_loop_end &&
+      size > end && end % frame == 0) {
+    size -= end;
+  }
+#endif
+  return size;
+}
+
+// Read size bytes of frames from a frame on into a head, setting *read to the
+// bytes read
+static bool read_head(section_source_t *source, uint32_t first, uint8_t *head, size_t size, size_t *read) {
+  if (!decoder_seek(&source->decoder, first)) {
+    return false;
+  }
+  int frames = decoder_read_frames(&source->decoder, head, size / source->file_bytes_in_frame);
+  if (frames <= 0) {
+    return false;
+  }
+  *read = (size_t)frames * source->file_bytes_in_frame;
+  return true;
+}
+
+static bool open_section(track_info_t *track, int position, section_source_t *source) {
+  memset(source, 0, sizeof(*source));
+  int page = track->page;
+
+  // A cached track opens from its header alone, without touching the card.
+  // A mapped one is never cached, being in memory already.
+  const uint8_t *mapping = track_mapping(track);
+  source->cache = mapping == NULL ? track_cache_get(track) : NULL;
+  if (source->cache != NULL) {
+    source->file = source->cache->header;
+  } else if (open_track(track, &source->file) != 0) {
+    return false;
+  }
+
+  TinyWav *file = &source->file;
+  if (file->numChannels != 1 && file->numChannels != 2) {
+    ESP_LOGE(ourTaskName, "Page %d: only mono or stereo audio is supported", page);
+    return false;
+  }
+
+  if (!convert_supported(file->sampFmt, I2S_SAMPLE_BITS)) {
+    ESP_LOGE(ourTaskName, "Page %d: %d bit samples of format %d cannot be played", page,
+             file->h.BitsPerSample, file->h.AudioFormat);
+    return false;
+  }
+
+  source->file_bytes_in_frame = tinywav_sample_size(file->sampFmt) * file->numChannels;
+  source->bytes_in_frame = I2S_SAMPLE_BITS / 8 * file->numChannels;
+  source->convert = convert_select(file->sampFmt, I2S_SAMPLE_BITS);
+  source->data_start = file->dataStart;
+
+  // The track plays up to the end of its loop and then from the loop's start
+  // on, for as long as the page is open
+  source->loop_start = file->loopEnd != 0 ? file->loopStart : 0;
+  source->loop_end = file->loopEnd != 0 ? file->loopEnd : (uint32_t)file->numFramesInHeader;
+  if (source->loop_end == 0) {
+    ESP_LOGE(ourTaskName, "Page %d: no audio", page);
+    return false;
+  }
+
+  if (source->cache != NULL) {
+    source->head = source->cache->data;
+    source->head_size = source->cache->size;
+    source->cached = true;
+  } else if (mapping != NULL) {
+    // Nothing to read ahead or cache: the track plays from the mapped address,
+    // which is only ever read
+    source->head = (uint8_t *)mapping;
+    source->head_size = (size_t)source->loop_end * source->file_bytes_in_frame;
+    source->mapped = true;
+  } else {
+    size_t head_size = head_bytes(source, 0);
+
+    // The head is read with the same aligned reads as the rest of the section,
+    // so it is DMA capable as well
+    source->head = (uint8_t *)heap_caps_malloc(head_size, MALLOC_CAP_DMA);
+    if (source->head == NULL) {
+      ESP_LOGE(ourTaskName, "Page %d: no memory for %u byte head", page, (unsigned)head_size);
+      return false;
+    }
+
+    // Packed tracks share the pack's descriptor, so they take aligned reads
+    // through a sector reader whatever the build
+    if (ALIGNED_READS || book_packed()) {
+      source->read_buffer = (uint8_t *)heap_caps_malloc(SECTION_READ_BUFFER_SIZE, MALLOC_CAP_DMA);
+      if (source->read_buffer == NULL ||
+          tinywav_set_read_buffer(file, source->read_buffer, SECTION_READ_BUFFER_SIZE) != 0) {
+        ESP_LOGE(ourTaskName, "Page %d: no memory for the read buffer", page);
+        return false;
+      }
+    }
+
+#if RAW_SECTOR_READS
+    if (map_track(track, &source->extent) && source->extent.runs == 1 && source->extent.sectors > 0) {
+      tinywav_set_sector_reader(file, read_track_sectors, &source->extent);
+    }
+#endif
+    if (book_packed() && file->sectorReader == NULL) {
+      tinywav_set_sector_reader(file, read_pack_sectors, NULL);
+    }
+
+    // The backend is picked from the header
+    if (!decoder_open(&source->decoder, file)) {
+      ESP_LOGE(ourTaskName, "Page %d: no decoder for format %d", page, file->h.AudioFormat);
+      return false;
+    }
+
+    if (!read_head(source, 0, source->head, head_size, &source->head_size)) {
+      ESP_LOGE(ourTaskName, "Page %d: could not read head", page);
+      return false;
+    }
+
+    // A loop starting later in the track has a head of its own, so the wrap
+    // never waits on the card either
+    if (source->loop_start > 0) {
+      size_t loop_head_size = head_bytes(source, source->loop_start);
+      source->loop_head = (uint8_t *)heap_caps_malloc(loop_head_size, MALLOC_CAP_DMA);
+      if (source->loop_head == NULL ||
+          !read_head(source, source->loop_start, source->loop_head, loop_head_size, &source->loop_head_size)) {
+        ESP_LOGE(ourTaskName, "Page %d: could not read the loop's head", page);
+        return false;
+      }
+    }
+
+    // A short track is copied into the cache, up to its loop end, as it plays
+    // through
+    source->cache = track_cache_start(track, file, (size_t)source->loop_end * source->file_bytes_in_frame);
+    if (source->cache != NULL) {
+      track_cache_fill(source->cache, 0, source->head, source->head_size);
+    }
+  }
+
+#if OUTPUT_SAMPLE_RATE
+  if (file->h.SampleRate != OUTPUT_SAMPLE_RATE) {
+    // Direct reads land in the input as they would in a block buffer
+    source->resample_input = (uint8_t *)heap_caps_malloc(SECTION_RESAMPLE_FRAMES * source->bytes_in_frame, MALLOC_CAP_DMA);
+    if (source->resample_input == NULL ||
+        !resampler_init(&source->resampler, file->h.SampleRate, OUTPUT_SAMPLE_RATE, file->numChannels, RESAMPLE_TAPS)) {
+      ESP_LOGE(ourTaskName, "Page %d: no memory to resample %lu Hz", page, (unsigned long)file->h.SampleRate);
+      heap_caps_free(source->resample_input);
+      source->resample_input = NULL;
+      return false;
+    }
+  }
+#endif
+
+  source->gain = gain_from_db(gain_normalize_db(file->loudness) + master_volume);
+  source->track = track;
+  source->position = position;
+  source->ready = true;
+  rewind_section(source);
+
+  ESP_LOGI(ourTaskName, "Page %d: %lu Hz%s, %d channels, %d bit%s, %u bytes buffered, %s, decoded by %s",
+           page, (unsigned long)file->h.SampleRate, source->resample_input != NULL ? " resampled" : "",
+           file->numChannels, file->h.BitsPerSample,
+           file->sampFmt == TW_FLOAT32 ? " float" : file->h.AudioFormat == TINYWAV_FORMAT_IMA_ADPCM ? " IMA ADPCM" : "",
+           (unsigned)source->head_size,
+           source->cached ? "from the track cache" : source->mapped ? "mapped from flash"
+           : file->sectorReader == read_track_sectors ? "raw reads"
+           : book_packed() ? "read from the book pack" : "read through FATFS",
+           source->cached ? "the cache" : source->mapped ? "nothing" : source->decoder.backend->name);
+  if (file->loudness != TINYWAV_LOUDNESS_UNKNOWN) {
+    ESP_LOGI(ourTaskName, "Page %d: loudness %s%d.%02d LUFS, gain %u/%d", page, file->loudness < 0 ? "-" : "",
+             abs(file->loudness) / 100, abs(file->loudness) % 100, (unsigned)source->gain, GAIN_UNITY);
+  }
+  if (file->loopEnd != 0) {
+    ESP_LOGI(ourTaskName, "Page %d: looping frames %lu to %lu of %ld", page, (unsigned long)source->loop_start,
+             (unsigned long)source->loop_end - 1, (long)file->numFramesInHeader);
+  }
+  return true;
+}
+
+// Also cleans up after open_section failed part way
+static void close_section(section_source_t *source) {
+  decoder_close(&source->decoder);
+  close_track(&source->file);
+  heap_caps_free(source->read_buffer);
+  if (!in_memory(source)) {
+    heap_caps_free(source->head);
+  }
+  heap_caps_free(source->loop_head);
+  if (source->resample_input != NULL) {
+    resampler_free(&source->resampler);
+    heap_caps_free(source->resample_input);
+  }
+  if (source->cache != NULL) {
+    track_cache_release(source->cache);
+  }
+  memset(source, 0, sizeof(*source));
+}
+
+// Once the cache holds the whole track the section plays from it, closing the
+// file and freeing its own heads
+static void play_from_cache(section_source_t *source) {
+  decoder_close(&source->decoder);
+  close_track(&source->file);
+  heap_caps_free(source->read_buffer);
+  heap_caps_free(source->head);
+  heap_caps_free(source->loop_head);
+  source->read_buffer = NULL;
+  source->loop_head = NULL;
+  source->head = source->cache->data;
+  source->head_size = source->cache->size;
+  source->cached = true;
+}
+
+static section_source_t *pooled_section(int position) {
+  for (int i = 0; i < SECTION_POOL_SIZE; ++i) {
+    if (pool[i].ready && pool[i].position == position) {
+      return &pool[i];
+    }
+  }
+  return NULL;
+}
+
+static section_source_t *open_position(int position, const section_source_t *in_use) {
+  track_info_t *track = track_at(position);
+  if (track == NULL) {
+    return NULL;
+  }
+
+  section_source_t *source = pooled_section(position);
+  if (source != NULL) {
+    return source;
+  }
+
+  // Reuse a free slot, or the one furthest from the section being played
+  int from = in_use != NULL ? in_use->position : position;
+  int furthest = -1;
+  for (int i = 0; i < SECTION_POOL_SIZE; ++i) {
+    if (!pool[i].ready) {
+      source = &pool[i];
+      break;
+    }
+    int distance = abs(pool[i].position - from);
+    if (&pool[i] != in_use && distance > furthest) {
+      furthest = distance;
+      source = &pool[i];
+    }
+  }
+  if (source == NULL) {
+    return NULL;
+  }
+
+  close_section(source);
+  if (!open_section(track, position, source)) {
+    close_section(source);
+    return NULL;
+  }
+  return source;
+}
+
+section_source_t *get_section(uint16_t page, const section_source_t *in_use) {
+  track_info_t *track = find_track(page);
+  if (track == NULL) {
+    ESP_LOGI(ourTaskName, "No track for page %u", page);
+    return NULL;
+  }
+  return open_position(track - track_at(0), in_use);
+}
+
+section_source_t *first_section(void) {
+  return open_position(0, NULL);
+}
+
+bool prefetch_section(const section_source_t *current) {
+  // Pages are mostly turned forwards, so the next page comes first
+  static const int offsets[] = {1, -1};
+  static const track_info_t *prefetched_for = NULL;
+  static int next_offset = 0;
+
+  if (current->track != prefetched_for) {
+    prefetched_for = current->track;
+    next_offset = 0;
+  }
+
+  // Each neighbour is tried once, so a track that fails to open is not
+  // retried between every block
+  while (next_offset < MIN(SECTION_POOL_SIZE - 1, 2)) {
+    int position = current->position + offsets[next_offset++];
+    if (track_at(position) == NULL || pooled_section(position) != NULL) {
+      continue;
+    }
+    open_position(position, current);
+    return true;
+  }
+  return false;
+}
+
+// Carry on reading from the first frame of the track or of its loop: from
+// the head for that frame, then the card after it
+static void play_from(section_source_t *source, uint32_t frame) {
+  if (source->cache != NULL && !source->cached && track_cache_complete(source->cache)) {
+    play_from_cache(source);
+  }
+
+  if (in_memory(source)) {
+    source->window = source->head + (size_t)frame * source->file_bytes_in_frame;
+    source->window_size = (size_t)(source->loop_end - frame) * source->file_bytes_in_frame;
+  } else if (frame == 0) {
+    source->window = source->head;
+    source->window_size = source->head_size;
+    decoder_seek(&source->decoder, source->head_size / source->file_bytes_in_frame);
+  } else {
+    source->window = source->loop_head;
+    source->window_size = source->loop_head_size;
+    decoder_seek(&source->decoder, frame + source->loop_head_size / source->file_bytes_in_frame);
+  }
+  source->window_pos = 0;
+}
+
+void rewind_section(section_source_t *source) {
+  play_from(source, 0);
+
+  if (source->resample_input != NULL) {
+    // Silence ahead of the first frame centres the first output frame's
+    // filter on it
+    resampler_reset(&source->resampler);
+    source->resample_start = 0;
+    source->resample_frames = RESAMPLE_TAPS / 2 - 1;
+    memset(source->resample_input, 0, source->resample_frames * source->bytes_in_frame);
+  }
+}
+
+static inline bool at_loop_end(const section_source_t *source) {
+  return source->window_pos >= source->window_size &&
+         (in_memory(source) || source->decoder.position >= source->loop_end);
+}
+
+// Read up to buffer_len bytes of the file's own samples, stopping at the loop
+// end
+static int IRAM_ATTR read_run(section_source_t *source, uint8_t *buffer, int buffer_len) {
+  int frames = 0;
+
+  if (source->window_pos < source->window_size) {
+    size_t from_head = MIN((size_t)buffer_len, source->window_size - source->window_pos);
+    memcpy(buffer, source->window + source->window_pos, from_head);
+    source->window_pos += from_head;
+    frames = from_head / source->file_bytes_in_frame;
+    buffer += from_head;
+    buffer_len -= from_head;
+    if (source->cached) {
+      track_cache_served(from_head);
+    }
+  }
+  if (in_memory(source)) {
+    return frames;
+  }
+
+#if ALIGNED_READS
+  // The heads end on a sector boundary, so a read running on past them keeps
+  // to whole sectors and the ones after it start aligned
+  if (frames > 0 && buffer_len >= TINYWAV_SECTOR_SIZE) {
+    buffer_len -= buffer_len % TINYWAV_SECTOR_SIZE;
+  } else if (frames > 0) {
+    return frames;
+  }
+#endif
+
+  uint32_t position = source->decoder.position;
+  int wanted = MIN((uint32_t)buffer_len / source->file_bytes_in_frame, source->loop_end - position);
+  if (wanted <= 0) {
+    return frames;
+  }
+
+  uint64_t staged_before = source->file.bytesStaged;
+  int64_t start = esp_timer_get_time();
+  uint32_t traced = trace_begin();
+  int file_frames = decoder_read_frames(&source->decoder, buffer, wanted);
+  trace_end(TRACE_READ, traced, file_frames > 0 ? file_frames : 0);
+  latency_record(&read_latency, esp_timer_get_time() - start);
+  staged_bytes += source->file.bytesStaged - staged_before;
+  if (file_frames < 0) {
+    return file_frames;
+  }
+  if (file_frames == 0) {
+    // The file holds fewer frames than its header says; loop where they end
+    if (position <= source->loop_start) {
+      return -1;
+    }
+    source->loop_end = position;
+  }
+  if (source->cache != NULL) {
+    track_cache_fill(source->cache, (size_t)position * source->file_bytes_in_frame, buffer,
+                     (size_t)file_frames * source->file_bytes_in_frame);
+  }
+  return frames + file_frames;
+}
+
+// Read up to buffer_len bytes of the file's own samples. A read reaching the
+// loop end carries on from the loop's start in the same buffer, so the loop
+// is spliced sample for sample without a short read.
+static int IRAM_ATTR read_file_frames(section_source_t *source, uint8_t *buffer, int buffer_len) {
+  size_t frame = source->file_bytes_in_frame;
+  int frames = 0;
+
+  while (true) {
+    int read = read_run(source, buffer + frames * frame, buffer_len - frames * frame);
+    if (read < 0) {
+      return frames > 0 ? frames : read;
+    }
+    frames += read;
+    if (!at_loop_end(source)) {
+      return frames;
+    }
+    play_from(source, source->loop_start);
+    if ((size_t)(frames + 1) * frame > (size_t)buffer_len) {
+      return frames;
+    }
+  }
+}
+
+// Point *samples at up to max_frames frames of a track held in memory, from
+// the loop's start again once the loop end is reached
+static int IRAM_ATTR window_frames(section_source_t *source, const uint8_t **samples, int max_frames) {
+  if (at_loop_end(source)) {
+    play_from(source, source->loop_start);
+  }
+  size_t frame = source->file_bytes_in_frame;
+  size_t size = MIN((size_t)max_frames, (source->window_size - source->window_pos) / frame) * frame;
+  *samples = source->window + source->window_pos;
+  source->window_pos += size;
+  if (source->cached) {
+    track_cache_served(size);
+  }
+  return size / frame;
+}
+
+// Read the file's samples into convert_buffer, a buffer at a time, and convert
+// them into the caller's buffer. A track held in memory is converted from
+// there without the copy.
+static int IRAM_ATTR read_converted(section_source_t *source, uint8_t *buffer, int buffer_len) {
+  int frames_wanted = buffer_len / source->bytes_in_frame;
+  int frames_per_read = SECTION_CONVERT_BUFFER_SIZE / source->file_bytes_in_frame;
+  int channels = source->file.numChannels;
+  int frames = 0;
+
+  while (frames < frames_wanted) {
+    int len = MIN(frames_wanted - frames, frames_per_read) * source->file_bytes_in_frame;
+    const uint8_t *samples = convert_buffer;
+    int read;
+    if (in_memory(source)) {
+      read = window_frames(source, &samples, len / source->file_bytes_in_frame);
+    } else {
+      read = read_file_frames(source, convert_buffer, len);
+    }
+    if (read <= 0) {
+      return frames > 0 ? frames : read;
+    }
+
+    uint32_t traced = trace_begin();
+    uint32_t start = esp_cpu_get_cycle_count();
+    source->convert(buffer + frames * source->bytes_in_frame, samples, read * channels);
+    convert_stats.cycles += esp_cpu_get_cycle_count() - start;
+    convert_stats.samples += read * channels;
+    trace_end(TRACE_CONVERT, traced, read * channels);
+
+    frames += read;
+    // A head ran out. In memory the next pass carries on over the loop.
+    if (!in_memory(source) && read * source->file_bytes_in_frame < len) {
+      break;
+    }
+  }
+  return frames;
+}
+
+// Read up to buffer_len bytes at I2S_SAMPLE_BITS, at the file's own rate
+static int IRAM_ATTR read_samples(section_source_t *source, uint8_t *buffer, int buffer_len) {
+  if (source->convert != NULL) {
+    return read_converted(source, buffer, buffer_len);
+  }
+  return read_file_frames(source, buffer, buffer_len);
+}
+
+// Resample the frames held for the resampler into the caller's buffer,
+// refilling them with as many frames as fit whenever they run out
+static int IRAM_ATTR read_resampled(section_source_t *source, uint8_t *buffer, int buffer_len) {
+  resampler_t *r = &source->resampler;
+  uint8_t *input = source->resample_input;
+  size_t frame = source->bytes_in_frame;
+  int frames_wanted = buffer_len / frame;
+  int frames = 0;
+
+  while (frames < frames_wanted) {
+    uint32_t traced = trace_begin();
+    uint32_t start = esp_cpu_get_cycle_count();
+#if I2S_SAMPLE_BITS == 16
+    int made = resample_s16(r, (int16_t *)(buffer + frames * frame), frames_wanted - frames,
+                            (const int16_t *)(input + source->resample_start * frame),
+                            source->resample_frames - source->resample_start);
+#else
+    int made = resample_s32(r, (int32_t *)(buffer + frames * frame), frames_wanted - frames,
+                            (const int32_t *)(input + source->resample_start * frame),
+                            source->resample_frames - source->resample_start);
+#endif
+    resample_stats.cycles += esp_cpu_get_cycle_count() - start;
+    resample_stats.frames += made;
+    trace_end(TRACE_RESAMPLE, traced, made);
+    frames += made;
+    source->resample_start += resampler_consume(r);
+    if (frames == frames_wanted) {
+      break;
+    }
+
+    // Keep the few frames the filter still needs and read behind them
+    size_t kept = source->resample_frames - source->resample_start;
+    memmove(input, input + source->resample_start * frame, kept * frame);
+    source->resample_start = 0;
+    source->resample_frames = kept;
+
+    size_t space = SECTION_RESAMPLE_FRAMES - kept;
+#if ALIGNED_READS
+    // Whole runs of the frames that fill the file's sectors, as size_buffers
+    // sizes the reads of sections played at their own rate
+    size_t file_frame = source->file_bytes_in_frame;
+    size_t sector_frames = TINYWAV_SECTOR_SIZE / MIN(file_frame & -file_frame, TINYWAV_SECTOR_SIZE);
+    if (space >= sector_frames) {
+      space -= space % sector_frames;
+    }
+#endif
+    int read = read_samples(source, input + kept * frame, space * frame);
+    if (read < 0) {
+      return frames > 0 ? frames : read;
+    }
+    if (read == 0) {
+      break;
+    }
+    source->resample_frames += read;
+  }
+  return frames;
+}
+
+int IRAM_ATTR read_section(section_source_t *source, uint8_t *buffer, int buffer_len) {
+  int frames;
+  if (source->resample_input != NULL) {
+    frames = read_resampled(source, buffer, buffer_len);
+  } else {
+    frames = read_samples(source, buffer, buffer_len);
+  }
+
+  if (frames > 0 && source->gain != GAIN_UNITY) {
+    size_t samples = (size_t)frames * source->file.numChannels;
+    uint32_t start = esp_cpu_get_cycle_count();
+#if I2S_SAMPLE_BITS == 16
+    gain_apply_s16((int16_t *)buffer, samples, source->gain);
+#else
+    gain_apply_s32((int32_t *)buffer, samples, source->gain);
+#endif
+    gain_stats.cycles += esp_cpu_get_cycle_count() - start;
+    gain_stats.samples += samples;
+  }
+  return frames;
+}
+
+latency_histogram_t *section_read_latency(void) {
+  return &read_latency;
+}
+
+uint64_t section_staged_bytes(void) {
+  return staged_bytes;
+}
+
+const convert_stats_t *section_convert_stats(void) {
+  return &convert_stats;
+}
+
+const resample_stats_t *section_resample_stats(void) {
+  return &resample_stats;
+}
+
+const gain_stats_t *section_gain_stats(void) {
+  return &gain_stats;
+}
+
+void sections_set_volume(int32_t db) {
+  master_volume = db;
+  for (int i = 0; i < SECTION_POOL_SIZE; ++i) {
+    if (pool[i].ready) {
+      pool[i].gain = gain_from_db(gain_normalize_db(pool[i].file.loudness) + db);
+    }
+  }
+}
+
+// Every section is converted to I2S_SAMPLE_BITS, and with OUTPUT_SAMPLE_RATE
+// resampled to it, so neither the file's sample format nor its rate matters
+bool sections_match(const section_source_t *a, const section_source_t *b) {
+  return section_sample_rate(a) == section_sample_rate(b) &&
+         a->file.numChannels == b->file.numChannels;
+}
@@ -0,0 +1,182 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "tinywav.h"
+#include "convert.h"
+#include "gain.h"
+#include "resample.h"
+#include "decoder.h"
+#include "file_managment.h"
+#include "latency.h"
+#include "track_cache.h"
+
+// Width of the samples sent to I2S, 16 or 32. Tracks in any other sample
+// format are converted to it as they are read (see convert.h), so tracks of
+// different formats share one channel configuration.
+#ifndef I2S_SAMPLE_BITS
+#define I2S_SAMPLE_BITS 16
+#endif
+
+// With OUTPUT_SAMPLE_RATE set every track is resampled to it as it is read
+// (see resample.h), so the I2S clock is programmed once at startup and pages
+// of any sample rate switch gaplessly. 0 plays every track at its own rate,
+// reprogramming the clock when a page change moves to another rate.
+// RESAMPLE_TAPS is the filter length, trading CPU time for quality; see
+// bench_resample for both.
+#ifndef OUTPUT_SAMPLE_RATE
+#define OUTPUT_SAMPLE_RATE 0
+#endif
+#ifndef RESAMPLE_TAPS
+#define RESAMPLE_TAPS 16
+#endif
+
+// Frames at I2S_SAMPLE_BITS a resampled section holds for the resampler
+#define SECTION_RESAMPLE_FRAMES 1024
+
+// File bytes converted at a time; six sectors hold a whole number of frames
+// of every format up to 32 bit stereo, 24 bit included
+#define SECTION_CONVERT_BUFFER_SIZE (6 * TINYWAV_SECTOR_SIZE)
+
+// Bytes of audio data kept in memory for every section, so a page change can
+// start the new section without waiting on the card
+#define SECTION_HEAD_SIZE 4096
+
+// With ALIGNED_READS every section reads the card in whole, sector aligned
+// runs (see tinywav_set_read_buffer), staging the partial sectors at either
+// end of a read in its own SECTION_READ_BUFFER_SIZE buffer. Reads of whole
+// sectors land in the caller's buffer without passing through FatFs.
+#ifndef ALIGNED_READS
+#define ALIGNED_READS 1
+#endif
+#define SECTION_READ_BUFFER_SIZE (4 * TINYWAV_SECTOR_SIZE)
+
+// With RAW_SECTOR_READS a section whose track sits in one contiguous run of
+// clusters reads its whole sectors straight from the card by sector number
+// (see map_track), skipping VFS and FatFs. Fragmented tracks read through
+// FatFs as before. Needs ALIGNED_READS.
+#ifndef RAW_SECTOR_READS
+#define RAW_SECTOR_READS ALIGNED_READS
+#endif
+#if RAW_SECTOR_READS && !ALIGNED_READS
+#error "RAW_SECTOR_READS needs ALIGNED_READS"
+#endif
+
+typedef struct section_source {
+  TinyWav file;
+  decoder_t decoder;        // reads the file's frames, see decoder.h
+  track_info_t *track;      // track playing from this source
+  int position;             // the track's position in page order
+  long data_start;          // file offset of the first audio byte
+  uint16_t bytes_in_frame;  // as read_section returns them, at I2S_SAMPLE_BITS
+  uint16_t file_bytes_in_frame;
+  convert_fn_t convert;     // NULL if the file is stored at I2S_SAMPLE_BITS
+  resampler_t resampler;
+  uint8_t *resample_input;  // frames waiting for the resampler, NULL when
+                            // the track plays at its own rate
+  uint16_t resample_start;  // first of them the resampler still needs
+  uint16_t resample_frames;
+  uint32_t loop_start;      // frames played again and again once the track
+  uint32_t loop_end;        // has played up to loop_end, the whole track
+                            // without a smpl loop
+  uint8_t *head;            // first head_size bytes of audio data, as stored
+  size_t head_size;
+  uint8_t *loop_head;       // the bytes from loop_start on, NULL when the
+  size_t loop_head_size;    // loop starts the track or the cache holds it
+  const uint8_t *window;    // head being read, ahead of the card
+  size_t window_size;
+  size_t window_pos;        // bytes of it already read
+  uint8_t *read_buffer;     // staging for aligned reads, NULL without them
+  track_extent_t extent;    // where the track sits on the card
+  track_cache_entry_t *cache; // the track's cache entry, NULL if not cached
+  bool cached;              // head is the whole track, held by the cache;
+                            // file and decoder are closed
+  bool mapped;              // head is the whole track in the mapped book
+                            // partition; there is no file or decoder
+  uint16_t gain;            // GAIN_SHIFT fixed point, bringing the track to
+                            // LOUDNESS_TARGET at the master volume
+  bool ready;
+} section_source_t;
+
+// Only SECTION_POOL_SIZE sections are open at once. Opening another closes
+// the pooled section furthest, in page order, from the one in use.
+
+// Section for a page, opening it if it is not pooled. Never closes in_use.
+// Returns NULL if the book has no playable track for the page.
+section_source_t *get_section(uint16_t page, const section_source_t *in_use);
+
+// Section for the first page of the book
+section_source_t *first_section(void);
+
+// Open the next page, then the previous one, around current if they are not
+// pooled. Opens at most one per call and returns false once there is nothing
+// left to open, so the reader can call it between blocks.
+bool prefetch_section(const section_source_t *current);
+
+// Start reading the section from its first sample again
+void rewind_section(section_source_t *source);
+
+// Read up to buffer_len bytes of audio at I2S_SAMPLE_BITS and the section's
+// sample rate, from the head first and then the card. Sections loop by
+// themselves: at the end of the track, or of its smpl chunk's loop, the read
+// carries on from the loop's start in the same buffer, reading it from a
+// head of its own, so the wrap neither clicks nor waits on the card.
+// Conversion and resampling run across the wrap as across any other frame.
+// The section's gain is applied last.
+// Returns the number of frames read, or a negative value on error. With
+// ALIGNED_READS the read that finishes a head may come up short.
+int read_section(section_source_t *source, uint8_t *buffer, int buffer_len);
+
+// Time taken by every card read of read_section, in microseconds
+latency_histogram_t *section_read_latency(void);
+
+// Bytes read_section has copied out of the sections' read buffers
+uint64_t section_staged_bytes(void);
+
+typedef struct convert_stats {
+  uint64_t samples; // converted to I2S_SAMPLE_BITS
+  uint64_t cycles;  // spent in the conversion kernels
+} convert_stats_t;
+
+// Samples read_section has converted and the CPU cycles it took
+const convert_stats_t *section_convert_stats(void);
+
+typedef struct resample_stats {
+  uint64_t frames; // output frames resampled to OUTPUT_SAMPLE_RATE
+  uint64_t cycles; // spent in the resampler
+} resample_stats_t;
+
+// Frames read_section has resampled and the CPU cycles it took
+const resample_stats_t *section_resample_stats(void);
+
+typedef struct gain_stats {
+  uint64_t samples; // scaled by a gain other than unity
+  uint64_t cycles;  // spent in the gain kernels
+} gain_stats_t;
+
+// Samples read_section has scaled and the CPU cycles it took
+const gain_stats_t *section_gain_stats(void);
+
+// Set the master volume, in hundredths of a dB, for every section. Sections
+// already playing change gain from their next read.
+void sections_set_volume(int32_t db);
+
+// Frames per second the section plays at, as read_section returns them
+static inline uint32_t section_sample_rate(const section_source_t *source) {
+#if OUTPUT_SAMPLE_RATE
+  (void)source;
+  return OUTPUT_SAMPLE_RATE;
+#else
+  return source->file.h.SampleRate;
+#endif
+}
+
+// Bytes per second the section plays at, as read_section returns them
+static inline uint32_t section_byte_rate(const section_source_t *source) {
+  return section_sample_rate(source) * source->bytes_in_frame;
+}
+
+// True when both sections can play through the same I2S configuration
+bool sections_match(const section_source_t *a, const section_source_t *b);
@@ -0,0 +1,177 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+// Lock-free queue of fixed size slots between one producer and one consumer,
+// which may run on different cores. The producer fills the slot
+// spsc_write_slot returns in place and publishes it with spsc_push; the
+// consumer uses spsc_read_slot's slot in place and frees it with spsc_pop.
+// Each count is written by one side only, and only after the slot it
+// publishes or frees, so neither side ever waits on the other.
+
+typedef struct spsc_queue {
+  uint8_t *slots;
+  uint32_t slot_size;
+  uint32_t count;  // slots
+  uint32_t pushed; // slots ever pushed, written by the producer only
+  uint32_t popped; // slots ever popped, written by the consumer only
+} spsc_queue_t;
+
+static inline void spsc_init(spsc_queue_t *q, void *slots, uint32_t slot_size, uint32_t count) {
+  q->slots = (uint8_t *)slots;
+  q->slot_size = slot_size;
+  q->count = count;
+  q->pushed = 0;
+  q->popped = 0;
+}
+
+// Slots pushed and not yet popped
+static inline uint32_t spsc_used(const spsc_queue_t *q) {
+  return __atomic_load_n(&q->pushed, __ATOMIC_ACQUIRE) - __atomic_load_n(&q->popped, __ATOMIC_ACQUIRE);
+}
+
+// Producer: the next free slot, or NULL while the queue is full
+static inline void *spsc_write_slot(spsc_queue_t *q) {
+  uint32_t pushed = q->pushed;
+  if (pushed - __atomic_load_n(&q->popped, __ATOMIC_ACQUIRE) == q->count) {
+    return NULL;
+  }
+  return q->slots + (pushed % q->count) * q->slot_size;
+}
+
+// Producer: publish the slot spsc_write_slot returned
+static inline void spsc_push(spsc_queue_t *q) {
+  __atomic_store_n(&q->pushed, q->pushed + 1, __ATOMIC_RELEASE);
+}
+
+// Consumer: the oldest pushed slot, or NULL while the queue is empty
+static inline void *spsc_read_slot(spsc_queue_t *q) {
+  uint32_t popped = q->popped;
+  if (__atomic_load_n(&q->pushed, __ATOMIC_ACQUIRE) == popped) {
+    return NULL;
+  }
+  return q->slots + (popped % q->count) * q->slot_size;
+}
+
+// Consumer: free the slot spsc_read_slot returned
+static inline void spsc_pop(spsc_queue_t *q) {
+  __atomic_store_n(&q->popped, q->popped + 1, __ATOMIC_RELEASE);
+}
+
+// Lock-free byte FIFO between one producer and one consumer, for streams such
+// as audio where the consumer takes whatever length it needs. The capacity is
+// a power of two, so positions are free running byte counts masked into the
+// buffer. The consumer sees the oldest bytes as one span, or two where they
+// wrap around the end of the buffer, so it can always take everything queued
+// in one go.
+//
+// The producer may also drain the FIFO, taking back what the consumer has not
+// read yet. The consumer therefore frees bytes with a compare and swap, which
+// fails if a drain took them first; it then peeks again.
+
+typedef struct spsc_span {
+  const uint8_t *data;
+  uint32_t len;
+} spsc_span_t;
+
+typedef struct spsc_fifo {
+  uint8_t *data;
+  uint32_t mask;    // capacity - 1
+  uint32_t written; // bytes ever written, written by the producer only
+  uint32_t read;    // bytes ever read or drained
+} spsc_fifo_t;
+
+// What spsc_fifo_peek returned
+typedef struct spsc_fifo_spans {
+  spsc_span_t span[2];
+  uint32_t start; // position of the first byte
+} spsc_fifo_spans_t;
+
+// Smallest power of two capacity that holds size bytes
+static inline uint32_t spsc_fifo_capacity(uint32_t size) {
+  uint32_t capacity = 1;
+  while (capacity < size) {
+    capacity <<= 1;
+  }
+  return capacity;
+}
+
+// False unless capacity is a power of two
+static inline bool spsc_fifo_init(spsc_fifo_t *f, void *data, uint32_t capacity) {
+  if (capacity == 0 || (capacity & (capacity - 1)) != 0) {
+    return false;
+  }
+  f->data = (uint8_t *)data;
+  f->mask = capacity - 1;
+  f->written = 0;
+  f->read = 0;
+  return true;
+}
+
+// Bytes written and not yet read
+static inline uint32_t spsc_fifo_used(const spsc_fifo_t *f) {
+  return __atomic_load_n(&f->written, __ATOMIC_ACQUIRE) - __atomic_load_n(&f->read, __ATOMIC_ACQUIRE);
+}
+
+// Copy len bytes from the FIFO, starting at position pos, into out
+static inline void spsc_fifo_copy_out(const spsc_fifo_t *f, uint32_t pos, uint8_t *out, uint32_t len) {
+  uint32_t offset = pos & f->mask;
+  uint32_t first = len < f->mask + 1 - offset ? len : f->mask + 1 - offset;
+  memcpy(out, f->data + offset, first);
+  memcpy(out + first, f->data, len - first);
+}
+
+// Producer: copy in all len bytes, or none if they do not fit
+static inline bool spsc_fifo_write(spsc_fifo_t *f, const void *data, uint32_t len) {
+  uint32_t written = f->written;
+  if (f->mask + 1 - (written - __atomic_load_n(&f->read, __ATOMIC_ACQUIRE)) < len) {
+    return false;
+  }
+  uint32_t offset = written & f->mask;
+  uint32_t first = len < f->mask + 1 - offset ? len : f->mask + 1 - offset;
+  memcpy(f->data + offset, data, first);
+  memcpy(f->data, (const uint8_t *)data + first, len - first);
+  __atomic_store_n(&f->written, written + len, __ATOMIC_RELEASE);
+  return true;
+}
+
+// Producer: empty the FIFO, first copying up to max of the bytes the consumer
+// had not read into out. Bytes the consumer reads meanwhile are not copied.
+// Returns the bytes copied.
+static inline uint32_t spsc_fifo_drain(spsc_fifo_t *f, void *out, uint32_t max) {
+  uint32_t written = f->written;
+  uint32_t read = __atomic_load_n(&f->read, __ATOMIC_ACQUIRE);
+  while (true) {
+    uint32_t len = written - read < max ? written - read : max;
+    spsc_fifo_copy_out(f, read, (uint8_t *)out, len);
+    if (__atomic_compare_exchange_n(&f->read, &read, written, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+      return len;
+    }
+  }
+}
+
+// Consumer: up to max of the oldest bytes, in place. Returns their length.
+static inline uint32_t spsc_fifo_peek(const spsc_fifo_t *f, spsc_fifo_spans_t *spans, uint32_t max) {
+  uint32_t read = __atomic_load_n(&f->read, __ATOMIC_ACQUIRE);
+  uint32_t used = __atomic_load_n(&f->written, __ATOMIC_ACQUIRE) - read;
+  uint32_t len = used < max ? used : max;
+  uint32_t offset = read & f->mask;
+  uint32_t first = len < f->mask + 1 - offset ? len : f->mask + 1 - offset;
+  spans->start = read;
+  spans->span[0].data = f->data + offset;
+  spans->span[0].len = first;
+  spans->span[1].data = f->data;
+  spans->span[1].len = len - first;
+  return len;
+}
+
+// Consumer: free the first len bytes of the spans spsc_fifo_peek returned.
+// False if the producer drained them first; what was copied out of the spans
+// is then stale and the consumer peeks again.
+static inline bool spsc_fifo_consume(spsc_fifo_t *f, const spsc_fifo_spans_t *spans, uint32_t len) {
+  uint32_t expected = spans->start;
+  return __atomic_compare_exchange_n(&f->read, &expected, spans->start + len, false, __ATOMIC_ACQ_REL,
+                                     __ATOMIC_ACQUIRE);
+}
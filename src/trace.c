@@ -0,0 +1,205 @@
+#include "trace.h"
+
+#if TRACE_ENABLE
+
+#include <string.h>
+
+#include "driver/uart.h"
+#include "esp_attr.h"
+#include "esp_log.h"
+#include "esp_rom_sys.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "sdkconfig.h"
+
+static const char* ourTaskName = "trace";
+
+#ifdef CONFIG_ESP_CONSOLE_UART_NUM
+#define TRACE_UART CONFIG_ESP_CONSOLE_UART_NUM
+#else
+#define TRACE_UART UART_NUM_0
+#endif
+
+#define TRACE_LANE_READER 1
+#define TRACE_LANE_ISR 2
+
+// seq is the record's number plus one once it is written, 0 while it is
+typedef struct trace_record {
+  uint32_t seq;
+  uint32_t start;
+  uint32_t cycles;
+  uint16_t event;
+  uint16_t arg;
+} trace_record_t;
+
+static const struct {
+  const char *name;
+  uint8_t lane;
+} event_info[TRACE_EVENTS] = {
+    [TRACE_READ] = {"read", TRACE_LANE_READER},
+    [TRACE_CONVERT] = {"convert", TRACE_LANE_READER},
+    [TRACE_RESAMPLE] = {"resample", TRACE_LANE_READER},
+    [TRACE_ENQUEUE] = {"enqueue", TRACE_LANE_READER},
+    [TRACE_ISR_REFILL] = {"isr refill", TRACE_LANE_ISR},
+    [TRACE_PAGE_SWITCH] = {"page switch", TRACE_LANE_READER},
+    [TRACE_UNDERRUN] = {"underrun", TRACE_LANE_ISR},
+};
+
+_Static_assert((TRACE_RECORDS & (TRACE_RECORDS - 1)) == 0, "TRACE_RECORDS must be a power of two");
+
+static trace_record_t records[TRACE_RECORDS];
+static trace_counters_t counters;
+static volatile bool paused = false;
+
+void IRAM_ATTR trace_end(trace_event_t event, uint32_t start, uint32_t arg) {
+  uint32_t cycles = event == TRACE_UNDERRUN ? 0 : TRACE_CLOCK() - start;
+
+  trace_counter_t *counter = &counters.events[event];
+  counter->count++;
+  counter->cycles += cycles;
+  if (cycles > counter->max_cycles) {
+    counter->max_cycles = cycles;
+  }
+  if (paused) {
+    return;
+  }
+
+  // Claim a record; a dump skips it until its seq is set
+  uint32_t seq = __atomic_fetch_add(&counters.recorded, 1, __ATOMIC_RELAXED);
+  trace_record_t *record = &records[seq & (TRACE_RECORDS - 1)];
+  __atomic_store_n(&record->seq, 0, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  record->start = start;
+  record->cycles = cycles;
+  record->event = event;
+  record->arg = arg > UINT16_MAX ? UINT16_MAX : arg;
+  __atomic_store_n(&record->seq, seq + 1, __ATOMIC_RELEASE);
+}
+
+// Copy out record seq, false if it was overwritten or is being written
+static bool read_record(uint32_t seq, trace_record_t *out) {
+  const trace_record_t *record = &records[seq & (TRACE_RECORDS - 1)];
+  if (__atomic_load_n(&record->seq, __ATOMIC_ACQUIRE) != seq + 1) {
+    return false;
+  }
+  memcpy(out, record, sizeof(*out));
+  __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  return __atomic_load_n(&record->seq, __ATOMIC_RELAXED) == seq + 1;
+}
+
+// The records' start times, unwrapped from 32 bits. The cycle counter wraps
+// every 17 s at 240 MHz, far longer than between two records.
+typedef struct unwrap {
+  bool started;
+  uint32_t last;
+  int64_t time;
+} unwrap_t;
+
+static int64_t unwrap_next(unwrap_t *u, uint32_t start) {
+  if (u->started) {
+    u->time += (int32_t)(start - u->last);
+  }
+  u->started = true;
+  u->last = start;
+  return u->time;
+}
+
+void trace_dump(FILE *out) {
+  paused = true;
+  uint32_t end = __atomic_load_n(&counters.recorded, __ATOMIC_ACQUIRE);
+  uint32_t first = end > TRACE_RECORDS ? end - TRACE_RECORDS : 0;
+  double ticks_per_us = esp_rom_get_cpu_ticks_per_us();
+
+  // A record finishing later may have started first, so timestamps count
+  // from the earliest start
+  unwrap_t unwrap = {0};
+  int64_t earliest = 0;
+  trace_record_t record;
+  for (uint32_t seq = first; seq != end; ++seq) {
+    if (read_record(seq, &record)) {
+      int64_t time = unwrap_next(&unwrap, record.start);
+      earliest = time < earliest ? time : earliest;
+    }
+  }
+
+  fprintf(out, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+  fprintf(out, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"MusicBook\"}},\n");
+  fprintf(out, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"reader task\"}},\n",
+          TRACE_LANE_READER);
+  fprintf(out, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"i2s isr\"}}",
+          TRACE_LANE_ISR);
+
+  unwrap = (unwrap_t){0};
+  for (uint32_t seq = first; seq != end; ++seq) {
+    if (!read_record(seq, &record) || record.event >= TRACE_EVENTS) {
+      continue;
+    }
+    double ts = (unwrap_next(&unwrap, record.start) - earliest) / ticks_per_us;
+    if (record.event == TRACE_UNDERRUN) {
+      fprintf(out, ",\n{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%.3f,\"pid\":1,\"tid\":%d}",
+              event_info[record.event].name, ts, event_info[record.event].lane);
+    } else {
+      fprintf(out, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%d,\"args\":{\"n\":%u}}",
+              event_info[record.event].name, ts, record.cycles / ticks_per_us,
+              event_info[record.event].lane, (unsigned)record.arg);
+    }
+  }
+
+  fprintf(out, "\n],\"otherData\":{\"records\":%lu", (unsigned long)counters.recorded);
+  for (int e = 0; e < TRACE_EVENTS; ++e) {
+    const trace_counter_t *counter = &counters.events[e];
+    fprintf(out, ",\"%s\":{\"count\":%lu,\"max_us\":%.3f,\"total_us\":%.0f}", event_info[e].name,
+            (unsigned long)counter->count, counter->max_cycles / ticks_per_us, counter->cycles / ticks_per_us);
+  }
+  fprintf(out, "}}\n");
+  fflush(out);
+  paused = false;
+}
+
+void trace_log_counters(void) {
+  uint32_t ticks_per_us = esp_rom_get_cpu_ticks_per_us();
+  for (int e = 0; e < TRACE_EVENTS; ++e) {
+    const trace_counter_t *counter = &counters.events[e];
+    if (e == TRACE_UNDERRUN) {
+      ESP_LOGI(ourTaskName, "%s: %lu", event_info[e].name, (unsigned long)counter->count);
+      continue;
+    }
+    ESP_LOGI(ourTaskName, "%s: %lu, avg %lu us, max %lu us", event_info[e].name, (unsigned long)counter->count,
+             (unsigned long)(counter->count > 0 ? counter->cycles / counter->count / ticks_per_us : 0),
+             (unsigned long)(counter->max_cycles / ticks_per_us));
+  }
+}
+
+const trace_counters_t *trace_counters(void) {
+  return &counters;
+}
+
+static void serve_console(void *arg) {
+  while (true) {
+    uint8_t command;
+    if (uart_read_bytes(TRACE_UART, &command, 1, portMAX_DELAY) != 1) {
+      continue;
+    }
+    if (command == 't') {
+      trace_dump(stdout);
+    } else if (command == 'c') {
+      trace_log_counters();
+    }
+  }
+}
+
+bool trace_start_console(void) {
+  esp_err_t err = uart_driver_install(TRACE_UART, 256, 0, 0, NULL, 0);
+  if (err != ESP_OK) {
+    ESP_LOGE(ourTaskName, "Could not install the console UART driver (%s)", esp_err_to_name(err));
+    return false;
+  }
+  // Core 0 and the lowest priority, so a dump never holds up playback
+  if (xTaskCreatePinnedToCore(serve_console, "trace", 4096, NULL, 1, NULL, 0) != pdPASS) {
+    ESP_LOGE(ourTaskName, "Could not start the trace console task");
+    return false;
+  }
+  return true;
+}
+
+#endif
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "esp_cpu.h"
+
+// Timeline of the playback hot path: each stage records its start and length
+// in CPU cycles (CCOUNT) into a fixed ring of TRACE_RECORDS records, without
+// locks, from the reader task and the I2S ISR alike. Aggregate counters per
+// stage survive the ring wrapping. A 't' on the console UART dumps the ring
+// as Chrome trace JSON (chrome://tracing, ui.perfetto.dev), a 'c' the
+// counters. Off by default; with TRACE_ENABLE 0 every call compiles away.
+#ifndef TRACE_ENABLE
+#define TRACE_ENABLE 0
+#endif
+#ifndef TRACE_RECORDS
+#define TRACE_RECORDS 2048 // a power of two, 16 bytes each
+#endif
+
+// The reader task and the I2S interrupt both run on core 1, so their records
+// share its cycle counter. The host build, whose cycle counter is per thread,
+// sets this to the simulated clock.
+#ifndef TRACE_CLOCK
+#define TRACE_CLOCK() esp_cpu_get_cycle_count()
+#endif
+
+typedef enum trace_event {
+  TRACE_READ,        // frames read from the card and decoded
+  TRACE_CONVERT,     // samples converted to I2S_SAMPLE_BITS
+  TRACE_RESAMPLE,    // frames resampled to OUTPUT_SAMPLE_RATE
+  TRACE_ENQUEUE,     // bytes queued for output
+  TRACE_ISR_REFILL,  // bytes copied into a DMA buffer by the ISR
+  TRACE_PAGE_SWITCH, // the page turned to, until its first block is queued
+  TRACE_UNDERRUN,    // a DMA buffer played short, an instant
+  TRACE_EVENTS
+} trace_event_t;
+
+typedef struct trace_counter {
+  uint32_t count;
+  uint32_t max_cycles;
+  uint64_t cycles;
+} trace_counter_t;
+
+typedef struct trace_counters {
+  trace_counter_t events[TRACE_EVENTS];
+  uint32_t recorded; // records written since boot, the ring holds the last TRACE_RECORDS
+} trace_counters_t;
+
+#if TRACE_ENABLE
+
+// Timestamp for the start of a stage
+static inline uint32_t trace_begin(void) {
+  return TRACE_CLOCK();
+}
+
+// Record a stage that started at `start`. arg is the stage's bytes, frames,
+// samples or page. Each event is recorded from one task or ISR only, which
+// keeps its counter.
+void trace_end(trace_event_t event, uint32_t start, uint32_t arg);
+
+static inline void trace_instant(trace_event_t event, uint32_t arg) {
+  trace_end(event, TRACE_CLOCK(), arg);
+}
+
+// Serve dumps to the console UART from a task on core 0
+bool trace_start_console(void);
+
+// Write the ring as Chrome trace JSON, the counters in its otherData.
+// Recording pauses meanwhile.
+void trace_dump(FILE *out);
+void trace_log_counters(void);
+const trace_counters_t *trace_counters(void);
+
+#else
+
+static inline uint32_t trace_begin(void) {
+  return 0;
+}
+static inline void trace_end(trace_event_t event, uint32_t start, uint32_t arg) {
+}
+static inline void trace_instant(trace_event_t event, uint32_t arg) {
+}
+static inline bool trace_start_console(void) {
+  return true;
+}
+static inline void trace_dump(FILE *out) {
+}
+static inline void trace_log_counters(void) {
+}
+
+#endif
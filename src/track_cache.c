@@ -0,0 +1,142 @@
+#include "track_cache.h"
+
+#include <string.h>
+#include <sys/param.h>
+
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+
+static const char* ourTaskName = "track_cache";
+
+#if CONFIG_SPIRAM
+#define TRACK_CACHE_CAPS MALLOC_CAP_SPIRAM
+#else
+#define TRACK_CACHE_CAPS (MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT)
+#endif
+
+static track_cache_entry_t entries[TRACK_CACHE_ENTRIES];
+static track_cache_stats_t stats;
+static uint32_t use_clock;
+
+static void free_entry(track_cache_entry_t *entry) {
+  heap_caps_free(entry->data);
+  stats.bytes_used -= entry->size;
+  memset(entry, 0, sizeof(*entry));
+}
+
+// Least recently used entry no section holds, NULL if every one is held
+static track_cache_entry_t *oldest_unused(void) {
+  track_cache_entry_t *oldest = NULL;
+  for (int i = 0; i < TRACK_CACHE_ENTRIES; ++i) {
+    track_cache_entry_t *entry = &entries[i];
+    if (entry->data != NULL && entry->users == 0 &&
+        (oldest == NULL || (int32_t)(entry->last_used - oldest->last_used) < 0)) {
+      oldest = entry;
+    }
+  }
+  return oldest;
+}
+
+static track_cache_entry_t *find_entry(const track_info_t *track) {
+  for (int i = 0; i < TRACK_CACHE_ENTRIES; ++i) {
+    if (entries[i].data != NULL && entries[i].track == track) {
+      return &entries[i];
+    }
+  }
+  return NULL;
+}
+
+track_cache_entry_t *track_cache_get(const track_info_t *track) {
+  track_cache_entry_t *entry = find_entry(track);
+  if (entry == NULL || !track_cache_complete(entry)) {
+    stats.misses++;
+    return NULL;
+  }
+  stats.hits++;
+  entry->users++;
+  entry->last_used = ++use_clock;
+  return entry;
+}
+
+track_cache_entry_t *track_cache_start(const track_info_t *track, const TinyWav *file, size_t size) {
+  if (size == 0 || size > TRACK_CACHE_MAX_TRACK || find_entry(track) != NULL) {
+    return NULL;
+  }
+
+  // Make room in the budget and a free slot
+  track_cache_entry_t *slot = NULL;
+  while (true) {
+    slot = NULL;
+    for (int i = 0; i < TRACK_CACHE_ENTRIES && slot == NULL; ++i) {
+      if (entries[i].data == NULL) {
+        slot = &entries[i];
+      }
+    }
+    if (slot != NULL && stats.bytes_used + size <= TRACK_CACHE_SIZE) {
+      break;
+    }
+    track_cache_entry_t *victim = oldest_unused();
+    if (victim == NULL) {
+      return NULL;
+    }
+    ESP_LOGI(ourTaskName, "Evicting %s (%u bytes)", track_name(victim->track), (unsigned)victim->size);
+    free_entry(victim);
+    stats.evictions++;
+  }
+
+  uint8_t *data = (uint8_t *)heap_caps_malloc(size, TRACK_CACHE_CAPS);
+  if (data == NULL) {
+    ESP_LOGE(ourTaskName, "No memory to cache %s (%u bytes)", track_name(track), (unsigned)size);
+    return NULL;
+  }
+
+  slot->track = track;
+  slot->data = data;
+  slot->size = size;
+  slot->filled = 0;
+  slot->users = 1;
+  slot->last_used = ++use_clock;
+
+  // Kept closed: only the header is needed to open sections from here
+  slot->header = *file;
+  slot->header.f = NULL;
+  slot->header.adpcmBuf = NULL;
+  slot->header.readBuf = NULL;
+  slot->header.sectorReader = NULL;
+  slot->header.sectorReaderContext = NULL;
+
+  stats.bytes_used += size;
+  return slot;
+}
+
+void track_cache_fill(track_cache_entry_t *entry, size_t offset, const void *data, size_t len) {
+  if (offset > entry->filled || offset + len <= entry->filled) {
+    return;
+  }
+  size_t skip = entry->filled - offset;
+  size_t n = MIN(len - skip, entry->size - entry->filled);
+  memcpy(entry->data + entry->filled, (const uint8_t *)data + skip, n);
+  entry->filled += n;
+
+  if (track_cache_complete(entry)) {
+    ESP_LOGI(ourTaskName, "Cached %s (%u bytes, %u of %u in use)", track_name(entry->track),
+             (unsigned)entry->size, (unsigned)stats.bytes_used, (unsigned)TRACK_CACHE_SIZE);
+  }
+}
+
+void track_cache_release(track_cache_entry_t *entry) {
+  if (entry->users > 0) {
+    entry->users--;
+  }
+  if (entry->users == 0 && !track_cache_complete(entry)) {
+    free_entry(entry);
+  }
+}
+
+void track_cache_served(size_t bytes) {
+  stats.bytes_served += bytes;
+}
+
+const track_cache_stats_t *track_cache_stats(void) {
+  return &stats;
+}
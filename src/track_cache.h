@@ -0,0 +1,72 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "tinywav.h"
+#include "file_managment.h"
+#include "sdkconfig.h"
+
+// Whole tracks kept in memory, so looping a short track and turning back to
+// its page never touch the card. A track whose frames up to its loop end, as
+// read from the file (decoded, before conversion and resampling), take at
+// most TRACK_CACHE_MAX_TRACK bytes is copied into the cache as it plays through
+// the first time; from then on its sections play from memory. Up to
+// TRACK_CACHE_SIZE bytes are cached, in PSRAM when the board has it and in
+// internal RAM otherwise, evicting the least recently used tracks not
+// playing.
+#ifndef TRACK_CACHE_SIZE
+#if CONFIG_SPIRAM
+#define TRACK_CACHE_SIZE (2 * 1024 * 1024)
+#else
+#define TRACK_CACHE_SIZE (64 * 1024)
+#endif
+#endif
+#ifndef TRACK_CACHE_MAX_TRACK
+#define TRACK_CACHE_MAX_TRACK (TRACK_CACHE_SIZE / 4)
+#endif
+#define TRACK_CACHE_ENTRIES 16
+
+typedef struct track_cache_entry {
+  const track_info_t *track;
+  TinyWav header;      // the file as opened, closed, for sections opened from here
+  uint8_t *data;       // the track's frames as read from the file
+  size_t size;
+  size_t filled;       // bytes copied in so far; complete once it is size
+  uint32_t last_used;
+  uint16_t users;      // sections holding the entry
+} track_cache_entry_t;
+
+typedef struct track_cache_stats {
+  uint32_t hits;         // sections opened from the cache
+  uint32_t misses;       // opened from the card
+  uint32_t evictions;
+  uint64_t bytes_served; // played from the cache
+  size_t bytes_used;     // held now, complete or filling
+} track_cache_stats_t;
+
+static inline bool track_cache_complete(const track_cache_entry_t *entry) {
+  return entry->filled == entry->size;
+}
+
+// The track's entry if it is complete, held until track_cache_release.
+// Counts a hit, or a miss for NULL.
+track_cache_entry_t *track_cache_get(const track_info_t *track);
+
+// Start caching a track of `size` bytes, opened as `file`, evicting unused
+// entries to make room. Held until track_cache_release. NULL if the track is
+// too large or the others are all playing.
+track_cache_entry_t *track_cache_start(const track_info_t *track, const TinyWav *file, size_t size);
+
+// Copy bytes read `offset` bytes into the track into the entry. Only bytes
+// continuing what it holds are taken, so a track fills as it plays through.
+void track_cache_fill(track_cache_entry_t *entry, size_t offset, const void *data, size_t len);
+
+// Stop holding an entry. One that never completed is freed.
+void track_cache_release(track_cache_entry_t *entry);
+
+// Count bytes played from the cache
+void track_cache_served(size_t bytes);
+
+const track_cache_stats_t *track_cache_stats(void);